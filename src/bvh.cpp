@@ -0,0 +1,536 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "stdafx.h"
+#include "bvh.h"
+
+#include <algorithm>
+#include <limits>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static const double infinity = numeric_limits<double>::infinity();
+
+static void triangleBounds(const vector<Triangle> &triangles,
+			   const uint *idx, uint count,
+			   Vector3d &min, Vector3d &max)
+{
+  min.set(infinity, infinity, infinity);
+  max.set(-infinity, -infinity, -infinity);
+  for (uint i = 0; i < count; i++) {
+    const Triangle &t = triangles[idx[i]];
+    for (uint k = 0; k < 3; k++) {
+      min[k] = MIN(min[k], MIN(t.A[k], MIN(t.B[k], t.C[k])));
+      max[k] = MAX(max[k], MAX(t.A[k], MAX(t.B[k], t.C[k])));
+    }
+  }
+}
+
+// The triangles' boxes and centres, in floats as they only decide the
+// splits; the nodes get their exact boxes from refit().
+struct BVH::Box
+{
+  float min[3], max[3], centre[3];
+};
+
+static inline float boxArea(const float *min, const float *max)
+{
+  const float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+  return 2 * (dx*dy + dy*dz + dz*dx);
+}
+
+static inline void boxReset(float *min, float *max)
+{
+  for (uint k = 0; k < 3; k++) {
+    min[k] = numeric_limits<float>::max();
+    max[k] = -numeric_limits<float>::max();
+  }
+}
+
+static inline void boxAdd(float *min, float *max,
+			  const float *addmin, const float *addmax)
+{
+  for (uint k = 0; k < 3; k++) {
+    min[k] = MIN(min[k], addmin[k]);
+    max[k] = MAX(max[k], addmax[k]);
+  }
+}
+
+
+// Builds the nodes of the triangles index[begin, end) into its own
+// node list, so subtrees can be built in parallel.
+struct BVH::Builder
+{
+  const vector<Box> &boxes;
+  vector<uint> &index;
+  vector<Node> nodes;
+
+  struct Range
+  {
+    uint node, begin, end;
+    Range(uint n, uint b, uint e) : node(n), begin(b), end(e) {};
+  };
+
+  Builder(const vector<Box> &boxes_, vector<uint> &index_)
+    : boxes(boxes_), index(index_) {};
+
+  // Subdivides from nodes[root], which holds index[begin, end).  With
+  // grain > 0 ranges of at most grain triangles are left to the caller
+  // in pending.
+  void build(uint root, uint begin, uint end,
+	     uint grain = 0, vector<Range> *pending = NULL)
+  {
+    vector<Range> todo;
+    todo.push_back(Range(root, begin, end));
+    while (!todo.empty()) {
+      const Range r = todo.back();
+      todo.pop_back();
+      if (pending && r.end - r.begin <= grain) {
+	pending->push_back(r);
+	continue;
+      }
+      nodes[r.node].first = r.begin;
+      nodes[r.node].count = r.end - r.begin;
+      uint mid;
+      if (!split(r.begin, r.end, mid))
+	continue;
+      const uint left = nodes.size();
+      nodes[r.node].first = left;
+      nodes[r.node].count = 0;
+      nodes.resize(left + 2);
+      todo.push_back(Range(left + 1, mid, r.end));
+      todo.push_back(Range(left, r.begin, mid));
+    }
+  }
+
+  // Sorts the triangles into index[begin, mid) and [mid, end) by the
+  // cheapest of the binned splits on all axes, false if they are better
+  // left in a leaf.
+  bool split(uint begin, uint end, uint &mid)
+  {
+    const uint count = end - begin;
+    if (count <= 2) return false;
+
+    float nmin[3], nmax[3], cmin[3], cmax[3];
+    boxReset(nmin, nmax);
+    boxReset(cmin, cmax);
+    for (uint i = begin; i < end; i++) {
+      const Box &b = boxes[index[i]];
+      boxAdd(nmin, nmax, b.min, b.max);
+      boxAdd(cmin, cmax, b.centre, b.centre);
+    }
+
+    float scale[3];
+    uint bin_count[3][bins];
+    float bin_min[3][bins][3], bin_max[3][bins][3];
+    for (uint axis = 0; axis < 3; axis++) {
+      const float extent = cmax[axis] - cmin[axis];
+      scale[axis] = extent > 0 ? bins / extent : 0;
+      for (uint b = 0; b < bins; b++) {
+	bin_count[axis][b] = 0;
+	boxReset(bin_min[axis][b], bin_max[axis][b]);
+      }
+    }
+    for (uint i = begin; i < end; i++) {
+      const Box &box = boxes[index[i]];
+      for (uint axis = 0; axis < 3; axis++) {
+	if (scale[axis] == 0) continue;
+	const uint b = binOf(box, axis, cmin[axis], scale[axis]);
+	bin_count[axis][b]++;
+	boxAdd(bin_min[axis][b], bin_max[axis][b], box.min, box.max);
+      }
+    }
+
+    double best_cost = infinity;
+    uint best_axis = 0, best_bin = 0;
+    for (uint axis = 0; axis < 3; axis++) {
+      if (scale[axis] == 0) continue;
+      // areas and counts left of each split, then the right sides
+      double left_area[bins - 1];
+      uint left_count[bins - 1];
+      float lmin[3], lmax[3];
+      boxReset(lmin, lmax);
+      uint lcount = 0;
+      for (uint b = 0; b < bins - 1; b++) {
+	boxAdd(lmin, lmax, bin_min[axis][b], bin_max[axis][b]);
+	lcount += bin_count[axis][b];
+	left_count[b] = lcount;
+	left_area[b] = lcount ? boxArea(lmin, lmax) : 0;
+      }
+      float rmin[3], rmax[3];
+      boxReset(rmin, rmax);
+      uint rcount = 0;
+      for (uint b = bins - 1; b > 0; b--) {
+	boxAdd(rmin, rmax, bin_min[axis][b], bin_max[axis][b]);
+	rcount += bin_count[axis][b];
+	if (rcount == 0 || left_count[b-1] == 0) continue;
+	const double cost = left_area[b-1] * left_count[b-1] +
+	  boxArea(rmin, rmax) * (double)rcount;
+	if (cost < best_cost) {
+	  best_cost = cost;
+	  best_axis = axis;
+	  best_bin = b;
+	}
+      }
+    }
+
+    // a traversal step costs about as much as a triangle test
+    if (count <= max_leaf && best_cost >= boxArea(nmin, nmax) * (count - 1))
+      return false;
+
+    if (best_cost == infinity) { // all centres in one place
+      mid = begin + count / 2;
+      return true;
+    }
+    uint *split_at =
+      std::partition(&index[0] + begin, &index[0] + end,
+		     InBins(boxes, best_axis, cmin[best_axis], scale[best_axis],
+			    best_bin));
+    mid = split_at - &index[0];
+    return true;
+  }
+
+  static inline uint binOf(const Box &box, uint axis, float min, float scale)
+  {
+    return MIN(bins - 1, (uint)((box.centre[axis] - min) * scale));
+  }
+
+  // whether a triangle's centre is in a bin below split
+  struct InBins
+  {
+    const vector<Box> &boxes;
+    uint axis;
+    float min, scale;
+    uint split;
+    InBins(const vector<Box> &b, uint a, float m, float s, uint sp)
+      : boxes(b), axis(a), min(m), scale(s), split(sp) {};
+    bool operator()(uint t) const {
+      return binOf(boxes[t], axis, min, scale) < split;
+    }
+  };
+};
+
+
+void BVH::clear()
+{
+  nodes.clear();
+  index.clear();
+}
+
+void BVH::build(const vector<Triangle> &triangles)
+{
+  clear();
+  const int count = triangles.size();
+  if (count == 0) return;
+
+  index.resize(count);
+  vector<Box> boxes(count);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int i = 0; i < count; i++) {
+    index[i] = i;
+    const Triangle &t = triangles[i];
+    Box &b = boxes[i];
+    for (uint k = 0; k < 3; k++) {
+      b.min[k] = MIN(t.A[k], MIN(t.B[k], t.C[k]));
+      b.max[k] = MAX(t.A[k], MAX(t.B[k], t.C[k]));
+      b.centre[k] = (t.A[k] + t.B[k] + t.C[k]) / 3;
+    }
+  }
+
+  Builder top(boxes, index);
+  top.nodes.resize(1);
+  vector<Builder::Range> pending;
+  uint grain = 0;
+#ifdef _OPENMP
+  // enough subtrees for all threads to keep busy
+  grain = MAX((uint)(count / (8 * omp_get_max_threads())), (uint)4096);
+#endif
+  if (grain > 0 && (uint)count > 2 * grain)
+    top.build(0, 0, count, grain, &pending);
+  else
+    top.build(0, 0, count);
+  nodes.swap(top.nodes);
+
+  const int n_pending = pending.size();
+  vector<Builder*> subtrees(n_pending);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int p = 0; p < n_pending; p++) {
+    subtrees[p] = new Builder(boxes, index);
+    subtrees[p]->nodes.resize(1);
+    subtrees[p]->build(0, pending[p].begin, pending[p].end);
+  }
+
+  // append the subtrees, their roots in place of the pending nodes
+  for (int p = 0; p < n_pending; p++) {
+    const vector<Node> &sub = subtrees[p]->nodes;
+    const uint base = nodes.size() - 1; // for sub[1] at nodes.size()
+    nodes.reserve(nodes.size() + sub.size() - 1);
+    for (uint i = 0; i < sub.size(); i++) {
+      Node node = sub[i];
+      if (node.count == 0)
+	node.first += base;
+      if (i == 0)
+	nodes[pending[p].node] = node;
+      else
+	nodes.push_back(node);
+    }
+    delete subtrees[p];
+  }
+
+  refit(triangles);
+}
+
+void BVH::refit(const vector<Triangle> &triangles)
+{
+  const int count = nodes.size();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 256)
+#endif
+  for (int i = 0; i < count; i++)
+    if (nodes[i].count > 0)
+      triangleBounds(triangles, &index[nodes[i].first], nodes[i].count,
+		     nodes[i].min, nodes[i].max);
+  for (int i = count - 1; i >= 0; i--) {
+    Node &node = nodes[i];
+    if (node.count > 0) continue;
+    const Node &l = nodes[node.first], &r = nodes[node.first + 1];
+    for (uint k = 0; k < 3; k++) {
+      node.min[k] = MIN(l.min[k], r.min[k]);
+      node.max[k] = MAX(l.max[k], r.max[k]);
+    }
+  }
+}
+
+
+// where the ray enters the box, if before tmax
+static inline bool hitBox(const Vector3d &min, const Vector3d &max,
+			  const Vector3d &from, const double *inv,
+			  double tmax, double &tnear)
+{
+  double t0 = 0, t1 = tmax;
+  for (uint k = 0; k < 3; k++) {
+    double tn = (min[k] - from[k]) * inv[k];
+    double tf = (max[k] - from[k]) * inv[k];
+    if (tn > tf) std::swap(tn, tf);
+    t0 = MAX(t0, tn);
+    t1 = MIN(t1, tf);
+    if (t0 > t1) return false;
+  }
+  tnear = t0;
+  return true;
+}
+
+bool BVH::intersect(const vector<Triangle> &triangles,
+		    const Vector3d &from, const Vector3d &dir,
+		    double &t, uint &triangle) const
+{
+  if (nodes.empty()) return false;
+  double inv[3];
+  for (uint k = 0; k < 3; k++)
+    inv[k] = 1. / dir[k];
+
+  double best = infinity;
+  double tnear;
+  vector<uint> stack;
+  stack.reserve(64);
+  if (hitBox(nodes[0].min, nodes[0].max, from, inv, best, tnear))
+    stack.push_back(0);
+  while (!stack.empty()) {
+    const Node &node = nodes[stack.back()];
+    stack.pop_back();
+    if (node.count > 0) {
+      for (uint i = node.first; i < node.first + node.count; i++) {
+	// Moeller-Trumbore
+	const Triangle &tr = triangles[index[i]];
+	const Vector3d e1 = tr.B - tr.A, e2 = tr.C - tr.A;
+	const Vector3d p = dir.cross(e2);
+	const double det = e1.dot(p);
+	if (det == 0) continue;
+	const double invdet = 1. / det;
+	const Vector3d s = from - tr.A;
+	const double u = s.dot(p) * invdet;
+	if (u < 0 || u > 1) continue;
+	const Vector3d q = s.cross(e1);
+	const double v = dir.dot(q) * invdet;
+	if (v < 0 || u + v > 1) continue;
+	const double th = e2.dot(q) * invdet;
+	if (th >= 0 && th < best) {
+	  best = th;
+	  triangle = index[i];
+	}
+      }
+      continue;
+    }
+    // the nearer child on top
+    double tl, tr;
+    const bool hl = hitBox(nodes[node.first].min, nodes[node.first].max,
+			   from, inv, best, tl);
+    const bool hr = hitBox(nodes[node.first+1].min, nodes[node.first+1].max,
+			   from, inv, best, tr);
+    if (hl && hr) {
+      if (tl < tr) {
+	stack.push_back(node.first + 1);
+	stack.push_back(node.first);
+      } else {
+	stack.push_back(node.first);
+	stack.push_back(node.first + 1);
+      }
+    }
+    else if (hl) stack.push_back(node.first);
+    else if (hr) stack.push_back(node.first + 1);
+  }
+  if (best == infinity) return false;
+  t = best;
+  return true;
+}
+
+
+static inline double boxDistance2(const Vector3d &min, const Vector3d &max,
+				  const Vector3d &p)
+{
+  double d2 = 0;
+  for (uint k = 0; k < 3; k++) {
+    if (p[k] < min[k]) d2 += (min[k] - p[k]) * (min[k] - p[k]);
+    else if (p[k] > max[k]) d2 += (p[k] - max[k]) * (p[k] - max[k]);
+  }
+  return d2;
+}
+
+// Ericson, Real-Time Collision Detection, 5.1.5
+static Vector3d closestOnTriangle(const Triangle &t, const Vector3d &p)
+{
+  const Vector3d ab = t.B - t.A, ac = t.C - t.A, ap = p - t.A;
+  const double d1 = ab.dot(ap), d2 = ac.dot(ap);
+  if (d1 <= 0 && d2 <= 0) return t.A;
+  const Vector3d bp = p - t.B;
+  const double d3 = ab.dot(bp), d4 = ac.dot(bp);
+  if (d3 >= 0 && d4 <= d3) return t.B;
+  const double vc = d1*d4 - d3*d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0)
+    return t.A + ab * (d1 / (d1 - d3));
+  const Vector3d cp = p - t.C;
+  const double d5 = ab.dot(cp), d6 = ac.dot(cp);
+  if (d6 >= 0 && d5 <= d6) return t.C;
+  const double vb = d5*d2 - d1*d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0)
+    return t.A + ac * (d2 / (d2 - d6));
+  const double va = d3*d6 - d5*d4;
+  if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+    return t.B + (t.C - t.B) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+  const double denom = 1. / (va + vb + vc);
+  return t.A + ab * (vb * denom) + ac * (vc * denom);
+}
+
+bool BVH::closest(const vector<Triangle> &triangles,
+		  const Vector3d &p, double maxdist,
+		  Vector3d &point, uint &triangle) const
+{
+  if (nodes.empty()) return false;
+  double best2 = maxdist * maxdist;
+  bool found = false;
+  vector<uint> stack;
+  stack.reserve(64);
+  stack.push_back(0);
+  while (!stack.empty()) {
+    const Node &node = nodes[stack.back()];
+    stack.pop_back();
+    if (boxDistance2(node.min, node.max, p) > best2) continue;
+    if (node.count > 0) {
+      for (uint i = node.first; i < node.first + node.count; i++) {
+	const Vector3d c = closestOnTriangle(triangles[index[i]], p);
+	const double d2 = (c - p).squared_length();
+	if (d2 <= best2) {
+	  best2 = d2;
+	  point = c;
+	  triangle = index[i];
+	  found = true;
+	}
+      }
+      continue;
+    }
+    const double dl = boxDistance2(nodes[node.first].min,
+				   nodes[node.first].max, p);
+    const double dr = boxDistance2(nodes[node.first+1].min,
+				   nodes[node.first+1].max, p);
+    if (dl < dr) {
+      stack.push_back(node.first + 1);
+      stack.push_back(node.first);
+    } else {
+      stack.push_back(node.first);
+      stack.push_back(node.first + 1);
+    }
+  }
+  return found;
+}
+
+
+// the largest dot product of dir with a vertex, found by descending
+// only into boxes that could hold a larger one
+double BVH::maxTowards(const vector<Triangle> &triangles,
+		       const double *dir) const
+{
+  double best = -infinity;
+  vector<uint> stack;
+  stack.reserve(64);
+  stack.push_back(0);
+  while (!stack.empty()) {
+    const Node &node = nodes[stack.back()];
+    stack.pop_back();
+    double bound = 0;
+    for (uint k = 0; k < 3; k++)
+      bound += dir[k] * (dir[k] > 0 ? node.max[k] : node.min[k]);
+    if (bound <= best) continue;
+    if (node.count > 0) {
+      for (uint i = node.first; i < node.first + node.count; i++) {
+	const Triangle &t = triangles[index[i]];
+	for (uint j = 0; j < 3; j++) {
+	  const Vector3d &v = t[j];
+	  best = MAX(best, dir[0]*v[0] + dir[1]*v[1] + dir[2]*v[2]);
+	}
+      }
+    } else {
+      stack.push_back(node.first + 1);
+      stack.push_back(node.first);
+    }
+  }
+  return best;
+}
+
+bool BVH::extents(const vector<Triangle> &triangles, const Matrix4d &T,
+		  Vector3d &min, Vector3d &max) const
+{
+  if (nodes.empty()) return false;
+  if (T.at(3,0) != 0 || T.at(3,1) != 0 || T.at(3,2) != 0 || T.at(3,3) == 0)
+    return false;
+  const double w = T.at(3,3);
+  for (uint k = 0; k < 3; k++) {
+    double dir[3];
+    for (uint j = 0; j < 3; j++) dir[j] = T.at(k,j) / w;
+    max[k] = T.at(k,3) / w + maxTowards(triangles, dir);
+    for (uint j = 0; j < 3; j++) dir[j] = -dir[j];
+    min[k] = T.at(k,3) / w - maxTowards(triangles, dir);
+  }
+  return true;
+}
@@ -0,0 +1,78 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include "stdafx.h"
+#include "triangle.h"
+
+// A bounding volume hierarchy over triangles, split by the surface area
+// heuristic over binned centroids, the big subtrees built in parallel.
+// It holds only triangle indices, the queries get the triangles it was
+// built from.  Shapes keep it in shape coordinates, so their transforms
+// are applied to the queries, not to the hierarchy.
+class BVH
+{
+ public:
+  BVH() {};
+
+  void clear();
+  bool empty() const { return nodes.empty(); };
+
+  void build(const vector<Triangle> &triangles);
+  // new boxes after the vertices moved, for the same triangles
+  void refit(const vector<Triangle> &triangles);
+
+  // the nearest hit of the ray from + t*dir with t >= 0
+  bool intersect(const vector<Triangle> &triangles,
+		 const Vector3d &from, const Vector3d &dir,
+		 double &t, uint &triangle) const;
+  // the point of the triangles nearest to p, if it is within maxdist
+  bool closest(const vector<Triangle> &triangles,
+	       const Vector3d &p, double maxdist,
+	       Vector3d &point, uint &triangle) const;
+  // the bounding box of the vertices transformed by T, false if T isn't
+  // affine
+  bool extents(const vector<Triangle> &triangles, const Matrix4d &T,
+	       Vector3d &min, Vector3d &max) const;
+
+  size_t nodeCount() const { return nodes.size(); };
+
+ private:
+  struct Node
+  {
+    Vector3d min, max;
+    uint first; // inner nodes: the left child, right is next to it;
+		// leaves: into index
+    uint count; // triangles of a leaf, 0 for inner nodes
+  };
+  vector<Node> nodes; // root first, children after their parent
+  vector<uint> index;
+
+  static const uint bins = 16;
+  static const uint max_leaf = 8;
+
+  struct Box;
+  struct Builder;
+  double maxTowards(const vector<Triangle> &triangles,
+		    const double *dir) const;
+};
+
+#endif // BVH_H
@@ -0,0 +1,263 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+// Checks the BVH against going through all triangles on a torus, and
+// measures its build time and queries per second.  Build in src/ after
+// configure with:
+//   g++ -O2 -fopenmp -I.. -I../libraries/vmmlib/include triangle.cpp bvh.cpp
+//     bvh_benchmark.cpp -o bvh_benchmark `pkg-config --cflags --libs gtkmm-2.4`
+//     -lGL -lGLU
+// and run as  bvh_benchmark [triangles]
+
+#include "stdafx.h"
+#include "bvh.h"
+
+#include <iostream>
+#include <limits>
+#include <stdlib.h>
+
+static int failures = 0;
+
+static void expect (bool condition, const char *what)
+{
+  if (!condition) {
+    cerr << "FAILED: " << what << endl;
+    failures++;
+  }
+}
+
+static double random_in (double min, double max)
+{
+  return min + (max - min) * (rand() / (double)RAND_MAX);
+}
+
+// a torus around the z axis with about n triangles
+static vector<Triangle> torus (uint n)
+{
+  const uint rings = MAX((uint)3, (uint)sqrt(n / 8.));
+  const uint sides = MAX((uint)3, n / (2 * rings));
+  const double R = 50, r = 15;
+  vector<Vector3d> v(rings * sides);
+  for (uint i = 0; i < rings; i++)
+    for (uint j = 0; j < sides; j++) {
+      const double a = 2 * M_PI * i / rings, b = 2 * M_PI * j / sides;
+      v[i * sides + j] = Vector3d((R + r * cos(b)) * cos(a),
+				  (R + r * cos(b)) * sin(a), r * sin(b));
+    }
+  vector<Triangle> triangles;
+  triangles.reserve(2 * rings * sides);
+  for (uint i = 0; i < rings; i++)
+    for (uint j = 0; j < sides; j++) {
+      const Vector3d &p = v[i * sides + j],
+	&q = v[((i + 1) % rings) * sides + j],
+	&s = v[i * sides + (j + 1) % sides],
+	&t = v[((i + 1) % rings) * sides + (j + 1) % sides];
+      triangles.push_back(Triangle(p, q, t));
+      triangles.push_back(Triangle(p, t, s));
+    }
+  return triangles;
+}
+
+// the rays go from a box around the torus towards its inside
+static void random_ray (Vector3d &from, Vector3d &dir)
+{
+  from = Vector3d(random_in(-80, 80), random_in(-80, 80), random_in(-30, 30));
+  const Vector3d to(random_in(-65, 65), random_in(-65, 65), random_in(-15, 15));
+  dir = to - from;
+}
+
+static bool linear_intersect (const vector<Triangle> &triangles,
+			      const Vector3d &from, const Vector3d &dir,
+			      double &t)
+{
+  double best = numeric_limits<double>::infinity();
+  for (uint i = 0; i < triangles.size(); i++) {
+    const Triangle &tr = triangles[i];
+    const Vector3d e1 = tr.B - tr.A, e2 = tr.C - tr.A;
+    const Vector3d p = dir.cross(e2);
+    const double det = e1.dot(p);
+    if (det == 0) continue;
+    const Vector3d s = from - tr.A;
+    const double u = s.dot(p) / det;
+    if (u < 0 || u > 1) continue;
+    const Vector3d q = s.cross(e1);
+    const double v = dir.dot(q) / det;
+    if (v < 0 || u + v > 1) continue;
+    const double th = e2.dot(q) / det;
+    if (th >= 0 && th < best) best = th;
+  }
+  t = best;
+  return best != numeric_limits<double>::infinity();
+}
+
+// the distance to the nearest vertex or edge midpoint, which the
+// nearest point can't be farther than
+static double vertex_distance (const vector<Triangle> &triangles,
+			       const Vector3d &p)
+{
+  double best = numeric_limits<double>::infinity();
+  for (uint i = 0; i < triangles.size(); i++) {
+    const Triangle &t = triangles[i];
+    for (uint j = 0; j < 3; j++) {
+      best = MIN(best, (t[j] - p).length());
+      best = MIN(best, ((t[j] + t[(j+1)%3]) / 2. - p).length());
+    }
+  }
+  return best;
+}
+
+static void check (vector<Triangle> triangles)
+{
+  BVH bvh;
+  bvh.build(triangles);
+  expect(!bvh.empty(), "built");
+
+  for (uint i = 0; i < 300; i++) {
+    Vector3d from, dir;
+    random_ray(from, dir);
+    double t = -1, lt = -1;
+    uint triangle;
+    const bool hit = bvh.intersect(triangles, from, dir, t, triangle);
+    expect(hit == linear_intersect(triangles, from, dir, lt), "ray hit");
+    if (hit) expect(fabs(t - lt) < 1e-9, "ray distance");
+  }
+
+  for (uint i = 0; i < 100; i++) {
+    const Vector3d p(random_in(-80, 80), random_in(-80, 80), random_in(-30, 30));
+    Vector3d point;
+    uint triangle;
+    expect(bvh.closest(triangles, p, 1000, point, triangle), "closest found");
+    expect((point - p).length() <= vertex_distance(triangles, p) + 1e-9,
+	   "closest distance");
+    const Triangle &t = triangles[triangle];
+    const Vector3d n = (t.B - t.A).cross(t.C - t.A);
+    expect(fabs(n.dot(point - t.A)) < 1e-9 * n.length(), "closest on its triangle");
+  }
+
+  Matrix4d T = Matrix4d::IDENTITY;
+  T.rotate(0.3, Vector3d(1, 2, 3));
+  T.set_translation(Vector3d(10, -20, 5));
+  Vector3d min, max;
+  expect(bvh.extents(triangles, T, min, max), "extents");
+  Vector3d lmin(1e300, 1e300, 1e300), lmax(-1e300, -1e300, -1e300);
+  for (uint i = 0; i < triangles.size(); i++)
+    triangles[i].AccumulateMinMax(lmin, lmax, T);
+  expect((min - lmin).length() < 1e-9 && (max - lmax).length() < 1e-9,
+	 "extents match");
+
+  // squash the torus and check the refitted hierarchy
+  for (uint i = 0; i < triangles.size(); i++)
+    for (uint j = 0; j < 3; j++)
+      triangles[i][j].z() *= 0.5;
+  bvh.refit(triangles);
+  for (uint i = 0; i < 100; i++) {
+    Vector3d from, dir;
+    random_ray(from, dir);
+    double t = -1, lt = -1;
+    uint triangle;
+    const bool hit = bvh.intersect(triangles, from, dir, t, triangle);
+    expect(hit == linear_intersect(triangles, from, dir, lt), "refitted ray hit");
+    if (hit) expect(fabs(t - lt) < 1e-9, "refitted ray distance");
+  }
+}
+
+int main (int argc, char *argv[])
+{
+  const uint n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+  srand(1);
+  check(torus(20000));
+  if (failures > 0)
+    return 1;
+
+  vector<Triangle> triangles = torus(n);
+  BVH bvh;
+  Glib::Timer timer;
+  bvh.build(triangles);
+  const double build = timer.elapsed();
+
+  const uint rays = 200000;
+  vector<Vector3d> from(rays), dir(rays);
+  for (uint i = 0; i < rays; i++)
+    random_ray(from[i], dir[i]);
+  uint hits = 0;
+  double sum = 0;
+  timer.start();
+  for (uint i = 0; i < rays; i++) {
+    double t;
+    uint triangle;
+    if (bvh.intersect(triangles, from[i], dir[i], t, triangle)) {
+      hits++;
+      sum += t;
+    }
+  }
+  const double ray_time = timer.elapsed();
+
+  const uint linear_rays = MAX((uint)1, 20000000 / (uint)triangles.size());
+  timer.start();
+  for (uint i = 0; i < linear_rays; i++) {
+    double t;
+    if (linear_intersect(triangles, from[i], dir[i], t))
+      sum += t;
+  }
+  const double linear_ray_time = timer.elapsed();
+
+  const uint points = 200000;
+  timer.start();
+  for (uint i = 0; i < points; i++) {
+    Vector3d point;
+    uint triangle;
+    if (bvh.closest(triangles, from[i], 1000, point, triangle))
+      sum += point.x();
+  }
+  const double closest_time = timer.elapsed();
+
+  timer.start();
+  bvh.refit(triangles);
+  const double refit = timer.elapsed();
+
+  Matrix4d T = Matrix4d::IDENTITY;
+  T.rotate(0.3, Vector3d(1, 2, 3));
+  Vector3d min, max;
+  const uint boxes = 1000;
+  timer.start();
+  for (uint i = 0; i < boxes; i++)
+    bvh.extents(triangles, T, min, max);
+  const double extents_time = timer.elapsed() / boxes;
+  timer.start();
+  Vector3d lmin(1e300, 1e300, 1e300), lmax(-1e300, -1e300, -1e300);
+  for (uint i = 0; i < triangles.size(); i++)
+    triangles[i].AccumulateMinMax(lmin, lmax, T);
+  const double linear_box_time = timer.elapsed();
+  sum += min.x() + lmin.x();
+
+  cout << "Triangles:      " << triangles.size() << ", "
+       << bvh.nodeCount() << " nodes" << endl;
+  cout << "Build:          " << build * 1000 << " ms, "
+       << triangles.size() / build / 1e6 << " M triangles/s" << endl;
+  cout << "Refit:          " << refit * 1000 << " ms" << endl;
+  cout << "Rays:           " << rays / ray_time << " /s ("
+       << hits * 100 / rays << "% hit), all triangles: "
+       << linear_rays / linear_ray_time << " /s" << endl;
+  cout << "Closest points: " << points / closest_time << " /s" << endl;
+  cout << "Bounding box:   " << extents_time * 1000 << " ms, all triangles: "
+       << linear_box_time * 1000 << " ms" << endl;
+  cout << "(checksum " << sum << ")" << endl;
+  return 0;
+}
@@ -0,0 +1,161 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "stdafx.h"
+#include "displaycache.h"
+#include "renderstats.h"
+
+
+std::vector<GLuint> DisplayCache::released_textures;
+
+DisplayCache::DisplayCache()
+  : line_width(1), point_size(1)
+{
+  for (uint c = 0; c < 4; c++) colour[c] = 1;
+}
+
+DisplayCache::DisplayCache(const DisplayCache &)
+  : line_width(1), point_size(1)
+{
+  for (uint c = 0; c < 4; c++) colour[c] = 1;
+}
+
+DisplayCache::~DisplayCache()
+{
+  clear();
+}
+
+DisplayCache &DisplayCache::operator=(const DisplayCache &rhs)
+{
+  if (this != &rhs)
+    clear();
+  return *this;
+}
+
+// without the GL context, see freeReleased()
+void DisplayCache::clear()
+{
+  for (uint i = 0; i < batches.size(); i++)
+    if (batches[i].texture)
+      released_textures.push_back(batches[i].texture);
+  batches.clear();
+  vertices.clear();
+  buffer.clear();
+}
+
+void DisplayCache::freeReleased()
+{
+  if (released_textures.empty()) return;
+  glDeleteTextures(released_textures.size(), &released_textures[0]);
+  released_textures.clear();
+}
+
+void DisplayCache::setColour(const float *rgb, float a)
+{
+  for (uint c = 0; c < 3; c++)
+    colour[c] = rgb[c];
+  colour[3] = a;
+}
+
+void DisplayCache::add(GLenum mode, GLfloat size, const Vector3d &v)
+{
+  if (batches.empty() || batches.back().mode != mode ||
+      batches.back().size != size) {
+    Batch b;
+    b.mode = mode;
+    b.size = size;
+    b.first = vertices.size();
+    b.count = 0;
+    b.texture = 0;
+    b.z = 0;
+    batches.push_back(b);
+  }
+  ColouredVertex cv;
+  for (uint k = 0; k < 3; k++)
+    cv.pos[k] = v[k];
+  for (uint c = 0; c < 4; c++) // as glColor4f() clamps
+    cv.colour[c] = (GLubyte) (CLAMP(colour[c], 0.f, 1.f) * 255 + 0.5);
+  vertices.push_back(cv);
+  batches.back().count++;
+}
+
+void DisplayCache::line(const Vector3d &from, const Vector3d &to)
+{
+  add(GL_LINES, line_width, from);
+  add(GL_LINES, line_width, to);
+}
+
+void DisplayCache::point(const Vector3d &p)
+{
+  add(GL_POINTS, point_size, p);
+}
+
+void DisplayCache::texture(GLuint texture, const Vector2d &min,
+			   const Vector2d &max, double z)
+{
+  if (texture == 0) return;
+  Batch b;
+  b.mode = GL_QUADS;
+  b.size = 0;
+  b.first = b.count = 0;
+  b.texture = texture;
+  for (uint c = 0; c < 4; c++) b.colour[c] = colour[c];
+  b.min = min;
+  b.max = max;
+  b.z = z;
+  batches.push_back(b);
+}
+
+void DisplayCache::finish()
+{
+  buffer.set(vertices);
+  vector<ColouredVertex>().swap(vertices);
+}
+
+void DisplayCache::draw() const
+{
+  for (uint i = 0; i < batches.size(); i++) {
+    const Batch &b = batches[i];
+    switch (b.mode) {
+    case GL_LINES:
+      glLineWidth(b.size);
+      buffer.draw(GL_LINES, b.first, b.count);
+      break;
+    case GL_POINTS:
+      glPointSize(b.size);
+      buffer.draw(GL_POINTS, b.first, b.count);
+      break;
+    default: // see glDrawCairoSurface()
+      glColor4fv(b.colour);
+      glBindTexture(GL_TEXTURE_2D, b.texture);
+      glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+      glEnable(GL_TEXTURE_2D);
+      glBegin(GL_QUADS);
+      glTexCoord2d(0.0,0.0); glVertex3d(b.min.x(),b.min.y(),b.z);
+      glTexCoord2d(1.0,0.0); glVertex3d(b.max.x(),b.min.y(),b.z);
+      glTexCoord2d(1.0,1.0); glVertex3d(b.max.x(),b.max.y(),b.z);
+      glTexCoord2d(0.0,1.0); glVertex3d(b.min.x(),b.max.y(),b.z);
+      glEnd();
+      RenderStats::countDraw(4);
+      glDisable(GL_TEXTURE_2D);
+      glBindTexture(GL_TEXTURE_2D, 0);
+    }
+  }
+  glLineWidth(1);
+}
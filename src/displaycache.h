@@ -0,0 +1,87 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef DISPLAYCACHE_H
+#define DISPLAYCACHE_H
+
+#include <vector>
+#include "stdafx.h"
+#include "vertexbuffer.h"
+
+// Coloured lines and points and alpha textured rectangles, recorded once
+// and then drawn again in the same order, like a display list.  Each run
+// of lines of one width, or points of one size, is a single draw call
+// from a VertexBuffer.  Recording and drawing need the GL context; a copy
+// starts out empty.  clear() and the destructor don't, the textures are
+// freed by freeReleased() on the next frame.
+class DisplayCache
+{
+ public:
+  DisplayCache();
+  DisplayCache(const DisplayCache &);
+  ~DisplayCache();
+  DisplayCache &operator=(const DisplayCache &);
+
+  void clear();
+  bool empty() const { return batches.empty(); };
+
+  // the style of what is recorded next, like glColor4f(),
+  // glLineWidth() and glPointSize()
+  void setColour(const float *rgb, float a);
+  void setLineWidth(float width) { line_width = width; };
+  void setPointSize(float size) { point_size = size; };
+
+  void line(const Vector3d &from, const Vector3d &to);
+  void point(const Vector3d &p);
+  // takes over texture, an alpha texture as from glCairoSurfaceTexture(),
+  // shown in the current colour on the rectangle min to max at height z
+  void texture(GLuint texture, const Vector2d &min, const Vector2d &max,
+	       double z);
+
+  // hands what was recorded since clear() to OpenGL
+  void finish();
+
+  void draw() const;
+
+  // frees the textures of cleared caches, with the GL context current
+  static void freeReleased();
+
+ private:
+  struct Batch
+  {
+    GLenum mode;        // GL_LINES, GL_POINTS or GL_QUADS for a texture
+    GLfloat size;       // line width or point size
+    size_t first, count;
+    GLuint texture;
+    GLfloat colour[4];
+    Vector2d min, max;
+    double z;
+  };
+  std::vector<Batch> batches;
+  std::vector<ColouredVertex> vertices; // until finish()
+  VertexBuffer buffer;
+
+  GLfloat colour[4];
+  GLfloat line_width, point_size;
+
+  void add(GLenum mode, GLfloat size, const Vector3d &v);
+
+  static std::vector<GLuint> released_textures;
+};
+
+#endif // DISPLAYCACHE_H
@@ -444,7 +444,9 @@ string Command::GetGCodeText(Vector3d &LastPos, double &lastE, double &lastF,
 }
 
 
-void draw_arc(Vector3d &lastPos, Vector3d center, double angle, double dz, short ccw)
+// appends the arc's line segments to lines if given, else draws them
+void draw_arc(Vector3d &lastPos, Vector3d center, double angle, double dz, short ccw,
+	      vector<Vector3d> *lines = NULL)
 {
   Vector3d arcpoint;
   Vector3d radiusv = lastPos-center;
@@ -457,12 +459,37 @@ void draw_arc(Vector3d &lastPos, Vector3d center, double angle, double dz, short
   for (long double a = 0; abs(a) < abs(angle); a+=astep){
     arcpoint = center + radiusv.rotate(a, axis);
     if (dz!=0 && angle!=0) arcpoint.z() = startZ + dz*a/angle;
-    glVertex3dv(lastPos);
-    glVertex3dv(arcpoint);
+    if (lines) {
+      lines->push_back(lastPos);
+      lines->push_back(arcpoint);
+    } else {
+      glVertex3dv(lastPos);
+      glVertex3dv(arcpoint);
+    }
     lastPos = arcpoint;
   }
 }
 
+// angle from arc endpoint P to Q around the center
+static long double arc_angle(const Vector3d &P, const Vector3d &Q, bool ccw)
+{
+  long double angle;
+  if (P==Q) angle = 2*M_PI;
+  else {
+#if 0  // marlin calculation (motion_control.cpp)
+    angle = atan2(P.x()*Q.y()-P.y()*Q.x(), P.x()*Q.x()+P.y()*Q.y());
+    if (angle < 0) angle += 2*M_PI;
+    if (!ccw) angle-=2*M_PI; // angle sign determines rotation
+#else
+    angle = angleBetween(P,Q); // ccw angle
+    if (!ccw) angle=-angle;
+    if (angle < 0) angle += 2*M_PI;  // alway positive, ccw determines rotation
+#endif
+  }
+  //if (abs(angle) < 0.00001) angle = 0;
+  return angle;
+}
+
 void Command::draw(Vector3d &lastPos, const Vector3d &offset,
 		   double extrwidth,
 		   bool arrows,  bool debug_arcs) const
@@ -493,20 +520,7 @@ void Command::draw(Vector3d &lastPos, const Vector3d &offset,
       else
 	glColor4f(1.f,0.5f,0.0f,lum);
     }
-    long double angle;
-    if (P==Q) angle = 2*M_PI;
-    else {
-#if 0  // marlin calculation (motion_control.cpp)
-      angle = atan2(P.x()*Q.y()-P.y()*Q.x(), P.x()*Q.x()+P.y()*Q.y());
-      if (angle < 0) angle += 2*M_PI;
-      if (!ccw) angle-=2*M_PI; // angle sign determines rotation
-#else
-      angle = angleBetween(P,Q); // ccw angle
-      if (!ccw) angle=-angle;
-      if (angle < 0) angle += 2*M_PI;  // alway positive, ccw determines rotation
-#endif
-    }
-    //if (abs(angle) < 0.00001) angle = 0;
+    long double angle = arc_angle(P, Q, ccw);
     double dz = off_where.z()-(off_lastPos).z(); // z move with arc
     Vector3d arcstart = off_lastPos;
     draw_arc(off_lastPos, center, angle, dz, ccw);
@@ -592,6 +606,25 @@ void Command::draw(Vector3d &lastPos, const Vector3d &offset,
   draw(lastPos, offset, extrwidth, arrows, debug_arcs);
 }
 
+void Command::getLines(Vector3d &lastPos, const Vector3d &offset,
+		       vector<Vector3d> &lines) const
+{
+  Vector3d off_where = where + offset;
+  Vector3d off_lastPos = lastPos + offset;
+  if (Code == ARC_CW || Code == ARC_CCW) {
+    Vector3d center = off_lastPos + arcIJK;
+    bool ccw = (Code == ARC_CCW);
+    long double angle = arc_angle(-arcIJK, off_where-center, ccw);
+    double dz = off_where.z()-off_lastPos.z();
+    draw_arc(off_lastPos, center, angle, dz, ccw, &lines);
+  }
+  if (off_lastPos!=off_where) {
+    lines.push_back(off_lastPos);
+    lines.push_back(off_where);
+  }
+  lastPos = where;
+}
+
 void Command::addToPosition(Vector3d &from, bool relative)
 {
   if (relative) from += where;
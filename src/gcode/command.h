@@ -173,6 +173,10 @@ public:
 		  bool debug_arcs = false) const;
 	void draw(Vector3d &lastPos, const Vector3d &offset, double extrwidth,
 		  bool arrows=true, bool debug_arcs = false) const;
+	// the segments draw() draws without arrows, boundary and debug_arcs,
+	// as pairs of points
+	void getLines(Vector3d &lastPos, const Vector3d &offset,
+		      vector<Vector3d> &lines) const;
 
 	bool hasNoEffect(const Vector3d LastPos, const double lastE,
 			 const double lastF, const bool relativeEcode) const;
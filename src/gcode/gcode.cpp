@@ -24,6 +24,7 @@
 
 #include <iostream>
 #include <sstream>
+#include <algorithm>
 
 #include "model.h"
 #include "ui/progress.h"
@@ -31,21 +32,33 @@
 #include "ctype.h"
 #include "settings.h"
 #include "render.h"
+#include "printer/print_job.h"
 
 
 GCode::GCode()
-  : gl_List(-1)
+  : gl_List(-1), buffer_first(0), buffer_lines(0)
 {
   Min.set(99999999.0,99999999.0,99999999.0);
   Max.set(-99999999.0,-99999999.0,-99999999.0);
   Center.set(0,0,0);
   buffer = Gtk::TextBuffer::create();
+  text = NULL;
+}
+
+GCode::~GCode()
+{
+  if (text)
+    text->Unref();
 }
 
 
 void GCode::clear()
 {
   buffer->erase (buffer->begin(), buffer->end());
+  if (text)
+    text->Unref();
+  text = NULL;
+  buffer_first = buffer_lines = 0;
   commands.clear();
   layerchanges.clear();
   buffer_zpos_lines.clear();
@@ -55,6 +68,7 @@ void GCode::clear()
   if (gl_List>=0)
     glDeleteLists(gl_List,1);
   gl_List = -1;
+  toolpath.clear();
 }
 
 
@@ -82,6 +96,7 @@ void GCode::translate(Vector3d trans)
   Min+=trans;
   Max+=trans;
   Center+=trans;
+  toolpath.clear();
 }
 
 
@@ -112,23 +127,23 @@ string getLineAt(const Glib::RefPtr<Gtk::TextBuffer> buffer, int lineno)
 
 void GCode::updateWhereAtCursor(const vector<char> &E_letters)
 {
-  int line = buffer->get_insert()->get_iter().get_line();
+  int line = buffer_first + buffer->get_insert()->get_iter().get_line();
   // Glib::RefPtr<Gtk::TextBuffer> buf = iter.get_buffer();
   if (line == 0) return;
-  string text = getLineAt(buffer, line-1);
+  string text = getLine(line-1);
   Command commandbefore(text, Vector3d::ZERO, E_letters);
   Vector3d where = commandbefore.where;
   // complete position of previous line
   int l = line;
   while (l>0 && where.x()==0) {
     l--;
-    text = getLineAt(buffer, l);
+    text = getLine(l);
     where.x() = Command(text, Vector3d::ZERO, E_letters).where.x();
   }
   l = line;
   while (l>0 && where.y()==0) {
     l--;
-    text = getLineAt(buffer, l);
+    text = getLine(l);
     where.y() = Command(text, Vector3d::ZERO, E_letters).where.y();
   }
   l = line;
@@ -137,7 +152,7 @@ void GCode::updateWhereAtCursor(const vector<char> &E_letters)
     for (uint i = buffer_zpos_lines.size()-1; i>0 ;i--)
       {
 	if (int(buffer_zpos_lines[i]) <= l) {
-	  text = getLineAt(buffer, buffer_zpos_lines[i]);
+	  text = getLine(buffer_zpos_lines[i]);
 	  //cerr << text << endl;
 	  Command c(text, Vector3d::ZERO, E_letters);
 	  where.z() = c.where.z();
@@ -146,12 +161,12 @@ void GCode::updateWhereAtCursor(const vector<char> &E_letters)
       }
   while (l>0 && where.z()==0) {
     l--;
-    text = getLineAt(buffer, l);
+    text = getLine(l);
     Command c(text, Vector3d::ZERO, E_letters);
     where.z() = c.where.z();
   }
   // current move:
-  text = getLineAt(buffer, line);
+  text = getLine(line);
   Command command(text, where, E_letters);
   Vector3d dwhere = command.where - where;
   where.z() -= 0.0000001;
@@ -322,7 +337,8 @@ void GCode::Read(Model *model, const vector<char> E_letters,
 
 	commands = loaded_commands;
 
-	buffer->set_text(alltext.str());
+	string gcodetext = alltext.str();
+	set_shared_text(gcodetext);
 
 	Center = (Max + Min)/2;
 
@@ -453,6 +469,21 @@ void GCode::draw(const Settings &settings, int layer,
 	}
 }
 
+void GCode::drawPrinting(const Settings &settings, unsigned long printed)
+{
+  int layer = getLayerNo(printed);
+  if (layer < 0) return;
+  const unsigned long start = getLayerStart(layer), end = getLayerEnd(layer);
+  const bool borders = settings.get_boolean("Display","DisplayGCodeBorders");
+  glEnable(GL_BLEND);
+  glDisable(GL_CULL_FACE);
+  glDisable(GL_LIGHTING);
+  if (!borders && !settings.get_boolean("Display","DebugGCodeExtruders")
+      && toolpath.drawPrinting(*this, settings, start, printed, end, 4))
+    return;
+  drawCommands(settings, start, printed, true, 4, false, borders);
+  drawCommands(settings, printed, end, true, 1, false, borders);
+}
 
 void GCode::drawCommands(const Settings &settings, uint start, uint end,
 			 bool liveprinting, int linewidth, bool arrows, bool boundary,
@@ -516,6 +547,12 @@ void GCode::drawCommands(const Settings &settings, uint start, uint end,
 	Vector4f gcodemovecolour = settings.get_colour("Display","GCodeMoveColour");
 	Vector4f gcodeprintingcolour = settings.get_colour("Display","GCodePrintingColour");
 
+	// whole layers of plain lines come from the vertex buffers
+	if (!liveprinting && !arrows && !boundary && !onlyZChange
+	    && !debuggcodeextruders
+	    && toolpath.draw(*this, settings, start, end, linewidth))
+	  return;
+
 	for(uint i=start; i <= end; i++)
 	{
 	        Vector3d extruder_offset = Vector3d::ZERO;
@@ -638,6 +675,30 @@ void GCode::drawCommands(const Settings &settings, uint start, uint end,
 
 
 
+// Notes the lines of more that set a z position, numbered from line on,
+// and counts line on by its newlines.  A last line without newline goes on
+// in the next more.
+static void find_zpos_lines(const string &more, unsigned long &line,
+			    vector<uint> &zpos_lines)
+{
+  for (size_t i = 0; i < more.length(); i++) {
+    const char c = more[i];
+    if (c == '\n')
+      line++;
+    else if ((c == 'Z' || c == 'z') &&
+	     (zpos_lines.empty() || zpos_lines.back() != line))
+      zpos_lines.push_back(line);
+  }
+}
+
+// appends more to text, noting its z position lines
+static void add_text(string &text, const string &more, unsigned long &line,
+		     vector<uint> &zpos_lines)
+{
+  find_zpos_lines(more, line, zpos_lines);
+  text += more;
+}
+
 void GCode::MakeText(string &GcodeTxt,
 		     const Settings &settings,
 		     ViewProgress * progress)
@@ -656,12 +717,18 @@ void GCode::MakeText(string &GcodeTxt,
 	date.set_time_current();
 	Glib::TimeVal time;
 	time.assign_current_time();
-	GcodeTxt += "; GCode by Repsnapper, "+
-	  date.format_string("%a, %x") +
-	  //time.as_iso8601() +
-	  "\n";
+	// save zpos line numbers for faster finding
+	buffer_zpos_lines.clear();
+	unsigned long line = 0;
+	find_zpos_lines(GcodeTxt, line, buffer_zpos_lines);
+
+	add_text(GcodeTxt, "; GCode by Repsnapper, "+
+		 date.format_string("%a, %x") +
+		 //time.as_iso8601() +
+		 "\n", line, buffer_zpos_lines);
 
-	GcodeTxt += "\n; Startcode\n"+GcodeStart + "; End Startcode\n\n";
+	add_text(GcodeTxt, "\n; Startcode\n"+GcodeStart + "; End Startcode\n\n",
+		 line, buffer_zpos_lines);
 
 	layerchanges.clear();
 	if (progress) progress->restart(_("Collecting GCode"), commands.size());
@@ -693,34 +760,26 @@ void GCode::MakeText(string &GcodeTxt,
 	  if ( commands[i].Code == LAYERCHANGE ) {
 	    layerchanges.push_back(i);
 	    if (GcodeLayer.length()>0)
-	      GcodeTxt += "\n; Layerchange GCode\n" + GcodeLayer +
-		"; End Layerchange GCode\n\n";
+	      add_text(GcodeTxt, "\n; Layerchange GCode\n" + GcodeLayer +
+		       "; End Layerchange GCode\n\n", line, buffer_zpos_lines);
 	  }
 
 	  if ( commands[i].where.z() < 0 )  {
 	    cerr << i << " Z < 0 "  << commands[i].info() << endl;
 	  }
 	  else {
-	    GcodeTxt += commands[i].GetGCodeText(LastPos, lastE, lastF,
-						 relativeecode,
-						 E_letter,
-						 speedalways) + "\n";
+	    add_text(GcodeTxt, commands[i].GetGCodeText(LastPos, lastE, lastF,
+							relativeecode,
+							E_letter,
+							speedalways) + "\n",
+		     line, buffer_zpos_lines);
 	  }
 	}
 
-	GcodeTxt += "\n; End GCode\n" + GcodeEnd + "\n";
+	add_text(GcodeTxt, "\n; End GCode\n" + GcodeEnd + "\n",
+		 line, buffer_zpos_lines);
 
-	buffer->set_text (GcodeTxt);
-
-	// save zpos line numbers for faster finding
-	buffer_zpos_lines.clear();
-	uint blines = buffer->get_line_count();
-	for (uint i = 0; i < blines; i++) {
-	  const string line = getLineAt(buffer, i);
-	  if (line.find("Z") != string::npos ||
-	      line.find("z") != string::npos)
-	    buffer_zpos_lines.push_back(i);
-	}
+	set_shared_text(GcodeTxt);
 
 	if (progress) progress->stop();
 
@@ -752,9 +811,109 @@ void GCode::MakeText(string &GcodeTxt,
 // }
 
 
-std::string GCode::get_text () const
+std::string GCode::get_text ()
 {
-  return buffer->get_text();
+  commit_buffer();
+  return text ? text->Text() : "";
+}
+
+// takes over the contents of newtext, shows its first lines
+void GCode::set_shared_text(string &newtext)
+{
+  if (text)
+    text->Unref();
+  text = new SharedText(newtext);
+  buffer_first = 0;
+  fill_buffer();
+}
+
+unsigned long GCode::getLineCount() const
+{
+  return text ? text->LineCount() : 0;
+}
+
+void GCode::showLines(unsigned long first)
+{
+  commit_buffer();
+  buffer_first = first;
+  fill_buffer();
+}
+
+// the window of the text from buffer_first on into the buffer
+void GCode::fill_buffer()
+{
+  const unsigned long lines = getLineCount();
+  if (buffer_first + buffer_window > lines)
+    buffer_first = lines > buffer_window ? lines - buffer_window : 0;
+  buffer_lines = MIN(buffer_window, lines - buffer_first);
+  string window;
+  if (text) {
+    const size_t from = text->LineOffset(buffer_first + 1),
+      to = text->LineOffset(buffer_first + buffer_lines + 1);
+    window = text->Text().substr(from, to - from);
+  }
+  buffer->set_text(window);
+  buffer->set_modified(false);
+}
+
+// puts the edits of the buffer into the text, only the lines of the
+// window are scanned anew
+void GCode::commit_buffer()
+{
+  if (!buffer->get_modified()) return;
+  string window = buffer->get_text();
+  const unsigned long old_count = getLineCount();
+  // the window holds whole lines
+  if (buffer_first + buffer_lines < old_count && window.length() > 0
+      && window[window.length() - 1] != '\n')
+    window += '\n';
+  vector<uint> window_zpos;
+  unsigned long line = buffer_first;
+  find_zpos_lines(window, line, window_zpos);
+
+  SharedText *newtext;
+  if (text) {
+    newtext = new SharedText(*text, buffer_first + 1, buffer_lines, window);
+    text->Unref();
+  } else
+    newtext = new SharedText(window);
+  text = newtext;
+  const unsigned long old_lines = buffer_lines;
+  buffer_lines = text->LineCount() + old_lines - old_count;
+  buffer->set_modified(false);
+
+  // the z positions found in the window replace its old ones, the later
+  // ones move with the lines
+  vector<uint>::iterator from =
+    lower_bound(buffer_zpos_lines.begin(), buffer_zpos_lines.end(), buffer_first);
+  vector<uint>::iterator to =
+    lower_bound(from, buffer_zpos_lines.end(), buffer_first + old_lines);
+  for (vector<uint>::iterator it = to; it != buffer_zpos_lines.end(); it++)
+    *it = *it - old_lines + buffer_lines;
+  from = buffer_zpos_lines.erase(from, to);
+  buffer_zpos_lines.insert(from, window_zpos.begin(), window_zpos.end());
+}
+
+// line (from 0) of the text as shown
+string GCode::getLine(unsigned long line) const
+{
+  if (line >= buffer_first && line < buffer_first + buffer_lines)
+    return getLineAt(buffer, line - buffer_first);
+  if (!text)
+    return "";
+  const size_t from = text->LineOffset(line + 1),
+    to = text->LineOffset(line + 2);
+  return text->Text().substr(from, to - from);
+}
+
+PrintJob *GCode::get_print_job()
+{
+  commit_buffer();
+  if (text)
+    return new StringPrintJob(text);
+
+  string empty;
+  return new StringPrintJob(empty);
 }
 
 
@@ -27,6 +27,10 @@
 #include <sstream>
 
 #include "command.h"
+#include "toolpath.h"
+
+class SharedText;
+class PrintJob;
 
 class GCodeIter
 {
@@ -53,6 +57,7 @@ class GCode
 
 public:
   GCode();
+  ~GCode();
 
   void Read  (Model *model, const vector<char> E_letters,
 	      ViewProgress *progress, string filename);
@@ -63,12 +68,22 @@ public:
   void drawCommands(const Settings &settings, uint start, uint end,
 		    bool liveprinting, int linewidth, bool arrows, bool boundary=false,
                     bool onlyZChange = false);
+  // the layer of command printed while printing it, see
+  // Toolpath::drawPrinting()
+  void drawPrinting(const Settings &settings, unsigned long printed);
+  // appends the commands to GcodeTxt, then takes over its contents
   void MakeText(string &GcodeTxt, const Settings &settings,
 		ViewProgress * progress);
 
   //bool append_text (const std::string &line);
-  std::string get_text() const;
+  std::string get_text();
   void clear();
+  // the commands changed, draw them anew
+  void invalidateToolpath() { toolpath.clear(); };
+
+  // Lines to print.  Shares the text generated or read last unless the
+  // buffer was edited since.
+  PrintJob *get_print_job();
 
   std::vector<Command> commands;
   uint size() { return commands.size(); };
@@ -77,7 +92,18 @@ public:
 
   void translate(Vector3d trans);
 
+  // Shows a window of the lines of the text, not all of them, as GTK gets
+  // slow with long texts: buffer_window lines from getBufferFirstLine()
+  // on.  Edits in it go into the text when the window moves.  The view
+  // scrolls over getLineCount() lines and moves the window with
+  // showLines().
   Glib::RefPtr<Gtk::TextBuffer> buffer;
+  static const unsigned long buffer_window = 4000;
+  // moves the window to start at line first (from 0)
+  void showLines(unsigned long first);
+  unsigned long getBufferFirstLine() const { return buffer_first; };
+  unsigned long getBufferLineCount() const { return buffer_lines; };
+  unsigned long getLineCount() const;
   GCodeIter *get_iter ();
 
   double GetTotalExtruded(bool relativeEcode) const;
@@ -87,7 +113,8 @@ public:
   Vector3d currentCursorWhere;
   Vector3d currentCursorFrom;
   Command currentCursorCommand;
-  vector<uint> buffer_zpos_lines; // line numbers where a z position is set
+  vector<uint> buffer_zpos_lines; // lines of the text where a z position
+                                  // is set
 
 
   vector<unsigned long> layerchanges;
@@ -98,4 +125,12 @@ public:
 
 private:
   unsigned long unconfirmed_blocks;
+
+  SharedText *text; // the whole text, NULL if none
+  unsigned long buffer_first, buffer_lines; // the lines of text in buffer
+  Toolpath toolpath;
+  void set_shared_text(string &newtext);
+  void fill_buffer();
+  void commit_buffer();
+  string getLine(unsigned long line) const;
 };
@@ -0,0 +1,381 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "stdafx.h"
+#include "toolpath.h"
+
+#include <algorithm>
+
+#include "gcode.h"
+#include "settings.h"
+
+
+// Everything build() takes from the settings, to notice changes without
+// going through the commands.  Read on every draw.
+static void get_style(const Settings &settings, vector<double> &style)
+{
+  style.clear();
+  style.push_back(settings.get_boolean("Slicing","RelativeEcode"));
+  style.push_back(settings.get_double("Hardware","MaxMoveSpeedXY"));
+  style.push_back(settings.get_boolean("Display","DebugGCodeOffset"));
+  style.push_back(settings.get_boolean("Display","DisplayGCodeMoves"));
+  style.push_back(settings.get_boolean("Display","LuminanceShowsSpeed"));
+  Vector4f colour = settings.get_colour("Display","GCodeMoveColour");
+  style.insert(style.end(), &colour[0], &colour[0] + 4);
+  colour = settings.get_colour("Display","GCodePrintingColour");
+  style.insert(style.end(), &colour[0], &colour[0] + 4);
+  for (uint e = 0; e < settings.getNumExtruders(); e++) {
+    string extrudername = settings.numberedExtruder("Extruder", e);
+    colour = settings.get_colour(extrudername,"DisplayColour");
+    style.insert(style.end(), &colour[0], &colour[0] + 4);
+    style.push_back(settings.get_double(extrudername,"MaxLineSpeed"));
+    Vector3d offset = settings.get_extruder_offset(e);
+    style.insert(style.end(), &offset[0], &offset[0] + 3);
+  }
+}
+
+static bool is_arc(const Command &command)
+{
+  return !command.is_value &&
+    (command.Code == ARC_CW || command.Code == ARC_CCW);
+}
+
+static void append_lines(vector<ColouredVertex> &vertices,
+			 const vector<Vector3d> &points, const Vector4f &colour)
+{
+  ColouredVertex v;
+  for (uint c = 0; c < 4; c++) // as glColor4f() clamps
+    v.colour[c] = (GLubyte) (CLAMP(colour[c], 0.f, 1.f) * 255 + 0.5);
+  for (uint i = 0; i < points.size(); i++) {
+    v.pos[0] = points[i].x();
+    v.pos[1] = points[i].y();
+    v.pos[2] = points[i].z();
+    vertices.push_back(v);
+  }
+}
+
+
+Toolpath::Toolpath()
+  : built(false), built_commands(0),
+    printing_start(0), printing_end(0), printing_commands(0),
+    printing_arcs(false)
+{
+}
+
+void Toolpath::clear()
+{
+  for (uint c = 0; c < NUM_LINE_CLASSES; c++) {
+    lines[c].clear();
+    layer_vertex[c].clear();
+    printing_lines[c].clear();
+    printing_vertex[c].clear();
+  }
+  layer_command.clear();
+  built = false;
+}
+
+// How GCode::drawCommands() makes lines of the commands, one after the
+// other: their colour, how wide they are and where they are.
+class Toolpath::LineMaker
+{
+public:
+  LineMaker(const Settings &settings, const vector<Command> &commands,
+	    bool liveprinting);
+
+  // the lines of command, false if it has none; the position moves on to
+  // its end.  first_arc: an arc with a wrong start point, left out.
+  bool next(const Command &command, bool first_arc, vector<Vector3d> &points,
+	    LineClass &lineclass, Vector4f &colour);
+
+  Vector3d pos;
+
+private:
+  bool liveprinting;
+  bool relativeE;
+  double maxmove_xy;
+  bool debuggcodeoffset;
+  bool displaygcodemoves;
+  bool luminanceshowsspeed;
+  Vector4f gcodemovecolour;
+  Vector4f gcodeprintingcolour;
+  // per extruder, looked up once
+  vector<Vector4f> extrudercolour;
+  vector<double> maxlinespeed;
+  vector<Vector3d> extruderoffset;
+
+  Vector3d last_extruder_offset;
+  double LastE;
+};
+
+Toolpath::LineMaker::LineMaker(const Settings &settings,
+			       const vector<Command> &commands,
+			       bool liveprinting)
+  : pos(0,0,0), liveprinting(liveprinting),
+    last_extruder_offset(Vector3d::ZERO), LastE(0.0)
+{
+  relativeE = settings.get_boolean("Slicing","RelativeEcode");
+  maxmove_xy = settings.get_double("Hardware","MaxMoveSpeedXY");
+  debuggcodeoffset = settings.get_boolean("Display","DebugGCodeOffset");
+  displaygcodemoves = settings.get_boolean("Display","DisplayGCodeMoves");
+  luminanceshowsspeed = settings.get_boolean("Display","LuminanceShowsSpeed");
+  gcodemovecolour = settings.get_colour("Display","GCodeMoveColour");
+  gcodeprintingcolour = settings.get_colour("Display","GCodePrintingColour");
+
+  uint n_extruders = settings.getNumExtruders();
+  for (uint i = 0; i < commands.size(); i++)
+    n_extruders = max(n_extruders, commands[i].extruder_no + 1);
+  extrudercolour.resize(n_extruders);
+  maxlinespeed.resize(n_extruders);
+  extruderoffset.resize(n_extruders);
+  for (uint e = 0; e < n_extruders; e++) {
+    string extrudername = settings.numberedExtruder("Extruder", e);
+    extrudercolour[e] = settings.get_colour(extrudername,"DisplayColour");
+    maxlinespeed[e] = settings.get_double(extrudername,"MaxLineSpeed");
+    extruderoffset[e] = settings.get_extruder_offset(e);
+  }
+}
+
+bool Toolpath::LineMaker::next(const Command &command, bool first_arc,
+			       vector<Vector3d> &points,
+			       LineClass &lineclass, Vector4f &Color)
+{
+  Vector3d extruder_offset = Vector3d::ZERO;
+  if (!debuggcodeoffset) { // show all together
+    extruder_offset = extruderoffset[command.extruder_no];
+    pos -= extruder_offset - last_extruder_offset;
+    last_extruder_offset = extruder_offset;
+  }
+  if (command.is_value) return false;
+
+  switch (command.Code) {
+  case ARC_CW:
+  case ARC_CCW:
+    if (first_arc)
+      return false; // don't draw arcs at beginning (wrong startpoint)
+  case COORDINATEDMOTION:
+    {
+      double luma;
+      if ( (!relativeE && command.e == LastE)
+	   || (relativeE && command.e == 0) ) { // move only
+	if (!displaygcodemoves) {
+	  pos = command.where;
+	  return false;
+	}
+	luma = 0.3 + 0.7 * command.f / maxmove_xy / 60;
+	Color = gcodemovecolour;
+      } else {
+	luma = 0.3 + 0.7 * command.f / maxlinespeed[command.extruder_no] / 60;
+	Color = liveprinting ? gcodeprintingcolour
+	  : extrudercolour[command.extruder_no];
+      }
+      if (luminanceshowsspeed)
+	Color *= luma;
+      lineclass = command.abs_extr != 0 ? MOVE_WIDE : MOVE;
+      LastE = command.e;
+      break;
+    }
+  case RAPIDMOTION:
+    Color = gcodemovecolour;
+    lineclass = command.abs_extr != 0 ? RAPID_WIDE : RAPID;
+    break;
+  default:
+    return false; // ignored GCodes
+  }
+
+  points.clear();
+  command.getLines(pos, extruder_offset, points);
+  return true;
+}
+
+// the loop of GCode::drawCommands() over all commands, not liveprinting
+void Toolpath::build(const GCode &gcode, const Settings &settings)
+{
+  const vector<Command> &commands = gcode.commands;
+  LineMaker maker(settings, commands, false);
+
+  // the commands before the first layer change count to layer 0
+  layer_command.clear();
+  layer_command.push_back(0);
+  for (uint l = 1; l < gcode.layerchanges.size(); l++)
+    layer_command.push_back(gcode.layerchanges[l]);
+  layer_command.push_back(commands.size());
+
+  vector<ColouredVertex> vertices[NUM_LINE_CLASSES];
+  for (uint c = 0; c < NUM_LINE_CLASSES; c++)
+    layer_vertex[c].clear();
+  layer_arcs.assign(layer_command.size(), false);
+  uint layer = 0;
+
+  vector<Vector3d> points;
+  for (uint i = 0; i < commands.size(); i++) {
+    for (; layer + 1 < layer_command.size() && layer_command[layer] <= i; layer++)
+      for (uint c = 0; c < NUM_LINE_CLASSES; c++)
+	layer_vertex[c].push_back(vertices[c].size());
+    if (is_arc(commands[i]))
+      layer_arcs[layer - 1] = true;
+
+    LineClass lineclass;
+    Vector4f Color;
+    if (maker.next(commands[i], i == 0, points, lineclass, Color))
+      append_lines(vertices[lineclass], points, Color);
+  }
+  for (; layer < layer_command.size(); layer++)
+    for (uint c = 0; c < NUM_LINE_CLASSES; c++)
+      layer_vertex[c].push_back(vertices[c].size());
+
+  for (uint c = 0; c < NUM_LINE_CLASSES; c++)
+    lines[c].set(vertices[c]);
+
+  built = true;
+  built_commands = commands.size();
+}
+
+bool Toolpath::draw(const GCode &gcode, const Settings &settings,
+		    unsigned long start, unsigned long end, GLfloat linewidth)
+{
+  vector<double> style;
+  get_style(settings, style);
+  if (!built || gcode.commands.size() != built_commands || style != built_style) {
+    built_style = style;
+    build(gcode, settings);
+  }
+
+  // start has to begin a layer, end be the last command of one or the
+  // layer change command after it
+  vector<unsigned long>::const_iterator found =
+    lower_bound(layer_command.begin(), layer_command.end(), start);
+  if (found == layer_command.end() || *found != start)
+    return false;
+  size_t first = found - layer_command.begin();
+  found = lower_bound(layer_command.begin(), layer_command.end(), end);
+  if (found == layer_command.end() || (*found != end && *found != end+1))
+    return false;
+  size_t last = found - layer_command.begin(); // exclusive
+  if (last <= first)
+    return false;
+  // the arc debug display only changes arcs
+  if (settings.get_boolean("Display","DisplayDebugArcs"))
+    for (size_t l = first; l < last; l++)
+      if (layer_arcs[l]) return false;
+
+  const GLfloat widths[NUM_LINE_CLASSES] = { 1, 2, linewidth, 2*linewidth };
+  for (uint c = 0; c < NUM_LINE_CLASSES; c++) {
+    size_t from = layer_vertex[c][first], to = layer_vertex[c][last];
+    if (to > from) {
+      glLineWidth(widths[c]);
+      lines[c].draw(GL_LINES, from, to - from);
+    }
+  }
+  glLineWidth(1);
+  return true;
+}
+
+// the lines of the commands start to end (inclusive), as drawCommands()
+// makes them when liveprinting
+void Toolpath::buildPrinting(const GCode &gcode, const Settings &settings,
+			     unsigned long start, unsigned long end)
+{
+  const vector<Command> &commands = gcode.commands;
+  LineMaker maker(settings, commands, true);
+
+  // get starting point
+  if (start > 0) {
+    unsigned long i = start;
+    while ((commands[i].is_value || commands[i].where == Vector3d::ZERO) && i < end)
+      i++;
+    maker.pos = commands[i].where;
+  }
+
+  vector<ColouredVertex> vertices[NUM_LINE_CLASSES];
+  for (uint c = 0; c < NUM_LINE_CLASSES; c++)
+    printing_vertex[c].clear();
+
+  printing_arcs = false;
+
+  vector<Vector3d> points;
+  for (unsigned long i = start; i <= end; i++) {
+    for (uint c = 0; c < NUM_LINE_CLASSES; c++)
+      printing_vertex[c].push_back(vertices[c].size());
+    if (is_arc(commands[i]))
+      printing_arcs = true;
+    LineClass lineclass;
+    Vector4f Color;
+    if (maker.next(commands[i], i == start, points, lineclass, Color))
+      append_lines(vertices[lineclass], points, Color);
+  }
+  for (uint c = 0; c < NUM_LINE_CLASSES; c++) {
+    printing_vertex[c].push_back(vertices[c].size());
+    printing_lines[c].set(vertices[c]);
+  }
+
+  printing_start = start;
+  printing_end = end;
+  printing_commands = commands.size();
+}
+
+bool Toolpath::drawPrinting(const GCode &gcode, const Settings &settings,
+			    unsigned long start, unsigned long printed,
+			    unsigned long end, GLfloat linewidth)
+{
+  const vector<Command> &commands = gcode.commands;
+  if (end >= commands.size() || start > end)
+    return false;
+
+  vector<double> style;
+  get_style(settings, style);
+  if (printing_vertex[0].empty() || start != printing_start ||
+      end != printing_end || commands.size() != printing_commands ||
+      style != printing_style) {
+    printing_style = style;
+    buildPrinting(gcode, settings, start, end);
+  }
+  if (printing_arcs && settings.get_boolean("Display","DisplayDebugArcs"))
+    return false;
+
+  // the printed line itself is drawn wide
+  printed = CLAMP(printed, start, end);
+  const size_t split_command = printed - start + 1;
+  const GLfloat printed_widths[NUM_LINE_CLASSES] = { 1, 2, linewidth, 2*linewidth };
+  const GLfloat widths[NUM_LINE_CLASSES] = { 1, 2, 1, 2 };
+  for (uint c = 0; c < NUM_LINE_CLASSES; c++) {
+    const size_t split = printing_vertex[c][split_command],
+      all = printing_vertex[c].back();
+    if (split > 0) {
+      glLineWidth(printed_widths[c]);
+      printing_lines[c].draw(GL_LINES, 0, split);
+    }
+    if (all > split) {
+      glLineWidth(widths[c]);
+      printing_lines[c].draw(GL_LINES, split, all - split);
+    }
+  }
+  glLineWidth(1);
+
+  // where the head is
+  unsigned long i = printed;
+  while ((commands[i].is_value || commands[i].where == Vector3d::ZERO) && i < end)
+    i++;
+  const Vector4f colour = settings.get_colour("Display","GCodePrintingColour");
+  glColor4fv(&colour[0]);
+  glPointSize(20);
+  glBegin(GL_POINTS);
+  glVertex3dv((GLdouble*)&commands[i].where);
+  glEnd();
+  return true;
+}
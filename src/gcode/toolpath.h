@@ -0,0 +1,87 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#pragma once
+
+#include <vector>
+
+#include "vertexbuffer.h"
+
+class GCode;
+class Settings;
+
+// The moves of a GCode as coloured line segments, put into vertex buffers
+// on the first draw after a change and then drawn by whole layers with one
+// call per line width.  It draws what GCode::drawCommands() draws for
+// plain lines; arrows, extrusion borders and the debug displays are still
+// drawn command by command.
+class Toolpath
+{
+ public:
+  Toolpath();
+
+  // forget the lines, they are built again on the next draw
+  void clear();
+
+  // draws the commands start to end (inclusive), which have to be whole
+  // layers; returns false if they aren't, or if they have arcs for the
+  // arc debug display
+  bool draw(const GCode &gcode, const Settings &settings,
+	    unsigned long start, unsigned long end, GLfloat linewidth);
+
+  // Draws the layer being printed, commands start to end (inclusive), as
+  // GCode::drawCommands() does when liveprinting: up to the printed
+  // command with linewidth, the rest thin, and a point where the head is.
+  // The layer is put into vertex buffers once, a newly printed command
+  // only moves the border between the wide and the thin range.  Returns
+  // false, having drawn nothing, if the layer has arcs for the arc debug
+  // display.
+  bool drawPrinting(const GCode &gcode, const Settings &settings,
+		    unsigned long start, unsigned long printed,
+		    unsigned long end, GLfloat linewidth);
+
+ private:
+  // rapid moves have width 1, other moves linewidth, and both twice that
+  // if they have abs_extr, see Command::draw()
+  enum LineClass { RAPID, RAPID_WIDE, MOVE, MOVE_WIDE, NUM_LINE_CLASSES };
+
+  VertexBuffer lines[NUM_LINE_CLASSES];
+  // layer n is commands layer_command[n] up to layer_command[n+1], its
+  // vertices start at layer_vertex[class][n]
+  std::vector<unsigned long> layer_command;
+  std::vector<size_t> layer_vertex[NUM_LINE_CLASSES];
+  std::vector<bool> layer_arcs;
+
+  bool built;
+  unsigned long built_commands;
+  std::vector<double> built_style; // the settings the colours came from
+
+  // the layer drawPrinting() drew last, command printing_start + n starts
+  // at vertex printing_vertex[class][n]
+  VertexBuffer printing_lines[NUM_LINE_CLASSES];
+  std::vector<size_t> printing_vertex[NUM_LINE_CLASSES];
+  unsigned long printing_start, printing_end;
+  unsigned long printing_commands;
+  std::vector<double> printing_style;
+  bool printing_arcs;
+
+  class LineMaker;
+  void build(const GCode &gcode, const Settings &settings);
+  void buildPrinting(const GCode &gcode, const Settings &settings,
+		     unsigned long start, unsigned long end);
+};
@@ -0,0 +1,301 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "stdafx.h"
+#include "layerpreview.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "settings.h"
+#include "shape.h"
+#include "flatshape.h"
+#include "slicer/layer.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifndef _OPENMP
+static Glib::StaticMutex infill_mutex = GLIBMM_STATIC_MUTEX_INIT;
+#endif
+
+// what the workers slice, so the model can change meanwhile
+struct LayerPreview::Input
+{
+  vector<Shape*> shapes;
+  vector<Matrix4d> transforms;
+  Settings settings;
+  ~Input()
+  {
+    for (uint i = 0; i < shapes.size(); i++)
+      delete shapes[i];
+  }
+};
+
+
+LayerPreview::LayerPreview()
+  : input(NULL), shown(NULL), quit(false)
+{
+  dispatcher.connect(signal_ready.make_slot());
+}
+
+LayerPreview::~LayerPreview()
+{
+  clear();
+  {
+    Glib::Mutex::Lock lock(mutex);
+    quit = true;
+    work_cond.broadcast();
+  }
+  for (uint i = 0; i < workers.size(); i++)
+    workers[i]->join();
+}
+
+void LayerPreview::set_shapes(const vector<Shape*> &shapes,
+			      const vector<Matrix4d> &transforms,
+			      const Settings &settings)
+{
+  clear();
+  input = new Input();
+  for (uint i = 0; i < shapes.size(); i++) {
+    const FlatShape *flat = dynamic_cast<const FlatShape*>(shapes[i]);
+    if (flat)
+      input->shapes.push_back(new FlatShape(*flat));
+    else
+      input->shapes.push_back(new Shape(*shapes[i]));
+  }
+  input->transforms = transforms;
+  input->settings.merge(settings);
+  input->settings.selectedExtruder = settings.selectedExtruder;
+}
+
+void LayerPreview::clear()
+{
+  list<Sliced> old;
+  {
+    Glib::Mutex::Lock lock(mutex);
+    queue.clear();
+    while (!running.empty())
+      idle_cond.wait(mutex);
+    old.swap(done);
+  }
+  old.splice(old.end(), cache);
+  for (list<Sliced>::iterator i = old.begin(); i != old.end(); ++i)
+    deleteSliced(*i);
+  shown = NULL;
+  delete input;
+  input = NULL;
+}
+
+void LayerPreview::wait()
+{
+  Glib::Mutex::Lock lock(mutex);
+  if (workers.empty()) return;
+  while (!queue.empty() || !running.empty())
+    idle_cond.wait(mutex);
+}
+
+void LayerPreview::deleteSliced(Sliced &sliced)
+{
+  delete sliced.layer;
+  delete sliced.below;
+}
+
+Layer *LayerPreview::get(double z, uint LayerNr, double thickness,
+			 bool calcinfill)
+{
+  collect();
+
+  Job job;
+  job.z = z;
+  job.LayerNr = LayerNr;
+  job.thickness = thickness;
+  job.calcinfill = calcinfill;
+  for (list<Sliced>::iterator i = cache.begin(); i != cache.end(); ++i)
+    if (i->job == job) {
+      cache.splice(cache.begin(), cache, i);
+      shown = i->layer;
+      break;
+    }
+  if (!input) return shown;
+
+  // this one first, then the ones around it
+  request(job, true);
+  Job above = job;
+  above.z += thickness;
+  above.LayerNr++;
+  request(above, false);
+  if (LayerNr > 0 && z >= thickness) {
+    Job below = job;
+    below.z -= thickness;
+    below.LayerNr--;
+    request(below, false);
+  }
+  return shown;
+}
+
+// queues job if it isn't sliced or being sliced; first drops the queued
+// jobs, for layers that aren't wanted any more
+void LayerPreview::request(const Job &job, bool first)
+{
+  Glib::Mutex::Lock lock(mutex);
+  if (first)
+    queue.clear();
+  for (list<Sliced>::const_iterator i = cache.begin(); i != cache.end(); ++i)
+    if (i->job == job) return;
+  for (list<Sliced>::const_iterator i = done.begin(); i != done.end(); ++i)
+    if (i->job == job) return;
+  if (std::find(running.begin(), running.end(), job) != running.end() ||
+      std::find(queue.begin(), queue.end(), job) != queue.end())
+    return;
+  queue.push_back(job);
+
+  if (workers.empty()) {
+    uint n_workers = 1;
+#ifdef _OPENMP
+    n_workers = CLAMP(omp_get_num_procs() - 1, 1, 4);
+#endif
+    for (uint i = 0; i < n_workers; i++) {
+      try {
+	workers.push_back(Glib::Thread::create
+			  (sigc::mem_fun(*this, &LayerPreview::work), true));
+      } catch (Glib::ThreadError &e) {
+	cerr << "no layer preview thread: " << e.what() << endl;
+	break;
+      }
+    }
+  }
+  work_cond.signal();
+}
+
+// takes the layers the workers made into the cache, and drops the least
+// recently used ones over cache_size, but not the one shown
+void LayerPreview::collect()
+{
+  {
+    Glib::Mutex::Lock lock(mutex);
+    cache.splice(cache.begin(), done);
+  }
+  list<Sliced>::iterator i = cache.end();
+  while (cache.size() > cache_size && i != cache.begin()) {
+    --i;
+    if (i->layer == shown) continue;
+    deleteSliced(*i);
+    i = cache.erase(i);
+  }
+}
+
+// in the worker threads
+void LayerPreview::work()
+{
+  Glib::Mutex::Lock lock(mutex);
+  while (true) {
+    while (!quit && queue.empty())
+      work_cond.wait(mutex);
+    if (quit) break;
+    Sliced sliced;
+    sliced.job = queue.front();
+    queue.pop_front();
+    running.push_back(sliced.job);
+    lock.release();
+
+    // input stays while something runs, see clear()
+    const Job &job = sliced.job;
+    sliced.layer = slice(input->shapes, input->transforms, input->settings,
+			 job.z, job.LayerNr, job.thickness, job.calcinfill);
+    sliced.below = NULL;
+    if (job.LayerNr > 0 && job.z >= job.thickness) {
+      sliced.below = slice(input->shapes, input->transforms, input->settings,
+			   job.z - job.thickness, job.LayerNr - 1,
+			   job.thickness, false);
+      sliced.layer->setPrevious(sliced.below);
+    }
+
+    lock.acquire();
+    running.erase(std::find(running.begin(), running.end(), job));
+    done.push_back(sliced);
+    if (running.empty())
+      idle_cond.broadcast();
+    dispatcher.emit();
+  }
+}
+
+Layer *LayerPreview::slice(const vector<Shape*> &shapes,
+			   const vector<Matrix4d> &transforms,
+			   const Settings &settings,
+			   double z, uint LayerNr, double thickness,
+			   bool calcinfill)
+{
+  double max_grad = 0;
+  double supportangle = settings.get_double("Slicing","SupportAngle")*M_PI/180.;
+  if (!settings.get_boolean("Slicing","Support")) supportangle = -1;
+
+  Layer * layer = new Layer(NULL, LayerNr, thickness,
+			    settings.get_integer("Slicing","Skins"));
+  layer->setZ(z);
+  for(size_t f = 0; f < shapes.size(); f++) {
+    layer->addShape(transforms[f], *shapes[f], z, max_grad, supportangle);
+  }
+
+  // vector<Poly> polys = layer->GetPolygons();
+  // for (guint i=0; i<polys.size();i++){
+  //   vector<Triangle> tri;
+  //   polys[i].getTriangulation(tri);
+  //   for (guint j=0; j<tri.size();j++){
+  //     tri[j].draw(GL_LINE_LOOP);
+  //   }
+  // }
+
+  layer->MakeShells(settings);
+
+  if (settings.get_boolean("Slicing","Skirt")) {
+    if (layer->getZ() - layer->getThickness() <= settings.get_double("Slicing","SkirtHeight"))
+      layer->MakeSkirt(settings.get_double("Slicing","SkirtDistance"),
+		       settings.get_boolean("Slicing","SingleSkirt") &&
+		       !settings.get_boolean("Slicing","Support"));
+  }
+
+  if (calcinfill) {
+#ifndef _OPENMP
+    // the saved infill patterns are only locked with OpenMP
+    Glib::StaticMutex::Lock lock(infill_mutex);
+#endif
+    layer->CalcInfill(settings);
+  }
+
+#define DEBUGPOLYS 0
+#if DEBUGPOLYS
+  // write out polygons for gnuplot
+  const vector<Poly> &polys = layer->GetPolygons();
+  const vector< vector<Poly> > &offs = layer->GetShellPolygons();
+  cout << "# polygons "<< endl;
+  for (guint i=0; i<polys.size();i++){
+    cout << polys[i].gnuplot_path() << endl;
+  }
+  for (guint s=0; s<offs.size();s++){
+    cout << "# offset polygons " << s << endl;
+    for (guint i=0; i<offs[s].size();i++){
+      cout << offs[s][i].gnuplot_path() << endl;
+    }
+  }
+#endif
+
+  return layer;
+}
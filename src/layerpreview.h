@@ -0,0 +1,105 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef LAYERPREVIEW_H
+#define LAYERPREVIEW_H
+
+#include <vector>
+#include <deque>
+#include <list>
+#include "stdafx.h"
+
+class Layer;
+class Shape;
+class Settings;
+
+// Single layers for the layer slider while the model isn't sliced,
+// sliced by worker threads from a copy of the shapes.  The last few
+// layers are kept, and the ones above and below the one asked for are
+// sliced ahead, as the slider usually moves on to them.
+class LayerPreview
+{
+ public:
+  LayerPreview();
+  ~LayerPreview();
+
+  // slice copies of these from now on, forgets the layers
+  void set_shapes(const vector<Shape*> &shapes,
+		  const vector<Matrix4d> &transforms,
+		  const Settings &settings);
+  bool has_shapes() const { return input != NULL; };
+  // forgets the shapes and layers, waits for the slicing going on
+  void clear();
+  // waits until the layers asked for so far are sliced
+  void wait();
+
+  // The layer at z if it is sliced, else the layer returned before (NULL
+  // at first) until it is.  The layers belong to the preview.
+  Layer *get(double z, uint LayerNr, double thickness, bool calcinfill);
+
+  // emitted in the main thread when a layer is sliced
+  sigc::signal< void > signal_ready;
+
+  // a layer of shapes with shells, and infill if calcinfill
+  static Layer *slice(const vector<Shape*> &shapes,
+		      const vector<Matrix4d> &transforms,
+		      const Settings &settings,
+		      double z, uint LayerNr, double thickness, bool calcinfill);
+
+ private:
+  struct Input;
+  struct Job
+  {
+    double z;
+    uint LayerNr;
+    double thickness;
+    bool calcinfill;
+    bool operator==(const Job &rhs) const {
+      return z == rhs.z && LayerNr == rhs.LayerNr &&
+	thickness == rhs.thickness && calcinfill == rhs.calcinfill;
+    };
+  };
+  struct Sliced
+  {
+    Job job;
+    Layer *layer;
+    Layer *below; // its previous
+  };
+
+  static const uint cache_size = 8;
+
+  Input *input;
+  std::list<Sliced> cache; // most recently used first, main thread only
+  Layer *shown;
+
+  Glib::Mutex mutex; // for all below
+  Glib::Cond work_cond, idle_cond;
+  std::deque<Job> queue;
+  std::vector<Job> running;
+  std::list<Sliced> done;   // not yet in the cache
+  bool quit;
+  std::vector<Glib::Thread *> workers;
+  Glib::Dispatcher dispatcher;
+
+  void request(const Job &job, bool first);
+  void collect();
+  void work();
+  static void deleteSliced(Sliced &sliced);
+};
+
+#endif // LAYERPREVIEW_H
@@ -0,0 +1,438 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "stdafx.h"
+#include "lod.h"
+
+#include <algorithm>
+#include <iostream>
+
+// how much more moving a border edge costs than a flat surface
+static const double border_weight = 1000;
+// the normal of a triangle may turn by up to about 80 degrees
+static const double min_normal_dot = 0.2;
+
+
+Decimator::Quadric::Quadric()
+{
+  for (uint i = 0; i < 10; i++) q[i] = 0;
+}
+
+// the squared distance to the plane n.v + d = 0, times weight
+Decimator::Quadric::Quadric(const Vector3d &n, double d, double weight)
+{
+  const double a = n.x(), b = n.y(), c = n.z();
+  q[0] = a*a; q[1] = a*b; q[2] = a*c; q[3] = a*d;
+              q[4] = b*b; q[5] = b*c; q[6] = b*d;
+                          q[7] = c*c; q[8] = c*d;
+                                      q[9] = d*d;
+  for (uint i = 0; i < 10; i++) q[i] *= weight;
+}
+
+Decimator::Quadric &Decimator::Quadric::operator+=(const Quadric &rhs)
+{
+  for (uint i = 0; i < 10; i++) q[i] += rhs.q[i];
+  return *this;
+}
+
+double Decimator::Quadric::error(const Vector3d &v) const
+{
+  const double x = v.x(), y = v.y(), z = v.z();
+  return q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x
+    + q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y
+    + q[7]*z*z + 2*q[8]*z
+    + q[9];
+}
+
+
+// orders vertex indices by position, to find the equal ones
+struct PositionLess
+{
+  const GLfloat *p;
+  PositionLess(const GLfloat *positions) : p(positions) {};
+  bool operator()(uint a, uint b) const
+  {
+    const GLfloat *pa = p + 3*a, *pb = p + 3*b;
+    if (pa[0] != pb[0]) return pa[0] < pb[0];
+    if (pa[1] != pb[1]) return pa[1] < pb[1];
+    return pa[2] < pb[2];
+  }
+};
+
+// an edge of face f, the lower vertex first
+struct Edge
+{
+  uint a, b, f;
+  Edge(uint v1, uint v2, uint face)
+    : a(min(v1, v2)), b(max(v1, v2)), f(face) {};
+  bool operator<(const Edge &rhs) const
+  { return a < rhs.a || (a == rhs.a && b < rhs.b); };
+};
+
+Decimator::Decimator(const vector<GLfloat> &positions,
+		     const volatile bool *cancel)
+  : live_faces(0), cancel(cancel)
+{
+  const uint n_corners = positions.size() / 3;
+  if (n_corners < 3) return;
+
+  // weld the corners of the triangles into vertices
+  vector<uint> order(n_corners);
+  for (uint i = 0; i < n_corners; i++) order[i] = i;
+  PositionLess less(&positions[0]);
+  std::sort(order.begin(), order.end(), less);
+  face.resize(n_corners - n_corners % 3);
+  for (uint i = 0; i < n_corners; i++) {
+    if (i == 0 || less(order[i-1], order[i])) {
+      const GLfloat *p = &positions[3*order[i]];
+      vertex.push_back(Vector3d(p[0], p[1], p[2]));
+    }
+    if (order[i] < face.size())
+      face[order[i]] = vertex.size() - 1;
+  }
+  vector<uint>().swap(order);
+
+  const uint n_faces = face.size() / 3;
+  quadric.resize(vertex.size());
+  version.assign(vertex.size(), 0);
+  vertex_dead.assign(vertex.size(), false);
+  vertex_faces.resize(vertex.size());
+  face_dead.assign(n_faces, false);
+
+  // the faces' planes, weighted by area, and their edges
+  vector<Edge> edges;
+  edges.reserve(face.size());
+  for (uint f = 0; f < n_faces; f++) {
+    const uint *v = &face[3*f];
+    if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0]) {
+      face_dead[f] = true;
+      continue;
+    }
+    live_faces++;
+    for (uint j = 0; j < 3; j++) {
+      vertex_faces[v[j]].push_back(f);
+      edges.push_back(Edge(v[j], v[(j+1)%3], f));
+    }
+    Vector3d n = (vertex[v[1]] - vertex[v[0]]).cross(vertex[v[2]] - vertex[v[0]]);
+    const double area2 = n.length();
+    if (area2 == 0) continue;
+    n /= area2;
+    const Quadric plane(n, -n.dot(vertex[v[0]]), area2 / 2);
+    for (uint j = 0; j < 3; j++)
+      quadric[v[j]] += plane;
+  }
+  std::sort(edges.begin(), edges.end());
+
+  for (uint i = 0; i < edges.size(); i++) {
+    const Edge &e = edges[i];
+    const bool first = i == 0 || edges[i-1] < e;
+    if (first)
+      pushEdge(e.a, e.b);
+    if (!first || (i + 1 < edges.size() && !(e < edges[i+1])))
+      continue;
+    // used by one face only, on a border: add a plane through the edge,
+    // upright on its face, so the vertices stay on the border line
+    const uint *v = &face[3*e.f];
+    const Vector3d n = (vertex[v[1]] - vertex[v[0]]).cross(vertex[v[2]] - vertex[v[0]]);
+    const Vector3d edge = vertex[e.b] - vertex[e.a];
+    Vector3d m = edge.cross(n);
+    const double len = m.length();
+    if (len == 0) continue;
+    m /= len;
+    const Quadric plane(m, -m.dot(vertex[e.a]), border_weight * edge.dot(edge));
+    quadric[e.a] += plane;
+    quadric[e.b] += plane;
+  }
+}
+
+// where v1 and v2 would go together (one of them or the middle), and the
+// error of that place
+double Decimator::collapseTarget(uint v1, uint v2, Vector3d &target) const
+{
+  Quadric q = quadric[v1];
+  q += quadric[v2];
+  const Vector3d candidates[3] = { vertex[v1], vertex[v2],
+				   (vertex[v1] + vertex[v2]) / 2 };
+  double best = 0;
+  for (uint i = 0; i < 3; i++) {
+    const double error = q.error(candidates[i]);
+    if (i == 0 || error < best) {
+      best = error;
+      target = candidates[i];
+    }
+  }
+  return best;
+}
+
+void Decimator::pushEdge(uint v1, uint v2)
+{
+  Vector3d target;
+  Collapse c;
+  c.cost = collapseTarget(v1, v2, target);
+  c.v1 = v1;
+  c.v2 = v2;
+  c.version1 = version[v1];
+  c.version2 = version[v2];
+  heap.push(c);
+}
+
+// whether moving v to target would turn one of its faces that don't also
+// have other over, or make it degenerate
+bool Decimator::turnsOver(uint v, uint other, const Vector3d &target) const
+{
+  const vector<uint> &faces = vertex_faces[v];
+  for (uint i = 0; i < faces.size(); i++) {
+    const uint f = faces[i];
+    if (face_dead[f]) continue;
+    const uint *fv = &face[3*f];
+    if (fv[0] == other || fv[1] == other || fv[2] == other) continue;
+    Vector3d p[3], moved[3];
+    for (uint j = 0; j < 3; j++) {
+      p[j] = vertex[fv[j]];
+      moved[j] = fv[j] == v ? target : p[j];
+    }
+    Vector3d before = (p[1] - p[0]).cross(p[2] - p[0]);
+    Vector3d after = (moved[1] - moved[0]).cross(moved[2] - moved[0]);
+    const double lb = before.length(), la = after.length();
+    if (la == 0) return true;
+    if (lb == 0) continue;
+    if (before.dot(after) < min_normal_dot * lb * la)
+      return true;
+  }
+  return false;
+}
+
+void Decimator::collapse(uint keep, uint remove, const Vector3d &target)
+{
+  vertex[keep] = target;
+  quadric[keep] += quadric[remove];
+  vertex_dead[remove] = true;
+  version[keep]++;
+  version[remove]++;
+
+  vector<uint> &faces = vertex_faces[keep];
+  const vector<uint> &removed_faces = vertex_faces[remove];
+  for (uint i = 0; i < removed_faces.size(); i++) {
+    const uint f = removed_faces[i];
+    if (face_dead[f]) continue;
+    uint *fv = &face[3*f];
+    if (fv[0] == keep || fv[1] == keep || fv[2] == keep) {
+      face_dead[f] = true; // the faces on the edge go
+      live_faces--;
+      continue;
+    }
+    for (uint j = 0; j < 3; j++)
+      if (fv[j] == remove) fv[j] = keep;
+    faces.push_back(f);
+  }
+  vector<uint>().swap(vertex_faces[remove]);
+
+  // drop the dead faces and find the neighbours
+  vector<uint> neighbours;
+  uint n = 0;
+  for (uint i = 0; i < faces.size(); i++) {
+    const uint f = faces[i];
+    if (face_dead[f]) continue;
+    faces[n++] = f;
+    for (uint j = 0; j < 3; j++)
+      if (face[3*f+j] != keep)
+	neighbours.push_back(face[3*f+j]);
+  }
+  faces.resize(n);
+  std::sort(neighbours.begin(), neighbours.end());
+  neighbours.erase(std::unique(neighbours.begin(), neighbours.end()),
+		   neighbours.end());
+
+  // the old costs with keep are out of date by its version
+  for (uint i = 0; i < neighbours.size(); i++)
+    pushEdge(keep, neighbours[i]);
+}
+
+bool Decimator::reduce(size_t target)
+{
+  uint count = 0;
+  while (live_faces > target && !heap.empty()) {
+    if (cancel && (++count % 1024) == 0 && *cancel)
+      return false;
+    const Collapse c = heap.top();
+    heap.pop();
+    if (vertex_dead[c.v1] || vertex_dead[c.v2] ||
+	version[c.v1] != c.version1 || version[c.v2] != c.version2)
+      continue; // out of date
+    Vector3d target;
+    collapseTarget(c.v1, c.v2, target);
+    if (turnsOver(c.v1, c.v2, target) || turnsOver(c.v2, c.v1, target))
+      continue; // comes back when a neighbour changes
+    collapse(c.v1, c.v2, target);
+  }
+  return !(cancel && *cancel);
+}
+
+void Decimator::getVertices(vector<NormalVertex> &vertices) const
+{
+  vertices.clear();
+  vertices.reserve(3 * live_faces);
+  NormalVertex nv;
+  for (uint f = 0; f < face_dead.size(); f++) {
+    if (face_dead[f]) continue;
+    const uint *fv = &face[3*f];
+    Vector3d n = (vertex[fv[1]] - vertex[fv[0]]).cross(vertex[fv[2]] - vertex[fv[0]]);
+    const double len = n.length();
+    if (len > 0) n /= len;
+    for (uint j = 0; j < 3; j++) {
+      const Vector3d &p = vertex[fv[j]];
+      for (uint k = 0; k < 3; k++) {
+	nv.pos[k] = p[k];
+	nv.normal[k] = n[k];
+      }
+      vertices.push_back(nv);
+    }
+  }
+}
+
+
+MeshLOD::MeshLOD()
+  : job(NULL)
+{
+}
+
+MeshLOD::MeshLOD(const MeshLOD &)
+  : job(NULL)
+{
+}
+
+MeshLOD::~MeshLOD()
+{
+  stop();
+  // the buffers go with the context if it isn't current now
+  for (uint i = 0; i < levels.size(); i++)
+    delete levels[i];
+}
+
+MeshLOD &MeshLOD::operator=(const MeshLOD &rhs)
+{
+  if (this != &rhs)
+    clear();
+  return *this;
+}
+
+void MeshLOD::start(vector<GLfloat> &positions)
+{
+  stop();
+  job = new Job();
+  job->refs = 2;
+  job->cancel = false;
+  job->input.swap(positions);
+  positions.clear();
+  try {
+    Glib::Thread::create(sigc::bind(sigc::ptr_fun(&MeshLOD::run), job), false);
+  } catch (Glib::ThreadError &e) {
+    cerr << "no levels of detail: " << e.what() << endl;
+    release(job); // for the thread
+    stop();
+  }
+}
+
+void MeshLOD::stop()
+{
+  if (job) {
+    job->cancel = true;
+    release(job);
+    job = NULL;
+  }
+}
+
+void MeshLOD::clear()
+{
+  stop();
+  for (uint i = 0; i < levels.size(); i++)
+    delete levels[i];
+  levels.clear();
+  level_triangles.clear();
+}
+
+void MeshLOD::release(Job *job)
+{
+  bool last;
+  {
+    Glib::Mutex::Lock lock(job->mutex);
+    last = --job->refs == 0;
+  }
+  if (last)
+    delete job;
+}
+
+// in the thread
+void MeshLOD::run(Job *job)
+{
+  {
+    Decimator decimator(job->input, &job->cancel);
+    vector<GLfloat>().swap(job->input);
+    size_t target = decimator.size() / 4;
+    while (!job->cancel && target >= min_triangles) {
+      if (!decimator.reduce(target))
+	break;
+      vector<NormalVertex> vertices;
+      decimator.getVertices(vertices);
+      {
+	Glib::Mutex::Lock lock(job->mutex);
+	job->ready_triangles.push_back(decimator.size());
+	job->ready.push_back(vector<NormalVertex>());
+	job->ready.back().swap(vertices);
+      }
+      if (decimator.size() > target)
+	break; // stuck, the next levels would be the same
+      target /= 4;
+    }
+  }
+  release(job);
+}
+
+// moves the levels the thread has made to the GL
+void MeshLOD::upload()
+{
+  if (!job) return;
+  Glib::Mutex::Lock lock(job->mutex);
+  for (uint i = 0; i < job->ready.size(); i++) {
+    VertexBuffer *buffer = new VertexBuffer();
+    buffer->set(job->ready[i]);
+    levels.push_back(buffer);
+    level_triangles.push_back(job->ready_triangles[i]);
+  }
+  job->ready.clear();
+  job->ready_triangles.clear();
+}
+
+const VertexBuffer *MeshLOD::get(size_t min)
+{
+  upload();
+  for (uint i = levels.size(); i > 0; i--)
+    if (level_triangles[i-1] >= min)
+      return levels[i-1];
+  return NULL;
+}
+
+const VertexBuffer *MeshLOD::getAtMost(size_t max)
+{
+  upload();
+  for (uint i = 0; i < levels.size(); i++)
+    if (level_triangles[i] <= max)
+      return levels[i];
+  return NULL;
+}
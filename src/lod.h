@@ -0,0 +1,130 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef LOD_H
+#define LOD_H
+
+#include <vector>
+#include <queue>
+#include "stdafx.h"
+#include "vertexbuffer.h"
+
+// Simplifies a triangle mesh by collapsing the edges whose removal changes
+// the surface least, measured by the quadric error of Garland and
+// Heckbert.  Edges on open borders are kept in place, collapses that
+// would turn a triangle over are skipped.
+class Decimator
+{
+ public:
+  // positions are x,y,z of three vertices per triangle, as in a vertex
+  // buffer; equal positions are taken for the same vertex
+  Decimator(const std::vector<GLfloat> &positions,
+	    const volatile bool *cancel = NULL);
+
+  // collapses edges until at most target triangles are left or no edge
+  // can go.  Returns false if *cancel became true.
+  bool reduce(size_t target);
+
+  size_t size() const { return live_faces; };
+  void getVertices(std::vector<NormalVertex> &vertices) const;
+
+ private:
+  struct Quadric
+  {
+    double q[10]; // upper half of the symmetric 4x4 matrix
+    Quadric();
+    Quadric(const Vector3d &n, double d, double weight);
+    Quadric &operator+=(const Quadric &rhs);
+    double error(const Vector3d &v) const;
+  };
+  struct Collapse
+  {
+    double cost;
+    uint v1, v2;
+    uint version1, version2; // of v1 and v2 when the cost was taken
+    bool operator<(const Collapse &rhs) const { return cost > rhs.cost; };
+  };
+
+  std::vector<Vector3d> vertex;
+  std::vector<Quadric> quadric;
+  std::vector<uint> version; // changes when a vertex moves or goes
+  std::vector<bool> vertex_dead;
+  std::vector< std::vector<uint> > vertex_faces;
+  std::vector<uint> face; // three vertices each
+  std::vector<bool> face_dead;
+  size_t live_faces;
+  std::priority_queue<Collapse> heap;
+  const volatile bool *cancel;
+
+  double collapseTarget(uint v1, uint v2, Vector3d &target) const;
+  void pushEdge(uint v1, uint v2);
+  bool turnsOver(uint v, uint other, const Vector3d &target) const;
+  void collapse(uint keep, uint remove, const Vector3d &target);
+};
+
+// Coarser versions of a mesh, made in a thread of their own.  The levels
+// have a quarter of the triangles of the one before, down to
+// min_triangles.  A copy starts out empty.
+class MeshLOD
+{
+ public:
+  static const size_t min_triangles = 2000;
+
+  MeshLOD();
+  MeshLOD(const MeshLOD &);
+  ~MeshLOD();
+  MeshLOD &operator=(const MeshLOD &);
+
+  // starts making the levels of positions, three vertices per triangle,
+  // which it takes over (positions is left empty)
+  void start(std::vector<GLfloat> &positions);
+  // drops the levels not made yet, keeps the others.  Doesn't wait for
+  // the thread, which finishes on its own.  No GL context needed.
+  void stop();
+  // stops and deletes the levels, needs the GL context
+  void clear();
+
+  // the coarsest level with at least min triangles, NULL if there is
+  // none (yet)
+  const VertexBuffer *get(size_t min);
+  // the finest level with at most max triangles, NULL if none
+  const VertexBuffer *getAtMost(size_t max);
+
+ private:
+  // shared with the thread, deleted by the last one to let go of it
+  struct Job
+  {
+    Glib::Mutex mutex; // for all but input and cancel
+    uint refs;
+    std::vector<GLfloat> input;
+    volatile bool cancel;
+    std::vector< std::vector<NormalVertex> > ready;
+    std::vector<size_t> ready_triangles;
+  };
+  Job *job;
+
+  // finest first, uploaded as they become ready
+  std::vector<VertexBuffer *> levels;
+  std::vector<size_t> level_triangles;
+
+  static void run(Job *job);
+  static void release(Job *job);
+  void upload();
+};
+
+#endif // LOD_H
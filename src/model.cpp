@@ -34,6 +34,8 @@
 #include "shape.h"
 #include "flatshape.h"
 #include "render.h"
+#include "renderstats.h"
+#include "layerpreview.h"
 
 Model::Model() :
   m_previewLayer(NULL),
@@ -50,13 +52,14 @@ Model::Model() :
   // Variable defaults
   Center.set(100.,100.,0.);
   preview_shapes.clear();
+  m_signal_gcode_changed.connect
+    (sigc::mem_fun(gcode, &GCode::invalidateToolpath));
 }
 
 Model::~Model()
 {
   ClearLayers();
   ClearGCode();
-  delete m_previewLayer;
   preview_shapes.clear();
 }
 
@@ -105,13 +108,13 @@ void Model::ClearLayers()
     delete *i;
   }
   layers.clear();
-  Infill::clearPatterns();
   ClearPreview();
+  Infill::clearPatterns();
 }
 
 void Model::ClearPreview()
 {
-  if (m_previewLayer) delete m_previewLayer;
+  m_preview.clear();
   m_previewLayer = NULL;
   m_previewGCode.clear();
   m_previewGCode_z = -100000;
@@ -129,17 +132,7 @@ void Model::GlDrawGCode(int layerno)
   }
   // assume that the real printing line is the one at the start of the buffer
   if (currentprintingline > 0) {
-    int currentlayer = gcode.getLayerNo(currentprintingline);
-    if (currentlayer>=0) {
-      int start = gcode.getLayerStart(currentlayer);
-      int end   = gcode.getLayerEnd(currentlayer);
-      //gcode.draw (settings, currentlayer, true, 1);
-      bool displaygcodeborders = settings.get_boolean("Display","DisplayGCodeBorders");
-      gcode.drawCommands(settings, start, currentprintingline, true, 4, false,
-			 displaygcodeborders);
-      gcode.drawCommands(settings, currentprintingline,  end,  true, 1, false,
-			 displaygcodeborders);
-    }
+    gcode.drawPrinting(settings, currentprintingline);
     // gcode.drawCommands(settings, currentprintingline-currentbufferedlines,
     // 		       currentprintingline, false, 3, true,
     // 		       settings.Display.DisplayGCodeBorders);
@@ -344,6 +337,7 @@ void Model::ModelChanged()
   //printer.update_temp_poll_interval(); // necessary?
   if (!is_printing) {
     CalcBoundingBoxAndCenter();
+    m_preview.clear();
     Infill::clearPatterns();
     if ( layers.size()>0 || m_previewGCode.size()>0 || m_previewLayer ) {
       ClearGCode();
@@ -778,22 +772,93 @@ Vector3d Model::GetViewCenter()
   return printOffset + Center;
 }
 
-// called from View::Draw
-int Model::draw (vector<Gtk::TreeModel::Path> &iter)
-{
-  vector<Shape*> sel_shapes;
-  vector<Matrix4d> transforms;
-  objtree.get_selected_shapes(iter, sel_shapes, transforms);
+// The selection highlight draws the geometry three times.  If a frame with
+// it took longer than this, the shapes get the plain highlight colour only.
+static const double max_highlight_frame_time = 0.2; // seconds
 
-  gint index = 1; // pick/select index. matches computation in update_model()
+void Model::setFrameTime(double seconds)
+{
+  if (seconds > max_highlight_frame_time)
+    for (uint i = 0; i < highlighted_shapes.size(); i++)
+      highlighted_shapes[i]->slow_drawing = true;
+  highlighted_shapes.clear();
+}
 
+// where the shapes are drawn, the print margin and the tree's translation
+Vector3d Model::drawOffset() const
+{
   Vector3d printOffset = settings.getPrintMargin();
   if(settings.get_boolean("Raft","Enable")) {
     const double rsize = settings.get_double("Raft","Size");
     printOffset += Vector3d(rsize, rsize, 0);
   }
   Vector3d translation = objtree.transform3D.getTranslation();
-  Vector3d offset = printOffset + translation;
+  return printOffset + translation;
+}
+
+// The point where the ray from + t*dir first hits a shape, in the
+// coordinates the shapes are drawn in.
+bool Model::rayHit(const Vector3d &from, const Vector3d &dir, Vector3d &hit)
+{
+  const Vector3d offfrom = from - drawOffset();
+  double best = -1;
+  for (uint i = 0; i < objtree.Objects.size(); i++) {
+    TreeObject *object = objtree.Objects[i];
+    const Matrix4d T = objtree.transform3D.transform * object->transform3D.transform;
+    for (uint j = 0; j < object->shapes.size(); j++) {
+      double t;
+      if (object->shapes[j]->intersect(T, offfrom, dir, t) &&
+	  (best < 0 || t < best))
+	best = t;
+    }
+  }
+  if (best < 0) return false;
+  hit = from + dir * best;
+  return true;
+}
+
+// Draws every shape in a flat colour that is its pick index for
+// ObjectsTree::find_stl_by_index(), black being none.  Called from
+// Render::find_object_at with lighting, blending and dithering off.
+void Model::drawPickIds()
+{
+  if (settings.get_boolean("Display","PreviewLoad") && preview_shapes.size() > 0)
+    return;
+
+  guint index = 1; // pick index, matches computation in update_model()
+
+  glPushMatrix();
+  Vector3d offset = drawOffset();
+  glTranslated(offset.x(),offset.y(),offset.z());
+  glMultMatrixd (&objtree.transform3D.transform.array[0]);
+  for (uint i = 0; i < objtree.Objects.size(); i++) {
+    TreeObject *object = objtree.Objects[i];
+    index++;
+
+    glPushMatrix();
+    glMultMatrixd (&object->transform3D.transform.array[0]);
+    for (uint j = 0; j < object->shapes.size(); j++) {
+      Shape *shape = object->shapes[j];
+      glColor3ub(index & 0xff, (index >> 8) & 0xff, (index >> 16) & 0xff);
+      index++;
+      glPushMatrix();
+      glMultMatrixd (&shape->transform3D.transform.array[0]);
+      shape->draw_geometry();
+      glPopMatrix();
+    }
+    glPopMatrix();
+  }
+  glPopMatrix();
+}
+
+// called from View::Draw
+int Model::draw (vector<Gtk::TreeModel::Path> &iter)
+{
+  vector<Shape*> sel_shapes;
+  vector<Matrix4d> transforms;
+  objtree.get_selected_shapes(iter, sel_shapes, transforms);
+
+  Vector3d offset = drawOffset();
 
   // Add the print offset to the drawing location of the STL objects.
   glTranslated(offset.x(),offset.y(),offset.z());
@@ -825,14 +890,11 @@ int Model::draw (vector<Gtk::TreeModel::Path> &iter)
   bool displaybbox = settings.get_boolean("Display","DisplayBBox");
   for (uint i = 0; i < objtree.Objects.size(); i++) {
     TreeObject *object = objtree.Objects[i];
-    index++;
 
     glPushMatrix();
     glMultMatrixd (&object->transform3D.transform.array[0]);
     for (uint j = 0; j < object->shapes.size(); j++) {
       Shape *shape = object->shapes[j];
-      glLoadName(index); // Load select/pick index
-      index++;
       glPushMatrix();
       glMultMatrixd (&shape->transform3D.transform.array[0]);
 
@@ -844,6 +906,7 @@ int Model::draw (vector<Gtk::TreeModel::Path> &iter)
       // this is slow for big shapes
       if (is_selected) {
 	if (!shape->slow_drawing && shape->dimensions()>2) {
+	  highlighted_shapes.push_back(shape);
 	  // Enable stencil buffer when we draw the selected object.
 	  glEnable(GL_STENCIL_TEST);
 	  glStencilFunc(GL_ALWAYS, 1, 1);
@@ -905,7 +968,6 @@ int Model::draw (vector<Gtk::TreeModel::Path> &iter)
     glPopMatrix();
   }
   glPopMatrix();
-  glLoadName(0); // Clear selection name to avoid selecting last object with later rendering.
 
   // draw total bounding box
   if(displaybbox)
@@ -955,6 +1017,7 @@ int Model::draw (vector<Gtk::TreeModel::Path> &iter)
     }
   int drawnlayer = -1;
   if(settings.get_boolean("Display","DisplayLayer")) {
+    RenderStats::Pass pass("Layers");
     drawnlayer = drawLayers(settings.get_double("Display","LayerValue"),
 			    offset, false);
   }
@@ -962,6 +1025,7 @@ int Model::draw (vector<Gtk::TreeModel::Path> &iter)
     // preview gcode if not calculated yet
     if ( m_previewGCode.size() != 0 ||
 	 ( layers.size() == 0 && gcode.commands.size() == 0 ) ) {
+      RenderStats::Pass pass("GCode");
       Vector3d start(0,0,0);
       const double thickness = settings.get_double("Slicing","LayerThickness");
       const double gcodedrawstart = settings.get_double("Display","GCodeDrawStart");
@@ -970,12 +1034,13 @@ int Model::draw (vector<Gtk::TreeModel::Path> &iter)
       const uint LayerNo = (uint)ceil(gcodedrawstart*(LayerCount-1));
       if (z != m_previewGCode_z) {
 	//uint prevext = settings.selectedExtruder;
-	Layer * previewGCodeLayer = calcSingleLayer(z, LayerNo, thickness, true, true);
+	Layer * previewGCodeLayer = calcSingleLayer(z, LayerNo, thickness, true);
 	if (previewGCodeLayer) {
 	  m_previewGCode.clear();
 	  vector<Command> commands;
 	  GCodeState state(m_previewGCode);
 	  previewGCodeLayer->MakeGCode(start, state, 0, settings);
+	  delete previewGCodeLayer;
 	  // state.AppendCommands(commands, settings.Slicing.RelativeEcode);
 	  m_previewGCode_z = z;
 	}
@@ -1028,7 +1093,10 @@ int Model::drawLayers(double height, const Vector3d &offset, bool calconly)
   else
     {
       LayerNr = sel_Layer;
-      z= minZ + sel_Z;
+      if (have_layers)
+	z= minZ + sel_Z;
+      else // on the layers, for the preview to find them again
+	z= minZ + sel_Layer*zStep;
     }
   if (have_layers) {
     LayerNr = CLAMP(LayerNr, 0, (int)layers.size() - 1);
@@ -1056,19 +1124,24 @@ int Model::drawLayers(double height, const Vector3d &offset, bool calconly)
 	}
       else
 	{
-	  if (!m_previewLayer || m_previewLayer->getZ() != z) {
-	    m_previewLayer = calcSingleLayer(z, LayerNr, lthickness,
-					     displayinfill, false);
-	    layer = m_previewLayer;
-	    Layer * previous = NULL;
-	    if (LayerNr>0 && z >= lthickness)
-	      previous = calcSingleLayer(z-lthickness, LayerNr-1, lthickness,
-					 false, false);
-	    layer->setPrevious(previous);
+	  // sliced in the background, shows the last one until it's done
+	  if (is_calculating) // infill calculation (saved patterns) would be disturbed
+	    m_previewLayer = NULL;
+	  else {
+	    if (!m_preview.has_shapes()) {
+	      vector<Shape*> shapes;
+	      vector<Matrix4d> transforms;
+	      if (settings.get_boolean("Slicing","SelectedOnly"))
+		objtree.get_selected_shapes(m_current_selectionpath, shapes, transforms);
+	      else
+		objtree.get_all_shapes(shapes, transforms);
+	      m_preview.set_shapes(shapes, transforms, settings);
+	    }
+	    m_previewLayer = m_preview.get(z, LayerNr, lthickness, displayinfill);
 	  }
 	  layer = m_previewLayer;
 	}
-      if (!calconly) {
+      if (!calconly && layer) {
 	layer->Draw(settings);
 
 	if (drawrulers)
@@ -1090,13 +1163,9 @@ int Model::drawLayers(double height, const Vector3d &offset, bool calconly)
 
 
 Layer * Model::calcSingleLayer(double z, uint LayerNr, double thickness,
-			       bool calcinfill, bool for_gcode) const
+			       bool calcinfill) const
 {
   if (is_calculating) return NULL; // infill calculation (saved patterns) would be disturbed
-  if (!for_gcode) {
-    if (m_previewLayer && m_previewLayer->getZ() == z
-	&& m_previewLayer->thickness == thickness) return m_previewLayer;
-  }
   vector<Shape*> shapes;
   vector<Matrix4d> transforms;
 
@@ -1105,56 +1174,8 @@ Layer * Model::calcSingleLayer(double z, uint LayerNr, double thickness,
   else
     objtree.get_all_shapes(shapes, transforms);
 
-  double max_grad = 0;
-  double supportangle = settings.get_double("Slicing","SupportAngle")*M_PI/180.;
-  if (!settings.get_boolean("Slicing","Support")) supportangle = -1;
-
-  Layer * layer = new Layer(NULL, LayerNr, thickness,
-			    settings.get_integer("Slicing","Skins"));
-  layer->setZ(z);
-  for(size_t f = 0; f < shapes.size(); f++) {
-    layer->addShape(transforms[f], *shapes[f], z, max_grad, supportangle);
-  }
-
-  // vector<Poly> polys = layer->GetPolygons();
-  // for (guint i=0; i<polys.size();i++){
-  //   vector<Triangle> tri;
-  //   polys[i].getTriangulation(tri);
-  //   for (guint j=0; j<tri.size();j++){
-  //     tri[j].draw(GL_LINE_LOOP);
-  //   }
-  // }
-
-  layer->MakeShells(settings);
-
-  if (settings.get_boolean("Slicing","Skirt")) {
-    if (layer->getZ() - layer->thickness <= settings.get_double("Slicing","SkirtHeight"))
-      layer->MakeSkirt(settings.get_double("Slicing","SkirtDistance"),
-		       settings.get_boolean("Slicing","SingleSkirt") &&
-		       !settings.get_boolean("Slicing","Support"));
-  }
-
-  if (calcinfill)
-    layer->CalcInfill(settings);
-
-#define DEBUGPOLYS 0
-#if DEBUGPOLYS
-  // write out polygons for gnuplot
-  vector<Poly> polys = layer->GetPolygons();
-  vector< vector<Poly> > offs = layer->GetShellPolygons();
-  cout << "# polygons "<< endl;
-  for (guint i=0; i<polys.size();i++){
-    cout << polys[i].gnuplot_path() << endl;
-  }
-  for (guint s=0; s<offs.size();s++){
-    cout << "# offset polygons " << s << endl;
-    for (guint i=0; i<offs[s].size();i++){
-      cout << offs[s][i].gnuplot_path() << endl;
-    }
-  }
-#endif
-
-  return layer;
+  return LayerPreview::slice(shapes, transforms, settings,
+			     z, LayerNr, thickness, calcinfill);
 }
 
 
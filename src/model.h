@@ -32,6 +32,7 @@
 #include "gcode/gcode.h"
 /* #include "gcodestate.h" */
 #include "settings.h"
+#include "layerpreview.h"
 /* #include "progress.h" */
 /* #include "slicer/poly.h" */
 
@@ -95,8 +96,10 @@ public:
 
 	vector<Layer*> layers;
 
-	Layer * m_previewLayer;
+	LayerPreview m_preview;
+	Layer * m_previewLayer; // shown from m_preview
 	double get_preview_Z();
+	sigc::signal< void > signal_preview_ready() { return m_preview.signal_ready; }
 	//Layer * m_previewGCodeLayer;
 	GCode m_previewGCode;
 	double m_previewGCode_z;
@@ -151,12 +154,16 @@ public:
 	Glib::RefPtr<Gtk::TextBuffer> errlog, echolog;
 
 	int draw(vector<Gtk::TreeModel::Path> &selected);
+	void drawPickIds();
+	bool rayHit(const Vector3d &from, const Vector3d &dir, Vector3d &hit);
+	// Render tells how long the frame took to draw, in seconds
+	void setFrameTime(double seconds);
 	int drawLayers(double height, const Vector3d &offset, bool calconly = false);
 	void setMeasuresPoint(const Vector3d &point);
 	Vector2d measuresPoint;
 
 	Layer * calcSingleLayer(double z, uint LayerNr, double thickness,
-				bool calcinfill, bool for_gcode=false) const ;
+				bool calcinfill) const ;
 
 	sigc::signal< void, Gtk::MessageType, const char *, const char * > signal_alert;
 	void alert (const char *message);
@@ -177,6 +184,10 @@ public:
 	//GCodeIter *m_iter;
 	Layer * lastlayer;
 
+	// shapes drawn with the selection highlight in the current frame
+	vector<Shape*> highlighted_shapes;
+	Vector3d drawOffset() const;
+
         // Slicing/GCode conversion functions
 	void Slice();
 
@@ -275,7 +275,7 @@ void Model::CleanupLayers()
 
 
 bool layersort(const Layer * l1, const Layer * l2){
-  return (l1->Z < l2->Z);
+  return (l1->getZ() < l2->getZ());
 }
 
 void Model::Slice()
@@ -456,7 +456,7 @@ void Model::Slice()
 
   for (uint nlayer = 1; nlayer < layers.size(); nlayer++) {
     layers[nlayer]->setPrevious(layers[nlayer-1]);
-    assert(layers[nlayer]->Z > layers[nlayer-1]->Z);
+    assert(layers[nlayer]->getZ() > layers[nlayer-1]->getZ());
   }
   if (layers.size()>0)
 	lastlayer = layers.back();
@@ -634,12 +634,12 @@ void Model::MakeSupportPolygons(Layer * layer, // lower -> will change
 				double widen)
 {
   const double distance =
-    settings.GetExtrudedMaterialWidth(layer->thickness);
+    settings.GetExtrudedMaterialWidth(layer->getThickness());
   // vector<Poly> tosupport = Clipping::getOffset(layerabove->GetToSupportPolygons(),
   //  					       distance/2.);
   //vector<Poly> tosupport = Clipping::getMerged(layerabove->GetToSupportPolygons(),
   // 					       distance);
-  vector<Poly> tosupport = layerabove->GetToSupportPolygons();
+  const vector<Poly> &tosupport = layerabove->GetToSupportPolygons();
 
   Clipping clipp;
   clipp.addPolys(layerabove->GetSupportPolygons(),  subject);
@@ -650,11 +650,11 @@ void Model::MakeSupportPolygons(Layer * layer, // lower -> will change
   vector<Poly> spolys = clipp.subtract(CL::pftNonZero,CL::pftEvenOdd);
 
   if (widen != 0) // widen from layer to layer
-    spolys = clipp.getOffset(spolys, widen * layer->thickness);
+    spolys = clipp.getOffset(spolys, widen * layer->getThickness());
 
   spolys = clipp.getMerged(spolys,distance);
 
-  layer->setSupportPolygons(spolys);
+  layer->takeSupportPolygons(spolys);
 }
 
 void Model::MakeSupportPolygons(double widen)
@@ -705,8 +705,7 @@ void Model::MakeSkirt()
       if (layers[i]->getZ() > skirtheight)
 	break;
       layers[i]->MakeSkirt(skirtdistance, singleskirt && !support);
-      vector<Poly> sp = layers[i]->GetSkirtPolygons();
-      clipp.addPolys(sp,subject);
+      clipp.addPolys(layers[i]->GetSkirtPolygons(),subject);
       endindex = i;
     }
   vector<Poly> skirts = clipp.unite(CL::pftPositive,CL::pftPositive);
@@ -807,6 +806,7 @@ void Model::ConvertToGCode()
 
   GCodeState state(gcode);
 
+  ClearPreview();
   Infill::clearPatterns();
 
   Vector3d printOffset  = settings.getPrintMargin();
@@ -0,0 +1,611 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+#include <iostream>
+#include <sstream>
+
+#include "fake_printer.h"
+#include "line_encoder.h"
+
+static void ntime_add_ns( ntime_t *t, unsigned long ns ) {
+  t->tv_sec += ns / ( 1000 * 1000 * 1000 );
+  t->tv_nsec += ns % ( 1000 * 1000 * 1000 );
+  if ( t->tv_nsec >= 1000 * 1000 * 1000 ) {
+    t->tv_sec++;
+    t->tv_nsec -= 1000 * 1000 * 1000;
+  }
+}
+
+static void ntime_add_us( ntime_t *t, unsigned long us ) {
+  t->tv_sec += us / ( 1000 * 1000 );
+  t->tv_nsec += ( us % ( 1000 * 1000 ) ) * 1000;
+  if ( t->tv_nsec >= 1000 * 1000 * 1000 ) {
+    t->tv_sec++;
+    t->tv_nsec -= 1000 * 1000 * 1000;
+  }
+}
+
+FakePrinter::Options::Options() :
+  rx_buffer_size( 128 ),
+  queue_size( 4 ),
+  exec_us( 0 ),
+  reply_latency_us( 0 ),
+  error_rate( 0.0 ),
+  temp_report_ms( 0 ),
+  boot_ms( 100 ),
+  baud( 0 ),
+  seed( 1 ) {
+}
+
+const char *const FakePrinter::Options::getopt_string = "r:q:x:l:e:t:b:s:";
+const char *const FakePrinter::Options::help =
+  "  -r bytes    RX buffer size (128)\n"
+  "  -q lines    command queue size (4)\n"
+  "  -x us       execution time per command (0)\n"
+  "  -l us       reply latency (0)\n"
+  "  -e rate     checksum error rate, 0..1 (0)\n"
+  "  -t ms       temperature report interval, 0 for none (0)\n"
+  "  -b baud     simulated serial speed, 0 for unlimited (0)\n"
+  "  -s seed     random seed for errors (1)\n";
+
+bool FakePrinter::Options::Parse( int opt, const char *arg ) {
+  switch ( opt ) {
+  case 'r': rx_buffer_size = strtoul( arg, NULL, 10 ); break;
+  case 'q': queue_size = strtoul( arg, NULL, 10 ); break;
+  case 'x': exec_us = strtoul( arg, NULL, 10 ); break;
+  case 'l': reply_latency_us = strtoul( arg, NULL, 10 ); break;
+  case 'e': error_rate = strtod( arg, NULL ); break;
+  case 't': temp_report_ms = strtoul( arg, NULL, 10 ); break;
+  case 'b': baud = strtoul( arg, NULL, 10 ); break;
+  case 's': seed = strtoul( arg, NULL, 10 ); break;
+  default: return false;
+  }
+  return true;
+}
+
+FakePrinter::FakePrinter( const Options &options ) :
+  options( options ) {
+  master_fd = -1;
+  running = false;
+  mutex_init( &mutex );
+  memset( &stats, 0, sizeof( stats ) );
+
+  connected = false;
+  booting = false;
+  last_line = 0;
+  last_binary = false;
+  resync_zeros = 0;
+  temp = bed = 20.0;
+  temp_target = bed_target = 0.0;
+  memset( pos, 0, sizeof( pos ) );
+  random_state = options.seed;
+}
+
+FakePrinter::~FakePrinter() {
+  Stop();
+  mutex_destroy( &mutex );
+}
+
+bool FakePrinter::Start( void ) {
+  if ( master_fd >= 0 )
+    return true;
+
+  if ( ( master_fd = posix_openpt( O_RDWR | O_NOCTTY ) ) < 0 ) {
+    cerr << "Error creating pseudo terminal: " << strerror( errno ) << endl;
+    return false;
+  }
+
+  if ( grantpt( master_fd ) != 0 || unlockpt( master_fd ) != 0 || ptsname( master_fd ) == NULL ) {
+    cerr << "Error setting up pseudo terminal: " << strerror( errno ) << endl;
+    close( master_fd );
+    master_fd = -1;
+    return false;
+  }
+  device = ptsname( master_fd );
+
+  // Put the slave side into raw mode already, so nothing is echoed before
+  // the host has set up the port
+  int slave_fd = open( device.c_str(), O_RDWR | O_NOCTTY );
+  if ( slave_fd >= 0 ) {
+    struct termios attribs;
+    if ( tcgetattr( slave_fd, &attribs ) == 0 ) {
+      cfmakeraw( &attribs );
+      tcsetattr( slave_fd, TCSANOW, &attribs );
+    }
+    close( slave_fd );
+  }
+
+  fcntl( master_fd, F_SETFL, fcntl( master_fd, F_GETFL ) | O_NONBLOCK );
+
+  running = true;
+  int rc;
+  if ( ( rc = thread_create( &thread, ThreadMainStatic, this ) ) != 0 ) {
+    cerr << "Error creating firmware thread: " << strerror( rc ) << endl;
+    running = false;
+    close( master_fd );
+    master_fd = -1;
+    return false;
+  }
+
+  return true;
+}
+
+void FakePrinter::Stop( void ) {
+  if ( master_fd < 0 )
+    return;
+
+  mutex_lock( &mutex );
+  running = false;
+  mutex_unlock( &mutex );
+
+  thread_join( thread );
+
+  close( master_fd );
+  master_fd = -1;
+}
+
+string FakePrinter::GetDevice( void ) {
+  return device;
+}
+
+FakePrinter::Stats FakePrinter::GetStats( void ) {
+  mutex_lock( &mutex );
+  Stats s = stats;
+  mutex_unlock( &mutex );
+  return s;
+}
+
+////////////////////////////////////////////////////////////////////////////
+//  Firmware Thread
+////////////////////////////////////////////////////////////////////////////
+
+void *FakePrinter::ThreadMainStatic( void *arg ) {
+  FakePrinter *printer = ( FakePrinter * ) arg;
+
+  return printer->ThreadMain();
+}
+
+void *FakePrinter::ThreadMain( void ) {
+  char buf[ 4096 ];
+  ntime_t now;
+  const ntime_t closed_sleep = { 0, 10 * 1000 * 1000 };
+
+  while ( true ) {
+    mutex_lock( &mutex );
+    bool run = running;
+    mutex_unlock( &mutex );
+    if ( ! run )
+      break;
+
+    // Wait for data or the next event, but check running now and then
+    ntime_get( &now );
+    long timeout = NextTimeout( now );
+    if ( timeout < 0 || timeout > 20 * 1000 )
+      timeout = 20 * 1000;
+
+    struct timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = timeout;
+    fd_set set;
+    FD_ZERO( &set );
+    FD_SET( master_fd, &set );
+    select( master_fd + 1, &set, NULL, NULL, &tv );
+
+    ntime_get( &now );
+
+    // Reading fails with EIO while nobody has the device open (Start()
+    // opened it once, before that it would just block)
+    ssize_t num = 0;
+    if ( FD_ISSET( master_fd, &set ) ) {
+      num = read( master_fd, buf, sizeof( buf ) );
+      if ( num < 0 && errno == EIO ) {
+	connected = false;
+	nsleep( &closed_sleep );
+	continue;
+      }
+    }
+
+    if ( ! connected )
+      PowerOn( now );
+    if ( num > 0 && ! booting )
+      Receive( buf, num, now );
+    Transfer( now );
+
+    if ( booting && ntime_diff_us( &boot_time, &now ) >= 0 ) {
+      booting = false;
+      SendReply( now, "start\n" );
+    }
+    if ( booting )
+      continue;
+
+    // Execute commands that are done, that makes room for more in the queue
+    ReadCommands( now );
+    while ( ! queue.empty() && ntime_diff_us( &exec_done, &now ) >= 0 ) {
+      Command cmd = queue.front();
+      queue.pop_front();
+      Execute( cmd.text, exec_done );
+      mutex_lock( &mutex );
+      stats.lines_executed++;
+      mutex_unlock( &mutex );
+
+      ntime_t done = exec_done;
+      ntime_add_us( &exec_done, options.exec_us );
+      ReadCommands( done );
+    }
+
+    // Like Repetier firmware, give up on a line that was not continued,
+    // the rest of a binary line cut by a flush would block it forever
+    if ( ! rx.empty() && queue.size() < options.queue_size &&
+	 ntime_diff_us( &rx_time, &now ) >= 200 * 1000 )
+      LineError( now, "Line not continued" );
+
+    if ( options.temp_report_ms > 0 && ntime_diff_us( &next_temp_report, &now ) >= 0 ) {
+      SendTemperatures( now, false );
+      ntime_add_us( &next_temp_report, options.temp_report_ms * 1000 );
+    }
+
+    // Send replies that are due
+    while ( ! replies.empty() && ntime_diff_us( &replies.front().time, &now ) >= 0 ) {
+      const string &text = replies.front().text;
+      size_t done = 0;
+      while ( done < text.length() ) {
+	ssize_t num = write( master_fd, text.c_str() + done, text.length() - done );
+	if ( num < 0 ) {
+	  if ( errno != EAGAIN )
+	    break;
+	  nsleep( &closed_sleep );
+	  continue;
+	}
+	done += num;
+      }
+      replies.pop_front();
+    }
+  }
+
+  return NULL;
+}
+
+// The host opened the device, which resets an Arduino based printer
+void FakePrinter::PowerOn( const ntime_t &now ) {
+  connected = true;
+  booting = true;
+  boot_time = now;
+  ntime_add_us( &boot_time, options.boot_ms * 1000 );
+  next_temp_report = boot_time;
+  ntime_add_us( &next_temp_report, options.temp_report_ms * 1000 );
+
+  wire.clear();
+  rx.clear();
+  queue.clear();
+  replies.clear();
+  last_line = 0;
+  last_binary = false;
+  resync_zeros = 0;
+  memset( pos, 0, sizeof( pos ) );
+}
+
+void FakePrinter::Receive( const char *data, size_t len, const ntime_t &now ) {
+  mutex_lock( &mutex );
+  stats.bytes_received += len;
+  mutex_unlock( &mutex );
+
+  if ( options.baud == 0 ) {
+    ReceiveRx( data, len, now );
+    return;
+  }
+
+  // The first byte arrives after one byte time, the others follow
+  if ( wire.empty() ) {
+    wire_time = now;
+    ntime_add_ns( &wire_time, WireByteNs() );
+  }
+  wire.append( data, len );
+}
+
+// Nanoseconds for one byte on the serial line, 8N1 has 10 bits per byte
+unsigned long FakePrinter::WireByteNs( void ) {
+  return 10UL * 1000 * 1000 * 1000 / options.baud;
+}
+
+// Move the bytes that arrived by now from the serial line to the RX buffer
+void FakePrinter::Transfer( const ntime_t &now ) {
+  if ( wire.empty() || ntime_diff_us( &wire_time, &now ) < 0 )
+    return;
+
+  unsigned long byte_ns = WireByteNs();
+  size_t num = 1 + ntime_diff_us( &wire_time, &now ) * 1000 / byte_ns;
+  if ( num > wire.length() )
+    num = wire.length();
+
+  ReceiveRx( wire.data(), num, now );
+  wire.erase( 0, num );
+  ntime_add_ns( &wire_time, num * byte_ns );
+}
+
+void FakePrinter::ReceiveRx( const char *data, size_t len, const ntime_t &now ) {
+  // Like Repetier firmware, after an error in a binary line skip all bytes
+  // as they arrive, up to resync_zeros zero bytes in a row
+  while ( len > 0 && resync_zeros > 0 ) {
+    resync_zeros = *data == '\0' ? resync_zeros - 1 : BinaryLineEncoder::resync_zeros;
+    data++;
+    len--;
+  }
+
+  size_t room = options.rx_buffer_size > rx.length() ? options.rx_buffer_size - rx.length() : 0;
+
+  if ( len > room ) {
+    mutex_lock( &mutex );
+    stats.rx_overflow_bytes += len - room;
+    mutex_unlock( &mutex );
+    len = room;
+  }
+  rx.append( data, len );
+  rx_time = now;
+}
+
+// Move complete lines from the RX buffer into the command queue
+void FakePrinter::ReadCommands( const ntime_t &now ) {
+  while ( queue.size() < options.queue_size ) {
+    Command cmd;
+    cmd.valid = true;
+
+    // Zero bytes between lines are ignored, see BinaryLineEncoder
+    size_t zeros = rx.find_first_not_of( '\0' );
+    rx.erase( 0, zeros == string::npos ? rx.length() : zeros );
+
+    // Binary lines (see BinaryLineEncoder) start with the top bit set
+    if ( ! rx.empty() && ( rx[ 0 ] & 0x80 ) ) {
+      size_t size = BinaryLineEncoder::LineSize( rx.data(), rx.length() );
+      if ( size > options.rx_buffer_size ) {
+	last_binary = true;
+	LineError( now, "Wrong binary line size" );
+	continue;
+      }
+      if ( size == 0 || size > rx.length() )
+	break;
+
+      string line = rx.substr( 0, size );
+      rx.erase( 0, size );
+      last_binary = true;
+
+      mutex_lock( &mutex );
+      stats.lines_received++;
+      mutex_unlock( &mutex );
+
+      unsigned long line_number;
+      if ( InjectError() || ! BinaryLineEncoder::Decode( line.data(), size, line_number, cmd.text ) ) {
+	LineError( now, "checksum mismatch" );
+	continue;
+      }
+      // Only the low 16 bits are sent
+      if ( line_number != ( ( unsigned long ) last_line + 1 ) % 0x10000 ) {
+	LineError( now, "Line Number is not Last Line Number+1" );
+	continue;
+      }
+
+      last_line++;
+      Enqueue( cmd, now );
+      continue;
+    }
+
+    size_t end = rx.find_first_of( "\r\n" );
+    if ( end == string::npos ) {
+      // No room left for the end of the line
+      if ( rx.length() >= options.rx_buffer_size )
+	LineError( now, "Line too long" );
+      break;
+    }
+
+    string line = rx.substr( 0, end );
+    rx.erase( 0, end + 1 );
+    last_binary = false;
+
+    size_t start = line.find_first_not_of( " \t" );
+    if ( start == string::npos )
+      continue;
+    line.erase( 0, start );
+
+    mutex_lock( &mutex );
+    stats.lines_received++;
+    mutex_unlock( &mutex );
+
+    if ( toupper( line[ 0 ] ) == 'N' ) {
+      char *num_end;
+      long line_number = strtol( line.c_str() + 1, &num_end, 10 );
+      size_t star = line.find( '*' );
+
+      if ( line_number != last_line + 1 && line.find( "M110" ) == string::npos ) {
+	LineError( now, "Line Number is not Last Line Number+1" );
+	continue;
+      }
+      if ( star == string::npos ) {
+	LineError( now, "No Checksum with line number" );
+	continue;
+      }
+
+      unsigned char cksum = 0;
+      for ( size_t i = 0; i < star; i++ )
+	cksum ^= line[ i ];
+
+      if ( InjectError() || cksum != atoi( line.c_str() + star + 1 ) ) {
+	LineError( now, "checksum mismatch" );
+	continue;
+      }
+
+      last_line = line_number;
+      size_t cmd_start = num_end - line.c_str();
+      cmd.text = line.substr( cmd_start, star - cmd_start );
+    } else if ( line.find( '*' ) < line.find( ';' ) ) {
+      // Like the rest of a line cut by a flush
+      LineError( now, "No Line Number with checksum" );
+      continue;
+    } else {
+      cmd.text = line.substr( 0, line.find( ';' ) );
+    }
+
+    size_t pos = cmd.text.find_first_not_of( " \t" );
+    cmd.text.erase( 0, pos == string::npos ? cmd.text.length() : pos );
+
+    Enqueue( cmd, now );
+  }
+}
+
+void FakePrinter::Enqueue( const Command &cmd, const ntime_t &now ) {
+  if ( queue.empty() ) {
+    exec_done = now;
+    ntime_add_us( &exec_done, options.exec_us );
+  }
+  queue.push_back( cmd );
+}
+
+// Fail a line with a checksum error, with probability error_rate
+bool FakePrinter::InjectError( void ) {
+  bool inject = options.error_rate > 0.0 &&
+    rand_r( &random_state ) < options.error_rate * ( ( double ) RAND_MAX + 1.0 );
+
+  if ( inject ) {
+    mutex_lock( &mutex );
+    stats.errors_injected++;
+    mutex_unlock( &mutex );
+  }
+
+  return inject;
+}
+
+// Like Marlin, flush the RX buffer and ask for the next expected line
+void FakePrinter::LineError( const ntime_t &now, const char *error ) {
+  mutex_lock( &mutex );
+  stats.line_errors++;
+  stats.rx_flushed_bytes += rx.length();
+  mutex_unlock( &mutex );
+
+  rx.clear();
+  if ( last_binary )
+    resync_zeros = BinaryLineEncoder::resync_zeros;
+
+  ostringstream os;
+  os << "Error:" << error << ", Last Line: " << last_line << "\n";
+  os << "Resend: " << last_line + 1 << "\n";
+  os << "ok\n";
+  SendReply( now, os.str() );
+}
+
+void FakePrinter::Execute( const string &cmd, const ntime_t &now ) {
+  if ( cmd.empty() ) {
+    SendReply( now, "ok\n" );
+    return;
+  }
+
+  char code = toupper( cmd[ 0 ] );
+  int num = atoi( cmd.c_str() + 1 );
+
+  // Parameters
+  bool have[ 26 ];
+  double value[ 26 ];
+  memset( have, 0, sizeof( have ) );
+  for ( size_t i = 1; i < cmd.length(); i++ ) {
+    char c = toupper( cmd[ i ] );
+    if ( c >= 'A' && c <= 'Z' && ( cmd[ i - 1 ] == ' ' || cmd[ i - 1 ] == '\t' ) ) {
+      have[ c - 'A' ] = true;
+      value[ c - 'A' ] = strtod( cmd.c_str() + i + 1, NULL );
+    }
+  }
+
+  const char axes[] = "XYZE";
+  ostringstream os;
+
+  if ( code == 'G' && ( num == 0 || num == 1 || num == 92 ) ) {
+    for ( int a = 0; a < 4; a++ )
+      if ( have[ axes[ a ] - 'A' ] )
+	pos[ a ] = value[ axes[ a ] - 'A' ];
+  } else if ( code == 'G' && num == 28 ) {
+    for ( int a = 0; a < 3; a++ )
+      pos[ a ] = 0.0;
+  } else if ( code == 'M' && ( num == 104 || num == 109 ) && have[ 'S' - 'A' ] ) {
+    temp = temp_target = value[ 'S' - 'A' ];
+  } else if ( code == 'M' && ( num == 140 || num == 190 ) && have[ 'S' - 'A' ] ) {
+    bed = bed_target = value[ 'S' - 'A' ];
+  } else if ( code == 'M' && num == 105 ) {
+    SendTemperatures( now, true );
+    return;
+  } else if ( code == 'M' && num == 114 ) {
+    char buf[ 200 ];
+    snprintf( buf, sizeof( buf ), "X:%.2f Y:%.2f Z:%.2f E:%.2f Count X: 0 Y:0 Z:0\n", pos[ 0 ], pos[ 1 ], pos[ 2 ], pos[ 3 ] );
+    os << buf;
+  } else if ( code == 'M' && num == 115 ) {
+    os << "FIRMWARE_NAME:RepSnapper FakePrinter PROTOCOL_VERSION:1.0 MACHINE_TYPE:Simulator EXTRUDER_COUNT:1\n";
+  }
+
+  os << "ok\n";
+  SendReply( now, os.str() );
+}
+
+void FakePrinter::SendReply( const ntime_t &now, const string &text ) {
+  Reply reply;
+  reply.time = now;
+  ntime_add_us( &reply.time, options.reply_latency_us );
+  reply.text = text;
+  replies.push_back( reply );
+}
+
+void FakePrinter::SendTemperatures( const ntime_t &now, bool ok ) {
+  char buf[ 200 ];
+  snprintf( buf, sizeof( buf ), "%s T:%.1f /%.1f B:%.1f /%.1f @:0 B@:0\n", ok ? "ok" : "", temp, temp_target, bed, bed_target );
+  SendReply( now, buf );
+}
+
+long FakePrinter::NextTimeout( const ntime_t &now ) {
+  long timeout = -1;
+
+  if ( ! connected )
+    return timeout;
+
+  const ntime_t *events[ 5 ];
+  int count = 0;
+  if ( booting )
+    events[ count++ ] = &boot_time;
+  if ( ! queue.empty() )
+    events[ count++ ] = &exec_done;
+  if ( ! replies.empty() )
+    events[ count++ ] = &replies.front().time;
+  if ( options.temp_report_ms > 0 )
+    events[ count++ ] = &next_temp_report;
+  if ( ! wire.empty() )
+    events[ count++ ] = &wire_time;
+
+  for ( int i = 0; i < count; i++ ) {
+    long t = ntime_diff_us( &now, events[ i ] );
+    if ( t < 0 )
+      t = 0;
+    if ( timeout < 0 || t < timeout )
+      timeout = t;
+  }
+
+  return timeout;
+}
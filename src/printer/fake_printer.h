@@ -0,0 +1,143 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <deque>
+#include <string>
+
+#include "thread.h"
+
+using namespace std;
+
+// Simulates a Marlin-like printer firmware on a pseudo terminal, for testing
+// and benchmarking the serial code without hardware.  The device name
+// returned by GetDevice() can be opened with PrinterSerial::Connect() like
+// a real serial port.  POSIX only.
+//
+// The model follows Marlin 1.x: received bytes go into an RX buffer of
+// rx_buffer_size bytes (excess bytes are dropped), complete lines are moved
+// from there into a command queue of queue_size entries, checked for line
+// number and checksum and executed one after the other, exec_us each.  The
+// "ok" is sent when a command is done.  On an error, the RX buffer is
+// flushed and "Error:...", "Resend: N" and "ok" are sent.  All replies are
+// delayed by reply_latency_us.  Binary lines (see BinaryLineEncoder) are
+// understood as well.
+//
+// With baud set, bytes from the host arrive one byte time (10 bits) after
+// the other, like on a real serial line.  The replies are not slowed down.
+//
+// Opening the device "resets" the printer: the line number is cleared and
+// "start" is sent after boot_ms.
+
+class FakePrinter {
+ public:
+  struct Options {
+    unsigned long rx_buffer_size; // bytes, Marlin default is 128
+    unsigned long queue_size; // commands, Marlin BUFSIZE default is 4
+    unsigned long exec_us; // time to execute one command
+    unsigned long reply_latency_us; // delay of every reply
+    double error_rate; // probability of an injected checksum error per line
+    unsigned long temp_report_ms; // automatic temperature reports (M155), 0 for none
+    unsigned long boot_ms; // delay of the start message after opening
+    unsigned long baud; // simulated serial speed, 0 for unlimited
+    unsigned int seed; // for error injection
+
+    Options();
+
+    // Command line options, for getopt()
+    static const char *const getopt_string;
+    static const char *const help;
+    bool Parse( int opt, const char *arg ); // false if opt is unknown
+  };
+
+  struct Stats {
+    unsigned long lines_received;
+    unsigned long lines_executed;
+    unsigned long errors_injected;
+    unsigned long line_errors; // checksum and line number errors
+    unsigned long rx_overflow_bytes;
+    unsigned long rx_flushed_bytes;
+    unsigned long bytes_received; // from the host
+  };
+
+  FakePrinter( const Options &options = Options() );
+  ~FakePrinter();
+
+  bool Start( void ); // Create the pseudo terminal and start the firmware thread
+  void Stop( void );
+  string GetDevice( void );
+  Stats GetStats( void );
+
+ private:
+  struct Command {
+    string text;
+    bool valid;
+  };
+  struct Reply {
+    ntime_t time;
+    string text;
+  };
+
+  const Options options;
+
+  int master_fd;
+  string device;
+
+  thread_t thread;
+  bool running;
+  mutex_t mutex; // for stats and running
+  Stats stats;
+
+  // Firmware state, firmware thread only
+  bool connected;
+  ntime_t boot_time;
+  bool booting;
+  string wire; // on the serial line, the first byte arrives at wire_time
+  ntime_t wire_time;
+  string rx;
+  ntime_t rx_time; // when the last bytes arrived in rx
+  deque<Command> queue;
+  ntime_t exec_done;
+  deque<Reply> replies;
+  ntime_t next_temp_report;
+  long last_line;
+  bool last_binary; // the last line received was a binary one
+  unsigned long resync_zeros; // zero bytes still to skip to, see BinaryLineEncoder
+  double pos[ 4 ];
+  double temp, temp_target, bed, bed_target;
+  unsigned int random_state;
+
+  static void *ThreadMainStatic( void *arg );
+  void *ThreadMain( void );
+
+  void PowerOn( const ntime_t &now );
+  void Receive( const char *data, size_t len, const ntime_t &now );
+  unsigned long WireByteNs( void );
+  void Transfer( const ntime_t &now );
+  void ReceiveRx( const char *data, size_t len, const ntime_t &now );
+  void ReadCommands( const ntime_t &now );
+  void Enqueue( const Command &cmd, const ntime_t &now );
+  bool InjectError( void );
+  void LineError( const ntime_t &now, const char *error );
+  void Execute( const string &cmd, const ntime_t &now );
+  void SendReply( const ntime_t &now, const string &text );
+  void SendTemperatures( const ntime_t &now, bool ok );
+  long NextTimeout( const ntime_t &now ); // ms until the next event, -1 for none
+};
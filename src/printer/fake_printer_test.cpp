@@ -0,0 +1,66 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+// Runs a FakePrinter until "quit" or end of input.  Connect to the device
+// it prints with RepSnapper or threaded_printer_serial_test.
+
+#include "fake_printer.h"
+
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace std;
+
+int main( int argc, char *argv[] ) {
+  FakePrinter::Options options;
+  int opt;
+
+  while ( ( opt = getopt( argc, argv, FakePrinter::Options::getopt_string ) ) != -1 ) {
+    if ( ! options.Parse( opt, optarg ) ) {
+      cerr << "Usage: " << argv[ 0 ] << " [options]" << endl;
+      cerr << FakePrinter::Options::help;
+      return 1;
+    }
+  }
+
+  FakePrinter printer( options );
+  if ( ! printer.Start() )
+    return 1;
+
+  cout << printer.GetDevice() << endl;
+
+  string line;
+  while ( getline( cin, line ) && line != "quit" )
+    ;
+
+  FakePrinter::Stats stats = printer.GetStats();
+  printer.Stop();
+
+  cout << "Bytes received:    " << stats.bytes_received << endl;
+  cout << "Lines received:    " << stats.lines_received << endl;
+  cout << "Lines executed:    " << stats.lines_executed << endl;
+  cout << "Errors injected:   " << stats.errors_injected << endl;
+  cout << "Line errors:       " << stats.line_errors << endl;
+  cout << "RX overflow bytes: " << stats.rx_overflow_bytes << endl;
+  cout << "RX flushed bytes:  " << stats.rx_flushed_bytes << endl;
+
+  return 0;
+}
@@ -0,0 +1,388 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "line_encoder.h"
+
+////////////////////////////////////////////////////////////////////////////
+//  LineEncoder
+////////////////////////////////////////////////////////////////////////////
+
+size_t LineEncoder::Describe( const char *line, size_t len, char *out, size_t size ) {
+  if ( len > size - 2 )
+    len = size - 2;
+
+  memcpy( out, line, len );
+  if ( len == 0 || out[ len - 1 ] != '\n' )
+    out[ len++ ] = '\n';
+  out[ len ] = '\0';
+
+  return len;
+}
+
+size_t LineEncoder::Resync( const char **data ) {
+  *data = NULL;
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+//  AsciiLineEncoder
+////////////////////////////////////////////////////////////////////////////
+
+size_t AsciiLineEncoder::Encode( unsigned long line_number, const char *command, size_t len, char *out ) {
+  char *loc = out;
+  char digits[ 24 ];
+  int num = 0;
+
+  do {
+    digits[ num++ ] = line_number % 10 + '0';
+    line_number /= 10;
+  } while ( line_number > 0 );
+
+  *loc++ = 'N';
+  while ( num > 0 )
+    *loc++ = digits[ --num ];
+  *loc++ = ' ';
+
+  memcpy( loc, command, len );
+  loc += len;
+
+  // Calculate checksum
+  unsigned char cksum = 0;
+  for ( const char *c = out; c < loc; c++ )
+    cksum ^= *c;
+
+  // Write checksum
+  *loc++ = '*';
+  if ( cksum >= 100 ) {
+    *loc++ = cksum / 100 + '0';
+  }
+  if ( cksum >= 10 ) {
+    *loc++ = ( cksum / 10 ) % 10 + '0';
+  }
+  *loc++ = cksum % 10 + '0';
+
+  // Terminate line
+  *loc++ = '\n';
+
+  return loc - out;
+}
+
+////////////////////////////////////////////////////////////////////////////
+//  BinaryLineEncoder
+////////////////////////////////////////////////////////////////////////////
+
+enum BinaryType { BINARY_UINT8, BINARY_UINT16, BINARY_INT32, BINARY_FLOAT };
+
+struct BinaryField {
+  char letter;
+  int bit; // 0..15 in the first bit field, 16..31 in the second
+  BinaryType type;
+};
+
+// In the order of the data
+static const BinaryField binary_fields[] = {
+  { 'N', 0, BINARY_UINT16 },
+  { 'M', 1, BINARY_UINT16 },
+  { 'G', 2, BINARY_UINT16 },
+  { 'X', 3, BINARY_FLOAT },
+  { 'Y', 4, BINARY_FLOAT },
+  { 'Z', 5, BINARY_FLOAT },
+  { 'E', 6, BINARY_FLOAT },
+  { 'F', 8, BINARY_FLOAT },
+  { 'T', 9, BINARY_UINT8 },
+  { 'S', 10, BINARY_INT32 },
+  { 'P', 11, BINARY_INT32 },
+  { 'I', 16, BINARY_FLOAT },
+  { 'J', 17, BINARY_FLOAT },
+  { 'R', 18, BINARY_FLOAT },
+  { 'D', 19, BINARY_FLOAT },
+  { 'C', 20, BINARY_FLOAT },
+  { 'H', 21, BINARY_FLOAT },
+  { 'A', 22, BINARY_FLOAT },
+  { 'B', 23, BINARY_FLOAT },
+  { 'K', 24, BINARY_FLOAT },
+  { 'L', 25, BINARY_FLOAT },
+  { 'O', 26, BINARY_FLOAT },
+};
+static const int num_binary_fields = sizeof( binary_fields ) / sizeof( binary_fields[ 0 ] );
+
+static const unsigned long binary_marker = 1 << 7;
+static const unsigned long binary_version_2 = 1 << 12;
+static const unsigned long binary_text = 1 << 15;
+
+// M codes taking text, which Repetier only parses from ASCII lines
+static const int text_m_codes[] = { 23, 28, 29, 30, 32, 36, 117, 531 };
+
+static size_t FieldSize( BinaryType type, bool version_2 ) {
+  switch ( type ) {
+  case BINARY_UINT8: return 1;
+  case BINARY_UINT16: return version_2 ? 2 : 1; // M and G are 8 bit in version 1
+  default: return 4;
+  }
+}
+
+static void Fletcher16( const unsigned char *data, size_t len, unsigned char &sum1, unsigned char &sum2 ) {
+  unsigned int s1 = 0, s2 = 0;
+
+  for ( size_t i = 0; i < len; i++ ) {
+    s1 = ( s1 + data[ i ] ) % 255;
+    s2 = ( s2 + s1 ) % 255;
+  }
+
+  sum1 = s1;
+  sum2 = s2;
+}
+
+static char *PutInt( char *loc, unsigned long value, size_t size ) {
+  for ( size_t i = 0; i < size; i++ )
+    *loc++ = ( value >> ( 8 * i ) ) & 0xff;
+  return loc;
+}
+
+static unsigned long GetInt( const unsigned char *loc, size_t size ) {
+  unsigned long value = 0;
+  for ( size_t i = 0; i < size; i++ )
+    value |= ( unsigned long ) loc[ i ] << ( 8 * i );
+  return value;
+}
+
+size_t BinaryLineEncoder::Encode( unsigned long line_number, const char *command, size_t len, char *out ) {
+  unsigned long bits = binary_marker | binary_version_2 | 1;
+  long ints[ num_binary_fields ];
+  float floats[ num_binary_fields ];
+  const char *loc = command;
+  const char *end = command + len;
+
+  ints[ 0 ] = line_number & 0xffff;
+
+  while ( true ) {
+    while ( loc < end && ( *loc == ' ' || *loc == '\t' ) )
+      loc++;
+    if ( loc == end )
+      break;
+
+    char letter = toupper( *loc++ );
+    int f;
+    for ( f = 1; f < num_binary_fields && binary_fields[ f ].letter != letter; f++ )
+      ;
+    if ( f == num_binary_fields || ( bits & ( 1UL << binary_fields[ f ].bit ) ) )
+      return ascii.Encode( line_number, command, len, out );
+
+    // A plain decimal number, no exponent ("X1E5" is X1 E5)
+    const char *start = loc;
+    if ( loc < end && ( *loc == '-' || *loc == '+' ) )
+      loc++;
+    const char *digits = loc;
+    while ( loc < end && isdigit( *loc ) )
+      loc++;
+    bool integer = true;
+    if ( loc < end && *loc == '.' ) {
+      integer = false;
+      loc++;
+      while ( loc < end && isdigit( *loc ) )
+	loc++;
+    }
+    if ( loc == digits || ( loc == digits + 1 && *digits == '.' ) || loc - start > 30 )
+      return ascii.Encode( line_number, command, len, out );
+
+    char number[ 32 ];
+    memcpy( number, start, loc - start );
+    number[ loc - start ] = '\0';
+    double value = strtod( number, NULL );
+
+    switch ( binary_fields[ f ].type ) {
+    case BINARY_UINT8:
+    case BINARY_UINT16:
+    case BINARY_INT32: {
+      long max = binary_fields[ f ].type == BINARY_UINT8 ? 0xff :
+	binary_fields[ f ].type == BINARY_UINT16 ? 0xffff : LONG_MAX;
+      long min = binary_fields[ f ].type == BINARY_INT32 ? -0x7fffffffL : 0;
+      if ( ! integer || value < min || value > max || value > 0x7fffffffL )
+	return ascii.Encode( line_number, command, len, out );
+      ints[ f ] = ( long ) value;
+      break;
+    }
+    case BINARY_FLOAT:
+      floats[ f ] = ( float ) value;
+      // Too many digits for a float, like a long extrusion in absolute mode
+      if ( fabs( floats[ f ] - value ) > 0.0005 )
+	return ascii.Encode( line_number, command, len, out );
+      break;
+    }
+
+    bits |= 1UL << binary_fields[ f ].bit;
+  }
+
+  if ( bits & ( 1UL << binary_fields[ 1 ].bit ) ) {
+    for ( size_t i = 0; i < sizeof( text_m_codes ) / sizeof( text_m_codes[ 0 ] ); i++ )
+      if ( ints[ 1 ] == text_m_codes[ i ] )
+	return ascii.Encode( line_number, command, len, out );
+  }
+
+  char *data = out;
+  data = PutInt( data, bits & 0xffff, 2 );
+  data = PutInt( data, bits >> 16, 2 );
+
+  for ( int f = 0; f < num_binary_fields; f++ ) {
+    if ( ! ( bits & ( 1UL << binary_fields[ f ].bit ) ) )
+      continue;
+
+    if ( binary_fields[ f ].type == BINARY_FLOAT ) {
+      unsigned int raw;
+      memcpy( &raw, &floats[ f ], 4 );
+      data = PutInt( data, raw, 4 );
+    } else
+      data = PutInt( data, ints[ f ], FieldSize( binary_fields[ f ].type, true ) );
+  }
+
+  unsigned char sum1, sum2;
+  Fletcher16( ( unsigned char * ) out, data - out, sum1, sum2 );
+  *data++ = sum1;
+  *data++ = sum2;
+
+  return data - out;
+}
+
+// A few more than the firmware waits for
+static const char binary_resync[ 32 ] = { 0 };
+
+size_t BinaryLineEncoder::Resync( const char **data ) {
+  *data = binary_resync;
+  return sizeof( binary_resync );
+}
+
+size_t BinaryLineEncoder::Describe( const char *line, size_t len, char *out, size_t size ) {
+  if ( len == 0 || ! ( line[ 0 ] & binary_marker ) )
+    return LineEncoder::Describe( line, len, out, size );
+
+  unsigned long line_number;
+  string command;
+  int num;
+  if ( Decode( line, len, line_number, command ) )
+    num = snprintf( out, size, "N%lu %s [%lu bytes binary]\n", line_number, command.c_str(), ( unsigned long ) len );
+  else
+    num = snprintf( out, size, "[%lu bytes binary, broken]\n", ( unsigned long ) len );
+
+  if ( num < 0 || ( size_t ) num >= size ) {
+    out[ size - 2 ] = '\n';
+    num = size - 1;
+  }
+  return num;
+}
+
+size_t BinaryLineEncoder::LineSize( const char *data, size_t len ) {
+  const unsigned char *udata = ( const unsigned char * ) data;
+
+  if ( len < 2 )
+    return 0;
+
+  unsigned long bits = GetInt( udata, 2 );
+  bool version_2 = bits & binary_version_2;
+  size_t size = 4; // bit field and checksum
+
+  if ( version_2 ) {
+    if ( len < 4 )
+      return 0;
+    bits |= GetInt( udata + 2, 2 ) << 16;
+    size += 2;
+
+    if ( bits & binary_text ) {
+      if ( len < 5 )
+	return 0;
+      size += 1 + udata[ 4 ];
+    }
+  } else if ( bits & binary_text )
+    size += 16;
+
+  for ( int f = 0; f < num_binary_fields; f++ )
+    if ( bits & ( 1UL << binary_fields[ f ].bit ) )
+      size += FieldSize( binary_fields[ f ].type, version_2 );
+
+  return size;
+}
+
+bool BinaryLineEncoder::Decode( const char *line, size_t len, unsigned long &line_number, string &command ) {
+  const unsigned char *udata = ( const unsigned char * ) line;
+
+  if ( len < 4 || LineSize( line, len ) != len )
+    return false;
+
+  unsigned char sum1, sum2;
+  Fletcher16( udata, len - 2, sum1, sum2 );
+  if ( sum1 != udata[ len - 2 ] || sum2 != udata[ len - 1 ] )
+    return false;
+
+  unsigned long bits = GetInt( udata, 2 );
+  bool version_2 = bits & binary_version_2;
+  const unsigned char *loc = udata + 2;
+  size_t text_len = 16;
+
+  if ( version_2 ) {
+    bits |= GetInt( loc, 2 ) << 16;
+    loc += 2;
+    if ( bits & binary_text )
+      text_len = *loc++;
+  }
+
+  line_number = 0;
+  command.clear();
+
+  for ( int f = 0; f < num_binary_fields; f++ ) {
+    if ( ! ( bits & ( 1UL << binary_fields[ f ].bit ) ) )
+      continue;
+
+    size_t size = FieldSize( binary_fields[ f ].type, version_2 );
+    unsigned long raw = GetInt( loc, size );
+    loc += size;
+
+    char buf[ 40 ];
+    if ( binary_fields[ f ].type == BINARY_FLOAT ) {
+      unsigned int raw32 = raw;
+      float value;
+      memcpy( &value, &raw32, 4 );
+      snprintf( buf, sizeof( buf ), "%c%.7g", binary_fields[ f ].letter, value );
+    } else if ( binary_fields[ f ].type == BINARY_INT32 )
+      snprintf( buf, sizeof( buf ), "%c%ld", binary_fields[ f ].letter, ( long ) ( int ) raw );
+    else
+      snprintf( buf, sizeof( buf ), "%c%lu", binary_fields[ f ].letter, raw );
+
+    if ( f == 0 ) {
+      line_number = raw;
+      continue;
+    }
+    if ( ! command.empty() )
+      command += ' ';
+    command += buf;
+  }
+
+  if ( bits & binary_text ) {
+    string text( ( const char * ) loc, text_len );
+    command += ' ';
+    command += text.substr( 0, text.find( '\0' ) );
+  }
+
+  return true;
+}
@@ -0,0 +1,89 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <string>
+
+using namespace std;
+
+// Turns a line of GCode into the bytes sent to the printer, together with
+// the line number and a checksum so that the firmware notices lost and
+// broken lines.
+class LineEncoder {
+ public:
+  // An encoded line is at most max_overhead bytes plus twice the command
+  static const size_t max_overhead = 32;
+
+  virtual ~LineEncoder() {};
+
+  virtual size_t Encode( unsigned long line_number, const char *command, size_t len, char *out ) = 0;
+  // Encodes command, len bytes without comment, newline and surrounding
+  // white space, as line line_number into out.  Returns the encoded length.
+
+  virtual size_t Describe( const char *line, size_t len, char *out, size_t size );
+  // Readable form of an encoded line for the log, ending in a newline, into
+  // out of size bytes.  Returns the length without the terminating '\0'.
+
+  virtual size_t Resync( const char **data );
+  // Bytes to send before a line sent again, for the firmware to find the
+  // start of the line after an error, into *data.  Returns their number,
+  // none by default.
+};
+
+// "N<line> <command>*<checksum>\n", the checksum being the XOR of all bytes
+// before the '*'.  Understood by all RepRap firmwares.
+class AsciiLineEncoder : public LineEncoder {
+ public:
+  virtual size_t Encode( unsigned long line_number, const char *command, size_t len, char *out );
+};
+
+// The binary protocol of Repetier firmware (version 2), for about half the
+// bytes of the ASCII form: a bit field telling which parameters follow,
+// the line number (16 bit), G and M codes as 16 bit integers, coordinates
+// as 32 bit floats, and a Fletcher-16 checksum, which unlike the XOR
+// checksum also catches swapped and zeroed bytes.  All little endian.  The
+// first byte always has the top bit set, which ASCII GCode never has, so
+// the firmware can tell the lines apart.
+//
+// Commands the binary form cannot express, like the text of M117, are
+// sent as ASCII lines, which the firmware accepts in between.
+//
+// After an error in a binary line, the firmware skips everything up to 30
+// zero bytes in a row, the rest of a cut line could look like anything.
+// Zero bytes between lines are ignored.
+class BinaryLineEncoder : public LineEncoder {
+  AsciiLineEncoder ascii;
+
+ public:
+  virtual size_t Encode( unsigned long line_number, const char *command, size_t len, char *out );
+  virtual size_t Describe( const char *line, size_t len, char *out, size_t size );
+  virtual size_t Resync( const char **data );
+
+  // The receiving side, for testing
+
+  static const size_t resync_zeros = 30;
+
+  static size_t LineSize( const char *data, size_t len );
+  // Size of the binary line starting at data, 0 if len bytes do not tell yet
+
+  static bool Decode( const char *line, size_t len, unsigned long &line_number, string &command );
+  // Checks the checksum and turns the line back into text, without line
+  // number.  line_number is the low 16 bits only.
+};
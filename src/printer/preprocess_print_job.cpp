@@ -0,0 +1,584 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "preprocess_print_job.h"
+
+static const char axis_letters[] = "XYZEF";
+
+// Shorter moves are not merged, they may be rounding noise
+static const double min_move = 1e-6;
+
+PreprocessPrintJob::Options::Options() {
+  strip_comments = true;
+  drop_unchanged = true;
+  drop_feedrate = true;
+  merge_lines = true;
+  fit_arcs = false;
+  relative_e = false;
+  tolerance = 0.01;
+  extrusion_tolerance = 0.05;
+  max_run = 64;
+  arc_fitter = NULL;
+}
+
+// "10.500" -> "10.5", "-3.000" -> "-3"
+static string TrimNumber( const string &text ) {
+  if ( text.find( '.' ) == string::npos )
+    return text;
+
+  size_t end = text.find_last_not_of( '0' );
+  if ( text[ end ] == '.' )
+    end--;
+
+  string trimmed = text.substr( 0, end + 1 );
+  if ( trimmed.empty() || trimmed == "-" || trimmed == "+" )
+    trimmed += "0";
+  return trimmed;
+}
+
+static string FormatNumber( double value, int decimals ) {
+  char buf[ 40 ];
+  snprintf( buf, sizeof( buf ), "%.*f", decimals, value );
+  return TrimNumber( buf );
+}
+
+// Splits the command part of a line into words like "X10.5".  Returns
+// false for anything else, like the text of M117.
+bool PreprocessPrintJob::ParseWords( const string &line, vector<Word> &words ) {
+  const char *loc = line.c_str();
+
+  words.clear();
+  while ( true ) {
+    while ( isspace( *loc ) )
+      loc++;
+    if ( *loc == '\0' )
+      return true;
+
+    Word word;
+    word.letter = toupper( *loc++ );
+    if ( word.letter < 'A' || word.letter > 'Z' )
+      return false;
+
+    // No exponents, "X1E5" is X1 E5
+    const char *start = loc;
+    if ( *loc == '-' || *loc == '+' )
+      loc++;
+    const char *digits = loc;
+    while ( isdigit( *loc ) )
+      loc++;
+    if ( *loc == '.' )
+      loc++;
+    while ( isdigit( *loc ) )
+      loc++;
+    if ( loc == digits || ( loc == digits + 1 && *digits == '.' ) )
+      return false;
+
+    word.text.assign( start, loc - start );
+    word.value = strtod( word.text.c_str(), NULL );
+    words.push_back( word );
+  }
+}
+
+PreprocessPrintJob::PreprocessPrintJob( PrintJob *source, const Options &options,
+					unsigned long stop_line ) :
+  source( source ), options( options ), stop_line( stop_line ) {
+  source_bytes = output_bytes = 0;
+  Reset();
+  line = 1;
+  byte_pos = source->BytePosition();
+}
+
+PreprocessPrintJob::~PreprocessPrintJob() {
+  delete source;
+}
+
+void PreprocessPrintJob::Reset( void ) {
+  output.clear();
+  ready = 0;
+  run.clear();
+
+  for ( int a = 0; a < AXES; a++ ) {
+    known[ a ] = false;
+    pos[ a ] = 0.0;
+  }
+  absolute = true;
+  absolute_e = ! options.relative_e;
+  inches = false;
+}
+
+bool PreprocessPrintJob::SeekLine( unsigned long line ) {
+  if ( ! source->SeekLine( line ) )
+    return false;
+
+  Reset();
+  this->line = line < 1 ? 1 : line;
+  byte_pos = source->BytePosition();
+  return true;
+}
+
+const char *PreprocessPrintJob::NextLine( size_t &len ) {
+  while ( ready == 0 ) {
+    size_t source_len;
+    const char *text = source->NextLine( source_len );
+
+    if ( text == NULL ) {
+      FlushRun();
+      if ( ready == 0 )
+	return NULL;
+      break;
+    }
+
+    source_bytes += source_len + 1;
+    ProcessLine( text, source_len );
+    line++;
+  }
+
+  current.swap( output.front().text );
+  byte_pos = output.front().byte_pos;
+  output.pop_front();
+  ready--;
+
+  if ( ! current.empty() )
+    output_bytes += current.length() + 1;
+
+  len = current.length();
+  return current.c_str();
+}
+
+bool PreprocessPrintJob::AtEnd( void ) {
+  return output.empty() && source->AtEnd();
+}
+
+void PreprocessPrintJob::ProcessLine( const char *text, size_t len ) {
+  string original( text, len );
+  size_t comment = original.find( ';' );
+  string command = original.substr( 0, comment );
+
+  size_t end = command.find_last_not_of( " \t\r" );
+  command.erase( end == string::npos ? 0 : end + 1 );
+  command.erase( 0, command.find_first_not_of( " \t" ) );
+
+  vector<Word> words;
+  bool parsed = ParseWords( command, words );
+
+  if ( parsed && IsMove( words ) &&
+       ( comment == string::npos || options.strip_comments ) ) {
+    ProcessMove( words );
+    return;
+  }
+
+  FlushRun();
+  Emit( options.strip_comments ? command : original );
+  UpdateState( parsed, command, words );
+}
+
+// G0 or G1 with nothing but axes and F
+bool PreprocessPrintJob::IsMove( const vector<Word> &words ) {
+  if ( words.empty() || words[ 0 ].letter != 'G' ||
+       words[ 0 ].text.find_first_not_of( "0" ) < words[ 0 ].text.length() - 1 ||
+       ( words[ 0 ].value != 0.0 && words[ 0 ].value != 1.0 ) )
+    return false;
+
+  bool have[ AXES ] = { false, false, false, false, false };
+  for ( size_t i = 1; i < words.size(); i++ ) {
+    const char *letter = strchr( axis_letters, words[ i ].letter );
+    if ( letter == NULL || have[ letter - axis_letters ] )
+      return false;
+    have[ letter - axis_letters ] = true;
+  }
+
+  return true;
+}
+
+void PreprocessPrintJob::ProcessMove( const vector<Word> &words ) {
+  string g = words[ 0 ].value == 0.0 ? "G0" : "G1";
+  bool have[ AXES ] = { false, false, false, false, false };
+  double value[ AXES ];
+  string text[ AXES ];
+
+  for ( size_t i = 1; i < words.size(); i++ ) {
+    int a = strchr( axis_letters, words[ i ].letter ) - axis_letters;
+    have[ a ] = true;
+    value[ a ] = words[ i ].value;
+    text[ a ] = TrimNumber( words[ i ].text );
+  }
+
+  // Where the last move ends
+  double x = run.empty() ? pos[ X ] : run.back().x;
+  double y = run.empty() ? pos[ Y ] : run.back().y;
+  double e = run.empty() ? pos[ E ] : run.back().e_end;
+  double f = have[ F ] ? value[ F ] : run.empty() ? pos[ F ] : run_f;
+  bool abs_e = absolute && absolute_e;
+
+  double nx = have[ X ] ? value[ X ] : x;
+  double ny = have[ Y ] ? value[ Y ] : y;
+  double len = hypot( nx - x, ny - y );
+  double de = 0.0;
+  if ( have[ E ] )
+    de = abs_e ? value[ E ] - e : value[ E ];
+
+  // Extruding or not along the XY plane from a known position
+  bool in_run = ( options.merge_lines || options.fit_arcs ) &&
+    absolute && ! inches && known[ X ] && known[ Y ] &&
+    ( have[ F ] || known[ F ] ) && ( ! have[ E ] || ! abs_e || known[ E ] ) &&
+    ( have[ X ] || have[ Y ] ) && len > min_move && de >= 0.0 &&
+    ( ! have[ Z ] || ( known[ Z ] && value[ Z ] == pos[ Z ] ) );
+
+  if ( in_run && ! run.empty() &&
+       ( g != run_g || f != run_f || ( de > 0.0 ) != run_extruding ) )
+    FlushRun();
+
+  if ( in_run ) {
+    if ( run.empty() ) {
+      run_x = pos[ X ];
+      run_y = pos[ Y ];
+      run_g = g;
+      run_f = f;
+      run_extruding = de > 0.0;
+    }
+
+    Move move;
+    move.x = nx;
+    move.y = ny;
+    move.len = len;
+    move.e = de;
+    move.e_end = abs_e && have[ E ] ? value[ E ] : e;
+    move.x_text = have[ X ] ? text[ X ] : FormatNumber( nx, 3 );
+    move.y_text = have[ Y ] ? text[ Y ] : FormatNumber( ny, 3 );
+    move.e_text = have[ E ] ? text[ E ] : "";
+    move.f_text = have[ F ] ? text[ F ] : "";
+    run.push_back( move );
+
+    // Placeholder, filled in by FlushRun()
+    Output out;
+    out.byte_pos = source->BytePosition();
+    output.push_back( out );
+
+    if ( run.size() >= options.max_run || line == stop_line )
+      FlushRun();
+    return;
+  }
+
+  FlushRun();
+
+  string out = g;
+  for ( int a = X; a <= E; a++ ) {
+    if ( ! have[ a ] )
+      continue;
+
+    bool relative = a == E ? ! abs_e : ! absolute;
+    bool unchanged = relative ? value[ a ] == 0.0 : known[ a ] && value[ a ] == pos[ a ];
+    if ( ! ( unchanged && options.drop_unchanged ) )
+      out += string( " " ) + axis_letters[ a ] + text[ a ];
+
+    if ( ! relative ) {
+      pos[ a ] = value[ a ];
+      known[ a ] = true;
+    } else
+      pos[ a ] += value[ a ];
+  }
+  if ( have[ F ] ) {
+    if ( ! ( known[ F ] && value[ F ] == pos[ F ] && options.drop_feedrate ) )
+      out += " F" + text[ F ];
+    pos[ F ] = value[ F ];
+    known[ F ] = true;
+  }
+
+  // Nothing left of the move
+  Emit( out == g ? "" : out );
+}
+
+void PreprocessPrintJob::UpdateState( bool parsed, const string &command,
+				      const vector<Word> &words ) {
+  if ( command.empty() )
+    return;
+
+  // Anything unknown may move the axes, except M codes
+  if ( ! parsed || words.empty() ) {
+    if ( toupper( command[ 0 ] ) != 'M' )
+      ForgetPosition();
+    return;
+  }
+
+  char letter = words[ 0 ].letter;
+  int num = ( int ) words[ 0 ].value;
+
+  if ( letter == 'M' ) {
+    if ( num == 82 )
+      absolute_e = true;
+    else if ( num == 83 )
+      absolute_e = false;
+  } else if ( letter == 'G' && ( num == 0 || num == 1 || num == 92 ) ) {
+    // Moves with a comment, and setting the position
+    bool abs_e = absolute && absolute_e;
+    bool any = false;
+    for ( size_t i = 1; i < words.size(); i++ ) {
+      const char *axis = strchr( axis_letters, words[ i ].letter );
+      if ( axis == NULL )
+	continue;
+
+      int a = axis - axis_letters;
+      bool relative = num != 92 && ( a == E ? ! abs_e : a != F && ! absolute );
+      if ( relative )
+	pos[ a ] += words[ i ].value;
+      else {
+	pos[ a ] = words[ i ].value;
+	known[ a ] = true;
+      }
+      any = true;
+    }
+    // Plain G92 sets all axes to 0 in some firmware, and does nothing in others
+    if ( num == 92 && ! any )
+      ForgetPosition();
+  } else if ( letter == 'G' && num == 90 )
+    absolute = true;
+  else if ( letter == 'G' && num == 91 )
+    absolute = false;
+  else if ( letter == 'G' && num == 20 )
+    inches = true;
+  else if ( letter == 'G' && num == 21 )
+    inches = false;
+  else if ( letter != 'G' || num != 4 )
+    ForgetPosition(); // homing, arcs, tool changes, ...
+}
+
+void PreprocessPrintJob::ForgetPosition( void ) {
+  for ( int a = 0; a < AXES; a++ )
+    known[ a ] = false;
+}
+
+void PreprocessPrintJob::Emit( const string &text ) {
+  Output out;
+  out.text = text;
+  out.byte_pos = source->BytePosition();
+  output.push_back( out );
+  ready = output.size();
+}
+
+void PreprocessPrintJob::FlushRun( void ) {
+  if ( run.empty() )
+    return;
+
+  size_t first = 0;
+  while ( first < run.size() ) {
+    size_t line_moves = options.merge_lines ? LineMoves( first ) : 1;
+    size_t arc_moves = 0;
+    double cx = 0.0, cy = 0.0;
+
+    if ( options.fit_arcs && run_g == "G1" )
+      arc_moves = ArcMoves( first, cx, cy );
+
+    if ( arc_moves > line_moves ) {
+      EmitPiece( first, first + arc_moves - 1, true, cx, cy );
+      first += arc_moves;
+    } else {
+      EmitPiece( first, first + line_moves - 1, false, 0.0, 0.0 );
+      first += line_moves;
+    }
+  }
+
+  run.clear();
+  ready = output.size();
+}
+
+bool PreprocessPrintJob::ExtrusionMatches( size_t a, size_t b ) {
+  if ( ! run_extruding )
+    return true;
+
+  double ratio_a = run[ a ].e / run[ a ].len;
+  double ratio_b = run[ b ].e / run[ b ].len;
+  return fabs( ratio_b - ratio_a ) <= ratio_a * options.extrusion_tolerance;
+}
+
+// Moves from first on that lie on a straight line, at least 1
+size_t PreprocessPrintJob::LineMoves( size_t first ) {
+  double sx = first == 0 ? run_x : run[ first - 1 ].x;
+  double sy = first == 0 ? run_y : run[ first - 1 ].y;
+  size_t last;
+
+  for ( last = first + 1; last < run.size(); last++ ) {
+    if ( ! ExtrusionMatches( first, last ) )
+      break;
+
+    double dx = run[ last ].x - sx, dy = run[ last ].y - sy;
+    double length = hypot( dx, dy );
+    if ( length < min_move )
+      break;
+
+    // Points in between close to the line and in order along it
+    double along = 0.0;
+    size_t i;
+    for ( i = first; i < last; i++ ) {
+      double px = run[ i ].x - sx, py = run[ i ].y - sy;
+      double t = ( px * dx + py * dy ) / length;
+      double dist = fabs( px * dy - py * dx ) / length;
+      if ( dist > options.tolerance || t < along || t > length )
+	break;
+      along = t;
+    }
+    if ( i < last )
+      break;
+  }
+
+  return last - first;
+}
+
+// Moves from first on that lie on an arc with center cx, cy, 0 if there
+// are less than 3
+size_t PreprocessPrintJob::ArcMoves( size_t first, double &cx, double &cy ) {
+  double sx = first == 0 ? run_x : run[ first - 1 ].x;
+  double sy = first == 0 ? run_y : run[ first - 1 ].y;
+  size_t moves = 0;
+
+  for ( size_t last = first + 2; last < run.size(); last++ ) {
+    if ( ! ExtrusionMatches( first, last ) )
+      break;
+
+    // Circle through start, middle and end point
+    const Move &mid = run[ ( first + last ) / 2 ];
+    const Move &end = run[ last ];
+    double bx = mid.x - sx, by = mid.y - sy;
+    double ex = end.x - sx, ey = end.y - sy;
+    double d = 2.0 * ( bx * ey - by * ex );
+    if ( fabs( d ) < min_move )
+      break;
+
+    double b_sq = bx * bx + by * by, e_sq = ex * ex + ey * ey;
+    double ox = sx + ( ey * b_sq - by * e_sq ) / d;
+    double oy = sy + ( bx * e_sq - ex * b_sq ) / d;
+
+    if ( ! ArcFits( first, last, ox, oy ) ) {
+      // Maybe the best fit through all points does
+      if ( options.arc_fitter == NULL )
+	break;
+
+      vector<double> px( 1, sx ), py( 1, sy );
+      for ( size_t i = first; i <= last; i++ ) {
+	px.push_back( run[ i ].x );
+	py.push_back( run[ i ].y );
+      }
+      double radius = hypot( sx - ox, sy - oy ), radius_sq;
+      double sq_error = px.size() * 2.0 * radius * options.tolerance;
+      if ( ! options.arc_fitter( px, py, sq_error, ox, oy, radius_sq ) ||
+	   ! ArcFits( first, last, ox, oy ) )
+	break;
+    }
+
+    moves = last - first + 1;
+    cx = ox;
+    cy = oy;
+  }
+
+  return moves;
+}
+
+// All points on the circle around cx, cy, all moves turning the same way
+// by less than 90 degrees, and none of the chords too far from the arc
+bool PreprocessPrintJob::ArcFits( size_t first, size_t last, double cx, double cy ) {
+  double sx = first == 0 ? run_x : run[ first - 1 ].x;
+  double sy = first == 0 ? run_y : run[ first - 1 ].y;
+  double radius = hypot( sx - cx, sy - cy );
+  double sweep = 0.0;
+  int turn = 0;
+
+  // Very large circles are lines
+  if ( radius > 1000.0 )
+    return false;
+
+  double px = sx - cx, py = sy - cy;
+  for ( size_t i = first; i <= last; i++ ) {
+    double qx = run[ i ].x - cx, qy = run[ i ].y - cy;
+    if ( fabs( hypot( qx, qy ) - radius ) > options.tolerance )
+      return false;
+
+    double cross = px * qy - py * qx;
+    double angle = atan2( cross, px * qx + py * qy );
+    if ( cross == 0.0 || fabs( angle ) >= M_PI / 2 )
+      return false;
+    if ( turn == 0 )
+      turn = cross > 0 ? 1 : -1;
+    else if ( ( cross > 0 ? 1 : -1 ) != turn )
+      return false;
+
+    double half_chord = run[ i ].len / 2;
+    if ( radius - sqrt( radius * radius - half_chord * half_chord ) > options.tolerance )
+      return false;
+
+    sweep += fabs( angle );
+    px = qx;
+    py = qy;
+  }
+
+  // Not a full circle, a G2/G3 ending at the start point is one
+  return sweep < 2 * M_PI - 0.1;
+}
+
+void PreprocessPrintJob::EmitPiece( size_t first, size_t last, bool arc,
+				    double cx, double cy ) {
+  double sx = first == 0 ? run_x : run[ first - 1 ].x;
+  double sy = first == 0 ? run_y : run[ first - 1 ].y;
+  const Move &end = run[ last ];
+  bool abs_e = absolute && absolute_e;
+  string out;
+
+  if ( arc ) {
+    double cross = ( sx - cx ) * ( run[ first ].y - cy ) - ( sy - cy ) * ( run[ first ].x - cx );
+    out = cross > 0 ? "G3" : "G2";
+    out += " X" + end.x_text + " Y" + end.y_text +
+      " I" + FormatNumber( cx - sx, 4 ) + " J" + FormatNumber( cy - sy, 4 );
+  } else {
+    out = run_g;
+    if ( ! ( end.x == sx && options.drop_unchanged ) )
+      out += " X" + end.x_text;
+    if ( ! ( end.y == sy && options.drop_unchanged ) )
+      out += " Y" + end.y_text;
+  }
+
+  if ( run_extruding ) {
+    double e = 0.0;
+    for ( size_t i = first; i <= last; i++ )
+      e += run[ i ].e;
+
+    out += " E" + ( abs_e ? end.e_text : FormatNumber( e, 5 ) );
+    pos[ E ] = abs_e ? end.e_end : pos[ E ] + e;
+  } else if ( ! end.e_text.empty() && ! options.drop_unchanged )
+    out += " E" + end.e_text;
+
+  string f_text;
+  for ( size_t i = first; i <= last; i++ )
+    if ( ! run[ i ].f_text.empty() )
+      f_text = run[ i ].f_text;
+  if ( ! f_text.empty() &&
+       ! ( known[ F ] && pos[ F ] == run_f && options.drop_feedrate ) )
+    out += " F" + f_text;
+  pos[ F ] = run_f;
+  known[ F ] = true;
+
+  pos[ X ] = end.x;
+  pos[ Y ] = end.y;
+
+  size_t base = output.size() - run.size();
+  output[ base + last ].text = out;
+}
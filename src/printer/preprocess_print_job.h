@@ -0,0 +1,154 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <limits.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "print_job.h"
+
+using namespace std;
+
+// Rewrites the lines of another print job while they are sent, to get more
+// motion through the serial link: comments, axes that do not move and
+// repeated F values are dropped, and runs of short G0/G1 moves in the XY
+// plane are merged into single moves (where they are collinear) or arcs
+// G2/G3 (where they lie on a circle), within tolerance.
+//
+// Line numbers stay the same as in the source job, so that progress and
+// SeekLine() still refer to the GCode shown to the user.  Lines merged into
+// a later one, and moves that do nothing, are returned as empty lines,
+// which are not sent.  To merge, up to max_run lines are read ahead.
+//
+// Moves are only merged while the current position is known, i.e. after
+// absolute moves or a G92, and in absolute mode.  The print is assumed to
+// start in absolute mode (G90) as RepSnapper's GCode does.  Lines the
+// preprocessor does not understand are passed on and end a run, and unless
+// they are M codes the position is unknown after them.
+class PreprocessPrintJob : public PrintJob {
+ public:
+  // Fits a circle to the points, returns false if the sum of the
+  // differences of squared radius and squared distance of the points from
+  // the center exceeds sq_error.  Like fit_arc() in the slicer.
+  typedef bool (*ArcFitter)( const vector<double> &x, const vector<double> &y,
+			     double sq_error, double &center_x, double &center_y,
+			     double &radius_sq );
+
+  struct Options {
+    bool strip_comments;
+    bool drop_unchanged; // axes moving to where they are
+    bool drop_feedrate; // F values equal to the current feedrate
+    bool merge_lines; // collinear moves
+    bool fit_arcs; // moves on a circle into G2/G3
+    bool relative_e; // E mode at the start, until M82 or M83
+    double tolerance; // mm, maximum distance of the result from the original path
+    double extrusion_tolerance; // maximum relative change of extrusion per mm in a run
+    unsigned long max_run; // moves merged at most
+    ArcFitter arc_fitter; // refines the arcs if set
+
+    Options();
+  };
+
+  // Takes ownership of source.  Nothing is merged beyond stop_line.
+  PreprocessPrintJob( PrintJob *source, const Options &options,
+		      unsigned long stop_line = ULONG_MAX );
+  virtual ~PreprocessPrintJob();
+
+  virtual bool IsValid( void ) { return source->IsValid(); };
+  virtual unsigned long LineCount( void ) { return source->LineCount(); };
+  virtual bool SeekLine( unsigned long line );
+  virtual const char *NextLine( size_t &len );
+  virtual bool AtEnd( void );
+  virtual unsigned long BytePosition( void ) { return byte_pos; };
+
+  // Total bytes of the lines read from the source and returned
+  unsigned long SourceBytes( void ) const { return source_bytes; };
+  unsigned long OutputBytes( void ) const { return output_bytes; };
+
+ private:
+  enum Axis { X, Y, Z, E, F, AXES };
+
+  struct Word {
+    char letter;
+    string text;
+    double value;
+  };
+
+  struct Output {
+    string text;
+    unsigned long byte_pos; // source position after the line
+  };
+
+  // A move in a run
+  struct Move {
+    double x, y; // end point
+    double len;
+    double e; // extruded along the move
+    double e_end; // E after the move, in absolute mode
+    string x_text, y_text, e_text, f_text; // as given, empty if not
+  };
+
+  PreprocessPrintJob( const PreprocessPrintJob & );
+  PreprocessPrintJob &operator=( const PreprocessPrintJob & );
+
+  PrintJob *source;
+  const Options options;
+  unsigned long stop_line;
+
+  unsigned long line; // source line number of the next line read
+  unsigned long byte_pos;
+  unsigned long source_bytes, output_bytes;
+
+  deque<Output> output; // ready lines first, then those of the run
+  size_t ready; // lines at the start of output that are ready
+  string current; // line last returned
+
+  // Machine state after the ready lines
+  bool known[ AXES ];
+  double pos[ AXES ];
+  bool absolute, absolute_e, inches;
+
+  // Moves in the XY plane not yet in output, all with the same G word and
+  // feedrate and all extruding or not, the first starting from run_x, run_y
+  vector<Move> run;
+  string run_g;
+  double run_f;
+  bool run_extruding;
+  double run_x, run_y;
+
+  static bool ParseWords( const string &line, vector<Word> &words );
+  static bool IsMove( const vector<Word> &words );
+
+  void Reset( void );
+  void ProcessLine( const char *text, size_t len );
+  void ProcessMove( const vector<Word> &words );
+  void UpdateState( bool parsed, const string &command, const vector<Word> &words );
+  void ForgetPosition( void );
+  void Emit( const string &text );
+
+  void FlushRun( void ); // Turns the run into lines
+  bool ExtrusionMatches( size_t a, size_t b );
+  size_t LineMoves( size_t first );
+  size_t ArcMoves( size_t first, double &cx, double &cy );
+  bool ArcFits( size_t first, size_t last, double cx, double cy );
+  void EmitPiece( size_t first, size_t last, bool arc, double cx, double cy );
+};
@@ -0,0 +1,490 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "stdafx.h"
+#else
+#define _( t ) t
+#endif
+
+#include <sstream>
+#include <string.h>
+
+#include "print_farm.h"
+#include "line_encoder.h"
+
+PrintFarm::Options::Options() :
+  poll_ms( 100 ),
+  temp_interval_ms( 5000 ),
+  reconnect_ms( 10000 ),
+  log_comm( false ) {
+}
+
+PrintFarm::PrinterConfig::PrinterConfig() :
+  baudrate( 115200 ),
+  send_window( 0 ),
+  binary( false ) {
+}
+
+const char *PrintFarm::Status::StateName( State state ) {
+  switch ( state ) {
+  case OFFLINE: return _("offline");
+  case IDLE: return _("idle");
+  case PRINTING: return _("printing");
+  case PAUSED: return _("paused");
+  }
+  return "";
+}
+
+PrintFarm::PrintFarm( const Options &options ) :
+  options( options ),
+  log( log_buffer_size, false, _("*** Log overflow ***\n"), true ) {
+  mutex_init( &mutex );
+  running = false;
+  stop = false;
+}
+
+PrintFarm::~PrintFarm() {
+  Stop();
+
+  for ( size_t i = 0; i < machines.size(); i++ )
+    delete machines[ i ];
+
+  mutex_destroy( &mutex );
+}
+
+bool PrintFarm::AddPrinter( const PrinterConfig &config ) {
+  mutex_lock( &mutex );
+
+  if ( running || Find( config.name ) != NULL ) {
+    mutex_unlock( &mutex );
+    return false;
+  }
+
+  Machine *machine = new Machine();
+  machine->config = config;
+  machine->has_job = false;
+  machine->paused = false;
+  machine->pause_requested = machine->resume_requested = machine->cancel_requested = false;
+  machine->connect_tried = false;
+
+  Status &status = machine->status;
+  status.name = config.name;
+  status.device = config.device;
+  status.state = OFFLINE;
+  status.line = status.lines = 0;
+  status.queued = status.done = status.failed = 0;
+  status.lines_sent = status.resends = 0;
+  status.latency_p50 = status.latency_p99 = 0;
+
+  machines.push_back( machine );
+
+  mutex_unlock( &mutex );
+  return true;
+}
+
+bool PrintFarm::Start( void ) {
+  mutex_lock( &mutex );
+
+  if ( running ) {
+    mutex_unlock( &mutex );
+    return true;
+  }
+
+  stop = false;
+
+  int rc;
+  if ( ( rc = thread_create( &thread, ThreadMainStatic, this ) ) != 0 ) {
+    mutex_unlock( &mutex );
+    ostringstream os;
+    os << _("Error creating print farm thread") << ": " << strerror( rc ) << endl;
+    Log( NULL, os.str() );
+    return false;
+  }
+
+  running = true;
+
+  mutex_unlock( &mutex );
+  return true;
+}
+
+void PrintFarm::Stop( void ) {
+  mutex_lock( &mutex );
+
+  if ( ! running ) {
+    mutex_unlock( &mutex );
+    return;
+  }
+
+  stop = true;
+  mutex_unlock( &mutex );
+
+  thread_join( thread );
+
+  // The controller is gone, nobody else touches the printers
+  for ( size_t i = 0; i < machines.size(); i++ ) {
+    Machine *machine = machines[ i ];
+
+    machine->serial.Disconnect();
+
+    mutex_lock( &mutex );
+    if ( machine->has_job )
+      EndJob( machine, false, _("stopped") );
+    while ( ! machine->queue.empty() ) {
+      delete machine->queue.front().job;
+      machine->queue.pop_front();
+    }
+    machine->status.queued = 0;
+    machine->status.state = OFFLINE;
+    machine->connect_tried = false;
+    mutex_unlock( &mutex );
+  }
+
+  mutex_lock( &mutex );
+  running = false;
+  mutex_unlock( &mutex );
+}
+
+bool PrintFarm::QueueJob( const string &printer, const string &name, PrintJob *job ) {
+  mutex_lock( &mutex );
+
+  Machine *machine = Find( printer );
+  if ( machine == NULL ) {
+    mutex_unlock( &mutex );
+    delete job;
+    return false;
+  }
+
+  Job entry;
+  entry.name = name;
+  entry.job = job;
+  machine->queue.push_back( entry );
+  machine->status.queued = machine->queue.size();
+
+  mutex_unlock( &mutex );
+
+  Log( machine, string( _("Queued") ) + " " + name + "\n" );
+  return true;
+}
+
+bool PrintFarm::Pause( const string &printer ) {
+  mutex_lock( &mutex );
+  Machine *machine = Find( printer );
+  if ( machine != NULL ) {
+    machine->pause_requested = true;
+    machine->resume_requested = false;
+  }
+  mutex_unlock( &mutex );
+
+  return machine != NULL;
+}
+
+bool PrintFarm::Resume( const string &printer ) {
+  mutex_lock( &mutex );
+  Machine *machine = Find( printer );
+  if ( machine != NULL ) {
+    machine->resume_requested = true;
+    machine->pause_requested = false;
+  }
+  mutex_unlock( &mutex );
+
+  return machine != NULL;
+}
+
+bool PrintFarm::Cancel( const string &printer ) {
+  mutex_lock( &mutex );
+  Machine *machine = Find( printer );
+  if ( machine != NULL )
+    machine->cancel_requested = true;
+  mutex_unlock( &mutex );
+
+  return machine != NULL;
+}
+
+void PrintFarm::GetStatus( vector<Status> &status ) {
+  mutex_lock( &mutex );
+
+  status.clear();
+  for ( size_t i = 0; i < machines.size(); i++ )
+    status.push_back( machines[ i ]->status );
+
+  mutex_unlock( &mutex );
+}
+
+bool PrintFarm::ReadFinishedJob( FinishedJob &job ) {
+  mutex_lock( &mutex );
+
+  bool ret = ! finished.empty();
+  if ( ret ) {
+    job = finished.front();
+    finished.pop_front();
+  }
+
+  mutex_unlock( &mutex );
+  return ret;
+}
+
+string PrintFarm::ReadLog( bool wait ) {
+  return log.Read( wait );
+}
+
+PrintFarm::Machine *PrintFarm::Find( const string &name ) {
+  for ( size_t i = 0; i < machines.size(); i++ )
+    if ( machines[ i ]->config.name == name )
+      return machines[ i ];
+
+  return NULL;
+}
+
+void PrintFarm::Log( const Machine *machine, const string &text ) {
+  if ( machine == NULL ) {
+    log.Write( text.c_str(), false );
+    return;
+  }
+
+  // Every line gets the name, the serial log comes in chunks of lines
+  string prefixed;
+  size_t start = 0;
+  while ( start < text.length() ) {
+    size_t end = text.find( '\n', start );
+    end = ( end == string::npos ) ? text.length() : end + 1;
+
+    prefixed += machine->config.name;
+    prefixed += ": ";
+    prefixed.append( text, start, end - start );
+    start = end;
+  }
+  if ( prefixed.length() > 0 && prefixed[ prefixed.length() - 1 ] != '\n' )
+    prefixed += '\n';
+
+  log.Write( prefixed.c_str(), false );
+}
+
+////////////////////////////////////////////////////////////////////////////
+//  Controller Thread Functions
+////////////////////////////////////////////////////////////////////////////
+
+void *PrintFarm::ThreadMainStatic( void *arg ) {
+  PrintFarm *farm = ( PrintFarm * ) arg;
+
+  return farm->ThreadMain();
+}
+
+void *PrintFarm::ThreadMain( void ) {
+  const ntime_t sleep_time = { ( time_t ) ( options.poll_ms / 1000 ),
+			       ( long ) ( options.poll_ms % 1000 ) * 1000 * 1000 };
+
+  while ( true ) {
+    mutex_lock( &mutex );
+    bool quit = stop;
+    mutex_unlock( &mutex );
+
+    if ( quit )
+      break;
+
+    ntime_t now;
+    ntime_get( &now );
+
+    for ( size_t i = 0; i < machines.size(); i++ )
+      Poll( machines[ i ], now );
+
+    nsleep( &sleep_time );
+  }
+
+  return NULL;
+}
+
+void PrintFarm::Poll( Machine *machine, const ntime_t &now ) {
+  ThreadedPrinterSerial &serial = machine->serial;
+  string str;
+
+  if ( ! serial.IsConnected() )
+    Connect( machine, now );
+
+  // Responses only come from our M105s
+  TemperatureReport report, temperature;
+  bool have_temperature = false;
+  while ( ( str = serial.ReadResponse() ) != "" ) {
+    if ( report.Parse( str.data(), str.length() ) ) {
+      temperature = report;
+      have_temperature = true;
+    }
+  }
+
+  while ( ( str = serial.ReadLog() ) != "" ) {
+    if ( options.log_comm )
+      Log( machine, str );
+  }
+
+  string error;
+  while ( ( str = serial.ReadErrorLog() ) != "" ) {
+    error = str;
+    Log( machine, str );
+  }
+
+  bool connected = serial.IsConnected();
+
+  // Take the requests and the next job.  The printer is only touched by
+  // this thread, so that it is safe to work on it without the mutex.
+  mutex_lock( &mutex );
+
+  bool pause = machine->pause_requested;
+  bool resume = machine->resume_requested;
+  bool cancel = machine->cancel_requested;
+  machine->pause_requested = machine->resume_requested = machine->cancel_requested = false;
+
+  if ( machine->has_job && ! connected )
+    EndJob( machine, false, _("connection lost") );
+
+  bool has_job = machine->has_job;
+  bool paused = machine->paused;
+
+  Job next;
+  next.job = NULL;
+  if ( ! has_job && connected && ! machine->queue.empty() ) {
+    next = machine->queue.front();
+    machine->queue.pop_front();
+  }
+
+  mutex_unlock( &mutex );
+
+  bool ended = false, ok = false;
+  const char *why = NULL;
+
+  if ( has_job && cancel ) {
+    serial.StopPrinting( true );
+    ended = true;
+    why = _("cancelled");
+  } else if ( has_job && pause && ! paused ) {
+    if ( serial.StopPrinting( true ) ) {
+      paused = true;
+      Log( machine, string( _("Paused") ) + "\n" );
+    }
+  } else if ( has_job && resume && paused ) {
+    if ( serial.ContinuePrinting( true ) ) {
+      paused = false;
+      Log( machine, string( _("Resumed") ) + "\n" );
+    }
+  } else if ( has_job && ! paused && ! serial.IsPrinting() ) {
+    ended = true;
+    ok = serial.GetPrintingProgress() >= serial.GetTotalPrintingLines();
+    why = ok ? _("done") : _("stopped");
+  }
+
+  bool started = false;
+  if ( next.job != NULL ) {
+    // Deletes the job if it cannot start
+    started = serial.StartPrinting( next.job );
+    if ( started )
+      Log( machine, string( _("Printing") ) + " " + next.name + "\n" );
+  }
+
+  if ( options.temp_interval_ms > 0 && connected &&
+       ntime_diff_us( &machine->last_temp_query, &now ) / 1000 >= ( long ) options.temp_interval_ms ) {
+    machine->last_temp_query = now;
+    serial.Send( "M105" );
+  }
+
+  ThreadedPrinterSerial::SendStats stats;
+  serial.GetSendStats( stats );
+  unsigned long line = serial.GetPrintingProgress();
+  unsigned long lines = serial.GetTotalPrintingLines();
+
+  mutex_lock( &mutex );
+
+  machine->paused = paused;
+  if ( ended )
+    EndJob( machine, ok, why );
+
+  if ( next.job != NULL ) {
+    machine->status.job = next.name;
+    machine->has_job = true;
+    machine->paused = false;
+    if ( ! started )
+      EndJob( machine, false, _("cannot be printed") );
+  }
+
+  Status &status = machine->status;
+  if ( ! connected )
+    status.state = OFFLINE;
+  else if ( ! machine->has_job )
+    status.state = IDLE;
+  else
+    status.state = machine->paused ? PAUSED : PRINTING;
+
+  status.line = line;
+  status.lines = lines;
+  status.queued = machine->queue.size();
+  if ( have_temperature )
+    status.temperature = temperature;
+  if ( error != "" )
+    status.error = error.substr( 0, error.find_last_not_of( "\r\n" ) + 1 );
+  status.lines_sent = stats.lines;
+  status.resends = stats.resends;
+  status.latency_p50 = stats.LatencyPercentile( 50 );
+  status.latency_p99 = stats.LatencyPercentile( 99 );
+
+  mutex_unlock( &mutex );
+}
+
+void PrintFarm::Connect( Machine *machine, const ntime_t &now ) {
+  if ( machine->connect_tried &&
+       ntime_diff_us( &machine->last_connect, &now ) / 1000 < ( long ) options.reconnect_ms )
+    return;
+
+  bool retry = machine->connect_tried;
+  machine->connect_tried = true;
+  machine->last_connect = now;
+  machine->last_temp_query = now;
+
+  ThreadedPrinterSerial &serial = machine->serial;
+  const PrinterConfig &config = machine->config;
+
+  // Joins the helper of a connection that broke
+  serial.Disconnect();
+
+  serial.SetSendWindow( config.send_window );
+  serial.SetLineEncoder( config.binary ? new BinaryLineEncoder() : NULL );
+
+  if ( serial.Connect( config.device, config.baudrate ) )
+    Log( machine, string( _("Connected to") ) + " " + config.device + "\n" );
+  else if ( ! retry )
+    Log( machine, string( _("Cannot connect to") ) + " " + config.device + "\n" );
+}
+
+void PrintFarm::EndJob( Machine *machine, bool ok, const char *why ) {
+  if ( ! machine->has_job )
+    return;
+
+  machine->has_job = false;
+  machine->paused = false;
+
+  if ( ok )
+    machine->status.done++;
+  else
+    machine->status.failed++;
+
+  FinishedJob job;
+  job.printer = machine->config.name;
+  job.job = machine->status.job;
+  job.ok = ok;
+  finished.push_back( job );
+
+  Log( machine, machine->status.job + " " + why + "\n" );
+}
@@ -0,0 +1,169 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "thread.h"
+#include "thread_buffer.h"
+#include "threaded_printer_serial.h"
+#include "print_job.h"
+#include "temperature_report.h"
+
+using namespace std;
+
+// Drives many printers from one process without a GUI, for print farms.
+// Every printer is a ThreadedPrinterSerial with its own queue of print
+// jobs, which are printed one after the other.
+//
+// One controller thread serves all printers: every poll_ms it drains their
+// responses and logs, polls the temperatures, (re)connects, starts the next
+// job of idle printers and updates the status, which any thread can read
+// with GetStatus().  The lines themselves are still sent by the helper
+// thread of each ThreadedPrinterSerial, which sleeps in poll() while its
+// printer is busy, so that a slow or hanging printer never holds up the
+// others.
+//
+// All methods may be called from any thread, ReadLog() from one at a time.
+class PrintFarm {
+ public:
+  struct Options {
+    unsigned long poll_ms; // controller period
+    unsigned long temp_interval_ms; // M105 period, 0 for none
+    unsigned long reconnect_ms; // retry period of lost connections
+    bool log_comm; // put all lines sent and received into the log
+
+    Options();
+  };
+
+  struct PrinterConfig {
+    string name;
+    string device;
+    int baudrate;
+    unsigned long send_window; // see ThreadedPrinterSerial::SetSendWindow()
+    bool binary; // send binary lines (BinaryLineEncoder)
+
+    PrinterConfig();
+  };
+
+  enum State { OFFLINE, IDLE, PRINTING, PAUSED };
+
+  struct Status {
+    string name;
+    string device;
+    State state;
+    string job; // printing or paused, else the last one
+    unsigned long line; // progress of job
+    unsigned long lines;
+    unsigned long queued; // jobs waiting
+    unsigned long done; // jobs printed to the end
+    unsigned long failed; // jobs cancelled or broken off
+    TemperatureReport temperature; // last report
+    string error; // last error
+    unsigned long lines_sent; // acknowledged by the printer, all jobs
+    unsigned long resends;
+    double latency_p50; // ms from sending a line to its "ok"
+    double latency_p99;
+
+    static const char *StateName( State state );
+  };
+
+  struct FinishedJob {
+    string printer;
+    string job;
+    bool ok; // printed to the end
+  };
+
+  PrintFarm( const Options &options = Options() );
+  ~PrintFarm(); // Stop()s
+
+  bool AddPrinter( const PrinterConfig &config );
+  // Before Start() only.  Returns false if the name is taken.
+
+  bool Start( void ); // Connect the printers and start the controller
+  void Stop( void ); // Stop all prints and disconnect.  Queued jobs are dropped.
+
+  bool QueueJob( const string &printer, const string &name, PrintJob *job );
+  // Appends job to the queue of printer, taking ownership.  Returns false,
+  // and deletes job, if there is no such printer.
+
+  // Act on the current job of printer in the next controller period
+  bool Pause( const string &printer );
+  bool Resume( const string &printer );
+  bool Cancel( const string &printer ); // counts as failed
+
+  void GetStatus( vector<Status> &status );
+
+  bool ReadFinishedJob( FinishedJob &job );
+  // Returns jobs that ended in the order they ended, false if there are none
+
+  string ReadLog( bool wait = false );
+  // Events, errors and (with log_comm) the communication of all printers,
+  // every line starting with the name of the printer.  "" if wait is false
+  // and there is nothing.  Lines are dropped while the log is full.
+
+ private:
+  struct Job {
+    string name;
+    PrintJob *job;
+  };
+
+  // A printer and its controller state, mutex required unless noted
+  struct Machine {
+    PrinterConfig config;
+    ThreadedPrinterSerial serial; // thread-safe itself
+    deque<Job> queue;
+    bool has_job; // status.job is printing or paused
+    bool paused;
+    bool pause_requested, resume_requested, cancel_requested;
+    ntime_t last_temp_query; // controller only
+    ntime_t last_connect; // controller only
+    bool connect_tried; // controller only
+    Status status;
+  };
+
+  static const unsigned long log_buffer_size = 64 * 1024;
+
+  const Options options;
+
+  mutex_t mutex;
+  vector<Machine *> machines; // fixed after Start()
+  deque<FinishedJob> finished;
+  bool running; // mutex required
+  bool stop; // mutex required
+
+  thread_t thread;
+  LockFreeThreadBuffer log;
+
+  PrintFarm( const PrintFarm & );
+  PrintFarm &operator=( const PrintFarm & );
+
+  Machine *Find( const string &name ); // mutex required
+  void Log( const Machine *machine, const string &text ); // text ends in a newline
+
+  static void *ThreadMainStatic( void *arg );
+  void *ThreadMain( void );
+
+  void Poll( Machine *machine, const ntime_t &now ); // controller only
+  void Connect( Machine *machine, const ntime_t &now ); // controller only, mutex must not be held
+  void EndJob( Machine *machine, bool ok, const char *why ); // mutex required
+};
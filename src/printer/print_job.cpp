@@ -0,0 +1,302 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include <string.h>
+#include <algorithm>
+
+#include "print_job.h"
+
+// Lines in text, a last line without newline counts as well
+static unsigned long CountLines( const char *text, size_t len ) {
+  unsigned long lines = 0;
+  const char *end = text + len;
+  const char *loc;
+
+  for ( loc = text; ( loc = ( const char * ) memchr( loc, '\n', end - loc ) ) != NULL; loc++ )
+    lines++;
+
+  if ( len > 0 && text[ len - 1 ] != '\n' )
+    lines++;
+
+  return lines;
+}
+
+////////////////////////////////////////////////////////////////////////////
+//  SharedText
+////////////////////////////////////////////////////////////////////////////
+
+SharedText::SharedText( string &str ) {
+  text.swap( str );
+  lines = CountLines( text.data(), text.length() );
+
+  line_index.reserve( lines / index_step + 1 );
+  IndexLines( 0, 1, lines + 1 );
+
+  refs = 1;
+  mutex_init( &mutex );
+}
+
+SharedText::SharedText( const SharedText &old, unsigned long first, unsigned long count, const string &replacement ) {
+  const size_t from = old.LineOffset( first );
+  const size_t to = old.LineOffset( first + count );
+  text.reserve( old.text.length() - ( to - from ) + replacement.length() );
+  text.append( old.text, 0, from );
+  text.append( replacement );
+  text.append( old.text, to, string::npos );
+
+  const unsigned long new_count = CountLines( replacement.data(), replacement.length() );
+  lines = old.lines - count + new_count;
+
+  line_index.reserve( old.line_index.size() + new_count / index_step + 1 );
+  vector<IndexEntry>::const_iterator entry = old.line_index.begin();
+  for ( ; entry != old.line_index.end() && entry->first < first; entry++ )
+    line_index.push_back( *entry );
+
+  // With the line after them, for an entry up to each later line
+  IndexLines( from, first, min( first + new_count + 1, lines + 1 ) );
+
+  for ( ; entry != old.line_index.end() && entry->first <= first + count; entry++ )
+    ;
+  for ( ; entry != old.line_index.end(); entry++ )
+    line_index.push_back( IndexEntry( entry->first - count + new_count,
+				      entry->second - ( to - from ) + replacement.length() ) );
+
+  refs = 1;
+  mutex_init( &mutex );
+}
+
+void SharedText::IndexLines( size_t pos, unsigned long line, unsigned long end_line ) {
+  const char *start = text.data();
+  const char *end = start + text.length();
+  const char *loc = start + pos;
+  for ( ; line < end_line; line++ ) {
+    if ( line_index.empty() || line - line_index.back().first >= index_step )
+      line_index.push_back( IndexEntry( line, loc - start ) );
+    loc = ( const char * ) memchr( loc, '\n', end - loc );
+    if ( loc == NULL )
+      break;
+    loc++;
+  }
+}
+
+SharedText::~SharedText() {
+  mutex_destroy( &mutex );
+}
+
+size_t SharedText::LineOffset( unsigned long line ) const {
+  if ( line < 1 )
+    return 0;
+  if ( line > lines )
+    return text.length();
+
+  // The last entry up to line, there is one for line 1
+  vector<IndexEntry>::const_iterator entry =
+    upper_bound( line_index.begin(), line_index.end(), IndexEntry( line, text.length() ) ) - 1;
+  size_t pos = entry->second;
+  for ( unsigned long count = line - entry->first; count > 0; count-- )
+    pos = text.find( '\n', pos ) + 1;
+
+  return pos;
+}
+
+SharedText *SharedText::Ref( void ) {
+  mutex_lock( &mutex );
+  refs++;
+  mutex_unlock( &mutex );
+  return this;
+}
+
+void SharedText::Unref( void ) {
+  mutex_lock( &mutex );
+  bool last = --refs == 0;
+  mutex_unlock( &mutex );
+
+  if ( last )
+    delete this;
+}
+
+////////////////////////////////////////////////////////////////////////////
+//  StringPrintJob
+////////////////////////////////////////////////////////////////////////////
+
+StringPrintJob::StringPrintJob( string &str ) {
+  text = new SharedText( str );
+  pos = 0;
+}
+
+StringPrintJob::StringPrintJob( SharedText *shared_text ) {
+  text = shared_text->Ref();
+  pos = 0;
+}
+
+StringPrintJob::~StringPrintJob() {
+  text->Unref();
+}
+
+bool StringPrintJob::SeekLine( unsigned long line ) {
+  if ( line > 1 && line > text->LineCount() )
+    return false;
+
+  pos = text->LineOffset( line );
+
+  return true;
+}
+
+const char *StringPrintJob::NextLine( size_t &len ) {
+  const string &str = text->Text();
+
+  if ( pos >= str.length() )
+    return NULL;
+
+  const char *start = str.data() + pos;
+  const char *stop = ( const char * ) memchr( start, '\n', str.length() - pos );
+
+  if ( stop == NULL ) {
+    len = str.length() - pos;
+    pos = str.length();
+  } else {
+    len = stop - start;
+    pos += len + 1;
+  }
+
+  return start;
+}
+
+////////////////////////////////////////////////////////////////////////////
+//  FilePrintJob
+////////////////////////////////////////////////////////////////////////////
+
+FilePrintJob::FilePrintJob( const string &filename ) :
+  buffer( chunk_size ) {
+  lines = 0;
+  buf_start = buf_end = 0;
+  buf_offset = 0;
+  eof = false;
+
+  if ( ( file = fopen( filename.c_str(), "rb" ) ) == NULL )
+    return;
+
+  // Count the lines and build the index
+  unsigned long newlines = 0;
+  long offset = 0;
+  size_t num;
+  char last = '\n';
+
+  line_index.push_back( 0 );
+  while ( ( num = fread( &buffer[ 0 ], 1, buffer.size(), file ) ) > 0 ) {
+    const char *start = &buffer[ 0 ];
+    const char *end = start + num;
+    const char *loc;
+
+    for ( loc = start; ( loc = ( const char * ) memchr( loc, '\n', end - loc ) ) != NULL; loc++ ) {
+      if ( ++newlines % index_step == 0 )
+	line_index.push_back( offset + ( loc - start ) + 1 );
+    }
+
+    offset += num;
+    last = end[ -1 ];
+  }
+  lines = newlines + ( last != '\n' ? 1 : 0 );
+
+  SeekLine( 1 );
+}
+
+FilePrintJob::~FilePrintJob() {
+  if ( file != NULL )
+    fclose( file );
+}
+
+bool FilePrintJob::Fill( void ) {
+  // Keep the partial line at the start of the buffer
+  if ( buf_start > 0 ) {
+    memmove( &buffer[ 0 ], &buffer[ buf_start ], buf_end - buf_start );
+    buf_offset += buf_start;
+    buf_end -= buf_start;
+    buf_start = 0;
+  }
+
+  // Very long line
+  if ( buf_end == buffer.size() )
+    buffer.resize( buffer.size() * 2 );
+
+  size_t num = fread( &buffer[ buf_end ], 1, buffer.size() - buf_end, file );
+  if ( num == 0 ) {
+    eof = true;
+    return false;
+  }
+
+  buf_end += num;
+  return true;
+}
+
+bool FilePrintJob::SeekLine( unsigned long line ) {
+  if ( file == NULL || ( line > 1 && line > lines ) )
+    return false;
+  if ( line < 1 )
+    line = 1;
+
+  unsigned long index = ( line - 1 ) / index_step;
+  if ( fseek( file, line_index[ index ], SEEK_SET ) != 0 )
+    return false;
+
+  buf_offset = line_index[ index ];
+  buf_start = buf_end = 0;
+  eof = false;
+
+  size_t len;
+  for ( unsigned long count = index * index_step + 1; count < line; count++ )
+    NextLine( len );
+
+  return true;
+}
+
+const char *FilePrintJob::NextLine( size_t &len ) {
+  if ( file == NULL )
+    return NULL;
+
+  while ( true ) {
+    const char *start = &buffer[ buf_start ];
+    const char *stop = ( const char * ) memchr( start, '\n', buf_end - buf_start );
+
+    if ( stop != NULL ) {
+      len = stop - start;
+      buf_start += len + 1;
+      return start;
+    }
+
+    if ( eof || ! Fill() ) {
+      // Last line without newline
+      if ( buf_start >= buf_end )
+	return NULL;
+      len = buf_end - buf_start;
+      start = &buffer[ buf_start ];
+      buf_start = buf_end;
+      return start;
+    }
+  }
+}
+
+bool FilePrintJob::AtEnd( void ) {
+  if ( file == NULL )
+    return true;
+  if ( buf_start < buf_end )
+    return false;
+
+  return eof || ! Fill();
+}
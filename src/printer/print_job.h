@@ -0,0 +1,136 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "thread.h"
+
+using namespace std;
+
+// Read-only text shared by reference counting.  The owner of a GCode text
+// hands it to a print job this way without copying it, and may drop or
+// replace it while the job is still printing.
+class SharedText {
+  static const unsigned long index_step = 256;
+  typedef pair< unsigned long, size_t > IndexEntry; // line, offset
+
+  string text;
+  unsigned long lines;
+  vector<IndexEntry> line_index; // line 1 and about every index_step lines after it
+  unsigned long refs; // mutex required
+  mutex_t mutex;
+
+  ~SharedText(); // use Unref()
+  SharedText( const SharedText & );
+  SharedText &operator=( const SharedText & );
+
+  void IndexLines( size_t pos, unsigned long line, unsigned long end_line ); // Lines from line at pos up to end_line
+
+ public:
+  SharedText( string &str ); // Takes over the contents of str, reference count is 1
+  SharedText( const SharedText &old, unsigned long first, unsigned long count, const string &replacement );
+  // Copy of old with count lines from line first on replaced, reference
+  // count is 1.  Only replacement is scanned for lines, the later ones are
+  // moved in the index.  replacement must end in a newline unless it
+  // replaces the last line.
+
+  SharedText *Ref( void );
+  void Unref( void );
+
+  const string &Text( void ) const { return text; };
+  unsigned long LineCount( void ) const { return lines; };
+  size_t LineOffset( unsigned long line ) const;
+  // Offset of line (from 1), the text length for the lines after the last
+};
+
+// Source of the lines of a print, read by the serial helper thread one
+// after the other.  Lines are numbered from 1 and returned without the
+// newline.
+class PrintJob {
+ public:
+  virtual ~PrintJob() {};
+
+  virtual bool IsValid( void ) = 0;
+  virtual unsigned long LineCount( void ) = 0;
+
+  virtual bool SeekLine( unsigned long line ) = 0;
+  // The next line returned will be line.  Returns false if there is no
+  // such line.
+
+  virtual const char *NextLine( size_t &len ) = 0;
+  // Returns the next line and its length, or NULL at the end.
+  // Valid until the next call.
+
+  virtual bool AtEnd( void ) = 0;
+  virtual unsigned long BytePosition( void ) = 0; // Bytes before the next line
+};
+
+// Prints from memory
+class StringPrintJob : public PrintJob {
+  SharedText *text;
+  size_t pos;
+
+ public:
+  StringPrintJob( string &str ); // Takes over the contents of str
+  StringPrintJob( SharedText *shared_text ); // Adds a reference
+  virtual ~StringPrintJob();
+
+  virtual bool IsValid( void ) { return true; };
+  virtual unsigned long LineCount( void ) { return text->LineCount(); };
+  virtual bool SeekLine( unsigned long line );
+  virtual const char *NextLine( size_t &len );
+  virtual bool AtEnd( void ) { return pos >= text->Text().length(); };
+  virtual unsigned long BytePosition( void ) { return pos; };
+};
+
+// Streams from a file, which is never read into memory as a whole.  The
+// file is scanned once on opening to count the lines and to note the
+// offset of every index_step'th line for seeking.
+class FilePrintJob : public PrintJob {
+  static const unsigned long index_step = 1024;
+  static const size_t chunk_size = 64 * 1024;
+
+  FILE *file;
+  unsigned long lines;
+  vector<long> line_index; // file offset of lines 1, 1 + index_step, ...
+
+  vector<char> buffer;
+  size_t buf_start; // start of unread data in buffer
+  size_t buf_end;
+  long buf_offset; // file offset of buffer[ 0 ]
+  bool eof;
+
+  bool Fill( void ); // Read more data, returns false at the end of the file
+
+ public:
+  FilePrintJob( const string &filename );
+  virtual ~FilePrintJob();
+
+  virtual bool IsValid( void ) { return file != NULL; };
+  virtual unsigned long LineCount( void ) { return lines; };
+  virtual bool SeekLine( unsigned long line );
+  virtual const char *NextLine( size_t &len );
+  virtual bool AtEnd( void );
+  virtual unsigned long BytePosition( void ) { return buf_offset + buf_start; };
+};
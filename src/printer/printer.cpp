@@ -20,9 +20,28 @@
 #include "stdafx.h"
 
 #include "printer.h"
+#include "preprocess_print_job.h"
+#include "temperature_report.h"
 #include "model.h"
+#include "slicer/geometry.h"
 #include "../ui/view.h"
 
+// fit_arc() for PreprocessPrintJob
+static bool FitArc( const vector<double> &x, const vector<double> &y, double sq_error,
+		    double &center_x, double &center_y, double &radius_sq ) {
+  vector<Vector2d> points;
+  for ( size_t i = 0; i < x.size(); i++ )
+    points.push_back( Vector2d( x[ i ], y[ i ] ) );
+
+  Vector2d center;
+  if ( ! fit_arc( points, sq_error, center, radius_sq ) )
+    return false;
+
+  center_x = center.x();
+  center_y = center.y();
+  return true;
+}
+
 Printer::Printer( View *view ) {
   m_view = view;
 
@@ -69,6 +88,21 @@ bool Printer::Connect( bool connect ) {
 }
 
 bool Printer::Connect( string device, int baudrate ) {
+  bool binary = false;
+  int window = 0;
+  if ( m_model != NULL ) {
+    try {
+      binary = m_model->settings.get_boolean("Hardware","BinaryGCode");
+    } catch (const Glib::KeyFileError &err) {
+    }
+    try {
+      window = m_model->settings.get_integer("Hardware","SendWindow");
+    } catch (const Glib::KeyFileError &err) {
+    }
+  }
+  SetLineEncoder( binary ? new BinaryLineEncoder() : NULL );
+  SetSendWindow( window > 0 ? window : 0 );
+
   signal_serial_state_changed.emit( SERIAL_CONNECTING );
   bool ret = ThreadedPrinterSerial::Connect( device, baudrate );
   signal_serial_state_changed.emit( ret ? SERIAL_CONNECTED : SERIAL_DISCONNECTED );
@@ -98,13 +132,32 @@ bool Printer::Reset( void ) {
 }
 
 bool Printer::StartPrinting( unsigned long start_line, unsigned long stop_line ) {
-  string commands = m_model->GetGCodeBuffer()->get_text();
-
-  return Printer::StartPrinting( commands, start_line, stop_line );
+  return Printer::StartPrinting( m_model->gcode.get_print_job(), start_line, stop_line );
 }
 
 bool Printer::StartPrinting( string commands, unsigned long start_line, unsigned long stop_line ) {
-  bool ret = ThreadedPrinterSerial::StartPrinting( commands, start_line, stop_line );
+  return Printer::StartPrinting( new StringPrintJob( commands ), start_line, stop_line );
+}
+
+bool Printer::StartPrinting( PrintJob *job, unsigned long start_line, unsigned long stop_line ) {
+  // Optimize the GCode on the way to the printer
+  if ( m_model != NULL ) {
+    Settings &settings = m_model->settings;
+    try {
+      if ( settings.get_boolean("Hardware","StreamOptimize") ) {
+	PreprocessPrintJob::Options options;
+	options.fit_arcs = settings.get_boolean("Hardware","StreamArcs");
+	options.tolerance = settings.get_double("Hardware","StreamTolerance");
+	options.drop_feedrate = ! settings.get_boolean("Hardware","SpeedAlways");
+	options.relative_e = settings.get_boolean("Slicing","RelativeEcode");
+	options.arc_fitter = FitArc;
+	job = new PreprocessPrintJob( job, options, stop_line );
+      }
+    } catch (const Glib::KeyFileError &err) {
+    }
+  }
+
+  bool ret = ThreadedPrinterSerial::StartPrinting( job, start_line, stop_line );
 
   if ( ret ) {
     prev_line = start_line;
@@ -305,8 +358,11 @@ bool Printer::Idle( void ) {
     ParseResponse( str );
 
   if ( m_view ) {
-    while ( ( str = ReadLog() ) != "" )
-      m_view->comm_log( str );
+    // Everything logged since the last time in one go, inserting into the
+    // log view line by line is too slow at high send rates
+    log_batch.clear();
+    if ( ReadLog( log_batch ) > 0 )
+      m_view->comm_log( log_batch );
 
     while ( ( str = ReadErrorLog() ) != "" ) {
       alert( str.c_str() );
@@ -357,26 +413,16 @@ bool Printer::QueryTemp( void ) {
   return true;
 }
 
-const Glib::RefPtr<Glib::Regex> templineRE_T =
-	Glib::Regex::create("(?ims)T\\:(?<temp>[\\-\\.\\d]+?)\\s+?");
-const Glib::RefPtr<Glib::Regex> templineRE_B =
-	Glib::Regex::create("(?ims)B\\:(?<temp>[\\-\\.\\d]+?)\\s+?");
-
-void Printer::ParseResponse( string line ) {
-  if (line.find("T:") != string::npos) {
-    Glib::MatchInfo match_info;
-    vector<string> matches;
-    string name;
-    if (templineRE_T->match(line, match_info)) {
-      std::istringstream iss(match_info.fetch_named("temp").c_str());
-      double temp; iss >> temp;
-      temps[TEMP_NOZZLE] = temp;
-    }
-    if (templineRE_B->match(line, match_info)) {
-      std::istringstream iss(match_info.fetch_named("temp").c_str());
-      double temp; iss >> temp;
-      temps[TEMP_BED] = temp;
-    }
+void Printer::ParseResponse( const string &line ) {
+  TemperatureReport report;
+
+  if ( report.Parse( line.data(), line.length() ) ) {
+    const TemperatureReport::Reading &nozzle = report.Nozzle();
+    if ( nozzle.valid )
+      temps[ TEMP_NOZZLE ] = nozzle.current;
+    if ( report.bed.valid )
+      temps[ TEMP_BED ] = report.bed.current;
+
     waiting_temp = false;
     UpdateTemperatureMonitor();
     signal_temp_changed.emit();
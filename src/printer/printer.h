@@ -39,6 +39,7 @@ private:
   unsigned long prev_line;
   bool waiting_temp;
   int temp_countdown;
+  string log_batch; // kept to reuse its memory
 
   sigc::connection idle_timeout;
   sigc::connection print_timeout;
@@ -47,7 +48,7 @@ private:
   bool Idle( void );
   bool QueryTemp( void );
   bool CheckPrintingProgress( void );
-  void ParseResponse( string line );
+  void ParseResponse( const string &line );
 
 public:
   Printer( View *view );
@@ -62,6 +63,7 @@ public:
 
   bool StartPrinting( unsigned long start_line = 1, unsigned long stop_line = ULONG_MAX );
   bool StartPrinting( string commands, unsigned long start_line = 1, unsigned long stop_line = ULONG_MAX );
+  bool StartPrinting( PrintJob *job, unsigned long start_line = 1, unsigned long stop_line = ULONG_MAX );
   bool StopPrinting( bool wait = true );
   bool ContinuePrinting( bool wait = true );
   void Inhibit( bool value = true );
@@ -50,17 +50,23 @@ PrinterSerial::PrinterSerial( unsigned long max_recv_block_ms ) :
   full_command_scratch = new char[ max_command_size + max_command_prefix + max_command_postfix + 10 ];
   command_scratch = full_command_scratch + max_command_prefix;
 
+  send_scratch = new char[ 2 * max_command_size + LineEncoder::max_overhead ];
+  log_scratch = new char[ 2 * max_command_size + max_command_prefix ];
+  line_encoder = new AsciiLineEncoder();
+
   full_recv_buffer = new char[ max_command_size + max_command_prefix + 10 ];
   recv_buffer = full_recv_buffer + max_command_prefix;
 
-#ifdef WIN32
-  device_handle = INVALID_HANDLE_VALUE;
   raw_recv = new char[ max_command_size + max_command_prefix + 10 ];
   *raw_recv = '\0';
+
+#ifdef WIN32
+  device_handle = INVALID_HANDLE_VALUE;
 #else
   device_fd = -1;
 #endif
   prev_cmd_line_number = 0;
+  resend_count = 0;
 }
 
 PrinterSerial::~PrinterSerial() {
@@ -76,11 +82,12 @@ PrinterSerial::~PrinterSerial() {
   }
 #endif
 
+  delete line_encoder;
   delete [] full_command_scratch;
+  delete [] send_scratch;
+  delete [] log_scratch;
   delete [] full_recv_buffer;
-#ifdef WIN32
   delete [] raw_recv;
-#endif
 }
 
 bool PrinterSerial::TestPort( const string device ) {
@@ -248,8 +255,6 @@ bool PrinterSerial::RawConnect( string device, int baudrate ) {
     return false;
   }
 
-  *raw_recv = '\0';
-
 #else
   // Verify speed is valid and convert to posix value
   speed_t speed = B0;
@@ -380,8 +385,9 @@ bool PrinterSerial::RawConnect( string device, int baudrate ) {
   msg[ 255 ] = '\0';
   LogLine( msg );
 
-  // Reset line number
+  // Reset line number and drop data left from a previous connection
   prev_cmd_line_number = 0;
+  *raw_recv = '\0';
 
   return true;
 }
@@ -461,6 +467,7 @@ bool PrinterSerial::RawReset( void ) {
 
   // Reset line number
   prev_cmd_line_number = 0;
+  *raw_recv = '\0';
 
   return true;
 }
@@ -482,13 +489,21 @@ char *PrinterSerial::Send( const char *command ) {
   return SendCommand();
 }
 
+void PrinterSerial::SetLineEncoder( LineEncoder *encoder ) {
+  delete line_encoder;
+  line_encoder = encoder != NULL ? encoder : new AsciiLineEncoder();
+}
+
 // Sends gcode command.  Performs formating and waits for reply.  The line starts at command_scratch + max_command_prefix.  If buffer_response, the reply is entered into the response_buffer.
 char *PrinterSerial::SendCommand( void ) {
   char *formated;
+  size_t len;
   char *recvd;
   bool send_text = true;
+  bool resend = false;
+  unsigned long skip_oks = 0; // "ok"s following resend requests
 
-  if ( ( formated = FormatLine() ) == NULL ) {
+  if ( ( formated = FormatLine( len ) ) == NULL ) {
     // Printer can't handle blank lines
     // Don't send them, just return an "ok" response
     // They won't show up in the log, since no data was actually sent
@@ -502,92 +517,89 @@ char *PrinterSerial::SendCommand( void ) {
 
   while ( true ) {
     if ( send_text ) {
-      if ( ! SendText( formated ) )
+      if ( resend && ! SendResync() )
+	return NULL;
+      if ( ! SendText( formated, len ) )
 	return NULL;
     }
 
     if ( ( recvd = RecvLine() ) == NULL )
       return NULL;
 
+    if ( strncasecmp( recvd, "ok", 2 ) == 0 && skip_oks > 0 ) {
+      // Acknowledges the resend request, not the line sent again
+      skip_oks--;
+      send_text = false;
+      continue;
+    }
+
     if ( strncasecmp( recvd, "ok", 2 ) == 0 || strncasecmp( recvd, "!!", 2 ) == 0 ) {
       return recvd;
     }
 
     if ( strncasecmp( recvd, "rs", 2 ) == 0 || strncasecmp( recvd, "resend:", 7 ) == 0 ) {
-      // Checksum error, resend the line
-      send_text = true;
+      // Checksum error, resend the line.  Marlin-like firmwares follow
+      // "Resend:" with an "ok", Teacup's "rs" comes alone.
+      send_text = resend = true;
+      resend_count++;
+      if ( strncasecmp( recvd, "resend:", 7 ) == 0 )
+	skip_oks++;
     } else {
       send_text = false;
     }
   }
 }
 
-// Formats line of gcode in command_scratch and returns a pointer to the starting character
-char *PrinterSerial::FormatLine( void ) {
+// Encodes the line of gcode in command_scratch into send_scratch and returns a pointer to it
+char *PrinterSerial::FormatLine( size_t &len ) {
   char *start = command_scratch;
+  while ( *start == ' ' || *start == '\t' )
+    start++;
 
-  // Add prefix
-  start--;
-  *start = ' ';
-
-  unsigned long this_line = prev_cmd_line_number + 1;
+  // Without comment, checksum and trailing white space
+  char *end;
+  for ( end = start; *end != '\n' && *end != ';' && *end != '\0' && *end != '*'; end++ )
+    ;
+  while ( end > start && ( end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' ) )
+    end--;
 
-  if ( this_line == 0 ) {
-    start--;
-    *start = '0';
-  } else {
-    unsigned long count;
-    for ( count = this_line; count > 0; count /= 10 ) {
-      start--;
-      *start = ( count % 10 ) + '0';
-    }
-  }
-  start--;
-  *start = 'N';
-
-  // Calculate checksum
-  unsigned char cksum = 0;
-  char *loc;
-  for ( loc = start; *loc != '\n' && *loc != ';' && *loc != '\0' && *loc != '*'; loc++ ) {
-    cksum ^= *loc;
-  }
-  while ( loc[-1] == ' ' || loc[-1] == '\t' ) {
-    loc--;
-    cksum ^= *loc;
-  }
-
-  if ( loc <= command_scratch ) {
+  if ( end == start ) {
     // Line was all whitespace and/or comment, nothing to send
     return NULL;
   }
 
-  // Write checksum
-  *loc++ = '*';
-  if ( cksum >= 100 ) {
-    *loc++ = cksum / 100 + '0';
-  }
-  if ( cksum >= 10 ) {
-    *loc++ = ( cksum / 10 ) % 10 + '0';
-  }
-  *loc++ = cksum % 10 + '0';
-
-  // Terminate line
-  *loc++ = '\n';
-  *loc++ = '\0';
+  len = line_encoder->Encode( prev_cmd_line_number + 1, start, end - start, send_scratch );
 
   prev_cmd_line_number++;
 
-  return start;
+  return send_scratch;
+}
+
+// Sends len bytes of text exactly.  Does not wait for reply.  Performs logging.
+bool PrinterSerial::SendText( const char *text, size_t len ) {
+  // Binary lines are logged readable
+  memcpy( log_scratch, "<-- ", 4 );
+  line_encoder->Describe( text, len, log_scratch + 4, 2 * max_command_size + max_command_prefix - 4 );
+  LogLine( log_scratch );
+
+  return WriteData( text, len );
 }
 
-// Sends indicated text exactly.  Does not wait for reply.  Performs logging.
-// Text must point mutable memory with 4 bytes available before it
-bool PrinterSerial::SendText( char *text ) {
-  memcpy( text - 4, "<-- ", 4 );
-  LogLine( text - 4 );
+// Sends the bytes the line encoder needs before a line sent again
+bool PrinterSerial::SendResync( void ) {
+  const char *data;
+  size_t len = line_encoder->Resync( &data );
+  if ( len == 0 )
+    return true;
 
-  size_t len = strlen( text );
+  snprintf( log_scratch, 100, _("<-- %lu bytes to resync\n"), ( unsigned long ) len );
+  LogLine( log_scratch );
 
+  return WriteData( data, len );
+}
+
+// Sends len bytes exactly.  Does not wait for reply.  Does not log.
+bool PrinterSerial::WriteData( const char *text, size_t len ) {
 #ifdef WIN32
   DWORD num;
   while ( len > 0 ) {
@@ -622,6 +634,17 @@ bool PrinterSerial::SendText( char *text ) {
   return true;
 }
 
+// True if RecvLine() will return a line without reading from the port
+bool PrinterSerial::RecvLineReady( void ) {
+  char *loc = raw_recv;
+
+  // Line ends left from the previous line, see RecvLine()
+  while ( *loc == '\n' || *loc == '\r' )
+    loc++;
+
+  return strpbrk( loc, "\n\r" ) != NULL;
+}
+
 // Waits for a complete line from the port and receives that line into recv_buffer (but not at the start of recv_buffer to make logging easier).  Returns pointer to start of recv'd data.  Performs logging.
 char *PrinterSerial::RecvLine( void ) {
   size_t tot_size = 0;
@@ -663,21 +686,46 @@ char *PrinterSerial::RecvLine( void ) {
   recv_buffer[ tot_size ] = '\0';
   memmove( raw_recv, raw_recv + tot_size, strlen( raw_recv + tot_size ) + 1 );
 #else
-  char *buf = recv_buffer;
-  bool done = false;
+  // Several lines may arrive with one read.  Unused data is kept in raw_recv
+  // for the next call, like above.
+  char *line_start = raw_recv;
+  char *raw_loc;
   ssize_t num;
   struct timeval timeout;
   fd_set set;
 
-  // Read the data
-  while ( ! done ) {
+  while ( true ) {
+    // Skip line ends left from the previous line (\r\n)
+    while ( *line_start == '\n' || *line_start == '\r' )
+      line_start++;
+
+    for ( raw_loc = line_start; *raw_loc != '\0' && *raw_loc != '\n' && *raw_loc != '\r'; raw_loc++ )
+      ;
+    tot_size = raw_loc - line_start;
+
+    if ( *raw_loc != '\0' ) {
+      *raw_loc++ = '\n';
+      tot_size++;
+      break;
+    }
+
+    // Keep the partial line at the start of the buffer
+    if ( line_start != raw_recv ) {
+      memmove( raw_recv, line_start, tot_size + 1 );
+      line_start = raw_recv;
+      raw_loc = raw_recv + tot_size;
+    }
+
     // Make sure line is not too long
     if ( tot_size + 20 >= max_command_size ) {
       LogLine( _("*** Error: Received line too long ***\n") );
       LogError( _("*** Error: Received line too long ***\n") );
-      *buf++ = '\n';
+      *raw_loc++ = '\n';
+      *raw_loc = '\0';
+      tot_size++;
       break;
     }
+
     // Use select to allow a read timeout.
     // If the timeout is reached, call RecvTimeout
     timeout.tv_sec = 0;
@@ -691,10 +739,7 @@ char *PrinterSerial::RecvLine( void ) {
 	    max_recv_block_ms == 0 ? NULL : &timeout );
 
     if ( FD_ISSET( device_fd, &set ) ) {
-      // Read the data.  Use a loop since Posix does not guarentee that an
-      // entire line will be read at once.
-      //cout << "Reading" << endl;
-      if ( ( num = read( device_fd, buf, max_command_size - tot_size - 20 ) ) == -1 ) {
+      if ( ( num = read( device_fd, raw_loc, max_command_size - tot_size - 20 ) ) == -1 ) {
 	int err = errno;
 	char msg[ 256 ];
 	LogLine( _("*** Error reading from port ***\n") );
@@ -706,17 +751,19 @@ char *PrinterSerial::RecvLine( void ) {
 	LogError( msg );
 	return NULL;
       }
-      tot_size += num;
-      buf += num;
+      raw_loc[ num ] = '\0';
 
-      if ( num > 0 && ( buf[-1] == '\n' || buf[-1] == '\r' ) ) {
-	done = true;
-      }
+      // End of file (device went away), don't spin on it
+      if ( num == 0 )
+	RecvTimeout();
     } else {
       RecvTimeout();
     }
   }
-  *buf = '\0';
+
+  memcpy( recv_buffer, line_start, tot_size );
+  recv_buffer[ tot_size ] = '\0';
+  memmove( raw_recv, line_start + tot_size, strlen( line_start + tot_size ) + 1 );
 #endif
 
   char *recvd = recv_buffer;
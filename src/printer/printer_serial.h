@@ -22,6 +22,8 @@
 #include <iostream>
 #include <vector>
 
+#include "line_encoder.h"
+
 #ifdef WIN32
 #include <windows.h>
 #endif
@@ -43,20 +45,25 @@ protected:
 #endif
   
   unsigned long prev_cmd_line_number;
+  unsigned long resend_count; // lines sent again on request of the printer
+  
+  LineEncoder *line_encoder;
   
   char *full_command_scratch;
   char *command_scratch;
+  char *send_scratch; // encoded line
+  char *log_scratch;
   char *full_recv_buffer;
   char *recv_buffer;
-  
-#ifdef WIN32
-  char *raw_recv;
-#endif
+  char *raw_recv; // received data not yet returned by RecvLine()
   
   char *SendCommand( void ); // Sends gcode command.  Performs formating and waits for reply.  The line starts at command_scratch + max_command_prefix.  If buffer_response, the reply is entered into the response_buffer.
   
-  char *FormatLine( void ); // Formats line of gcode in command_scratch and returns a pointer to the starting character
-  bool SendText( char *text ); // Sends indicated text exactly.  Does not wait for reply.  Performs logging.
+  char *FormatLine( size_t &len ); // Encodes the line of gcode in command_scratch and returns a pointer to it and its length, or NULL for a blank line
+  bool SendText( const char *text, size_t len ); // Sends len bytes of text exactly.  Does not wait for reply.  Performs logging.
+  bool SendResync( void ); // Sends what the line encoder needs before a line sent again, if anything.  Performs logging.
+  bool WriteData( const char *data, size_t len ); // Sends len bytes exactly, without logging
+  bool RecvLineReady( void ); // True if RecvLine() will return a line without reading from the port
   char *RecvLine( void ); // Waits for a complete line from the port and receives that line into recv_buffer (but not at the start of recv_buffer to make logging easier).  Returns pointer to start of recv'd data.  Performs logging.  
   
   virtual void RecvTimeout( void );
@@ -93,4 +100,8 @@ public:
   virtual bool Reset( void );
   
   virtual char *Send( const char *command );
+  
+  // How lines are sent, ASCII with line number and checksum by default.
+  // Takes ownership of encoder, NULL for the default.
+  virtual void SetLineEncoder( LineEncoder *encoder );
 };
@@ -0,0 +1,324 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+// Head-less print farm controller: drives the printers given on the command
+// line with a PrintFarm.  Jobs are GCode files dropped into a spool
+// directory per printer, SPOOL/NAME/*.gcode, which are printed in the order
+// of their names.  A file is renamed to .queued when it is queued and to
+// .done or .failed when it ended.  Files still .queued on exit were not
+// started and are queued again on the next start.
+//
+// The status of all printers is written to a file (or stdout) every few
+// seconds, the log goes to stdout.  SIGINT or SIGTERM stop all prints and
+// quit.  POSIX only.
+
+#ifdef HAVE_CONFIG_H
+#include "stdafx.h"
+#else
+#define _( t ) t
+#endif
+
+#include "print_farm.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace std;
+
+static volatile sig_atomic_t quit = 0;
+
+static void HandleSignal( int ) {
+  quit = 1;
+}
+
+// NAME=DEVICE[,BAUD[,WINDOW[,binary]]]
+static bool ParsePrinter( const string &arg, PrintFarm::PrinterConfig &config ) {
+  size_t eq = arg.find( '=' );
+  if ( eq == string::npos || eq == 0 || arg.find( '/' ) < eq )
+    return false;
+
+  config.name = arg.substr( 0, eq );
+
+  vector<string> fields;
+  size_t start = eq + 1;
+  while ( true ) {
+    size_t comma = arg.find( ',', start );
+    fields.push_back( arg.substr( start, comma - start ) );
+    if ( comma == string::npos )
+      break;
+    start = comma + 1;
+  }
+
+  config.device = fields[ 0 ];
+  if ( config.device == "" || fields.size() > 4 )
+    return false;
+  if ( fields.size() > 1 )
+    config.baudrate = atoi( fields[ 1 ].c_str() );
+  if ( fields.size() > 2 )
+    config.send_window = strtoul( fields[ 2 ].c_str(), NULL, 10 );
+  if ( fields.size() > 3 ) {
+    if ( fields[ 3 ] != "binary" )
+      return false;
+    config.binary = true;
+  }
+
+  return config.baudrate > 0;
+}
+
+static bool HasSuffix( const string &str, const string &suffix ) {
+  return str.length() >= suffix.length() &&
+    str.compare( str.length() - suffix.length(), suffix.length(), suffix ) == 0;
+}
+
+// Files queued by an earlier run, which did not get to them
+static void RestoreSpool( const string &dir ) {
+  DIR *d = opendir( dir.c_str() );
+  if ( d == NULL )
+    return;
+
+  struct dirent *entry;
+  while ( ( entry = readdir( d ) ) != NULL ) {
+    string name = entry->d_name;
+    if ( HasSuffix( name, ".gcode.queued" ) ) {
+      string path = dir + "/" + name;
+      rename( path.c_str(), path.substr( 0, path.length() - 7 ).c_str() );
+    }
+  }
+  closedir( d );
+}
+
+// Queue the new files in the spool directory of printer
+static void ScanSpool( PrintFarm &farm, const string &dir, const string &printer ) {
+  DIR *d = opendir( dir.c_str() );
+  if ( d == NULL )
+    return;
+
+  vector<string> files;
+  struct dirent *entry;
+  while ( ( entry = readdir( d ) ) != NULL ) {
+    string name = entry->d_name;
+    if ( name[ 0 ] != '.' && HasSuffix( name, ".gcode" ) )
+      files.push_back( name );
+  }
+  closedir( d );
+
+  sort( files.begin(), files.end() );
+
+  for ( size_t i = 0; i < files.size(); i++ ) {
+    string path = dir + "/" + files[ i ];
+
+    // The open file is read on, whatever its name
+    PrintJob *job = new FilePrintJob( path );
+    if ( ! job->IsValid() || rename( path.c_str(), ( path + ".queued" ).c_str() ) != 0 ) {
+      delete job;
+      continue;
+    }
+
+    farm.QueueJob( printer, files[ i ], job );
+  }
+}
+
+static void AppendReading( ostringstream &os, const char *name, const TemperatureReport::Reading &reading ) {
+  if ( ! reading.valid )
+    return;
+
+  char buf[ 64 ];
+  if ( reading.has_target )
+    snprintf( buf, sizeof( buf ), "%s %.1f/%.1f ", name, reading.current, reading.target );
+  else
+    snprintf( buf, sizeof( buf ), "%s %.1f ", name, reading.current );
+  os << buf;
+}
+
+// "T0 201.3/210.0 T1 25.0/0.0 B 60.1/60.0"
+static string FormatTemperature( const TemperatureReport &report ) {
+  ostringstream os;
+
+  if ( report.extruders > 1 ) {
+    for ( int i = 0; i < report.extruders; i++ ) {
+      char name[ 8 ];
+      snprintf( name, sizeof( name ), "T%d", i );
+      AppendReading( os, name, report.extruder[ i ] );
+    }
+  } else {
+    AppendReading( os, "T", report.Nozzle() );
+  }
+  AppendReading( os, "B", report.bed );
+  AppendReading( os, "C", report.chamber );
+
+  return os.str();
+}
+
+static void WriteStatus( PrintFarm &farm, const string &file ) {
+  vector<PrintFarm::Status> status;
+  farm.GetStatus( status );
+
+  ostringstream os;
+  char buf[ 256 ];
+
+  snprintf( buf, sizeof( buf ), "%-12s %-8s %6s %5s %5s %5s %7s %7s %7s  %-24s %s\n",
+	    "printer", "state", "done%", "queue", "done", "fail", "lines", "resends", "p99 ms", "job", "temperature" );
+  os << buf;
+
+  for ( size_t i = 0; i < status.size(); i++ ) {
+    const PrintFarm::Status &s = status[ i ];
+    double percent = s.lines > 0 ? s.line * 100.0 / s.lines : 0;
+
+    snprintf( buf, sizeof( buf ), "%-12s %-8s %6.1f %5lu %5lu %5lu %7lu %7lu %7.1f  %-24s %s\n",
+	      s.name.c_str(), PrintFarm::Status::StateName( s.state ), percent,
+	      s.queued, s.done, s.failed, s.lines_sent, s.resends, s.latency_p99,
+	      s.job.c_str(), FormatTemperature( s.temperature ).c_str() );
+    os << buf;
+
+    if ( s.error != "" )
+      os << "             " << _("last error") << ": " << s.error << endl;
+  }
+
+  if ( file == "" ) {
+    cout << os.str() << endl;
+    return;
+  }
+
+  // Replace the file at once, for readers polling it
+  string tmp = file + ".tmp";
+  ofstream out( tmp.c_str() );
+  out << os.str();
+  out.close();
+  if ( ! out || rename( tmp.c_str(), file.c_str() ) != 0 )
+    cerr << _("Cannot write") << " " << file << endl;
+}
+
+static void Usage( const char *name ) {
+  cerr << "Usage: " << name << " [options] NAME=DEVICE[,BAUD[,WINDOW[,binary]]]..." << endl;
+  cerr << "  -d dir      spool directory, jobs are dir/NAME/*.gcode (spool)" << endl;
+  cerr << "  -s file     write the status to file instead of stdout" << endl;
+  cerr << "  -i seconds  status interval (10)" << endl;
+  cerr << "  -T seconds  temperature poll interval, 0 for none (5)" << endl;
+  cerr << "  -c          log all communication" << endl;
+  cerr << "BAUD defaults to 115200, WINDOW (send window bytes) to 0 for ping-pong." << endl;
+}
+
+int main( int argc, char *argv[] ) {
+  PrintFarm::Options options;
+  string spool = "spool";
+  string status_file;
+  unsigned long status_interval = 10;
+  int opt;
+
+  while ( ( opt = getopt( argc, argv, "d:s:i:T:c" ) ) != -1 ) {
+    if ( opt == 'd' )
+      spool = optarg;
+    else if ( opt == 's' )
+      status_file = optarg;
+    else if ( opt == 'i' )
+      status_interval = strtoul( optarg, NULL, 10 );
+    else if ( opt == 'T' )
+      options.temp_interval_ms = strtoul( optarg, NULL, 10 ) * 1000;
+    else if ( opt == 'c' )
+      options.log_comm = true;
+    else {
+      Usage( argv[ 0 ] );
+      return 1;
+    }
+  }
+
+  if ( optind >= argc ) {
+    Usage( argv[ 0 ] );
+    return 1;
+  }
+
+  PrintFarm farm( options );
+  vector<string> names;
+
+  for ( int i = optind; i < argc; i++ ) {
+    PrintFarm::PrinterConfig config;
+    if ( ! ParsePrinter( argv[ i ], config ) ) {
+      cerr << _("Bad printer") << ": " << argv[ i ] << endl;
+      Usage( argv[ 0 ] );
+      return 1;
+    }
+    if ( ! farm.AddPrinter( config ) ) {
+      cerr << _("Printer given twice") << ": " << config.name << endl;
+      return 1;
+    }
+    names.push_back( config.name );
+  }
+
+  for ( size_t i = 0; i < names.size(); i++ )
+    RestoreSpool( spool + "/" + names[ i ] );
+
+  signal( SIGINT, HandleSignal );
+  signal( SIGTERM, HandleSignal );
+
+  if ( ! farm.Start() ) {
+    cerr << farm.ReadLog();
+    return 1;
+  }
+
+  ntime_t last_status;
+  ntime_get( &last_status );
+  const ntime_t poll_sleep = { 0, 200 * 1000 * 1000 };
+
+  while ( ! quit ) {
+    for ( size_t i = 0; i < names.size(); i++ )
+      ScanSpool( farm, spool + "/" + names[ i ], names[ i ] );
+
+    PrintFarm::FinishedJob job;
+    while ( farm.ReadFinishedJob( job ) ) {
+      string path = spool + "/" + job.printer + "/" + job.job;
+      rename( ( path + ".queued" ).c_str(), ( path + ( job.ok ? ".done" : ".failed" ) ).c_str() );
+    }
+
+    string str;
+    while ( ( str = farm.ReadLog() ) != "" )
+      cout << str << flush;
+
+    ntime_t now;
+    ntime_get( &now );
+    if ( ntime_diff_us( &last_status, &now ) / 1000000 >= ( long ) status_interval ) {
+      last_status = now;
+      WriteStatus( farm, status_file );
+    }
+
+    nsleep( &poll_sleep );
+  }
+
+  farm.Stop();
+
+  // The jobs ended by stopping
+  PrintFarm::FinishedJob job;
+  while ( farm.ReadFinishedJob( job ) ) {
+    string path = spool + "/" + job.printer + "/" + job.job;
+    rename( ( path + ".queued" ).c_str(), ( path + ".failed" ).c_str() );
+  }
+  cout << farm.ReadLog() << flush;
+  WriteStatus( farm, status_file );
+
+  return 0;
+}
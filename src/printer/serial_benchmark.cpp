@@ -0,0 +1,344 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+// Streams GCode through ThreadedPrinterSerial to a FakePrinter and reports
+// the throughput.  The printer sources include stdafx.h, and with it
+// gtkmm, only if HAVE_CONFIG_H is defined, so in src/printer they build
+// on their own with:
+//   g++ -O2 -DHAVE_POSIX_THREADS fake_printer.cpp thread_buffer.cpp
+//     line_encoder.cpp print_job.cpp preprocess_print_job.cpp printer_serial.cpp
+//     threaded_printer_serial.cpp serial_benchmark.cpp -lpthread -o serial_benchmark
+// To build them with config.h as make does, in the top build directory:
+//   g++ -O2 -DHAVE_CONFIG_H -DHAVE_POSIX_THREADS -I. -Isrc
+//     -Ilibraries/vmmlib/include src/printer/fake_printer.cpp
+//     src/printer/thread_buffer.cpp src/printer/line_encoder.cpp
+//     src/printer/print_job.cpp src/printer/preprocess_print_job.cpp
+//     src/printer/printer_serial.cpp src/printer/threaded_printer_serial.cpp
+//     src/printer/serial_benchmark.cpp `pkg-config --cflags --libs gtkmm-2.4`
+//     -lpthread -o serial_benchmark
+//
+// Use -b to limit the fake printer to a real serial speed, otherwise the
+// pseudo terminal is much faster than any printer.  With -o or -a the
+// synthetic GCode is also checked to stay within the tolerance, and the
+// exit status is 1 if it does not.  -c checks the recovery from line
+// errors in send window mode, the exit status is 1 if the serial line is
+// not kept busy most of the time.
+
+#include "fake_printer.h"
+#include "preprocess_print_job.h"
+#include "threaded_printer_serial.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Blocks of 1000 moves, rows of collinear moves alternating with rings of
+// 200 sided polygonal circles of 4 to 20mm radius, extruding 0.05 per mm
+string SyntheticGCode( unsigned long lines ) {
+  ostringstream os;
+  char buf[ 100 ];
+  double x = 0.0, y = 0.0, e = 0.0;
+
+  os << "G21\nG90\nG92 E0\n";
+  for ( unsigned long i = 0; i < lines; i++ ) {
+    unsigned long block = i / 1000, n = i % 1000;
+    double nx, ny;
+    if ( block % 2 == 0 ) {
+      nx = n * 0.1;
+      ny = block * 0.2;
+    } else {
+      double radius = 4.0 + ( n / 200 ) * 4.0;
+      double angle = 2 * M_PI * ( n % 200 ) / 200;
+      nx = 100.0 + radius * cos( angle );
+      ny = 100.0 + radius * sin( angle );
+    }
+    e += 0.05 * hypot( nx - x, ny - y );
+    x = nx;
+    y = ny;
+    snprintf( buf, sizeof( buf ), "G1 X%.3f Y%.3f E%.5f F1800\n", x, y, e );
+    os << buf;
+  }
+
+  return os.str();
+}
+
+static bool GetWord( const string &line, char letter, double &value ) {
+  size_t pos = line.find( letter );
+  if ( pos == string::npos )
+    return false;
+  value = strtod( line.c_str() + pos + 1, NULL );
+  return true;
+}
+
+// Distance of x, y from the line from sx, sy to ex, ey
+static double SegmentDistance( double x, double y, double sx, double sy,
+			       double ex, double ey ) {
+  double dx = ex - sx, dy = ey - sy;
+  double length_sq = dx * dx + dy * dy;
+  double t = length_sq > 0.0 ? ( ( x - sx ) * dx + ( y - sy ) * dy ) / length_sq : 0.0;
+  t = t < 0.0 ? 0.0 : t > 1.0 ? 1.0 : t;
+  return hypot( x - sx - t * dx, y - sy - t * dy );
+}
+
+// Distance of x, y from the arc from sx, sy to ex, ey around cx, cy,
+// counterclockwise if ccw
+static double ArcDistance( double x, double y, double sx, double sy,
+			   double ex, double ey, double cx, double cy, bool ccw ) {
+  double start = atan2( sy - cy, sx - cx );
+  double sweep = atan2( ey - cy, ex - cx ) - start;
+  double angle = atan2( y - cy, x - cx ) - start;
+  if ( ! ccw ) {
+    sweep = -sweep;
+    angle = -angle;
+  }
+  sweep = fmod( sweep + 4 * M_PI, 2 * M_PI );
+  angle = fmod( angle + 4 * M_PI, 2 * M_PI );
+  if ( angle > sweep )
+    return min( hypot( x - sx, y - sy ), hypot( x - ex, y - ey ) );
+  return fabs( hypot( x - cx, y - cy ) - hypot( sx - cx, sy - cy ) );
+}
+
+// Preprocesses gcode with options and checks that the end points of the
+// original moves lie within tolerance of the moves and arcs sent instead.
+// The moves must be absolute G1 with X and Y, like SyntheticGCode().
+bool CheckPreprocessed( const string &gcode, const PreprocessPrintJob::Options &options ) {
+  string text = gcode;
+  PreprocessPrintJob job( new StringPrintJob( text ), options );
+  istringstream source( gcode );
+  string source_line;
+  vector<double> px, py; // original points since the last line sent
+  bool known = false;
+  double x = 0.0, y = 0.0, max_distance = 0.0;
+  unsigned long arcs = 0, moves = 0;
+  const char *out;
+  size_t len;
+
+  while ( ( out = job.NextLine( len ) ) != NULL && getline( source, source_line ) ) {
+    string line( out, len );
+    double sx, sy;
+    if ( GetWord( source_line, 'X', sx ) && GetWord( source_line, 'Y', sy ) ) {
+      px.push_back( sx );
+      py.push_back( sy );
+    }
+    if ( line.empty() )
+      continue;
+
+    bool arc = line.compare( 0, 3, "G2 " ) == 0 || line.compare( 0, 3, "G3 " ) == 0;
+    double ex = x, ey = y, i = 0.0, j = 0.0;
+    if ( line.compare( 0, 3, "G1 " ) != 0 && ! arc ) {
+      px.clear();
+      py.clear();
+      continue;
+    }
+    GetWord( line, 'X', ex );
+    GetWord( line, 'Y', ey );
+    if ( arc && ( ! GetWord( line, 'I', i ) || ! GetWord( line, 'J', j ) ) ) {
+      cerr << "Arc without center: " << line << endl;
+      return false;
+    }
+
+    if ( known ) {
+      for ( size_t p = 0; p < px.size(); p++ ) {
+	double distance = arc ?
+	  ArcDistance( px[ p ], py[ p ], x, y, ex, ey, x + i, y + j, line[ 1 ] == '3' ) :
+	  SegmentDistance( px[ p ], py[ p ], x, y, ex, ey );
+	max_distance = max( max_distance, distance );
+      }
+      arcs += arc;
+      moves++;
+    }
+    px.clear();
+    py.clear();
+    x = ex;
+    y = ey;
+    known = true;
+  }
+
+  // Coordinates are sent with 3 decimals
+  bool ok = max_distance <= options.tolerance + 1e-3;
+  cout << "Check:           " << moves << " moves, " << arcs << " arcs, "
+       << max_distance << " mm from the original points"
+       << ( ok ? "" : " FAILED" ) << endl;
+  return ok;
+}
+
+int main( int argc, char *argv[] ) {
+  FakePrinter::Options options;
+  unsigned long window = 0;
+  unsigned long synthetic_lines = 100000;
+  bool optimize = false;
+  bool binary = false;
+  bool failed = false;
+  double min_busy = 0.0;
+  PreprocessPrintJob::Options preprocess;
+  int opt;
+
+  string getopt_string = string( "w:n:oaT:Bc" ) + FakePrinter::Options::getopt_string;
+  while ( ( opt = getopt( argc, argv, getopt_string.c_str() ) ) != -1 ) {
+    if ( opt == 'w' )
+      window = strtoul( optarg, NULL, 10 );
+    else if ( opt == 'n' )
+      synthetic_lines = strtoul( optarg, NULL, 10 );
+    else if ( opt == 'o' )
+      optimize = true;
+    else if ( opt == 'a' )
+      optimize = preprocess.fit_arcs = true;
+    else if ( opt == 'T' )
+      preprocess.tolerance = strtod( optarg, NULL );
+    else if ( opt == 'B' )
+      binary = true;
+    else if ( opt == 'c' ) {
+      // 5% line errors at 115200 baud, options after -c change the case
+      window = 120;
+      synthetic_lines = 3000;
+      options.error_rate = 0.05;
+      options.baud = 115200;
+      min_busy = 90.0;
+    }
+    else if ( ! options.Parse( opt, optarg ) ) {
+      cerr << "Usage: " << argv[ 0 ] << " [options] [file.gcode]" << endl;
+      cerr << "  -w bytes    send window, 0 for ping-pong (0)" << endl;
+      cerr << "  -n lines    synthetic GCode lines if no file is given (100000)" << endl;
+      cerr << "  -o          optimize the GCode while sending" << endl;
+      cerr << "  -a          optimize and send arcs (implies -o)" << endl;
+      cerr << "  -T mm       tolerance of the optimization (0.01)" << endl;
+      cerr << "  -B          send binary lines (BinaryLineEncoder)" << endl;
+      cerr << "  -c          check recovery from errors: -w 120 -n 3000 -e 0.05 -b 115200," << endl;
+      cerr << "              fail if the serial line is busy less than 90% of the time" << endl;
+      cerr << FakePrinter::Options::help;
+      return 1;
+    }
+  }
+
+  // Files are streamed from disk, synthetic GCode is printed from memory
+  PrintJob *job;
+  if ( optind < argc ) {
+    job = new FilePrintJob( argv[ optind ] );
+    if ( ! job->IsValid() ) {
+      cerr << "Cannot open " << argv[ optind ] << endl;
+      return 1;
+    }
+  } else {
+    string gcode = SyntheticGCode( synthetic_lines );
+    if ( optimize && ! CheckPreprocessed( gcode, preprocess ) )
+      failed = true;
+    job = new StringPrintJob( gcode );
+  }
+
+  PreprocessPrintJob *preprocessed = NULL;
+  if ( optimize )
+    job = preprocessed = new PreprocessPrintJob( job, preprocess );
+
+  FakePrinter printer( options );
+  if ( ! printer.Start() )
+    return 1;
+
+  ThreadedPrinterSerial serial;
+  serial.SetSendWindow( window );
+  if ( binary )
+    serial.SetLineEncoder( new BinaryLineEncoder() );
+  if ( ! serial.Connect( printer.GetDevice(), 115200 ) ) {
+    cerr << serial.ReadErrorLog();
+    return 1;
+  }
+
+  // Wait for the printer to come up
+  serial.SendAndWaitResponse( "M105" );
+  serial.ResetSendStats();
+
+  ntime_t start, end;
+  ntime_get( &start );
+
+  if ( ! serial.StartPrinting( job ) ) {
+    cerr << serial.ReadErrorLog();
+    return 1;
+  }
+
+  const ntime_t poll_sleep = { 0, 10 * 1000 * 1000 };
+  while ( serial.IsPrinting() ) {
+    serial.ReadLog( false );
+    nsleep( &poll_sleep );
+  }
+  // Acknowledged after everything sent before
+  serial.SendAndWaitResponse( "M400" );
+
+  ntime_get( &end );
+
+  unsigned long bytes;
+  unsigned long lines = serial.GetPrintingProgress( &bytes );
+
+  // The job is kept until the next print or connect
+  unsigned long source_bytes = 0, output_bytes = 0;
+  if ( preprocessed != NULL ) {
+    source_bytes = preprocessed->SourceBytes();
+    output_bytes = preprocessed->OutputBytes();
+  }
+
+  ThreadedPrinterSerial::SendStats stats;
+  serial.GetSendStats( stats );
+  FakePrinter::Stats fw_stats = printer.GetStats();
+
+  serial.Disconnect();
+  printer.Stop();
+
+  double seconds = ntime_diff_us( &start, &end ) / 1e6;
+  // 10 bits per byte on the serial line
+  double busy = options.baud == 0 ? 0.0 :
+    100.0 * fw_stats.bytes_received * 10 / options.baud / seconds;
+
+  cout << "Send window:     " << window << ( window == 0 ? " (ping-pong)" : " bytes" ) << endl;
+  cout << "Encoding:        " << ( binary ? "binary" : "ASCII" ) << endl;
+  cout << "Lines:           " << stats.lines << endl;
+  cout << "Time:            " << seconds << " s" << endl;
+  cout << "Lines/s:         " << stats.lines / seconds << endl;
+  cout << "Bytes/s:         " << bytes / seconds << endl;
+  cout << "GCode lines/s:   " << lines / seconds << endl;
+  if ( optimize )
+    cout << "Optimized bytes: " << output_bytes << " of " << source_bytes << endl;
+  cout << "Latency p50:     " << stats.LatencyPercentile( 50 ) << " ms" << endl;
+  cout << "Latency p90:     " << stats.LatencyPercentile( 90 ) << " ms" << endl;
+  cout << "Latency p99:     " << stats.LatencyPercentile( 99 ) << " ms" << endl;
+  cout << "Latency max:     " << stats.LatencyPercentile( 100 ) << " ms" << endl;
+  cout << "Resent lines:    " << stats.resends << endl;
+  cout << "Firmware errors: " << fw_stats.line_errors
+       << " (" << fw_stats.errors_injected << " injected)" << endl;
+  cout << "Sent bytes:      " << fw_stats.bytes_received << endl;
+  cout << "RX overflow:     " << fw_stats.rx_overflow_bytes << " bytes" << endl;
+  cout << "Executed lines:  " << fw_stats.lines_executed << endl;
+  if ( options.baud != 0 )
+    cout << "Line busy:       " << busy << " %" << endl;
+
+  if ( min_busy > 0.0 ) {
+    bool ok = options.baud != 0 && busy >= min_busy;
+    cout << "Check:           line busy at least " << min_busy << " %, "
+	 << ( options.baud == 0 ? "needs -b " : "" ) << ( ok ? "passed" : "FAILED" ) << endl;
+    if ( ! ok )
+      failed = true;
+  }
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+// Checks TemperatureReport on typical firmware lines and compares its speed
+// with regular expressions and istringstream, which Printer::ParseResponse()
+// used before (POSIX regex here, in place of Glib::Regex).  Build with:
+//   g++ -O2 -DHAVE_POSIX_THREADS temperature_report.cpp temperature_benchmark.cpp
+//     -o temperature_benchmark
+
+#include "temperature_report.h"
+#include "thread.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <math.h>
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+static const char *const lines[] = {
+  "ok T:201.3 /210.0 B:60.1 /60.0 @:127 B@:0",
+  " T:201.3 /210.0 B:60.1 /60.0 @:127 B@:0",
+  "ok T:201.0 /210.0 B:60.0 /60.0 T0:201.0 /210.0 T1:25.4 /0.0 @:127 B@:0 @0:127 @1:0",
+  "T:199.82 E:0 W:?",
+  "ok T:21.5 B:-14.2",
+  "ok",
+  "echo:busy: processing",
+  "X:10.00 Y:20.00 Z:0.30 E:1.20 Count X: 800 Y:1600 Z:120",
+};
+static const int line_count = sizeof( lines ) / sizeof( lines[ 0 ] );
+
+static int failures = 0;
+
+static void Expect( bool condition, const char *what, int line ) {
+  if ( ! condition ) {
+    cerr << "FAILED: " << what << " in \"" << lines[ line ] << "\"" << endl;
+    failures++;
+  }
+}
+
+static bool Near( double a, double b ) {
+  return fabs( a - b ) < 1e-9;
+}
+
+static void Check( void ) {
+  TemperatureReport r;
+
+  Expect( r.Parse( lines[ 0 ], strlen( lines[ 0 ] ) ), "found", 0 );
+  Expect( r.ok, "ok", 0 );
+  Expect( r.nozzle.valid && Near( r.nozzle.current, 201.3 ) && Near( r.nozzle.target, 210.0 ), "T", 0 );
+  Expect( r.bed.valid && Near( r.bed.current, 60.1 ) && Near( r.bed.target, 60.0 ), "B", 0 );
+  Expect( r.extruders == 0 && ! r.chamber.valid, "nothing else", 0 );
+
+  Expect( r.Parse( lines[ 1 ], strlen( lines[ 1 ] ) ) && ! r.ok, "report without ok", 1 );
+
+  Expect( r.Parse( lines[ 2 ], strlen( lines[ 2 ] ) ), "found", 2 );
+  Expect( r.extruders == 2, "extruders", 2 );
+  Expect( Near( r.Nozzle( 1 ).current, 25.4 ) && Near( r.Nozzle( 1 ).target, 0.0 ), "T1", 2 );
+  Expect( Near( r.Nozzle( 0 ).current, 201.0 ), "T0", 2 );
+
+  Expect( r.Parse( lines[ 3 ], strlen( lines[ 3 ] ) ), "found", 3 );
+  Expect( Near( r.nozzle.current, 199.82 ) && ! r.nozzle.has_target, "T without target", 3 );
+
+  Expect( r.Parse( lines[ 4 ], strlen( lines[ 4 ] ) ), "found", 4 );
+  Expect( Near( r.nozzle.current, 21.5 ) && Near( r.bed.current, -14.2 ), "T and B", 4 );
+
+  for ( int i = 5; i < line_count; i++ )
+    Expect( ! r.Parse( lines[ i ], strlen( lines[ i ] ) ), "no temperature", i );
+}
+
+// The old way
+static regex_t regex_t_temp, regex_b_temp;
+
+static bool RegexParse( const string &line, double &nozzle, double &bed ) {
+  if ( line.find( "T:" ) == string::npos )
+    return false;
+
+  regmatch_t match[ 2 ];
+  if ( regexec( &regex_t_temp, line.c_str(), 2, match, 0 ) == 0 ) {
+    istringstream iss( line.substr( match[ 1 ].rm_so, match[ 1 ].rm_eo - match[ 1 ].rm_so ) );
+    iss >> nozzle;
+  }
+  if ( regexec( &regex_b_temp, line.c_str(), 2, match, 0 ) == 0 ) {
+    istringstream iss( line.substr( match[ 1 ].rm_so, match[ 1 ].rm_eo - match[ 1 ].rm_so ) );
+    iss >> bed;
+  }
+  return true;
+}
+
+int main( int argc, char *argv[] ) {
+  unsigned long iterations = argc > 1 ? strtoul( argv[ 1 ], NULL, 10 ) : 1000000;
+
+  Check();
+  if ( failures > 0 )
+    return 1;
+
+  regcomp( &regex_t_temp, "T:([-.0-9]+)[[:space:]]", REG_EXTENDED | REG_ICASE );
+  regcomp( &regex_b_temp, "B:([-.0-9]+)[[:space:]]", REG_EXTENDED | REG_ICASE );
+
+  // The lines as they come from ReadResponse()
+  string strings[ line_count ];
+  for ( int i = 0; i < line_count; i++ )
+    strings[ i ] = string( lines[ i ] ) + "\n";
+
+  double sum = 0;
+  ntime_t start, end;
+
+  TemperatureReport report;
+  ntime_get( &start );
+  for ( unsigned long n = 0; n < iterations; n++ ) {
+    const string &line = strings[ n % line_count ];
+    if ( report.Parse( line.data(), line.length() ) )
+      sum += report.Nozzle().current + report.bed.current;
+  }
+  ntime_get( &end );
+  double report_ns = ntime_diff_us( &start, &end ) * 1000.0 / iterations;
+
+  unsigned long regex_iterations = iterations / 10 + 1;
+  ntime_get( &start );
+  for ( unsigned long n = 0; n < regex_iterations; n++ ) {
+    double nozzle = 0, bed = 0;
+    if ( RegexParse( strings[ n % line_count ], nozzle, bed ) )
+      sum += nozzle + bed;
+  }
+  ntime_get( &end );
+  double regex_ns = ntime_diff_us( &start, &end ) * 1000.0 / regex_iterations;
+
+  regfree( &regex_t_temp );
+  regfree( &regex_b_temp );
+
+  cout << "Lines:                 " << line_count << " kinds, " << iterations << " parsed" << endl;
+  cout << "TemperatureReport:     " << report_ns << " ns/line" << endl;
+  cout << "regex + istringstream: " << regex_ns << " ns/line" << endl;
+  cout << "Speedup:               " << regex_ns / report_ns << endl;
+  cout << "(checksum " << sum << ")" << endl;
+
+  return 0;
+}
@@ -0,0 +1,159 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "temperature_report.h"
+
+static inline bool IsSpace( char c ) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static inline bool IsDigit( char c ) {
+  return c >= '0' && c <= '9';
+}
+
+// A number like -12.5 at p.  Returns its end, or NULL if there is none.
+static const char *ParseNumber( const char *p, const char *end, double &value ) {
+  bool negative = false;
+  if ( p < end && ( *p == '-' || *p == '+' ) ) {
+    negative = *p == '-';
+    p++;
+  }
+
+  double whole = 0;
+  bool digits = false;
+  for ( ; p < end && IsDigit( *p ); p++ ) {
+    whole = whole * 10 + ( *p - '0' );
+    digits = true;
+  }
+
+  double fraction = 0, divisor = 1;
+  if ( p < end && *p == '.' ) {
+    for ( p++; p < end && IsDigit( *p ); p++ ) {
+      fraction = fraction * 10 + ( *p - '0' );
+      divisor *= 10;
+      digits = true;
+    }
+  }
+
+  if ( ! digits )
+    return NULL;
+
+  value = whole + fraction / divisor;
+  if ( negative )
+    value = -value;
+
+  return p;
+}
+
+// "201.3 /210.0" after the "T:"
+static const char *ParseReading( const char *p, const char *end, TemperatureReport::Reading &reading ) {
+  const char *next = ParseNumber( p, end, reading.current );
+  if ( next == NULL )
+    return p;
+  reading.valid = true;
+  p = next;
+
+  const char *slash = p;
+  while ( slash < end && IsSpace( *slash ) )
+    slash++;
+  if ( slash < end && *slash == '/' ) {
+    slash++;
+    while ( slash < end && IsSpace( *slash ) )
+      slash++;
+    if ( ( next = ParseNumber( slash, end, reading.target ) ) != NULL ) {
+      reading.has_target = true;
+      p = next;
+    }
+  }
+
+  return p;
+}
+
+void TemperatureReport::Clear( void ) {
+  const Reading none = { false, false, 0.0, 0.0 };
+
+  ok = false;
+  nozzle = bed = chamber = none;
+  for ( int i = 0; i < max_extruders; i++ )
+    extruder[ i ] = none;
+  extruders = 0;
+}
+
+bool TemperatureReport::Parse( const char *line, size_t len ) {
+  const char *p = line;
+  const char *end = line + len;
+  bool found = false;
+
+  Clear();
+
+  while ( true ) {
+    while ( p < end && IsSpace( *p ) )
+      p++;
+    if ( p >= end )
+      break;
+
+    const char *word = p;
+    while ( p < end && ! IsSpace( *p ) && *p != ':' )
+      p++;
+    size_t word_len = p - word;
+
+    if ( p < end && *p == ':' ) {
+      p++;
+
+      Reading *reading = NULL;
+      if ( word_len == 1 && word[ 0 ] == 'T' ) {
+	reading = &nozzle;
+      } else if ( word_len == 1 && word[ 0 ] == 'B' ) {
+	reading = &bed;
+      } else if ( word_len == 1 && word[ 0 ] == 'C' ) {
+	reading = &chamber;
+      } else if ( word_len >= 2 && word[ 0 ] == 'T' ) {
+	int number = 0;
+	size_t i;
+	for ( i = 1; i < word_len && IsDigit( word[ i ] ) && number < max_extruders; i++ )
+	  number = number * 10 + ( word[ i ] - '0' );
+	if ( i == word_len && number < max_extruders ) {
+	  reading = &extruder[ number ];
+	  if ( number >= extruders )
+	    extruders = number + 1;
+	}
+      }
+
+      if ( reading != NULL ) {
+	p = ParseReading( p, end, *reading );
+	found = found || reading->valid;
+      }
+    } else if ( word == line && word_len == 2 && word[ 0 ] == 'o' && word[ 1 ] == 'k' ) {
+      ok = true;
+    }
+
+    // Rest of the word, like the "?" of "W:?"
+    while ( p < end && ! IsSpace( *p ) )
+      p++;
+  }
+
+  return found;
+}
+
+const TemperatureReport::Reading &TemperatureReport::Nozzle( int number ) const {
+  if ( number >= 0 && number < max_extruders && extruder[ number ].valid )
+    return extruder[ number ];
+
+  return nozzle;
+}
@@ -0,0 +1,61 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+// The temperatures in a status line of the firmware, the reply to M105 or
+// an automatic report (M155), like
+//   ok T:201.3 /210.0 B:60.1 /60.0 T0:201.3 /210.0 T1:25.0 /0.0 @:127 B@:0
+//    T:201.3 /210.0 B:60.1 /60.0 @:127 B@:0
+//   T:201.3 E:0 W:?
+//
+// Parse() scans the line once, without regular expressions, allocations
+// or the locale (which may want a decimal comma), so that it is cheap to
+// run on every line.  Words are only recognized at the start of the line
+// or after white space, so "echo:" or "Count X:" are not taken for
+// temperatures.
+struct TemperatureReport {
+  static const int max_extruders = 8;
+
+  struct Reading {
+    bool valid;
+    bool has_target;
+    double current;
+    double target; // after the "/", if has_target
+  };
+
+  bool ok; // the line starts with "ok", the report came with the reply to a command
+  Reading nozzle; // "T:", the active extruder
+  Reading extruder[ max_extruders ]; // "T0:", "T1:", ...
+  int extruders; // number of the highest "Tn:" + 1, 0 if none
+  Reading bed; // "B:"
+  Reading chamber; // "C:"
+
+  TemperatureReport() { Clear(); };
+  void Clear( void );
+
+  bool Parse( const char *line, size_t len );
+  // Clears and fills in what line contains.  Returns false if there is no
+  // temperature in it.
+
+  const Reading &Nozzle( int extruder = 0 ) const;
+  // "Tn:" if present, else "T:"
+};
@@ -102,8 +102,37 @@ inline int nsleep( const ntime_t *req ) {
   Sleep( req->tv_sec * 1000 + ( req->tv_nsec + 999999 ) / 1000000 );
   return 0;
 };
+inline void ntime_get( ntime_t *t ) {
+  DWORD ms = GetTickCount();
+  t->tv_sec = ms / 1000;
+  t->tv_nsec = ( ms % 1000 ) * 1000 * 1000;
+};
 #else
 #include <time.h>
+#include <sys/time.h>
 typedef struct timespec ntime_t;
 inline int nsleep( const ntime_t *req ) { return nanosleep( req, NULL ); };
+inline void ntime_get( ntime_t *t ) {
+#ifdef CLOCK_MONOTONIC
+  clock_gettime( CLOCK_MONOTONIC, t );
+#else
+  struct timeval tv;
+  gettimeofday( &tv, NULL );
+  t->tv_sec = tv.tv_sec;
+  t->tv_nsec = tv.tv_usec * 1000;
 #endif
+};
+#endif
+
+// Full memory barrier, for the lock-free LockFreeThreadBuffer
+#if defined( __GNUC__ )
+#define memory_barrier() __sync_synchronize()
+#else
+#define memory_barrier() MemoryBarrier()
+#endif
+
+// Microseconds from start to end, for time measurements with ntime_get()
+inline long ntime_diff_us( const ntime_t *start, const ntime_t *end ) {
+  return ( ( long ) end->tv_sec - ( long ) start->tv_sec ) * 1000 * 1000 +
+    ( end->tv_nsec - start->tv_nsec ) / 1000;
+};
@@ -36,22 +36,35 @@ ThreadBuffer::ThreadBuffer( size_t buffer_size, bool is_line_buffered, const nti
   
   sleep_time = nsleep_time;
   
+  cond_init( &space_cond );
+  space_waiters = 0;
+  
   last_write_overflowed = false;
 }
 
 ThreadBuffer::~ThreadBuffer() {
   delete [] buff;
+  cond_destroy( &space_cond );
   mutex_destroy( &mutex );
   if ( use_write_mutex )
     mutex_destroy( &write_mutex );
 }
 
+ptrdiff_t ThreadBuffer::BytesUsed( void ) {
+  // The difference is negative once the write pointer wrapped around.  Don't
+  // use % here, the signed difference would be converted to unsigned.
+  ptrdiff_t used = write_ptr - read_ptr;
+  if ( used < 0 )
+    used += size;
+  return used;
+}
+
 ssize_t ThreadBuffer::SpaceAvailable( void ) {
   // Determine space remaining in buffer, being sure to always leave room
   // for the overflow string
   // 10 is a padding factor to ensure than a simple off by one errors
   // never cause the write pointer to advance pass the read pointer
-  return size - ( ( write_ptr - read_ptr ) % size ) - 10 - overflow.length();
+  return size - BytesUsed() - 10 - overflow.length();
 }
 
 bool ThreadBuffer::Write( const char *data, bool wait, ssize_t datalen ) {
@@ -84,11 +97,10 @@ bool ThreadBuffer::Write( const char *data, bool wait, ssize_t datalen ) {
   if ( fulldatalen > SpaceAvailable() ) {
     if ( wait ) {
       // Wait until enough space is available
-      while ( fulldatalen > SpaceAvailable() ) {
-	mutex_unlock( &mutex );
-	nsleep( &sleep_time );
-	mutex_lock( &mutex );
-      }
+      space_waiters++;
+      while ( fulldatalen > SpaceAvailable() )
+	cond_wait( &space_cond, &mutex );
+      space_waiters--;
     } else if ( last_write_overflowed || overflow.length() == 0 ) {
       // Wrote overflow string last time, don't write it again, just give up
       mutex_unlock( &mutex );
@@ -160,7 +172,7 @@ bool ThreadBuffer::DataAvailable( void ) {
   if ( min_line_len == 0 )
     return read_ptr != write_ptr;
   
-  ptrdiff_t avail = ( write_ptr - read_ptr ) % size;
+  ptrdiff_t avail = BytesUsed();
   
   return avail >= (ptrdiff_t) min_line_len;
 }
@@ -267,6 +279,7 @@ size_t ThreadBuffer::Read( string *str, char *data, size_t max_len, bool wait, c
   
   // Atomically update the read pointer
   read_ptr = new_read_ptr;
+  FreedSpace();
   
   if ( last_write_overflowed && SpaceAvailable() > 0 ) {
     // Turn overflow message back on
@@ -302,10 +315,16 @@ void ThreadBuffer::WaitOnRead( void ) {
 void ThreadBuffer::WroteToEmpty( void ) {
 }
 
+void ThreadBuffer::FreedSpace( void ) {
+  if ( space_waiters > 0 )
+    cond_broadcast( &space_cond );
+}
+
 void ThreadBuffer::Flush( void ) {
   mutex_lock( &mutex );
   
   read_ptr = write_ptr;
+  FreedSpace();
   
   mutex_unlock( &mutex );
 }
@@ -443,6 +462,7 @@ void ThreadBufferReturnData::Flush( void ) {
   }
   
   read_ptr = init_write_ptr;
+  FreedSpace();
   
   mutex_unlock( &mutex );
 }
@@ -498,3 +518,235 @@ void ThreadBufferReturnData::ReturnData::AddLine( const char *line ) {
 string ThreadBufferReturnData::ReturnData::GetData( void ) {
   return data;
 }
+
+LockFreeThreadBuffer::LockFreeThreadBuffer( size_t buffer_size, bool is_line_buffered, string overflow_indicator, bool multiple_writers ) :
+  overflow( overflow_indicator ),
+  line_buffered( is_line_buffered ),
+  multiple_writers( multiple_writers ) {
+
+  // Room for the overflow string and its newline, rounded up so that
+  // positions can be masked
+  for ( size = 16; size < buffer_size + overflow.length() + 1; size *= 2 )
+    ;
+  buff = new char[ size ];
+  read_pos = write_pos = 0;
+  reader_write_pos = writer_read_pos = 0;
+  last_write_overflowed = false;
+
+  if ( multiple_writers )
+    mutex_init( &write_mutex );
+  mutex_init( &wait_mutex );
+  cond_init( &wait_cond );
+  reader_waiting = writer_waiting = false;
+  space_wanted = 0;
+}
+
+LockFreeThreadBuffer::~LockFreeThreadBuffer() {
+  delete [] buff;
+  if ( multiple_writers )
+    mutex_destroy( &write_mutex );
+  mutex_destroy( &wait_mutex );
+  cond_destroy( &wait_cond );
+}
+
+void LockFreeThreadBuffer::Signal( void ) {
+  mutex_lock( &wait_mutex );
+  cond_broadcast( &wait_cond );
+  mutex_unlock( &wait_mutex );
+}
+
+// The waiting side sets its flag before checking the positions again, and
+// the other side checks the flag after updating its position, with a
+// barrier in between on both sides.  So either the waiting side sees the
+// update, or the other side sees the flag and signals.  The mutex makes sure
+// the signal is not sent between the check and cond_wait.
+void LockFreeThreadBuffer::WaitForData( void ) {
+  mutex_lock( &wait_mutex );
+  reader_waiting = true;
+  memory_barrier();
+  while ( read_pos == write_pos )
+    cond_wait( &wait_cond, &wait_mutex );
+  reader_waiting = false;
+  mutex_unlock( &wait_mutex );
+  memory_barrier();
+}
+
+// A waiting writer is only woken up when half of the buffer is free, so
+// that a reader which just keeps up does not signal it for every line.
+void LockFreeThreadBuffer::WaitForSpace( size_t len ) {
+  mutex_lock( &wait_mutex );
+  space_wanted = len > Capacity() / 2 ? len : Capacity() / 2;
+  memory_barrier();
+  writer_waiting = true;
+  memory_barrier();
+  while ( write_pos - read_pos + space_wanted > Capacity() )
+    cond_wait( &wait_cond, &wait_mutex );
+  writer_waiting = false;
+  mutex_unlock( &wait_mutex );
+  memory_barrier();
+}
+
+void LockFreeThreadBuffer::CopyIn( unsigned long pos, const char *data, size_t len ) {
+  size_t start = pos & ( size - 1 );
+  size_t split = len < size - start ? len : size - start;
+
+  memcpy( buff + start, data, split );
+  memcpy( buff, data + split, len - split );
+}
+
+void LockFreeThreadBuffer::CopyOut( unsigned long pos, string *str, char *data, size_t len ) {
+  size_t start = pos & ( size - 1 );
+  size_t split = len < size - start ? len : size - start;
+
+  if ( str == NULL ) {
+    memcpy( data, buff + start, split );
+    memcpy( data + split, buff, len - split );
+    data[ len ] = '\0';
+  } else {
+    str->append( buff + start, split );
+    str->append( buff, len - split );
+  }
+}
+
+bool LockFreeThreadBuffer::Write( const char *data, bool wait, ssize_t datalen ) {
+  if ( datalen < 0 )
+    datalen = strlen( data );
+
+  // If the buffer is line buffered and the data to write does not end in a
+  // newline, one will be added.
+  bool add_newline = line_buffered && ( datalen == 0 || data[ datalen - 1 ] != '\n' );
+  size_t fulldatalen = datalen + ( add_newline ? 1 : 0 );
+
+  if ( fulldatalen > Capacity() )
+    return false;
+  if ( fulldatalen == 0 )
+    return true;
+
+  if ( multiple_writers )
+    mutex_lock( &write_mutex );
+
+  unsigned long pos = write_pos;
+  bool ret = true;
+
+  if ( pos - writer_read_pos + fulldatalen > Capacity() ) {
+    writer_read_pos = read_pos;
+    memory_barrier();
+  }
+
+  if ( pos - writer_read_pos + fulldatalen > Capacity() ) {
+    if ( wait ) {
+      WaitForSpace( fulldatalen );
+      writer_read_pos = read_pos;
+      memory_barrier();
+    } else if ( last_write_overflowed || overflow.length() == 0 ) {
+      // Wrote overflow string last time, don't write it again, just give up
+      if ( multiple_writers )
+	mutex_unlock( &write_mutex );
+      return false;
+    } else {
+      // Write the overflow string to the space kept free for it
+      data = overflow.c_str();
+      datalen = overflow.length();
+      add_newline = line_buffered && data[ datalen - 1 ] != '\n';
+      fulldatalen = datalen + ( add_newline ? 1 : 0 );
+      last_write_overflowed = true;
+      ret = false;
+    }
+  } else {
+    last_write_overflowed = false;
+  }
+
+  CopyIn( pos, data, datalen );
+  if ( add_newline )
+    CopyIn( pos + datalen, "\n", 1 );
+
+  // Publish the data, then wake up the reader if it sleeps
+  memory_barrier();
+  write_pos = pos + fulldatalen;
+  memory_barrier();
+  if ( reader_waiting )
+    Signal();
+
+  if ( multiple_writers )
+    mutex_unlock( &write_mutex );
+
+  return ret;
+}
+
+size_t LockFreeThreadBuffer::Read( string *str, char *data, size_t max_len, bool wait ) {
+  unsigned long pos = read_pos;
+
+  if ( pos == reader_write_pos ) {
+    reader_write_pos = write_pos;
+    memory_barrier();
+  }
+
+  if ( pos == reader_write_pos ) {
+    if ( ! wait )
+      return 0;
+    WaitForData();
+    reader_write_pos = write_pos;
+    memory_barrier();
+  }
+
+  size_t len = reader_write_pos - pos;
+
+  if ( line_buffered ) {
+    // Up to and including the first newline, accounting for wrap around
+    size_t start = pos & ( size - 1 );
+    size_t split = len < size - start ? len : size - start;
+    const char *loc = ( const char * ) memchr( buff + start, '\n', split );
+
+    if ( loc != NULL )
+      len = loc - ( buff + start ) + 1;
+    else if ( ( loc = ( const char * ) memchr( buff, '\n', len - split ) ) != NULL )
+      len = split + ( loc - buff ) + 1;
+  }
+
+  // Truncate read to max length, the rest of the line is dropped
+  size_t copy_len = len;
+  if ( str == NULL && copy_len > max_len ) {
+    copy_len = max_len;
+    if ( ! line_buffered )
+      len = copy_len;
+  }
+
+  CopyOut( pos, str, data, copy_len );
+
+  // Free the space, then wake up the writer if it sleeps
+  memory_barrier();
+  read_pos = pos + len;
+  memory_barrier();
+  if ( writer_waiting && write_pos - read_pos + space_wanted <= Capacity() )
+    Signal();
+
+  return copy_len;
+}
+
+size_t LockFreeThreadBuffer::Read( char *data, size_t max_len, bool wait ) {
+  return Read( NULL, data, max_len, wait );
+}
+
+string LockFreeThreadBuffer::Read( bool wait ) {
+  string str;
+
+  Read( &str, NULL, 0, wait );
+
+  return str;
+}
+
+size_t LockFreeThreadBuffer::Read( string &str, bool wait ) {
+  return Read( &str, NULL, 0, wait );
+}
+
+bool LockFreeThreadBuffer::DataAvailable( void ) {
+  return read_pos != write_pos;
+}
+
+void LockFreeThreadBuffer::Flush( void ) {
+  memory_barrier();
+  read_pos = reader_write_pos = write_pos;
+  memory_barrier();
+  if ( writer_waiting )
+    Signal();
+}
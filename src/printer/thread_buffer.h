@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <sys/types.h>
 #include <string>
 
 #include "thread.h"
@@ -50,12 +51,17 @@ protected:
 
   ntime_t sleep_time;
 
+  cond_t space_cond; // signaled when data was read and a writer waits for space, mutex required
+  unsigned long space_waiters; // mutex required
+
   const bool line_buffered;
   const unsigned long min_line_len;
 
+  ptrdiff_t BytesUsed( void );
   ssize_t SpaceAvailable( void );
   virtual void WaitOnRead( void );
   virtual void WroteToEmpty( void );
+  void FreedSpace( void ); // Wake up writers waiting for space, mutex required
 
   char *ReadRawData( string *str, char *data, char *read_start, unsigned long length, bool null_terminate = true );
   // Copys data from circular buffer, wrapping when necessary.
@@ -121,3 +127,65 @@ public:
 
   virtual bool WaitForReturnData( ReturnData &return_data );
 };
+
+// Single producer, single consumer buffer with the API of ThreadBuffer.
+// Neither side ever takes a lock while the other one runs: the producer
+// only advances write_pos and the consumer only advances read_pos.  A mutex
+// and a condition are only used to sleep when waiting on a full or empty
+// buffer.
+//
+// If more than one thread writes, multiple_writers serializes the writers
+// with a mutex; the reader is still never blocked by them.  There must only
+// ever be one reading thread, Flush() counts as reading.
+class LockFreeThreadBuffer {
+protected:
+  // The positions count up forever, masked to index buff.  Each side keeps
+  // a copy of the other side's position and only looks at the real one
+  // when the copy says full or empty.  The two sides' data is kept on
+  // different cache lines.
+  static const size_t cache_line = 64;
+
+  size_t size; // power of two
+  char *buff;
+  char pad0[ cache_line ];
+  volatile unsigned long read_pos; // set by reader only
+  unsigned long reader_write_pos; // reader only
+  char pad1[ cache_line ];
+  volatile unsigned long write_pos; // set by writer only
+  unsigned long writer_read_pos; // writer only
+  char pad2[ cache_line ];
+
+  const string overflow;
+  bool last_write_overflowed; // writer only
+
+  const bool line_buffered;
+  const bool multiple_writers;
+  mutex_t write_mutex;
+
+  mutex_t wait_mutex;
+  cond_t wait_cond;
+  volatile bool reader_waiting;
+  volatile bool writer_waiting;
+  volatile size_t space_wanted; // by the waiting writer
+
+  size_t Capacity( void ) { return size - overflow.length() - 1; }; // for data other than the overflow string
+  void Signal( void );
+  void WaitForData( void );
+  void WaitForSpace( size_t len );
+
+  void CopyIn( unsigned long pos, const char *data, size_t len );
+  void CopyOut( unsigned long pos, string *str, char *data, size_t len ); // appends to str
+
+  size_t Read( string *str, char *data, size_t max_len, bool wait );
+
+public:
+  LockFreeThreadBuffer( size_t buffer_size, bool is_line_buffered, string overflow_indicator = "", bool multiple_writers = false );
+  ~LockFreeThreadBuffer();
+  bool Write( const char *data, bool wait, ssize_t datalen = -1 );
+  size_t Read( char *data, size_t max_len, bool wait );
+  string Read( bool wait );
+  size_t Read( string &str, bool wait );
+  // Appends to str, so that a reader draining the buffer can reuse it
+  bool DataAvailable( void );
+  void Flush( void );
+};
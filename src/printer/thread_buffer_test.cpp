@@ -17,10 +17,19 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+// Interactive test of the buffers, or with -b a benchmark of their
+// throughput and latency between two threads.  Build with:
+//   g++ -O2 -DHAVE_POSIX_THREADS thread_buffer.cpp thread_buffer_test.cpp
+//     -lpthread -o thread_buffer_test
+
 #include "thread_buffer.h"
 
+#include <algorithm>
 #include <iostream>
+#include <vector>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 //#define USE_RET_DATA
 
@@ -70,7 +79,98 @@ void *Reader( void * ) {
   return NULL;
 }
 
-int main( void ) {
+template <class Buffer>
+struct BenchData {
+  Buffer *buffer;
+  unsigned long lines;
+  ntime_t pause; // between lines, 0 for as fast as possible
+};
+
+template <class Buffer>
+void *BenchWriter( void *arg ) {
+  BenchData<Buffer> *bench = ( BenchData<Buffer> * ) arg;
+  char line[ 100 ];
+  ntime_t now;
+
+  for ( unsigned long i = 0; i < bench->lines; i++ ) {
+    if ( bench->pause.tv_nsec > 0 )
+      nsleep( &bench->pause );
+    ntime_get( &now );
+    // Padded to the length of a typical log line
+    snprintf( line, sizeof( line ), "%ld %ld --> ok T:200.0 /200.0 B:60.0 /60.0\n", ( long ) now.tv_sec, ( long ) now.tv_nsec );
+    bench->buffer->Write( line, true );
+  }
+
+  return NULL;
+}
+
+template <class Buffer>
+void Benchmark( const char *name, Buffer &buffer, unsigned long lines, long pause_us ) {
+  BenchData<Buffer> bench;
+  bench.buffer = &buffer;
+  bench.lines = lines;
+  bench.pause.tv_sec = 0;
+  bench.pause.tv_nsec = pause_us * 1000;
+
+  vector<long> latency;
+  latency.reserve( lines );
+  char line[ 1024 + 10 ];
+  ntime_t start, end, sent, now;
+  thread_t thread;
+
+  ntime_get( &start );
+  thread_create( &thread, BenchWriter<Buffer>, &bench );
+
+  while ( latency.size() < lines ) {
+    if ( buffer.Read( line, 1024, true ) == 0 )
+      continue;
+    ntime_get( &now );
+    sent.tv_sec = strtol( line, NULL, 10 );
+    sent.tv_nsec = strtol( strchr( line, ' ' ) + 1, NULL, 10 );
+    latency.push_back( ntime_diff_us( &sent, &now ) );
+  }
+
+  ntime_get( &end );
+  thread_join( thread );
+
+  sort( latency.begin(), latency.end() );
+  double seconds = ntime_diff_us( &start, &end ) / 1e6;
+
+  printf( "%-22s %8.0f lines/s  latency us: p50 %6ld  p99 %6ld  max %6ld\n",
+	  name, lines / seconds,
+	  latency[ lines / 2 ], latency[ lines * 99 / 100 ], latency[ lines - 1 ] );
+}
+
+void Benchmarks( unsigned long lines ) {
+  // Sizes and sleeps as used by ThreadedPrinterSerial before the lock-free
+  // buffer
+  const ntime_t sleep = { 0, 10 * 1000 * 1000 };
+  const long pauses[] = { 0, 100 };
+
+  for ( int i = 0; i < 2; i++ ) {
+    unsigned long count = pauses[ i ] == 0 ? lines : lines / 100;
+    if ( pauses[ i ] == 0 )
+      printf( "%lu lines, as fast as possible:\n", count );
+    else
+      printf( "%lu lines, one every %ld us:\n", count, pauses[ i ] );
+
+    ThreadBuffer tb( 4096, true, sleep, "", true, false );
+    Benchmark( "ThreadBuffer", tb, count, pauses[ i ] );
+
+    SignalingThreadBuffer stb( 4096, true, sleep, "", true, false );
+    Benchmark( "SignalingThreadBuffer", stb, count, pauses[ i ] );
+
+    LockFreeThreadBuffer lftb( 4096, true );
+    Benchmark( "LockFreeThreadBuffer", lftb, count, pauses[ i ] );
+  }
+}
+
+int main( int argc, char *argv[] ) {
+  if ( argc > 1 && strcmp( argv[ 1 ], "-b" ) == 0 ) {
+    Benchmarks( argc > 2 ? strtoul( argv[ 2 ], NULL, 10 ) : 1000000 );
+    return 0;
+  }
+
   char line[ 1024 + 10 ];
   thread_t thread;
 #ifdef USE_RET_DATA
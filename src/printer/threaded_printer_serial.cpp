@@ -25,24 +25,30 @@
 
 #include <iostream>
 #include <sstream>
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#ifndef WIN32
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#endif
 
 #include "threaded_printer_serial.h"
 
 const ntime_t ThreadedPrinterSerial::command_buffer_sleep = { 0, 100 * 1000 * 1000 };
-const ntime_t ThreadedPrinterSerial::response_buffer_sleep = { 0, 10 * 1000 * 1000 };
-const ntime_t ThreadedPrinterSerial::log_buffer_sleep = { 0, 10 * 1000 * 1000 };
 const ntime_t ThreadedPrinterSerial::helper_thread_sleep = { 0, 100 * 1000 * 1000 };
 
 ThreadedPrinterSerial::ThreadedPrinterSerial() :
   PrinterSerial( helper_thread_sleep.tv_nsec / 1000 / 1000 ),
   command_buffer( command_buffer_size, command_buffer_sleep, "", false, true ),
-  response_buffer( response_buffer_size, true, response_buffer_sleep, "", true, false ),
-  log_buffer( log_buffer_size, false, log_buffer_sleep, _("\n*** Log overflow ***\n\n"), true, false ),
-  error_buffer( log_buffer_size, true, log_buffer_sleep, _("\n*** Error Log overflow ***\n\n"), true, false ) {
+  response_buffer( response_buffer_size, true ),
+  log_buffer( log_buffer_size, false, _("\n*** Log overflow ***\n\n"), true ),
+  error_buffer( error_buffer_size, true, _("\n*** Error Log overflow ***\n\n"), true ) {
   request_print = is_printing = printing_complete = false;
-  printer_commands = NULL;
+  print_job = NULL;
   pc_lines_printed = 0;
   pc_bytes_printed = 0;
   pc_stop_line = 0;
@@ -55,12 +61,31 @@ ThreadedPrinterSerial::ThreadedPrinterSerial() :
   helper_active = false;
   helper_cancel = false;
   return_data = NULL;
+
+#ifndef WIN32
+  if ( pipe( wake_fd ) == 0 ) {
+    for ( int i = 0; i < 2; i++ ) {
+      fcntl( wake_fd[ i ], F_SETFL, fcntl( wake_fd[ i ], F_GETFL ) | O_NONBLOCK );
+      fcntl( wake_fd[ i ], F_SETFD, FD_CLOEXEC );
+    }
+  } else {
+    wake_fd[ 0 ] = wake_fd[ 1 ] = -1;
+  }
+#endif
+
+  send_window = helper_send_window = 0;
+  new_line_encoder = NULL;
+  ResetSendWindow();
+
+  mutex_init( &stats_mutex );
+  ResetSendStats();
 }
 
 ThreadedPrinterSerial::~ThreadedPrinterSerial() {
   if ( helper_active ) {
     mutex_lock( &pc_cond_mutex );
     helper_cancel = true;
+    WakeHelper();
     mutex_unlock( &pc_cond_mutex );
 
     thread_join( helper_thread );
@@ -70,9 +95,18 @@ ThreadedPrinterSerial::~ThreadedPrinterSerial() {
   mutex_destroy( &pc_mutex );
   mutex_destroy( &pc_cond_mutex );
   cond_destroy( &pc_cond );
+  mutex_destroy( &stats_mutex );
 
-  if ( printer_commands != NULL )
-    delete [] printer_commands;
+  if ( print_job != NULL )
+    delete print_job;
+  delete new_line_encoder;
+
+#ifndef WIN32
+  if ( wake_fd[ 0 ] >= 0 ) {
+    close( wake_fd[ 0 ] );
+    close( wake_fd[ 1 ] );
+  }
+#endif
 }
 
 bool ThreadedPrinterSerial::Connect( string device, int baudrate ) {
@@ -80,10 +114,10 @@ bool ThreadedPrinterSerial::Connect( string device, int baudrate ) {
   if ( ! PrinterSerial::RawConnect( device, baudrate ) )
     return false;
 
-  // Clear printer_commands
-  if ( printer_commands != NULL ) {
-    delete [] printer_commands;
-    printer_commands = NULL;
+  // Clear the print job
+  if ( print_job != NULL ) {
+    delete print_job;
+    print_job = NULL;
   }
 
   // Clear/Flush buffers
@@ -114,6 +148,7 @@ void ThreadedPrinterSerial::Disconnect( void ) {
   if ( helper_active ) {
     mutex_lock( &pc_cond_mutex );
     helper_cancel = true;
+    WakeHelper();
     mutex_unlock( &pc_cond_mutex );
 
     thread_join( helper_thread );
@@ -138,6 +173,7 @@ bool ThreadedPrinterSerial::Reset( void ) {
   if ( helper_active ) {
     mutex_lock( &pc_cond_mutex );
     helper_cancel = true;
+    WakeHelper();
     mutex_unlock( &pc_cond_mutex );
 
     thread_join( helper_thread );
@@ -168,47 +204,37 @@ bool ThreadedPrinterSerial::Reset( void ) {
 }
 
 bool ThreadedPrinterSerial::StartPrinting( string commands, unsigned long start_line, unsigned long stop_line ) {
-  char *commands_copy;
+  return StartPrinting( new StringPrintJob( commands ), start_line, stop_line );
+}
+
+bool ThreadedPrinterSerial::StartPrinting( PrintJob *job, unsigned long start_line, unsigned long stop_line ) {
   int rc;
-  size_t pos;
-  unsigned long count;
-  unsigned long lines_printed;
-  unsigned long bytes_printed;
-
-  for ( pos = -1, count = 1; count < start_line; count++ ) {
-    if ( ( pos = commands.find( '\n', pos + 1 ) ) == string::npos ) {
-      char err_buf[ 1024 ];
-      snprintf( err_buf, 1024, _("Error: Cannot start print at line %lu since Gcode only contains %lu lines\n"), start_line, count );
-      if ( err_buf[ 1022 ] != '\0' )
-	err_buf[ 1022 ] = '\n';
-      err_buf[ 1023 ] = '\0';
-      LogError( err_buf );
-      return false;
-    }
-  }
 
-  bytes_printed = pos + 1;
-  lines_printed = start_line > 0 ? start_line - 1 : 0;
+  if ( ! job->IsValid() ) {
+    delete job;
+    ostringstream os;
+    os << _("Error starting print") << ": " << _("Cannot read Gcode") << endl;
+    LogError( os.str().c_str() );
+    return false;
+  }
 
-  while ( count < stop_line ) {
-    if ( ( pos = commands.find( '\n', pos + 1 ) ) == string::npos ) {
-      if ( commands[ commands.length() - 1 ] != '\n' )
-	count++;
-      break;
-    }
-    count++;
+  if ( ! job->SeekLine( start_line ) ) {
+    char err_buf[ 1024 ];
+    snprintf( err_buf, 1024, _("Error: Cannot start print at line %lu since Gcode only contains %lu lines\n"), start_line, job->LineCount() );
+    delete job;
+    if ( err_buf[ 1022 ] != '\0' )
+      err_buf[ 1022 ] = '\n';
+    err_buf[ 1023 ] = '\0';
+    LogError( err_buf );
+    return false;
   }
-  stop_line = count;
 
-  // Allocate memory for commands
-  size_t len;
-  len = commands.length();
-  commands_copy = new char[ len + 10 ];
-  memcpy( commands_copy, commands.c_str(), len + 1 );
+  if ( stop_line > job->LineCount() )
+    stop_line = job->LineCount();
 
   // Make sure we are connected to a printer
   if ( ! IsConnected() ) {
-    delete [] commands_copy;
+    delete job;
     ostringstream os;
     os << _("Error starting print") << ": " << _("Printer connection not established") << endl;
     LogError( os.str().c_str() );
@@ -217,7 +243,7 @@ bool ThreadedPrinterSerial::StartPrinting( string commands, unsigned long start_
 
   // Lock pc_mutex
   if ( ( rc = mutex_lock( &pc_mutex ) ) != 0 ) {
-    delete [] commands_copy;
+    delete job;
     ostringstream os;
     os << _("Error starting print") << ": pc_mutex: " << strerror( rc ) << endl;
     LogError( os.str().c_str() );
@@ -226,7 +252,7 @@ bool ThreadedPrinterSerial::StartPrinting( string commands, unsigned long start_
 
   // Lock the cond mutex
   if ( ( rc = mutex_lock( &pc_cond_mutex ) ) != 0 ) {
-    delete [] commands_copy;
+    delete job;
     mutex_unlock( &pc_mutex );
     ostringstream os;
     os << _("Error starting print") << ": pc_cond_mutex: " << strerror( rc ) << endl;
@@ -235,7 +261,7 @@ bool ThreadedPrinterSerial::StartPrinting( string commands, unsigned long start_
   }
 
   if ( inhibit_count > 0 ) {
-    delete [] commands_copy;
+    delete job;
     mutex_unlock( &pc_cond_mutex );
     mutex_unlock( &pc_mutex );
     return false;
@@ -244,9 +270,10 @@ bool ThreadedPrinterSerial::StartPrinting( string commands, unsigned long start_
   // Make sure we are not already printing
   if ( is_printing ) {
     request_print = false;
+    WakeHelper();
 
     if ( ( rc = cond_wait( &pc_cond, &pc_cond_mutex ) ) !=0 ) {
-      delete [] commands_copy;
+      delete job;
       mutex_unlock( &pc_cond_mutex );
       mutex_unlock( &pc_mutex );
       ostringstream os;
@@ -256,20 +283,21 @@ bool ThreadedPrinterSerial::StartPrinting( string commands, unsigned long start_
     }
   }
 
-  // Ready to start printing, set the variables
-  if ( printer_commands != NULL )
-    delete [] printer_commands;
+  // The helper is not reading the job any more, replace it
+  if ( print_job != NULL )
+    delete print_job;
+  print_job = job;
 
-  printer_commands = commands_copy;
-  pc_lines_printed = lines_printed;
-  pc_bytes_printed = bytes_printed;
+  // Ready to start printing, set the variables
+  pc_lines_printed = start_line > 0 ? start_line - 1 : 0;
+  pc_bytes_printed = print_job->BytePosition();
   pc_stop_line = stop_line;
 
   // Request printing
   request_print = true;
+  WakeHelper();
 
   if ( ( rc = cond_wait( &pc_cond, &pc_cond_mutex ) ) !=0 ) {
-    delete [] commands_copy;
     mutex_unlock( &pc_cond_mutex );
     mutex_unlock( &pc_mutex );
     ostringstream os;
@@ -312,6 +340,7 @@ bool ThreadedPrinterSerial::StopPrinting( bool wait ) {
   }
 
   request_print = false;
+  WakeHelper();
 
   if ( wait && is_printing ) {
     if ( ( rc = cond_wait( &pc_cond, &pc_cond_mutex ) ) !=0 ) {
@@ -332,7 +361,7 @@ bool ThreadedPrinterSerial::StopPrinting( bool wait ) {
 bool ThreadedPrinterSerial::ContinuePrinting( bool wait ) {
   int rc;
 
-  if ( printer_commands == NULL ) {
+  if ( print_job == NULL ) {
     ostringstream os;
     os << _("Error continuing print") << ": ";
     os << _("No stopped print to continue") << endl;
@@ -367,6 +396,7 @@ bool ThreadedPrinterSerial::ContinuePrinting( bool wait ) {
   }
 
   request_print = true;
+  WakeHelper();
 
   if ( wait && ! is_printing ) {
     if ( ( rc = cond_wait( &pc_cond, &pc_cond_mutex ) ) !=0 ) {
@@ -402,6 +432,36 @@ bool ThreadedPrinterSerial::IsInhibited( void ) {
   return inhib;
 }
 
+void ThreadedPrinterSerial::SetLineEncoder( LineEncoder *encoder ) {
+  if ( ! helper_active ) {
+    PrinterSerial::SetLineEncoder( encoder );
+    return;
+  }
+
+  // The default, made here since NULL means no change for the helper
+  if ( encoder == NULL )
+    encoder = new AsciiLineEncoder();
+
+  mutex_lock( &pc_cond_mutex );
+  delete new_line_encoder;
+  new_line_encoder = encoder;
+  mutex_unlock( &pc_cond_mutex );
+  WakeHelper();
+}
+
+void ThreadedPrinterSerial::SetSendWindow( unsigned long bytes ) {
+  mutex_lock( &pc_cond_mutex );
+  send_window = bytes;
+  mutex_unlock( &pc_cond_mutex );
+}
+
+unsigned long ThreadedPrinterSerial::GetSendWindow( void ) {
+  mutex_lock( &pc_cond_mutex );
+  unsigned long bytes = send_window;
+  mutex_unlock( &pc_cond_mutex );
+  return bytes;
+}
+
 unsigned long ThreadedPrinterSerial::GetPrintingProgress( unsigned long *bytes_printed ) {
   unsigned long lines;
   unsigned long bytes;
@@ -429,8 +489,41 @@ unsigned long ThreadedPrinterSerial::GetTotalPrintingLines( void ) {
   return lines;
 }
 
+void ThreadedPrinterSerial::GetSendStats( SendStats &stats ) {
+  mutex_lock( &stats_mutex );
+  stats = send_stats;
+  mutex_unlock( &stats_mutex );
+}
+
+void ThreadedPrinterSerial::ResetSendStats( void ) {
+  mutex_lock( &stats_mutex );
+  memset( &send_stats, 0, sizeof( send_stats ) );
+  mutex_unlock( &stats_mutex );
+}
+
+double ThreadedPrinterSerial::SendStats::LatencyPercentile( double percent ) const {
+  unsigned long total = 0;
+  unsigned long bucket;
+
+  for ( bucket = 0; bucket < latency_buckets; bucket++ )
+    total += latency[ bucket ];
+
+  unsigned long count = 0;
+  for ( bucket = 0; bucket < latency_buckets - 1; bucket++ ) {
+    count += latency[ bucket ];
+    if ( count > 0 && count >= total * percent / 100.0 )
+      break;
+  }
+
+  return ( bucket + 1 ) * 0.1;
+}
+
 bool ThreadedPrinterSerial::Send( string command ) {
-  return command_buffer.Write( command.c_str(), true );
+  if ( ! command_buffer.Write( command.c_str(), true ) )
+    return false;
+
+  WakeHelper();
+  return true;
 }
 
 string ThreadedPrinterSerial::SendAndWaitResponse( string command ) {
@@ -438,6 +531,7 @@ string ThreadedPrinterSerial::SendAndWaitResponse( string command ) {
 
   if ( ! command_buffer.Write( command.c_str(), true, -1, &ret_data ) )
     return "";
+  WakeHelper();
 
   if ( ret_data == NULL )
     return "";
@@ -461,6 +555,10 @@ string ThreadedPrinterSerial::ReadLog( bool wait ) {
   return log_buffer.Read( wait );
 }
 
+size_t ThreadedPrinterSerial::ReadLog( string &log ) {
+  return log_buffer.Read( log, false );
+}
+
 string ThreadedPrinterSerial::ReadErrorLog( bool wait ) {
   return error_buffer.Read( wait );
 }
@@ -476,6 +574,8 @@ void *ThreadedPrinterSerial::HelperMainStatic( void *arg ) {
 }
 
 void *ThreadedPrinterSerial::HelperMain( void ) {
+  ResetSendWindow();
+
   // Read start line before continuing
   // The printer seems to lock up if it recvs a command before the start
   // line has been sent
@@ -496,12 +596,16 @@ void *ThreadedPrinterSerial::HelperMain( void ) {
 
     CheckPrintingState();
 
-    if ( command_buffer.Read( command_scratch, max_command_size, false, &return_data ) > 0 ) {
+    // Stay in send window mode until all lines in flight are acknowledged,
+    // even if the window was switched off meanwhile
+    if ( helper_send_window > 0 || have_pending || ! in_flight.empty() || ! resend_queue.empty() ) {
+      SendWindowStep();
+    } else if ( command_buffer.Read( command_scratch, max_command_size, false, &return_data ) > 0 ) {
       SendCommand( true );
     } else if ( IsPrinting() ) {
       SendNextPrinterCommand();
     } else {
-      nsleep( &helper_thread_sleep );
+      WaitIdle();
     }
   }
 
@@ -517,9 +621,18 @@ void ThreadedPrinterSerial::CheckPrintingState( void ) {
     if ( return_data != NULL )
       return_data->AddLine( _("**Connection closed\n") );
     return_data = NULL;
+    AbortSendWindow( _("**Connection closed\n") );
     thread_exit();
   }
 
+  helper_send_window = send_window;
+
+  // Lines are logged by the encoder that encoded them
+  if ( new_line_encoder != NULL && ! have_pending && in_flight.empty() && resend_queue.empty() ) {
+    PrinterSerial::SetLineEncoder( new_line_encoder );
+    new_line_encoder = NULL;
+  }
+
   if ( request_print != is_printing ) {
     is_printing = request_print;
     printing_complete = false;
@@ -530,36 +643,44 @@ void ThreadedPrinterSerial::CheckPrintingState( void ) {
 }
 
 void ThreadedPrinterSerial::SendNextPrinterCommand( void ) {
-  unsigned long datalen;
-  bool truncated = false;
+  NextPrinterCommand();
 
-  mutex_lock( &pc_cond_mutex );
+  // Send the command and wait for response
+  SendCommand( false );
+}
 
-  // Find the bounds of the next command
-  const char *start = printer_commands + pc_bytes_printed;
+void ThreadedPrinterSerial::NextPrinterCommand( void ) {
+  size_t datalen = 0;
+  bool truncated = false;
 
-  const char *stop;
-  for ( stop = start; *stop != '\n' && *stop != '\0'; stop++ )
-    ;
+  // Only the helper reads the job while printing, no mutex required
+  const char *start = print_job->NextLine( datalen );
+  if ( start == NULL )
+    datalen = 0;
 
-  datalen = stop - start;
   if ( datalen > max_command_size - 2 ) {
     datalen = max_command_size - 2;
     truncated = true;
   }
 
   // Copy command to scratch buffer.  Always add a newline.
-  memcpy( command_scratch, start, datalen );
+  if ( datalen > 0 )
+    memcpy( command_scratch, start, datalen );
   char *loc = command_scratch + datalen;
   *loc++ = '\n';
   *loc++ = '\0';
 
+  bool at_end = print_job->AtEnd();
+  unsigned long bytes = print_job->BytePosition();
+
+  mutex_lock( &pc_cond_mutex );
+
   // Update status
   pc_lines_printed++;
-  pc_bytes_printed = stop - printer_commands + ( ( *stop == '\n' ) ? 1 : 0 );
+  pc_bytes_printed = bytes;
 
   // Update printing complete
-  if ( *stop == '\0' || pc_lines_printed >= pc_stop_line )
+  if ( at_end || pc_lines_printed >= pc_stop_line )
     printing_complete = true;
 
   mutex_unlock( &pc_cond_mutex );
@@ -573,50 +694,429 @@ void ThreadedPrinterSerial::SendNextPrinterCommand( void ) {
     LogLine( warn );
     LogError( warn );
   }
-
-  // Send the command and wait for response
-  SendCommand( false );
 }
 
 void ThreadedPrinterSerial::SendCommand( bool buffer_response ) {
+  ThreadBufferReturnData::ReturnData *ret_data = return_data;
+  return_data = NULL;
+
+  unsigned long line_number = prev_cmd_line_number;
+  unsigned long resends = resend_count;
+  ntime_t sent;
+  ntime_get( &sent );
+
   // Don't send blank lines
   char *recvd = PrinterSerial::SendCommand();
 
+  if ( prev_cmd_line_number != line_number )
+    RecordSendStats( &sent, resend_count - resends );
+
   if ( recvd == NULL ) {
-    if ( return_data != NULL )
-      return_data->AddLine( _("**Error sending line\n") );
-    return_data = NULL;
+    if ( ret_data != NULL )
+      ret_data->AddLine( _("**Error sending line\n") );
     return;
   }
 
+  HandleResponse( recvd, buffer_response, ret_data );
+}
+
+// Deliver the reply to a line to whoever is waiting for it
+void ThreadedPrinterSerial::HandleResponse( char *recvd, bool buffer_response, ThreadBufferReturnData::ReturnData *ret_data ) {
   if ( strncasecmp( recvd, "!!", 2 ) == 0 ) {
     // !! Fatal Error
     response_buffer.Write( recvd, true );
-    if ( return_data != NULL )
-      return_data->AddLine( _("**Fatal Error\n") );
-    return_data = NULL;
+    if ( ret_data != NULL )
+      ret_data->AddLine( _("**Fatal Error\n") );
+    AbortSendWindow( _("**Fatal Error\n") );
     helper_active = false;
     Disconnect(); // This is safe.  With helper active false, no mutexes are needed and no threads are killed.
     thread_exit();
   }
 
-  if ( return_data != NULL ) {
-    return_data->AddLine( recvd );
-    return_data = NULL;
+  if ( ret_data != NULL ) {
+    ret_data->AddLine( recvd );
   } else if ( buffer_response ) {
     // buffer resposne if it is "interesting", that is if it is more than
     // just the two letter "ok" reply followed by white space.
     char *loc;
-    for ( loc = recvd + 2; *loc != ' '; loc++ )
+    for ( loc = recvd + 2; *loc == ' ' || *loc == '\t'; loc++ )
       ;
 
-    if ( *loc != '\n' )
+    if ( *loc != '\n' && *loc != '\0' )
       response_buffer.Write( recvd, false );
   }
 }
 
+////////////////////////////////////////////////////////////////////////////
+//  Send Window Mode
+////////////////////////////////////////////////////////////////////////////
+
+void ThreadedPrinterSerial::ResetSendWindow( void ) {
+  in_flight.clear();
+  resend_queue.clear();
+  acknowledged.clear();
+  in_flight_bytes = 0;
+  skip_oks = 0;
+  resend_active = false;
+  resend_line = 0;
+  stale_requests = 0;
+  ack_latency_us = initial_ack_latency_us;
+  idle_timeouts = 0;
+  have_pending = false;
+  pending_line.return_data = NULL;
+}
+
+void ThreadedPrinterSerial::AbortSendWindow( const char *msg ) {
+  deque<InFlightLine>::iterator it;
+
+  for ( it = in_flight.begin(); it != in_flight.end(); it++ ) {
+    if ( it->return_data != NULL )
+      it->return_data->AddLine( msg );
+  }
+  for ( it = resend_queue.begin(); it != resend_queue.end(); it++ ) {
+    if ( it->return_data != NULL )
+      it->return_data->AddLine( msg );
+  }
+  if ( have_pending && pending_line.return_data != NULL )
+    pending_line.return_data->AddLine( msg );
+
+  ResetSendWindow();
+}
+
+bool ThreadedPrinterSerial::FetchPendingLine( void ) {
+  if ( have_pending )
+    return true;
+
+  // Lines to resend come first, they are already formatted
+  if ( ! resend_queue.empty() ) {
+    pending_line = resend_queue.front();
+    resend_queue.pop_front();
+    have_pending = true;
+    return true;
+  }
+
+  // Window was switched off, just drain what is in flight
+  if ( helper_send_window == 0 )
+    return false;
+
+  while ( true ) {
+    ThreadBufferReturnData::ReturnData *ret_data = NULL;
+    bool buffer_response;
+
+    if ( command_buffer.Read( command_scratch, max_command_size, false, &ret_data ) > 0 ) {
+      buffer_response = true;
+    } else if ( IsPrinting() ) {
+      NextPrinterCommand();
+      buffer_response = false;
+    } else {
+      return false;
+    }
+
+    size_t len;
+    char *formated = FormatLine( len );
+    if ( formated == NULL ) {
+      // Blank lines are not sent, answer them right away like
+      // PrinterSerial::SendCommand() does
+      if ( ret_data != NULL )
+	ret_data->AddLine( "ok\n" );
+      continue;
+    }
+
+    pending_line.text.assign( formated, len );
+    pending_line.line_number = prev_cmd_line_number;
+    pending_line.buffer_response = buffer_response;
+    pending_line.return_data = ret_data;
+    have_pending = true;
+    return true;
+  }
+}
+
+// Returns false if sending failed
+bool ThreadedPrinterSerial::FillSendWindow( void ) {
+  // Send as long as the lines fit into the window.  A line is always sent
+  // if nothing is in flight, even if it is larger than the window.  A line
+  // sent again waits for the lines on the way and goes alone (see class
+  // definition).
+  if ( resend_active && stale_requests > 0 )
+    return true;
+
+  while ( FetchPendingLine() ) {
+    size_t len = pending_line.text.length();
+
+    if ( ! in_flight.empty() && ( resend_active || in_flight_bytes + len > helper_send_window ) )
+      break;
+
+    bool resync = resend_active && pending_line.line_number == resend_line;
+    if ( ( resync && ! SendResync() ) || ! SendText( pending_line.text.data(), len ) ) {
+      AbortSendWindow( _("**Error sending line\n") );
+      return false;
+    }
+
+    ntime_get( &pending_line.sent );
+    in_flight.push_back( pending_line );
+    in_flight_bytes += len;
+    have_pending = false;
+  }
+
+  return true;
+}
+
+void ThreadedPrinterSerial::SendWindowStep( void ) {
+  if ( ! FillSendWindow() )
+    return;
+
+  if ( in_flight.empty() && stale_requests == 0 ) {
+    WaitIdle();
+    return;
+  }
+
+  // Wait for the next reply.  New lines to send wake us up as well, they
+  // may fit into the window.
+#ifndef WIN32
+  int ready = WaitForEvent( stale_requests > 0 ? ResendWaitMs() : max_recv_block_ms );
+  if ( ready == 0 ) {
+    RecvTimeout();
+    return;
+  }
+  if ( ready < 0 )
+    return;
+#endif
+
+  char *recvd = RecvLine();
+
+  if ( recvd == NULL ) {
+    AbortSendWindow( _("**Error sending line\n") );
+    return;
+  }
+  idle_timeouts = 0;
+
+  if ( strncasecmp( recvd, "ok", 2 ) == 0 || strncasecmp( recvd, "!!", 2 ) == 0 ) {
+    if ( skip_oks > 0 && recvd[ 0 ] != '!' ) {
+      skip_oks--;
+      return;
+    }
+
+    if ( in_flight.empty() ) // unexpected, nothing to acknowledge
+      return;
+
+    // Every ok acknowledges the oldest line in flight
+    InFlightLine &line = in_flight.front();
+    bool buffer_response = line.buffer_response;
+    ThreadBufferReturnData::ReturnData *ret_data = line.return_data;
+
+    if ( resend_active && line.line_number == resend_line ) {
+      resend_active = false;
+      stale_requests = 0;
+    }
+
+    RecordSendStats( &line.sent, 0 );
+
+    // Keep it in case the "ok" was not for this line
+    line.buffer_response = false;
+    line.return_data = NULL;
+    acknowledged.push_back( line );
+    if ( acknowledged.size() > acknowledged_keep )
+      acknowledged.pop_front();
+
+    in_flight_bytes -= line.text.length();
+    in_flight.pop_front();
+
+    HandleResponse( recvd, buffer_response, ret_data );
+  } else if ( strncasecmp( recvd, "rs", 2 ) == 0 || strncasecmp( recvd, "resend:", 7 ) == 0 ) {
+    HandleResend( recvd );
+  }
+}
+
+void ThreadedPrinterSerial::HandleResend( const char *recvd ) {
+  const char *loc;
+  for ( loc = recvd; *loc != '\0' && ! isdigit( *loc ); loc++ )
+    ;
+  unsigned long line_number = strtoul( loc, NULL, 10 );
+
+  // The firmware follows every resend request with an "ok"
+  skip_oks++;
+
+  // Caused by a line that was on the way, before line_number is sent again
+  if ( resend_active && line_number == resend_line && stale_requests > 0 ) {
+    stale_requests--;
+    return;
+  }
+
+  ResendFrom( line_number );
+}
+
+void ThreadedPrinterSerial::ResendFrom( unsigned long line_number ) {
+  deque<InFlightLine>::iterator it;
+  for ( it = in_flight.begin(); it != in_flight.end() && it->line_number != line_number; it++ )
+    ;
+
+  if ( it == in_flight.end() ) {
+    // Already waiting to be sent again?
+    if ( ( have_pending && pending_line.line_number == line_number ) ||
+	 ( ! resend_queue.empty() && resend_queue.front().line_number == line_number ) ) {
+      resend_active = true;
+      resend_line = line_number;
+      return;
+    }
+
+    // Acknowledged by mistake?
+    deque<InFlightLine>::iterator acked;
+    for ( acked = acknowledged.begin(); acked != acknowledged.end() && acked->line_number != line_number; acked++ )
+      ;
+
+    if ( acked == acknowledged.end() ) {
+      char msg[ 100 ];
+      snprintf( msg, 99, _("*** Error: Resend requested for line %lu which is not in flight\n"), line_number );
+      if ( msg[ 98 ] != '\0' )
+	msg[ 98 ] = '\n';
+      msg[ 99 ] = '\0';
+      LogLine( msg );
+      LogError( msg );
+      return;
+    }
+
+    // Put it back in flight with the lines acknowledged after it
+    for ( deque<InFlightLine>::iterator line = acked; line != acknowledged.end(); line++ )
+      in_flight_bytes += line->text.length();
+    in_flight.insert( in_flight.begin(), acked, acknowledged.end() );
+    acknowledged.erase( acked, acknowledged.end() );
+    it = in_flight.begin();
+  }
+
+  // A line waiting to be sent must go after the resent ones
+  if ( have_pending ) {
+    resend_queue.push_front( pending_line );
+    have_pending = false;
+  }
+
+  deque<InFlightLine>::iterator line;
+  for ( line = it; line != in_flight.end(); line++ )
+    in_flight_bytes -= line->text.length();
+
+  RecordSendStats( NULL, in_flight.end() - it );
+  resend_queue.insert( resend_queue.begin(), it, in_flight.end() );
+  // One of them caused this request.  With a resync the firmware skips
+  // the others.
+  const char *resync;
+  stale_requests = line_encoder->Resync( &resync ) > 0 ? 0 : in_flight.end() - it - 1;
+  in_flight.erase( it, in_flight.end() );
+
+  resend_active = true;
+  resend_line = line_number;
+}
+
+unsigned long ThreadedPrinterSerial::ResendWaitMs( void ) {
+  unsigned long ms = 3 * ack_latency_us / 1000 + 1;
+  return ms < max_recv_block_ms ? ms : max_recv_block_ms;
+}
+
+void ThreadedPrinterSerial::RecordSendStats( const ntime_t *sent, unsigned long resends ) {
+  unsigned long bucket = 0;
+
+  if ( sent != NULL ) {
+    ntime_t now;
+    ntime_get( &now );
+    long us = ntime_diff_us( sent, &now );
+    bucket = us > 0 ? us / 100 : 0;
+    ack_latency_us += ( us - ack_latency_us ) / 8;
+    if ( bucket >= SendStats::latency_buckets )
+      bucket = SendStats::latency_buckets - 1;
+  }
+
+  mutex_lock( &stats_mutex );
+  if ( sent != NULL ) {
+    send_stats.lines++;
+    send_stats.latency[ bucket ]++;
+  }
+  send_stats.resends += resends;
+  mutex_unlock( &stats_mutex );
+}
+
+void ThreadedPrinterSerial::WakeHelper( void ) {
+#ifndef WIN32
+  if ( wake_fd[ 1 ] >= 0 ) {
+    char c = 0;
+    ssize_t rc = write( wake_fd[ 1 ], &c, 1 ); // a full pipe is fine, the helper wakes up anyway
+    (void) rc;
+  }
+#endif
+}
+
+#ifndef WIN32
+int ThreadedPrinterSerial::WaitForEvent( long timeout_ms ) {
+  if ( RecvLineReady() )
+    return 1;
+
+  struct pollfd fds[ 2 ];
+  fds[ 0 ].fd = device_fd;
+  fds[ 0 ].events = POLLIN;
+  fds[ 1 ].fd = wake_fd[ 0 ];
+  fds[ 1 ].events = POLLIN;
+
+  // Without the wake up pipe, poll the main thread(s) like a sleep would
+  if ( wake_fd[ 0 ] < 0 && ( timeout_ms < 0 || timeout_ms > (long) max_recv_block_ms ) )
+    timeout_ms = max_recv_block_ms;
+
+  int rc = poll( fds, wake_fd[ 0 ] >= 0 ? 2 : 1, timeout_ms );
+  if ( rc < 0 )
+    return errno == EINTR ? -1 : 0;
+
+  if ( fds[ 1 ].revents & POLLIN ) {
+    char buf[ 64 ];
+    while ( read( wake_fd[ 0 ], buf, sizeof( buf ) ) > 0 )
+      ;
+  }
+
+  if ( fds[ 0 ].revents & POLLIN )
+    return 1;
+
+  // Port went away, let the caller see the error instead of spinning
+  if ( fds[ 0 ].revents & ( POLLERR | POLLHUP | POLLNVAL ) )
+    return 1;
+
+  return rc == 0 ? 0 : -1;
+}
+#endif
+
+void ThreadedPrinterSerial::WaitIdle( void ) {
+#ifdef WIN32
+  nsleep( &helper_thread_sleep );
+#else
+  if ( WaitForEvent( -1 ) <= 0 )
+    return;
+
+  // Something the printer sent on its own, like an "echo:" or a temperature
+  // report.  RecvLine() logs it.
+  char *recvd = RecvLine();
+  if ( recvd == NULL ) {
+    nsleep( &helper_thread_sleep );
+    return;
+  }
+
+  if ( strncasecmp( recvd, "!!", 2 ) == 0 )
+    HandleResponse( recvd, false, NULL );
+#endif
+}
+
 void ThreadedPrinterSerial::RecvTimeout( void ) {
   CheckPrintingState();
+
+  // The lines on the way that did not answer were lost in a flush
+  if ( stale_requests > 0 ) {
+    stale_requests = 0;
+    FillSendWindow();
+    return;
+  }
+
+  // Resent line lost (see class definition)?  All older lines must be
+  // acknowledged before, the firmware may just be busy otherwise.
+  if ( resend_active && ! in_flight.empty() &&
+       in_flight.front().line_number == resend_line &&
+       ++idle_timeouts >= resend_timeout_count ) {
+    idle_timeouts = 0;
+    ResendFrom( resend_line );
+    FillSendWindow();
+  }
 }
 
 // Log the line.  The provided line should end in a newline character.
@@ -20,31 +20,45 @@
 #pragma once
 
 #include <limits.h>
+#include <deque>
+#include <string>
 
 #include "thread.h"
 #include "thread_buffer.h"
 #include "printer_serial.h"
+#include "print_job.h"
 
 using namespace std;
 
 class ThreadedPrinterSerial : protected PrinterSerial
 {
+ public:
+  struct SendStats {
+    static const unsigned long latency_buckets = 2000;
+
+    unsigned long lines; // lines acknowledged by the printer
+    unsigned long resends; // lines sent again on request of the printer
+    unsigned long latency[ latency_buckets ]; // from sending a line to its "ok", in 0.1 ms steps.  The last bucket counts all slower lines.
+
+    double LatencyPercentile( double percent ) const; // in ms
+  };
+
+ private:
   static const unsigned long command_buffer_size = 8192;
   static const unsigned long response_buffer_size = 4096;
-  static const unsigned long log_buffer_size = 8192;
+  static const unsigned long log_buffer_size = 64 * 1024; // a UI tick of logging at full speed
+  static const unsigned long error_buffer_size = 8192;
 
   static const ntime_t command_buffer_sleep;
-  static const ntime_t response_buffer_sleep;
-  static const ntime_t log_buffer_sleep;
   static const ntime_t helper_thread_sleep;
 
   // Rules:
-  // request_print, is_printing, and printer_commands are initialized to NULL
+  // request_print, is_printing, and print_job are initialized to NULL
   // To stop printing, thread must lock the mutex, set request_print to false
   //   and wait for the helper to signal on pc_cond.  Finally, release the
   //   mutex.
   // To start printing, lock the mutex, if is_printing is true, stop printing
-  //   per the above steps.  Next, set printer commands to the desired commands
+  //   per the above steps.  Next, replace print_job with the desired job
   //   and clear ps_status.  Then, set request_print to true and wait for
   //   the helper to signal on pc_cond.  Finally, release the mutex.
   // For the purpose of status bars and status lights,
@@ -56,8 +70,11 @@ class ThreadedPrinterSerial : protected PrinterSerial
   //     set is_printing to match request_print, signal on pc_cond, and relase
   //     the mutex.
   //   <<handle queued commands>
-  //   if is_printing, send the next command from printer_commands.  Do NOT
+  //   if is_printing, send the next command from print_job.  Do NOT
   //     need to lock the mutex.
+  //   if there is nothing to do, wait in poll() on the port and wake_fd.
+  //     Whoever changes request_print or helper_cancel or queues a command
+  //     calls WakeHelper() after.
 
   mutex_t pc_mutex;
   bool request_print; // set by main thread(s), pc_mutex required
@@ -65,27 +82,110 @@ class ThreadedPrinterSerial : protected PrinterSerial
   bool printing_complete; // set by helper, no mutex required
   cond_t pc_cond; // signaled by helper, pc_mutex and pc_cond_mutex required
   mutex_t pc_cond_mutex;
-  const char *printer_commands; // set by main thread(s), pc_mutex required
+  PrintJob *print_job; // set by main thread(s) when is_printing is false, pc_mutex required.  Read by helper when is_printing is true
   unsigned long pc_lines_printed; // when is_printing is false, set by main thread(s), pc_mutex required.  When is_printing is true, set by helper, pc_mutex requried
   unsigned long pc_bytes_printed; // when is_printing is false, set by main thread(s), pc_mutex required.  When is_printing is true, set by helper, pc_mutex required
   unsigned long pc_stop_line; // set by main thread(s), pc_mutex required
   int inhibit_count; // set by main thread(s), pc_cond_mutex required
 
   ThreadBufferReturnData command_buffer;
-  SignalingThreadBuffer response_buffer;
-  ThreadBuffer log_buffer;
-  ThreadBuffer error_buffer;
+  // Written by the helper (the logs by any thread), each read by one main thread
+  LockFreeThreadBuffer response_buffer;
+  LockFreeThreadBuffer log_buffer;
+  LockFreeThreadBuffer error_buffer;
 
   bool helper_active;
   thread_t helper_thread;
   bool helper_cancel;
+#ifndef WIN32
+  int wake_fd[ 2 ]; // pipe, written by WakeHelper() when there is something to do for the helper
+#endif
 
   ThreadBufferReturnData::ReturnData *return_data;
 
+  // Send window ("character counting") mode:
+  // Instead of waiting for the "ok" of every line, lines are sent as long as
+  // the total size of the not yet acknowledged lines fits into send_window
+  // bytes, which should not exceed the receive buffer of the firmware.  Every
+  // "ok" acknowledges the oldest line in flight.
+  //
+  // On a checksum or line number error, Marlin-like firmwares answer
+  // "Error:...", "Resend: N" and "ok", and flush their receive buffer.  The
+  // lines still on the way are rejected the same way, with another request
+  // for line N each, or lost in the flush.  So all lines from N on are
+  // queued to be sent again, and the "ok" after each resend request is
+  // skipped.  A copy of N sent before the lines on the way have arrived
+  // would just be lost in their flushes, so N is held back until each of
+  // them has caused a request, or for ResendWaitMs() without any reply,
+  // three times the average time to an "ok".  Then N is sent alone, the
+  // lines after it follow once it is acknowledged.  A request for N after
+  // that means it was rejected again, and it is sent once more right
+  // away.  If it is lost without any reply, it is sent again after
+  // resend_timeout_count receive timeouts.
+  //
+  // If the line encoder resyncs the firmware (see LineEncoder::Resync()),
+  // the lines on the way are skipped, and N is sent right away.
+  //
+  // The rest of a line cut by a flush may reach the firmware as a command of
+  // its own, and its "ok" acknowledges a line that was rejected.  So the last
+  // acknowledged_keep lines are kept to be sent again on a request for them.
+  //
+  // A send_window of 0 selects the classic ping-pong mode, one line at a
+  // time.
+  static const unsigned long resend_timeout_count = 1;
+  static const long initial_ack_latency_us = 8000; // a window of 128 bytes at 115200 baud
+  static const unsigned long acknowledged_keep = 16;
+
+  struct InFlightLine {
+    string text; // formatted line, as sent
+    unsigned long line_number;
+    ntime_t sent;
+    bool buffer_response;
+    ThreadBufferReturnData::ReturnData *return_data;
+  };
+
+  unsigned long send_window; // set by main thread(s), pc_cond_mutex required
+  LineEncoder *new_line_encoder; // for the helper to switch to, pc_cond_mutex required
+  unsigned long helper_send_window; // copy of send_window, helper only
+  deque<InFlightLine> in_flight; // sent, waiting for "ok".  Helper only
+  deque<InFlightLine> resend_queue; // to be sent again, before new lines.  Helper only
+  deque<InFlightLine> acknowledged; // the last lines acknowledged, without response.  Helper only
+  unsigned long in_flight_bytes; // helper only
+  unsigned long skip_oks; // "ok"s not acknowledging a line, helper only
+  bool resend_active; // waiting for resend_line to be acknowledged, helper only
+  unsigned long resend_line; // helper only
+  unsigned long stale_requests; // requests to expect from lines on the way before resend_line is sent again, helper only
+  unsigned long idle_timeouts; // receive timeouts since the last reply, helper only
+  long ack_latency_us; // running average from sending a line to its "ok", helper only
+  bool have_pending; // pending_line is ready to be sent, helper only
+  InFlightLine pending_line; // helper only
+
+  mutex_t stats_mutex;
+  SendStats send_stats; // stats_mutex required
+
+  void RecordSendStats( const ntime_t *sent, unsigned long resends ); // sent may be NULL to count resends only
+
   void CheckPrintingState( void ); // Check if main thread is requesting printing and set helper thread switches accordingly
 
+  void NextPrinterCommand( void ); // Copy the next line of the print to command_scratch and update progress
   void SendNextPrinterCommand( void );
   void SendCommand( bool buffer_response );
+  void HandleResponse( char *recvd, bool buffer_response, ThreadBufferReturnData::ReturnData *ret_data );
+
+  void ResetSendWindow( void ); // Forget all lines in flight, helper only
+  void AbortSendWindow( const char *msg ); // Fail the lines in flight with msg, helper only
+  bool FetchPendingLine( void ); // Fill pending_line, returns false if there is nothing to send
+  bool FillSendWindow( void ); // Send lines while they fit into the window
+  void SendWindowStep( void ); // Fill the send window and handle one reply
+  void HandleResend( const char *recvd );
+  void ResendFrom( unsigned long line_number );
+  unsigned long ResendWaitMs( void ); // how long the lines on the way may take to answer, helper only
+
+  void WakeHelper( void ); // Interrupt WaitForEvent() in the helper, any thread
+#ifndef WIN32
+  int WaitForEvent( long timeout_ms ); // Wait for data from the printer (1), a WakeHelper() (-1) or the timeout (0), -1 ms for none.  Helper only
+#endif
+  void WaitIdle( void ); // Nothing to send, wait for something to do.  Helper only
 
   void RecvTimeout( void );
   void LogLine( const char *line ); // Log the line.  The provided line should end in a newline character.
@@ -109,12 +209,26 @@ class ThreadedPrinterSerial : protected PrinterSerial
   // Send and SendAndWaitResponse can safely be sent
   // while printing.
   virtual bool StartPrinting( string commands, unsigned long start_line = 1, unsigned long stop_line = ULONG_MAX );
+  virtual bool StartPrinting( PrintJob *job, unsigned long start_line = 1, unsigned long stop_line = ULONG_MAX );
+  // Takes ownership of job, which is deleted when the next print starts,
+  // or right away if printing cannot be started.  Lines are read from it
+  // as they are sent, so a FilePrintJob prints a file of any size and a
+  // StringPrintJob on SharedText does not copy the text.
   virtual bool IsPrinting( void );
   virtual bool StopPrinting( bool wait = true );
   virtual bool ContinuePrinting( bool wait = true );
   virtual void Inhibit( bool value = true );
   virtual bool IsInhibited( void );
 
+  virtual void SetLineEncoder( LineEncoder *encoder );
+  // While connected, the helper switches once no lines are in flight.
+
+  void SetSendWindow( unsigned long bytes );
+  unsigned long GetSendWindow( void );
+  // Bytes to keep in flight in send window mode, 0 for ping-pong (default).
+  // Must not be larger than the receive buffer of the firmware (for
+  // example 127 bytes for Marlin with the default RX_BUFFER_SIZE of 128).
+
   unsigned long GetPrintingProgress( unsigned long *bytes_printed = NULL );
   // Returns last line number ok'd by the printer
   // If printing is stopped, returns last line number of previous print
@@ -123,13 +237,18 @@ class ThreadedPrinterSerial : protected PrinterSerial
   unsigned long GetTotalPrintingLines( void );
   // Return the ending line of the current print
 
-  using PrinterSerial::Send;
+  void GetSendStats( SendStats &stats );
+  void ResetSendStats( void );
+  // Statistics of the lines sent so far, for benchmarking the connection
+
   bool Send( string command );
   // Command may be multiple commands separated by newlines (\n).
   // Such commands are queued atomically.
   // Commands may be sent when printing is active.
   // Commands sent with this interface have higher priority than commands
   // sent from StartPrinting.
+  // Hides PrinterSerial::Send(), which would send right away from the
+  // calling thread, racing the helper.
 
   string ReadResponse( bool wait = false );
   // returns "" if wait is false and no response is ready
@@ -144,6 +263,10 @@ class ThreadedPrinterSerial : protected PrinterSerial
   string ReadLog( bool wait = false );
   // returns "" if wait is false and no log entries are ready
 
+  size_t ReadLog( string &log );
+  // Appends all log entries that are ready to log, without waiting.
+  // Returns their length.
+
   string ReadErrorLog( bool wait = false );
   // returns "" if wait is false and no log entries are ready
 };
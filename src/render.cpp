@@ -24,6 +24,9 @@
 #include "settings.h"
 #include "ui/view.h"
 #include "model.h"
+#include "renderstats.h"
+#include "displaycache.h"
+#include "vertexbuffer.h"
 #include "slicer/geometry.h"
 
 #define N_LIGHTS (sizeof (m_lights) / sizeof(m_lights[0]))
@@ -42,7 +45,8 @@ inline GtkWidget *Render::get_widget()
 inline Model *Render::get_model() const { return m_view->get_model(); }
 
 Render::Render (View *view, Glib::RefPtr<Gtk::TreeSelection> selection) :
-  m_arcBall(new ArcBall()), m_view (view), m_selection(selection)
+  m_arcBall(new ArcBall()), m_dragPlaneZ(0), m_view (view), m_selection(selection),
+  m_frame_time(0), m_frame_time_avg(0)
 {
 
   set_events (Gdk::POINTER_MOTION_MASK |
@@ -111,6 +115,7 @@ Render::~Render()
 void Render::set_model(Model *model)
 {
   model->signal_zoom().connect (sigc::mem_fun(*this, &Render::zoom_to_model));
+  model->signal_preview_ready().connect (sigc::mem_fun(*this, &Render::queue_draw));
   zoom_to_model();
 }
 
@@ -209,13 +214,21 @@ bool Render::on_configure_event(GdkEventConfigure* event)
   if (!gldrawable->gl_begin(get_gl_context()))
     return false;
 
-  const int w = get_width(), h = get_height();
+  setup_gl(get_width(), get_height());
 
+  gldrawable->gl_end();
+
+  return true;
+}
+
+// the projection and lights for drawing on w x h pixels
+void Render::setup_gl(int w, int h)
+{
   glLoadIdentity();
   glViewport (0, 0, w, h);
   glMatrixMode (GL_PROJECTION);
   glLoadIdentity ();
-  gluPerspective (45.0f, (float)get_width()/(float)get_height(),1.0f, 1000000.0f);
+  gluPerspective (45.0f, (float)w/(float)h,1.0f, 1000000.0f);
   glMatrixMode (GL_MODELVIEW);
   glLoadIdentity ();
 
@@ -248,10 +261,6 @@ bool Render::on_configure_event(GdkEventConfigure* event)
   glDepthFunc (GL_LEQUAL);
   glEnable (GL_DEPTH_TEST);
   glHint (GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
-
-  gldrawable->gl_end();
-
-  return true;
 }
 
 bool Render::on_expose_event(GdkEventExpose* event)
@@ -261,6 +270,47 @@ bool Render::on_expose_event(GdkEventExpose* event)
   if (!gldrawable || !gldrawable->gl_begin(get_gl_context()))
     return false;
 
+  // what was cleared without the context since the last frame
+  DisplayCache::freeReleased();
+  VertexBuffer::freeReleased();
+
+  Model *model = get_model();
+  const bool show_stats = model &&
+    model->settings.get_boolean("Display","ShowRenderStats");
+
+  Glib::Timer frame_timer;
+  // with the overlay on, the passes wait for each other to be timed
+  RenderStats::beginFrame(show_stats);
+
+  draw_scene();
+  if (show_stats)
+    draw_stats(get_width(), get_height());
+
+  if (gldrawable->is_double_buffered()) {
+    gldrawable->swap_buffers();
+  } else {
+    glFlush();
+  }
+  // the commands are only queued so far, wait for them only to time them
+  if (show_stats)
+    glFinish();
+  gldrawable->gl_end();
+
+  m_frame_time = frame_timer.elapsed();
+  RenderStats::endFrame(m_frame_time);
+  if (m_frame_time_avg == 0)
+    m_frame_time_avg = m_frame_time;
+  else
+    m_frame_time_avg = 0.9 * m_frame_time_avg + 0.1 * m_frame_time;
+  if (model)
+    model->setFrameTime(m_frame_time);
+
+  return true;
+}
+
+// the scene as seen through m_transform, without swapping the buffers
+void Render::draw_scene()
+{
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
   glLoadIdentity();
   glTranslatef (0.0, 0.0, -2.0 * m_zoom);
@@ -277,14 +327,121 @@ bool Render::on_expose_event(GdkEventExpose* event)
   m_view->Draw (selpath);
 
   glPopMatrix();
+}
 
-  if (gldrawable->is_double_buffered()) {
-    gldrawable->swap_buffers();
-  } else {
-    glFlush();
-  }
-  gldrawable->gl_end();
+// the statistics of the frame before in the top left corner
+void Render::draw_stats(int w, int h)
+{
+  if (fontheight == 0) return;
+  const vector<string> lines =
+    RenderStats::describe(RenderStats::lastFrame());
+
+  glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+  glDisable(GL_LIGHTING);
+  glDisable(GL_DEPTH_TEST);
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glOrtho(0, w, 0, h, -1, 1);
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+
+  glColor3f(1.0f, 1.0f, 0.6f);
+  for (uint i = 0; i < lines.size(); i++)
+    draw_string(Vector3d(4, h - (i + 1) * (fontheight + 2), 0), lines[i]);
+
+  glPopMatrix();
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  glPopAttrib();
+}
 
+// Draws the scene into an offscreen GL pixmap of width x height and
+// writes the statistics to out: of the first frame, which makes the
+// vertex buffers, and the average of frames more after the layer preview
+// is sliced.  Needs no window, but GLX needs an X display (Xvfb will do).
+// The buffers are made in the context of the pixmap, so this is only for
+// a run that quits afterwards.
+bool Render::benchmark(uint frames, int width, int height, ostream &out)
+{
+  Glib::RefPtr<Gdk::GL::Config> glconfig =
+    Gdk::GL::Config::create(Gdk::GL::MODE_RGBA |
+			    Gdk::GL::MODE_DEPTH |
+			    Gdk::GL::MODE_STENCIL |
+			    Gdk::GL::MODE_SINGLE);
+  if (!glconfig) {
+    cerr << "no GL visual for the render benchmark" << endl;
+    return false;
+  }
+  Glib::RefPtr<Gdk::Pixmap> pixmap =
+    Gdk::Pixmap::create(Glib::RefPtr<Gdk::Drawable>(), width, height,
+			glconfig->get_depth());
+  Glib::RefPtr<Gdk::GL::Pixmap> glpixmap =
+    Gdk::GL::ext(pixmap).set_gl_capability(glconfig);
+  Glib::RefPtr<Gdk::GL::Context> glcontext;
+  if (glpixmap) // offscreen needs indirect rendering
+    glcontext = Gdk::GL::Context::create(glpixmap, false);
+  if (!glcontext || !glpixmap->gl_begin(glcontext)) {
+    cerr << "no GL context for the render benchmark" << endl;
+    return false;
+  }
+  setup_gl(width, height);
+
+  RenderStats::Frame first, sum;
+  double min_time = 0, max_time = 0;
+  sum.time = 0;
+  sum.draw_calls = sum.vertices = 0;
+  // the first frame, then one to show the layer preview, then the others
+  for (uint f = 0; f < frames + 2; f++) {
+    Glib::Timer frame_timer;
+    RenderStats::beginFrame(true);
+    draw_scene();
+    glFinish();
+    const RenderStats::Frame &frame = RenderStats::endFrame(frame_timer.elapsed());
+    if (f == 0) {
+      first = frame;
+      Model *model = get_model();
+      if (model)
+	model->m_preview.wait();
+    }
+    if (f < 2)
+      continue;
+    if (f == 2 || frame.time < min_time) min_time = frame.time;
+    if (f == 2 || frame.time > max_time) max_time = frame.time;
+    sum.time += frame.time;
+    sum.draw_calls += frame.draw_calls;
+    sum.vertices += frame.vertices;
+    for (uint i = 0; i < frame.passes.size(); i++) {
+      uint p = 0;
+      while (p < sum.passes.size() && sum.passes[p].first != frame.passes[i].first)
+	p++;
+      if (p == sum.passes.size())
+	sum.passes.push_back(make_pair(frame.passes[i].first, 0.));
+      sum.passes[p].second += frame.passes[i].second;
+    }
+  }
+  glpixmap->gl_end();
+
+  out << "Render benchmark, " << width << "x" << height << endl;
+  out << "First frame:" << endl;
+  vector<string> lines = RenderStats::describe(first);
+  for (uint i = 0; i < lines.size(); i++)
+    out << "  " << lines[i] << endl;
+  if (frames > 0) {
+    sum.time /= frames;
+    sum.draw_calls /= frames;
+    sum.vertices /= frames;
+    for (uint p = 0; p < sum.passes.size(); p++)
+      sum.passes[p].second /= frames;
+    out << "Average of " << frames << " frames:" << endl;
+    lines = RenderStats::describe(sum);
+    for (uint i = 0; i < lines.size(); i++)
+      out << "  " << lines[i] << endl;
+    out << "  Min: " << min_time * 1000 << " ms, max: "
+	<< max_time * 1000 << " ms" << endl;
+  }
   return true;
 }
 
@@ -351,6 +508,13 @@ bool Render::on_button_press_event(GdkEventButton* event)
        (event->state & GDK_SHIFT_MASK || event->state & GDK_CONTROL_MASK) )  {
     guint index = find_object_at(event->x, event->y);
     if (index) {
+      // drag at the height of the point grabbed, so it stays under the mouse
+      Vector3d from, to, hit;
+      mouse_ray(event->x, event->y, from, to);
+      if (get_model()->rayHit(from, to - from, hit))
+	m_dragPlaneZ = hit.z();
+      else
+	m_dragPlaneZ = 0;
       Gtk::TreeModel::iterator iter = get_model()->objtree.find_stl_by_index(index);
       if (!m_selection->is_selected(iter)) {
 	// if (!(event->state & GDK_CONTROL_MASK))  // add to selection by CONTROL
@@ -432,8 +596,9 @@ bool Render::on_motion_notify_event(GdkEventMotion* event)
       vector<TreeObject*>objects;
       if (!m_view->get_selected_objects(objects, shapes))
 	return true;
-      const Vector3d mouse_down_plat = mouse_on_plane(m_dragStart.x(), m_dragStart.y());
-      const Vector3d mousePlat  = mouse_on_plane(event->x, event->y);
+      const Vector3d mouse_down_plat = mouse_on_plane(m_dragStart.x(), m_dragStart.y(),
+						      m_dragPlaneZ);
+      const Vector3d mousePlat  = mouse_on_plane(event->x, event->y, m_dragPlaneZ);
       const Vector2d mouse_xy   = Vector2d(mousePlat.x(), mousePlat.y());
       const Vector2d deltamouse = mouse_xy - Vector2d(mouse_down_plat.x(), mouse_down_plat.y());
       const Vector3d movevec(deltamouse.x(), deltamouse.y(), 0.);
@@ -537,83 +702,57 @@ void Render::CenterView()
 
 guint Render::find_object_at(gdouble x, gdouble y)
 {
-  // Render everything in selection mode
+  // Draw the shapes in their pick colours, clipped to the pixel under
+  // the cursor, and read that back.  Nothing is swapped, the next
+  // expose draws the back buffer anew.
+  Model *model = get_model();
   Glib::RefPtr<Gdk::GL::Drawable> gldrawable = get_gl_drawable();
-  if (!gldrawable->gl_begin(get_gl_context()))
-    return false;
-
-  const GLsizei BUFSIZE = 256;
-  GLuint select_buffer[BUFSIZE];
-
-  glSelectBuffer(BUFSIZE, select_buffer);
-  (void)glRenderMode(GL_SELECT);
+  if (!model || !gldrawable || !gldrawable->gl_begin(get_gl_context()))
+    return 0;
 
   GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT,viewport);
+  const GLint px = (GLint)x, py = viewport[3] - 1 - (GLint)y;
+
+  glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT |
+	       GL_SCISSOR_BIT | GL_LIGHTING_BIT | GL_POLYGON_BIT);
+  glEnable(GL_SCISSOR_TEST);
+  glScissor(px, py, 1, 1);
+  glClearColor(0, 0, 0, 0);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glDisable(GL_LIGHTING);
+  glDisable(GL_BLEND);
+  glDisable(GL_DITHER);
+  glDisable(GL_CULL_FACE);
+  glEnable(GL_DEPTH_TEST);
+  glDepthMask(GL_TRUE);
+  // flat shapes are alpha textures, only their filled parts count
+  glEnable(GL_ALPHA_TEST);
+  glAlphaFunc(GL_GREATER, 0.5f);
+  glShadeModel(GL_FLAT);
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-  glMatrixMode (GL_PROJECTION);
   glPushMatrix();
   glLoadIdentity ();
-  glGetIntegerv(GL_VIEWPORT,viewport);
-  gluPickMatrix(x,viewport[3]-y,2,2,viewport); // 2x2 pixels around the cursor
-  gluPerspective (45.0f, (float)get_width()/(float)get_height(),1.0f, 1000000.0f);
-  glMatrixMode (GL_MODELVIEW);
-  glInitNames();
-  glPushName(0);
-  glLoadIdentity ();
-
   glTranslatef (0.0, 0.0, -2.0 * m_zoom);
   glMultMatrixf (m_transform.M);
   CenterView();
-  glPushMatrix();
-  glColor3f(0.75f,0.75f,1.0f);
-
-  glLightModeli(GL_LIGHT_MODEL_LOCAL_VIEWER, 1);
-
-  vector<Gtk::TreeModel::Path> no_object;
-  m_view->Draw (no_object, true);
-
-  // restor projection and model matrices
-  glMatrixMode(GL_PROJECTION);
-  glPopMatrix();
-  glMatrixMode(GL_MODELVIEW);
+  model->drawPickIds();
   glPopMatrix();
-  // restore rendering mode
-  GLint hits = glRenderMode(GL_RENDER);
 
-  if (gldrawable->is_double_buffered())
-    gldrawable->swap_buffers();
-  else
-    glFlush();
+  GLubyte pixel[4];
+  glReadPixels(px, py, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel);
+  glPopAttrib();
   gldrawable->gl_end();
 
-  // Process the selection hits
-  GLuint *ptr = select_buffer;
-  GLuint name = 0;
-  GLuint minZ = G_MAXUINT;
-
-  for (GLint i = 0; i < hits; i++) { /*  for each hit  */
-     GLuint n = *ptr++; // number of hits in this record
-     GLuint z1 = *ptr++; // Minimum Z in the hit record
-     ptr++; // Skip Maximum Z coord
-     if (n > 0 && z1 < minZ) {
-       // Found an object further forward.
-       name = *ptr;
-       minZ = z1;
-     }
-     ptr += n; // Skip n name records;
-  }
-
-  return name;
+  return pixel[0] | (pixel[1] << 8) | (pixel[2] << 16);
 }
 
 
 // http://www.3dkingdoms.com/selection.html
-Vector3d Render::mouse_on_plane(double x, double y, double plane_z) const
+// the points on the near and far clipping planes under the mouse
+void Render::mouse_ray(double x, double y, Vector3d &from, Vector3d &to) const
 {
-  Vector3d margin;
-  Model *m = get_model();
-  if (m!=NULL) margin = m->settings.getPrintMargin();
-
  // This function will find 2 points in world space that are on the line into the screen defined by screen-space( ie. window-space ) point (x,y)
   double mvmatrix[16];
   double projmatrix[16];
@@ -626,9 +765,19 @@ Vector3d Render::mouse_on_plane(double x, double y, double plane_z) const
   dClickY = double ((double)get_height() - y); // OpenGL renders with (0,0) on bottom, mouse reports with (0,0) on top
 
   gluUnProject ((double) x, dClickY, 0.0, mvmatrix, projmatrix, viewport, &dX, &dY, &dZ);
-  Vector3d rayP1( dX, dY, dZ );
+  from = Vector3d( dX, dY, dZ );
   gluUnProject ((double) x, dClickY, 1.0, mvmatrix, projmatrix, viewport, &dX, &dY, &dZ);
-  Vector3d rayP2( dX, dY, dZ );
+  to = Vector3d( dX, dY, dZ );
+}
+
+Vector3d Render::mouse_on_plane(double x, double y, double plane_z) const
+{
+  Vector3d margin;
+  Model *m = get_model();
+  if (m!=NULL) margin = m->settings.getPrintMargin();
+
+  Vector3d rayP1, rayP2;
+  mouse_ray(x, y, rayP1, rayP2);
 
   // intersect with z=plane_z;
   if (rayP2.z() != rayP1.z()) {
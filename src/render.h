@@ -33,6 +33,7 @@ class Render : public Gtk::GL::DrawingArea
   Matrix4fT m_transform;
   Vector2f  m_downPoint;
   Vector2f  m_dragStart;
+  double    m_dragPlaneZ; // objects move in XY along this plane
   View *m_view;
   Model *get_model() const;
   Glib::RefPtr<Gtk::TreeSelection> m_selection;
@@ -44,10 +45,19 @@ class Render : public Gtk::GL::DrawingArea
   float m_zoom;
   gllight *m_lights[4];
 
+  // drawing time of the last frame and the average of the recent ones,
+  // in seconds, including the wait for the graphics card
+  double m_frame_time;
+  double m_frame_time_avg;
+
   void SetEnableLight(unsigned int lightNr, bool on);
+  void setup_gl(int w, int h);
+  void draw_scene();
+  void draw_stats(int w, int h);
   void CenterView();
   void selection_changed();
   guint find_object_at(gdouble x, gdouble y);
+  void mouse_ray(double x, double y, Vector3d &from, Vector3d &to) const;
   Vector3d mouse_on_plane(double x, double y, double plane_z=0) const;
 
  public:
@@ -59,9 +69,13 @@ class Render : public Gtk::GL::DrawingArea
   void set_zoom (float zoom) {m_zoom=zoom;};
   void zoom_to_model();
   void set_transform(const Matrix4fT &transform) {m_transform=transform;};
+  double get_frame_time() const {return m_frame_time;};
+  double get_average_frame_time() const {return m_frame_time_avg;};
 
   static void draw_string(const Vector3d &pos, const string s);
 
+  bool benchmark(uint frames, int width, int height, ostream &out);
+
   virtual void on_realize();
   virtual bool on_configure_event(GdkEventConfigure* event);
   virtual bool on_expose_event(GdkEventExpose* event);
@@ -0,0 +1,114 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "stdafx.h"
+#include "renderstats.h"
+
+#include <sstream>
+#include <iomanip>
+
+bool RenderStats::counting = false;
+bool RenderStats::finish = false;
+RenderStats::Frame RenderStats::current;
+RenderStats::Frame RenderStats::last;
+std::vector<size_t> RenderStats::running;
+double RenderStats::mark = 0;
+
+static Glib::Timer *timer = NULL;
+
+
+void RenderStats::beginFrame(bool finish_passes)
+{
+  if (!timer)
+    timer = new Glib::Timer();
+  finish = finish_passes;
+  current.time = 0;
+  current.draw_calls = 0;
+  current.vertices = 0;
+  current.passes.clear();
+  current.passes.push_back(std::make_pair(string("Other"), 0.));
+  running.assign(1, 0);
+  counting = true;
+  timer->start();
+  mark = 0;
+}
+
+const RenderStats::Frame &RenderStats::endFrame(double time)
+{
+  if (counting) {
+    charge();
+    counting = false;
+    current.time = time;
+    last = current;
+  }
+  return last;
+}
+
+// the time since the last mark goes to the innermost running pass
+void RenderStats::charge()
+{
+  if (finish)
+    glFinish();
+  const double now = timer->elapsed();
+  current.passes[running.back()].second += now - mark;
+  mark = now;
+}
+
+RenderStats::Pass::Pass(const char *name)
+  : counted(counting)
+{
+  if (!counted) return;
+  charge();
+  size_t p = 0;
+  while (p < current.passes.size() && current.passes[p].first != name)
+    p++;
+  if (p == current.passes.size())
+    current.passes.push_back(std::make_pair(string(name), 0.));
+  running.push_back(p);
+}
+
+RenderStats::Pass::~Pass()
+{
+  // endFrame() may have come first
+  if (!counted || !counting) return;
+  charge();
+  running.pop_back();
+}
+
+std::vector<std::string> RenderStats::describe(const Frame &frame)
+{
+  std::vector<std::string> lines;
+  std::ostringstream s;
+  s << std::fixed << std::setprecision(2);
+  s << "Frame: " << frame.time * 1000 << " ms";
+  if (frame.time > 0)
+    s << " (" << std::setprecision(0) << 1 / frame.time << " fps)";
+  lines.push_back(s.str());
+  s.str("");
+  s << "Draw calls: " << frame.draw_calls
+    << ", vertices: " << frame.vertices;
+  lines.push_back(s.str());
+  s << std::setprecision(2);
+  for (uint i = 0; i < frame.passes.size(); i++) {
+    s.str("");
+    s << frame.passes[i].first << ": " << frame.passes[i].second * 1000 << " ms";
+    lines.push_back(s.str());
+  }
+  return lines;
+}
@@ -0,0 +1,83 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef RENDERSTATS_H
+#define RENDERSTATS_H
+
+#include <vector>
+#include <string>
+#include "stdafx.h"
+
+// Counts what a frame hands to OpenGL and times its drawing passes, for
+// the overlay of Display.ShowRenderStats and the render benchmark.  Only
+// the draws of VertexBuffers and DisplayCaches are counted, not the
+// immediate mode drawing that is left (glBegin() to glEnd(), as for the
+// grid and the bounding boxes).
+// Main thread only.
+class RenderStats
+{
+ public:
+  struct Frame
+  {
+    double time;               // seconds, all in all
+    unsigned long draw_calls;
+    unsigned long vertices;
+    // seconds in each pass, in the order they first ran, the time
+    // outside of all passes first
+    std::vector< std::pair<std::string, double> > passes;
+  };
+
+  // counts a frame from now on; with finish the passes wait for the
+  // graphics card at their ends, so their times include its drawing
+  static void beginFrame(bool finish);
+  // the frame took time seconds from before beginFrame()
+  static const Frame &endFrame(double time);
+  static const Frame &lastFrame() { return last; };
+
+  static void countDraw(size_t vertices)
+  {
+    if (!counting) return;
+    current.draw_calls++;
+    current.vertices += vertices;
+  };
+
+  // The time from construction to destruction goes to the pass name, but
+  // not the time of the passes run meanwhile.  Nothing if no frame is
+  // counted.
+  class Pass
+  {
+  public:
+    Pass(const char *name);
+    ~Pass();
+  private:
+    bool counted;
+  };
+
+  // the frame as lines of text
+  static std::vector<std::string> describe(const Frame &frame);
+
+ private:
+  static bool counting, finish;
+  static Frame current, last;
+  static std::vector<size_t> running; // into current.passes, innermost last
+  static double mark;
+
+  static void charge();
+};
+
+#endif // RENDERSTATS_H
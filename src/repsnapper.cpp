@@ -45,12 +45,16 @@ public:
 	string printerdevice_path;
   string svg_output_path;
   bool svg_single_output;
+	uint render_benchmark_frames;
+	uint slice_benchmark_runs;
 	std::vector<std::string> files;
 private:
 	void init ()
 	{
 		// specify defaults here or in the block below
 		use_gui = true;
+		render_benchmark_frames = 0;
+		slice_benchmark_runs = 0;
 	}
 	void version ()
 	{
@@ -72,6 +76,11 @@ private:
 			     "  --svg [file]           slice to SVG file\n"
 			     "  --ssvg [file]          slice to single layer SVG files [file]NNNN.svg\n"
 			     "  -s, --settings [file]  read render settings [file]\n"
+			     "  --render-benchmark [n] draw [FILES] n times offscreen,\n"
+			     "                         print the rendering statistics\n"
+			     "  --slice-benchmark [n]  head-less, generate the GCode for the\n"
+			     "                         input n times, print the time and the\n"
+			     "                         polygon copies of each run\n"
 			     "  -h, --help             show this help\n"
 			     "\n"
 			     "Report bugs to #repsnapper, irc.freenode.net\n\n"));
@@ -117,6 +126,12 @@ public:
 				svg_output_path = argv[++i];
 				svg_single_output = true;
 			}
+			else if (param && !strcmp (arg, "--render-benchmark"))
+				render_benchmark_frames = atoi (argv[++i]);
+			else if (param && !strcmp (arg, "--slice-benchmark")) {
+				slice_benchmark_runs = atoi (argv[++i]);
+				use_gui = false;
+			}
 			else if (!strcmp (arg, "--version") || !strcmp (arg, "-v"))
 				version();
 			else
@@ -280,7 +295,16 @@ int main(int argc, char **argv)
 	return 0;
       }
 
-      if (opts.gcode_output_path.size() > 0) {
+      if (opts.slice_benchmark_runs > 0) {
+	for (uint i = 0; i < opts.slice_benchmark_runs; i++) {
+	  Poly::resetCopyCount();
+	  Glib::Timer timer;
+	  model->ConvertToGCode();
+	  cout << "Run " << i+1 << ": " << timer.elapsed() << " s, "
+	       << Poly::getCopyCount() << " polygon copies" << endl;
+	}
+      }
+      else if (opts.gcode_output_path.size() > 0) {
 	model->ConvertToGCode();
         model->WriteGCode(Gio::File::create_for_path(opts.gcode_output_path));
       }
@@ -315,6 +339,15 @@ int main(int argc, char **argv)
 
   model->ModelChanged();
 
+  if (opts.render_benchmark_frames > 0) {
+    // draws offscreen, the window is hidden before it is drawn
+    bool ok = mainwin->render_benchmark(opts.render_benchmark_frames,
+					800, 600, cout);
+    delete mainwin;
+    delete model;
+    return ok ? 0 : 1;
+  }
+
   tk.run();
 
   delete mainwin;
@@ -29,9 +29,13 @@
 #include <omp.h>
 #endif
 
+// shapes with fewer are drawn whole at every size
+static const size_t lod_min_triangles = 100000;
+
 // Constructor
 Shape::Shape()
-  : slow_drawing(false), gl_List(-1)
+  : slow_drawing(false), geometry_changed(true), geometry_radius(0),
+    bvh_changed(true), bvh_moved(false), normal_lines_length(0)
 {
   Min.set(0,0,0);
   Max.set(200,200,200);
@@ -40,14 +44,24 @@ Shape::Shape()
 
 void Shape::clear() {
   triangles.clear();
-  if (gl_List>=0)
-    glDeleteLists(gl_List,1);
-  gl_List = -1;
+  invalidateGeometry();
 };
 
+void Shape::invalidateGeometry(bool same_triangles)
+{
+  geometry_changed = true;
+  if (same_triangles)
+    bvh_moved = true;
+  else
+    bvh_changed = true;
+  slow_drawing = false;
+  lod.stop();
+}
+
 void Shape::setTriangles(const vector<Triangle> &triangles_)
 {
   triangles = triangles_;
+  invalidateGeometry();
 
   CalcBBox();
   double vol = volume();
@@ -207,6 +221,7 @@ void Shape::makeHollow(double wallthickness)
   Matrix4d invT = transform3D.getInverse();
   vector<Triangle> cubet = cube(invT*Min-wall, invT*Max+wall);
   triangles.insert(triangles.end(),cubet.begin(),cubet.end());
+  invalidateGeometry();
   CalcBBox();
 }
 
@@ -214,6 +229,7 @@ void Shape::invertNormals()
 {
   for (uint i = 0; i < triangles.size(); i++)
     triangles[i].invertNormal();
+  invalidateGeometry();
 }
 
 // doesn't work
@@ -236,6 +252,7 @@ void Shape::repairNormals(double sqdistance)
     //cerr << i<< ": " << numadj << " - " << numwrong  << endl;
     //if (numwrong > numadj/2) triangles[i].invertNormal();
   }
+  invalidateGeometry();
 }
 
 void Shape::mirror()
@@ -243,6 +260,7 @@ void Shape::mirror()
   const Vector3d mCenter = transform3D.getInverse() * Center;
   for (uint i = 0; i < triangles.size(); i++)
     triangles[i].mirrorX(mCenter);
+  invalidateGeometry(true);
   CalcBBox();
 }
 
@@ -267,6 +285,7 @@ string Shape::getSTLsolid() const
 void Shape::addTriangles(const vector<Triangle> &tr)
 {
   triangles.insert(triangles.end(), tr.begin(), tr.end());
+  invalidateGeometry();
   CalcBBox();
 }
 
@@ -336,13 +355,36 @@ void Shape::CalcBBox()
 {
   Min.set(INFTY,INFTY,INFTY);
   Max.set(-INFTY,-INFTY,-INFTY);
-  for(size_t i = 0; i < triangles.size(); i++) {
-    triangles[i].AccumulateMinMax (Min, Max, transform3D.transform);
-  }
+  // large shapes are bounded through the hierarchy, which only visits
+  // the triangles at the extremes
+  if (triangles.size() < bvh_min_triangles ||
+      !getBVH().extents(triangles, transform3D.transform, Min, Max))
+    for(size_t i = 0; i < triangles.size(); i++) {
+      triangles[i].AccumulateMinMax (Min, Max, transform3D.transform);
+    }
   Center = (Max + Min) / 2;
-  if (gl_List>=0)
-    glDeleteLists(gl_List,1);
-  gl_List = -1;
+}
+
+const BVH &Shape::getBVH()
+{
+  if (bvh_changed)
+    bvh.build(triangles);
+  else if (bvh_moved)
+    bvh.refit(triangles);
+  bvh_changed = bvh_moved = false;
+  return bvh;
+}
+
+bool Shape::intersect(const Matrix4d &T, const Vector3d &from,
+		      const Vector3d &dir, double &t)
+{
+  // the ray in shape coordinates, t stays the same along it
+  Matrix4d inverse;
+  if (!(T * transform3D.transform).inverse(inverse)) return false;
+  const Vector3d sfrom = inverse * from;
+  const Vector3d sdir = inverse * (from + dir) - sfrom;
+  uint triangle;
+  return getBVH().intersect(triangles, sfrom, sdir, t, triangle);
 }
 
 Vector3d Shape::scaledCenter() const
@@ -457,6 +499,8 @@ int Shape::divideAtZ(double z, Shape *upper, Shape *lower, const Matrix4d &T) co
 			 uppersplit.begin(),uppersplit.end());
   lower->triangles.insert(lower->triangles.end(),
 			 lowersplit.begin(),lowersplit.end());
+  upper->invalidateGeometry();
+  lower->invalidateGeometry();
   upper->CalcBBox();
   lower->CalcBBox();
   lower->Rotate(Vector3d(0,1,0),M_PI);
@@ -469,6 +513,7 @@ int Shape::divideAtZ(double z, Shape *upper, Shape *lower, const Matrix4d &T) co
 
 void Shape::PlaceOnPlatform()
 {
+  CalcBBox(); // for the current transform
   transform3D.move(Vector3d(0,0,-Min.z()));
 }
 
@@ -509,6 +554,7 @@ void Shape::Twist(double angle)
       }
     triangles[i].calcNormal();
   }
+  invalidateGeometry(true);
   CalcBBox();
 }
 
@@ -857,16 +903,14 @@ void Shape::draw(const Settings &settings, bool highlight, uint max_triangles)
 		glMaterialfv(GL_FRONT, GL_DIFFUSE, mat_diffuse);
 
 		glColor4fv(mat_diffuse);
-		for(size_t i=0;i<triangles.size();i++)
-		{
-			glBegin(GL_LINE_LOOP);
-			glLineWidth(1);
-			glNormal3dv((GLdouble*)&(triangles[i].Normal));
-			glVertex3dv((GLdouble*)&(triangles[i].A));
-			glVertex3dv((GLdouble*)&(triangles[i].B));
-			glVertex3dv((GLdouble*)&(triangles[i].C));
-			glEnd();
-		}
+		glLineWidth(1);
+		// the outlines of all triangles, back faces included
+		glPushAttrib(GL_POLYGON_BIT);
+		glDisable(GL_CULL_FACE);
+		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+		const VertexBuffer *level = detailLevel(max_triangles);
+		(level ? level : &geometry)->draw(GL_TRIANGLES);
+		glPopAttrib();
 	}
 
 	glDisable(GL_LIGHTING);
@@ -875,16 +919,25 @@ void Shape::draw(const Settings &settings, bool highlight, uint max_triangles)
 	if(settings.get_boolean("Display","DisplayNormals"))
 	{
 	        glColor4fv(settings.get_colour("Display","NormalsColour"));
-		glBegin(GL_LINES);
 		double nlength = settings.get_double("Display","NormalsLength");
-		for(size_t i=0;i<triangles.size();i++)
-		{
+		buildGeometry();
+		if (nlength != normal_lines_length || normal_lines.empty()) {
+		  vector<NormalVertex> lines(2*triangles.size());
+		  for(size_t i=0;i<triangles.size();i++)
+		  {
 			Vector3d center = (triangles[i].A+triangles[i].B+triangles[i].C)/3.0;
-			glVertex3dv((GLdouble*)&center);
 			Vector3d N = center + (triangles[i].Normal*nlength);
-			glVertex3dv((GLdouble*)&N);
+			for (uint k = 0; k < 3; k++) {
+			  lines[2*i].pos[k]   = center[k];
+			  lines[2*i+1].pos[k] = N[k];
+			  lines[2*i].normal[k] = lines[2*i+1].normal[k]
+			    = triangles[i].Normal[k];
+			}
+		  }
+		  normal_lines.set(lines);
+		  normal_lines_length = nlength;
 		}
-		glEnd();
+		normal_lines.draw(GL_LINES);
 	}
 
 	// Endpoints
@@ -892,14 +945,8 @@ void Shape::draw(const Settings &settings, bool highlight, uint max_triangles)
 	{
       	        glColor4fv(settings.get_colour("Display","EndpointsColour"));
 		glPointSize(settings.get_double("Display","EndPointSize"));
-		glBegin(GL_POINTS);
-		for(size_t i=0;i<triangles.size();i++)
-		{
-		  glVertex3dv((GLdouble*)&(triangles[i].A));
-		  glVertex3dv((GLdouble*)&(triangles[i].B));
-		  glVertex3dv((GLdouble*)&(triangles[i].C));
-		}
-		glEnd();
+		const VertexBuffer *level = detailLevel(max_triangles);
+		(level ? level : &geometry)->draw(GL_POINTS);
 	}
 	glDisable(GL_DEPTH_TEST);
 
@@ -967,23 +1014,89 @@ void Shape::drawBBox() const
 }
 
 
-void Shape::draw_geometry(uint max_triangles)
+void Shape::buildGeometry()
 {
+  // a copied shape starts with empty buffers
+  if (!geometry_changed && geometry.size() == 3*triangles.size())
+    return;
+
+  vector<NormalVertex> vertices(3*triangles.size());
+  for(size_t i=0;i<triangles.size();i++)
+    for (uint j = 0; j < 3; j++) {
+      NormalVertex &v = vertices[3*i+j];
+      for (uint k = 0; k < 3; k++) {
+	v.pos[k] = triangles[i][j][k];
+	v.normal[k] = triangles[i].Normal[k];
+      }
+    }
+  geometry.set(vertices);
+  normal_lines.clear();
+  geometry_changed = false;
+
+  Vector3d vmin(0,0,0), vmax(0,0,0);
+  for (size_t i = 0; i < vertices.size(); i++)
+    for (uint k = 0; k < 3; k++) {
+      if (i == 0 || vertices[i].pos[k] < vmin[k]) vmin[k] = vertices[i].pos[k];
+      if (i == 0 || vertices[i].pos[k] > vmax[k]) vmax[k] = vertices[i].pos[k];
+    }
+  geometry_center = (vmin + vmax) / 2;
+  geometry_radius = (vmax - vmin).length() / 2;
+
+  lod.clear();
+  if (triangles.size() >= lod_min_triangles) {
+    vector<GLfloat> positions(3*vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+      for (uint k = 0; k < 3; k++)
+	positions[3*i+k] = vertices[i].pos[k];
+    lod.start(positions);
+  }
+}
 
-  bool listDraw = (max_triangles == 0); // not in preview mode
-  bool haveList = gl_List >= 0;
+// About as many triangles as the shape covers pixels, from its bounding
+// sphere in the current matrices: more don't show.
+size_t Shape::screenTriangles() const
+{
+  GLdouble modelview[16], projection[16];
+  GLint viewport[4];
+  glGetDoublev(GL_MODELVIEW_MATRIX, modelview);
+  glGetDoublev(GL_PROJECTION_MATRIX, projection);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  const Vector3d &c = geometry_center;
+  const double eye_z = modelview[2]*c.x() + modelview[6]*c.y()
+    + modelview[10]*c.z() + modelview[14];
+  const double scale = Vector3d(modelview[0], modelview[1], modelview[2]).length();
+  const double radius = geometry_radius * scale;
+  double pixels = radius * projection[5] * viewport[3] / 2;
+  if (projection[15] == 0) { // perspective
+    if (-eye_z <= radius) return triangles.size(); // we are inside
+    pixels /= -eye_z;
+  }
+  return (size_t) (M_PI * pixels * pixels);
+}
 
-  if (!listDraw && haveList) {
-    if (gl_List>=0)
-      glDeleteLists(gl_List,1);
-    gl_List = -1;
-    haveList = false;
+// what to draw: the geometry or a level of detail, in preview mode one
+// with at most max_triangles, NULL if there is none yet
+const VertexBuffer *Shape::detailLevel(uint max_triangles)
+{
+  buildGeometry();
+  if (max_triangles == 0) {
+    const VertexBuffer *level = lod.get(screenTriangles());
+    return level ? level : &geometry;
   }
-  if (listDraw && !haveList) {
-    gl_List = glGenLists(1);
-    glNewList(gl_List, GL_COMPILE);
+  if (triangles.size() <= max_triangles)
+    return &geometry;
+  return lod.getAtMost(max_triangles);
+}
+
+void Shape::draw_geometry(uint max_triangles)
+{
+  const VertexBuffer *level = detailLevel(max_triangles);
+  if (level) {
+    level->draw(GL_TRIANGLES);
+    return;
   }
-  if (!listDraw || !haveList) {
+
 	uint step = 1;
 	if (max_triangles>0) step = floor(triangles.size()/max_triangles);
 	step = max((uint)1,step);
@@ -997,24 +1110,6 @@ void Shape::draw_geometry(uint max_triangles)
 		glVertex3dv(triangles[i].C);
 	}
 	glEnd();
-  }
-  if (listDraw && !haveList) {
-    glEndList();
-  }
-
-  if (listDraw && gl_List >= 0) { // have stored list
-    Glib::TimeVal starttime, endtime;
-    if (!slow_drawing) {
-      starttime.assign_current_time();
-    }
-    glCallList(gl_List);
-    if (!slow_drawing) {
-      endtime.assign_current_time();
-      Glib::TimeVal usedtime = endtime-starttime;
-      if (usedtime.as_double() > 0.2) slow_drawing = true;
-    }
-    return;
-  }
 }
 
 /*
@@ -34,6 +34,9 @@
 #include "triangle.h"
 #include "slicer/geometry.h"
 #include "poly.h"
+#include "vertexbuffer.h"
+#include "lod.h"
+#include "bvh.h"
 
 //#define ABS(a)	   (((a) < 0) ? -(a) : (a))
 
@@ -135,6 +138,7 @@ public:
     int saveBinarySTL(Glib::ustring filename) const;
 
 
+    // the selection highlight made a frame too slow, see Model::setFrameTime
     bool slow_drawing;
     virtual string info() const;
 
@@ -143,15 +147,44 @@ public:
 
     void setTriangles(const vector<Triangle> &triangles_);
 
+    // where the ray from + t*dir first hits the shape transformed by
+    // T * transform3D, t >= 0
+    bool intersect(const Matrix4d &T, const Vector3d &from,
+		   const Vector3d &dir, double &t);
+
     uint size() const {return triangles.size();}
 
 protected:
 
-    int gl_List;
+    // the triangles changed, the vertex buffers have to be built again;
+    // if only the vertices moved the hierarchy is only refitted
+    void invalidateGeometry(bool same_triangles = false);
 
 private:
 
     vector<Triangle> triangles;
+
+    // triangles as float vertices with normals, in shape coordinates, so
+    // transforms don't touch them
+    VertexBuffer geometry;
+    bool geometry_changed;
+    void buildGeometry();
+    // coarser geometry for shapes with many triangles, and the bounding
+    // sphere to choose from it by size on screen
+    MeshLOD lod;
+    Vector3d geometry_center;
+    double geometry_radius;
+    size_t screenTriangles() const;
+    const VertexBuffer *detailLevel(uint max_triangles);
+    // the triangles in shape coordinates, for queries and the bounding
+    // box of large shapes
+    BVH bvh;
+    bool bvh_changed, bvh_moved;
+    const BVH &getBVH();
+    static const uint bvh_min_triangles = 10000;
+    // DisplayNormals lines
+    VertexBuffer normal_lines;
+    double normal_lines_length;
     //vector<Polygon2d>  polygons;  // surface polygons instead of triangles
     void calcPolygons();
 
@@ -0,0 +1,123 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+// Runs the anti-ooze retract pass on a long random print and checks that
+// it keeps the path and the extrusion, and that every retract is pushed
+// back.  It needs the slicer linked in; build in the top build directory
+// after make with:
+//   g++ -O2 -fopenmp -DHAVE_GTK -I. -Isrc -Isrc/slicer -Ilibraries
+//     -Ilibraries/vmmlib/include `pkg-config --cflags gtkmm-2.4`
+//     src/slicer/antiooze_benchmark.cpp
+//     `ls src/*.o src/*/*.o | grep -v repsnapper-repsnapper.o` .libs/*.a
+//     `pkg-config --libs gtkmm-2.4 gtkglextmm-1.2 libxml++-2.6`
+//     -lGLU -lzip -o antiooze_benchmark
+// and run as  antiooze_benchmark [lines]
+
+#include "stdafx.h"
+#include "printlines.h"
+
+#include <iostream>
+#include <stdlib.h>
+
+static int failures = 0;
+
+static void expect (bool condition, const char *what)
+{
+  if (!condition) {
+    cerr << "FAILED: " << what << endl;
+    failures++;
+  }
+}
+
+// a zigzag of short extrusions, every 8th line a move of up to 10mm
+static vector<PLine3> print (uint n)
+{
+  vector<PLine3> lines;
+  lines.reserve(n);
+  Vector3d p(0, 0, 0.2);
+  for (uint i = 0; i < n; i++) {
+    const Vector3d q = p + Vector3d((rand() % 100) / 10., (rand() % 100) / 10., 0);
+    const bool move = (rand() % 8 == 0);
+    lines.push_back(PLine3(move ? SHELL : INFILL, 0, p, q, 3000,
+			   move ? 0 : 0.05 * (q - p).length()));
+    p = q;
+  }
+  return lines;
+}
+
+static double extrusion (const vector<PLine3> &lines, double &absolute)
+{
+  double sum = 0;
+  absolute = 0;
+  for (uint i = 0; i < lines.size(); i++) {
+    sum += lines[i].extrusion;
+    absolute += lines[i].absolute_extrusion;
+  }
+  return sum;
+}
+
+static void check (uint n)
+{
+  const double mindistance = 5, amount = 1, speed = 3000, zlift = 0.3;
+  vector<PLine3> lines = print(n);
+  double absolute;
+  const double before = extrusion(lines, absolute);
+  const Vector3d start = lines.front().from, end = lines.back().to;
+
+  const uint added = Printlines::makeAntioozeRetract(lines, mindistance, amount,
+						     speed, zlift);
+  expect(lines.size() == n + added, "line count");
+  expect(added > 0, "retracts added");
+  expect(lines.front().from == start && lines.back().to == end, "path ends");
+  bool connected = true, dry_lifts = true;
+  uint lifted = 0;
+  for (uint i = 0; i < lines.size(); i++) {
+    if (i > 0 && (lines[i].from - lines[i-1].to).length() > 1e-9)
+      connected = false;
+    if (lines[i].lifted > 0) {
+      lifted++;
+      if (!lines[i].is_move()) dry_lifts = false;
+    }
+  }
+  expect(connected, "path connected");
+  expect(lifted > 0 && dry_lifts, "only moves lifted");
+  const double after = extrusion(lines, absolute);
+  expect(fabs(after - before) < 1e-6 * before, "extrusion kept");
+  expect(fabs(absolute) < 1e-6 * n, "retracts pushed back");
+}
+
+int main (int argc, char *argv[])
+{
+  const uint n = argc > 1 ? strtoul(argv[1], NULL, 10) : 5000000;
+
+  srand(1);
+  check(20000);
+  if (failures > 0)
+    return 1;
+
+  vector<PLine3> lines = print(n);
+  Glib::Timer timer;
+  const uint added = Printlines::makeAntioozeRetract(lines, 5, 1, 3000, 0.3);
+  const double time = timer.elapsed();
+
+  cout << "Lines:      " << n << ", " << added << " added" << endl;
+  cout << "Anti-ooze:  " << time << " s, "
+       << n / time / 1e6 << " M lines/s" << endl;
+  return 0;
+}
@@ -400,6 +400,76 @@ vector<Poly> Clipping::getShrinkedCapped(const vector<Poly> &polys, double dista
   return getPolys(offset,z,extrf);
 }
 
+// all shells at once, without converting back and forth between
+// Poly and clipper coordinates for every offset
+vector< vector<Poly> > Clipping::getShells(const vector<Poly> &polys, uint count,
+					   double firstdistance, double distance,
+					   double thinwidth, vector<Poly> &thinpolys,
+					   double cleandist,
+					   JoinType jtype, double miterdist)
+{
+  vector< vector<Poly> > shells(count);
+  if (count == 0) return shells;
+  double z=0, extrf=1.;
+  if (polys.size()>0) {
+    z = polys.back().getZ();
+    extrf = polys.back().getExtrusionFactor();
+  }
+  const CL::JoinType cljtype = CLType(jtype);
+  const CL::cInt clwidth = CL_FACTOR*thinwidth;
+  CL::Paths shrinked = getClipperPolygons(polys);
+  CL::Paths thick, thin;
+  for (uint i = 0; i < count; i++) {
+    shrinked = CLOffset(shrinked, -CL_FACTOR*(i==0 ? firstdistance : distance),
+			cljtype, miterdist);
+    if (clwidth > 0) {
+      CLSplitThin(shrinked, clwidth, thick, thin);
+      shrinked.swap(thick);
+      vector<Poly> tpolys = getPolys(thin, z, extrf);
+      thinpolys.insert(thinpolys.end(), tpolys.begin(), tpolys.end());
+    }
+    // next shell is made from the simplified one
+    if (cleandist > 0)
+      CL::CleanPolygons(shrinked, CL_FACTOR*cleandist);
+    shells[i] = getPolys(shrinked, z, extrf);
+  }
+  return shells;
+}
+
+void Clipping::splitThin(const vector<Poly> &polys, double width,
+			 vector<Poly> &thickpolys, vector<Poly> &thinpolys)
+{
+  double z=0, extrf=1.;
+  if (polys.size()>0) {
+    z = polys.back().getZ();
+    extrf = polys.back().getExtrusionFactor();
+  }
+  CL::Paths thick, thin;
+  CLSplitThin(getClipperPolygons(polys), CL_FACTOR*width, thick, thin);
+  thickpolys = getPolys(thick, z, extrf);
+  thinpolys  = getPolys(thin,  z, extrf);
+}
+
+// one erosion, two dilations of the eroded result:
+// the thick areas come back to (almost) their original size,
+// the bigger dilation is the clip to get the thin rest
+// (it is bigger to avoid overlap of thin and thick extrusion lines)
+void Clipping::CLSplitThin(const CL::Paths &cpolys, CL::cInt clwidth,
+			   CL::Paths &thick, CL::Paths &thin)
+{
+  // go in, now thin polys are gone
+  CL::Paths eroded = CLOffset(cpolys, -clwidth/2, CL::jtMiter, 1);
+  // go out again to the size of the thick parts
+  thick = CLOffset(eroded, clwidth/2, CL::jtMiter, 1);
+  CL::Paths bigthick = CLOffset(eroded, clwidth*31/20, CL::jtMiter, 1);
+  // difference to original are thin polys
+  CL::Clipper clpr;
+  clpr.AddPaths(cpolys,   CL::ptSubject, true);
+  clpr.AddPaths(bigthick, CL::ptClip,    true);
+  thin.clear();
+  clpr.Execute(CL::ctDifference, thin, CL::pftEvenOdd, CL::pftEvenOdd);
+}
+
 
 // offset with reverse test
  CL::Paths Clipping::CLOffset(const CL::Paths &cpolys, int cldist,
@@ -60,6 +60,8 @@ class Clipping
   static CL::Paths CLOffset(const CL::Paths &cpolys, int cldist,
 			    CL::JoinType cljtype, double miter_limit=1,
 			    bool reverse=false);
+  static void CLSplitThin(const CL::Paths &cpolys, CL::cInt clwidth,
+			  CL::Paths &thick, CL::Paths &thin);
 
   bool debug;
   vector<CL::Paths> subjpolygons; // for debugging
@@ -115,6 +117,21 @@ public:
   static vector<Poly> getShrinkedCapped(const vector<Poly> &polys, double distance,
 					JoinType jtype=jmiter,double miterdist=1);
 
+  // successive inward offsets in one pass, staying in clipper coordinates:
+  // shell 0 is polys shrinked by firstdistance, every further shell is
+  // shrinked by distance from the previous one.
+  // Areas thinner than thinwidth are removed from each shell and
+  // collected in thinpolys (if thinwidth > 0).
+  static vector< vector<Poly> > getShells(const vector<Poly> &polys, uint count,
+					  double firstdistance, double distance,
+					  double thinwidth, vector<Poly> &thinpolys,
+					  double cleandist=0,
+					  JoinType jtype=jmiter, double miterdist=1);
+
+  // split into thick areas and areas thinner than width
+  static void splitThin(const vector<Poly> &polys, double width,
+			vector<Poly> &thickpolys, vector<Poly> &thinpolys);
+
   //vector< vector<Vector2d> > intersect(const Poly poly1, const Poly poly2) const;
 
   static Poly           getPoly(const CL::Path &cpoly, double z, double extrusionfactor);
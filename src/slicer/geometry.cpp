@@ -1360,11 +1360,10 @@ void glDrawPolySurfaceRastered(const vector<Poly> &polys,
 }
 
 
-void glDrawCairoSurface(const Cairo::RefPtr<Cairo::ImageSurface> surface,
-			const Vector2d &min, const Vector2d &max,
-			const double z)
+// a new texture with the alpha values of surface, 0 if there is none
+GLuint glCairoSurfaceTexture(const Cairo::RefPtr<Cairo::ImageSurface> surface)
 {
-  if (surface==0) return;
+  if (surface==0) return 0;
   int w = surface->get_width();
   int h = surface->get_height();
   unsigned char * data = surface->get_data();
@@ -1384,6 +1383,15 @@ void glDrawCairoSurface(const Cairo::RefPtr<Cairo::ImageSurface> surface,
   // build our texture mipmaps
   gluBuild2DMipmaps( GL_TEXTURE_2D, GL_ALPHA, w, h,
 		     GL_ALPHA, GL_UNSIGNED_BYTE, data );
+  return texture;
+}
+
+void glDrawCairoSurface(const Cairo::RefPtr<Cairo::ImageSurface> surface,
+			const Vector2d &min, const Vector2d &max,
+			const double z)
+{
+  GLuint texture = glCairoSurfaceTexture(surface);
+  if (texture == 0) return;
 
   glEnable(GL_TEXTURE_2D);
   glBegin(GL_QUADS);
@@ -137,6 +137,7 @@ void glDrawPolySurfaceRastered(const vector<Poly> &polys,
 			       const double z,
 			       const double resolution);
 
+GLuint glCairoSurfaceTexture(const Cairo::RefPtr<Cairo::ImageSurface> surface);
 void glDrawCairoSurface(const Cairo::RefPtr<Cairo::ImageSurface> surface,
 			const Vector2d &min, const Vector2d &max,
 			const double z);
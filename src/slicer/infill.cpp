@@ -235,7 +235,7 @@ ClipperLib::Polygons Infill::makeInfillPattern(InfillType type,
 	      ymax = y;
 	    }
 	    for (double y = ymax; y > pMin.y(); y-=2*hexd) {
-	      double x2 = x+hexa+layer->thickness/10.; // offset to not combine polys
+	      double x2 = x+hexa+layer->getThickness()/10.; // offset to not combine polys
 	      y+=0.5*hexd;
 	      poly.addVertex(x2, y);
 	      poly.addVertex(x2+hexa, y-hexd/2);
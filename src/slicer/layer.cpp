@@ -28,7 +28,8 @@
 #define CLEANFACTOR 7
 
 Layer::Layer(Layer * prevlayer, int layerno, double thick, uint skins)
-  : LayerNo(layerno), thickness(thick), previous(prevlayer), skins(skins)
+  : LayerNo(layerno), thickness(thick), previous(prevlayer), skins(skins),
+    polygons_changes(0), display_changed(true), display_previous_changes(0)
 {
   normalInfill = NULL;
   fullInfill = NULL;
@@ -45,9 +46,17 @@ Layer::~Layer()
   Clear();
 }
 
+void Layer::changed(bool polygons)
+{
+  display_changed = true;
+  if (polygons)
+    polygons_changes++;
+}
+
 
 void Layer::Clear()
 {
+  changed(true);
   delete normalInfill; normalInfill = NULL;
   delete fullInfill; fullInfill = NULL;
   delete skirtInfill; skirtInfill = NULL;
@@ -94,6 +103,7 @@ void Layer::Clear()
 
 
 void Layer::SetPolygons(vector<Poly> &polys) {
+  changed(true);
   this->polygons = polys;
   for(uint i=0;i<polygons.size();i++){
     polygons[i].setZ(Z);
@@ -176,6 +186,7 @@ int Layer::addShape(const Matrix4d &T, const Shape &shape, double z,
 
 void Layer::cleanupPolygons()
 {
+  changed(true);
   double clean = thickness/CLEANFACTOR;
   for(uint i=0; i < polygons.size(); i++){
     polygons[i].cleanup(clean);
@@ -184,6 +195,7 @@ void Layer::cleanupPolygons()
 
 void Layer::addPolygons(vector<Poly> &polys)
 {
+  changed(true);
   for(uint i=0;i<polys.size();i++){
     polys[i].setZ(Z);
   }
@@ -192,9 +204,10 @@ void Layer::addPolygons(vector<Poly> &polys)
 
 
 void Layer::calcBridgeAngles(const Layer *layerbelow) {
+  changed();
   bridge_angles.resize(bridgePolygons.size());
   Clipping clipp;
-  vector<Poly> polysbelow = *(layerbelow->GetInnerShell());//clipp.getOffset(polygons,3*thickness);
+  const vector<Poly> &polysbelow = *(layerbelow->GetInnerShell());//clipp.getOffset(polygons,3*thickness);
   bridgePillars.resize(bridgePolygons.size());
   for (uint i=0; i<bridgePolygons.size(); i++)
     {
@@ -255,6 +268,7 @@ void Layer::CalcRaftInfill (const vector<Poly> &polys,
 			    double extrusionfactor, double infilldistance,
 			    double rotation)
 {
+  changed();
   setMinMax(polys);
   normalInfill = new Infill(this, extrusionfactor);
   normalInfill->setName("Raft");
@@ -264,6 +278,7 @@ void Layer::CalcRaftInfill (const vector<Poly> &polys,
 
 void Layer::CalcInfill (const Settings &settings)
 {
+  changed();
   // inFill distances in real mm:
   // for full polys/layers:
   double fullInfillDistance=0;
@@ -368,15 +383,17 @@ void Layer::CalcInfill (const Settings &settings)
 // call before full fill areas are multiplied
 void Layer::makeSkinPolygons()
 {
+  changed();
   if (skins<2) return;
-  skinFullFillPolygons = fullFillPolygons;
-  fullFillPolygons.clear();
+  clearpolys(skinFullFillPolygons);
+  skinFullFillPolygons.swap(fullFillPolygons);
 }
 
 // add bridge polys and subtract them from normal and full fill polys
 // each given ExPoly is a single bridge with its holes
 void Layer::addBridgePolygons(const vector<ExPoly> &newexpolys)
 {
+  changed();
   // clip against normal fill and make these areas into bridges:
   Clipping clipp;
   uint num_bridges = newexpolys.size();
@@ -395,7 +412,8 @@ void Layer::addBridgePolygons(const vector<ExPoly> &newexpolys)
   clipp.clear();
   clipp.addPolys(fillPolygons,subject);
   clipp.addPolys(newexpolys, clip);
-  setNormalFillPolygons(clipp.subtract());
+  vector<Poly> normals = clipp.subtract();
+  takeNormalFillPolygons(normals);
 }
 
 void Layer::addFullPolygons(const vector<ExPoly> &newpolys, bool decor)
@@ -406,6 +424,7 @@ void Layer::addFullPolygons(const vector<ExPoly> &newpolys, bool decor)
 // add full fill and subtract them from normal fill polys
 void Layer::addFullPolygons(const vector<Poly> &newpolys, bool decor)
 {
+  changed();
   if (newpolys.size()==0) return;
   Clipping clipp;
   clipp.clear();
@@ -422,13 +441,14 @@ void Layer::addFullPolygons(const vector<Poly> &newpolys, bool decor)
     clipp.addPolys(fullFillPolygons,subject);
     clipp.addPolys(inter,clip);
     clipp.setZ(Z);
-    setFullFillPolygons(clipp.subtract());
+    vector<Poly> full = clipp.subtract();
+    takeFullFillPolygons(full);
   }
   else {
     fullFillPolygons.insert(fullFillPolygons.end(),inter.begin(),inter.end());
   }
 
-  setNormalFillPolygons(normals);
+  takeNormalFillPolygons(normals);
   //  mergeFullPolygons(false); // done separately
 }
 
@@ -440,6 +460,7 @@ void cleanup(vector<Poly> &polys, double error)
 
 void Layer::mergeFullPolygons(bool bridge)
 {
+  changed();
   // if (bridge) {
   //   // setBridgePolygons(Clipping::getMerged(bridgePolygons, thickness));
   //   // clipp.addPolys(bridgePolygons,clip);
@@ -450,7 +471,8 @@ void Layer::mergeFullPolygons(bool bridge)
   // clipp.addPolys(decorPolygons,clip);
   // setFullFillPolygons(clipp.subtract());
 
-  setFullFillPolygons(Clipping::getMerged(fullFillPolygons, thickness));
+  vector<Poly> merged = Clipping::getMerged(fullFillPolygons, thickness);
+  takeFullFillPolygons(merged);
   cleanup(fullFillPolygons, thickness/CLEANFACTOR);
   //subtract from normal fills
   clipp.clear();
@@ -459,12 +481,14 @@ void Layer::mergeFullPolygons(bool bridge)
   clipp.addPolys(fullFillPolygons,clip);
   clipp.addPolys(decorPolygons,clip);
   vector<Poly> normals = clipp.subtractMerged();
-  setNormalFillPolygons(normals);
+  takeNormalFillPolygons(normals);
   // }
 }
 void Layer::mergeSupportPolygons()
 {
-  setSupportPolygons(Clipping::getMerged(GetSupportPolygons()));
+  changed();
+  vector<Poly> merged = Clipping::getMerged(supportPolygons);
+  takeSupportPolygons(merged);
 }
 
 const vector<Poly> * Layer::GetInnerShell() const
@@ -494,7 +518,7 @@ vector<ExPoly> Layer::GetExPolygons() const
 }
 
 // circular numbering
-vector<Poly> Layer::GetShellPolygonsCirc(int number) const
+const vector<Poly> & Layer::GetShellPolygonsCirc(int number) const
 {
   number = (shellPolygons.size() +  number) % shellPolygons.size();
   return shellPolygons[number];
@@ -502,21 +526,34 @@ vector<Poly> Layer::GetShellPolygonsCirc(int number) const
 
 void Layer::setNormalFillPolygons(const vector<Poly> &polys)
 {
+  vector<Poly> copy = polys;
+  takeNormalFillPolygons(copy);
+}
+void Layer::takeNormalFillPolygons(vector<Poly> &polys)
+{
+  changed();
   clearpolys(fillPolygons);
-  fillPolygons = polys;
+  fillPolygons.swap(polys);
   for (uint i=0; i<fillPolygons.size();i++)
     fillPolygons[i].setZ(Z);
 }
 
 void Layer::setFullFillPolygons(const vector<Poly> &polys)
 {
+  vector<Poly> copy = polys;
+  takeFullFillPolygons(copy);
+}
+void Layer::takeFullFillPolygons(vector<Poly> &polys)
+{
+  changed();
   clearpolys(fullFillPolygons);
-  fullFillPolygons = polys;
+  fullFillPolygons.swap(polys);
   for (uint i=0; i<fullFillPolygons.size();i++)
     fullFillPolygons[i].setZ(Z);
 }
 void Layer::setBridgePolygons(const vector<ExPoly> &expolys)
 {
+  changed();
   uint count = expolys.size();
   // vector<Poly> polygroups;
   // vector<bool> done; done.resize(count);
@@ -549,8 +586,14 @@ void Layer::setBridgeAngles(const vector<double> &angles)
 
 void Layer::setSupportPolygons(const vector<Poly> &polys)
 {
+  vector<Poly> copy = polys;
+  takeSupportPolygons(copy);
+}
+void Layer::takeSupportPolygons(vector<Poly> &polys)
+{
+  changed();
   clearpolys(supportPolygons);
-  supportPolygons = polys;
+  supportPolygons.swap(polys);
   const double minarea = 10*thickness*thickness;
   for (int i = supportPolygons.size()-1; i >= 0; i--) {
     supportPolygons[i].cleanup(thickness/CLEANFACTOR);
@@ -568,8 +611,14 @@ void Layer::setSupportPolygons(const vector<Poly> &polys)
 
 void Layer::setSkirtPolygons(const vector<Poly> &poly)
 {
+  vector<Poly> copy = poly;
+  takeSkirtPolygons(copy);
+}
+void Layer::takeSkirtPolygons(vector<Poly> &polys)
+{
+  changed();
   clearpolys(skirtPolygons);
-  skirtPolygons = poly;
+  skirtPolygons.swap(polys);
   for (uint i=0; i<skirtPolygons.size(); i++) {
     skirtPolygons[i].cleanup(thickness);
     skirtPolygons[i].setZ(Z);
@@ -582,21 +631,7 @@ void Layer::FindThinpolys(const vector<Poly> &polys, double extrwidth,
 {
 #define THINPOLYS 1
 #if THINPOLYS
-  // go in
-  thickpolys = Clipping::getOffset(polys, -0.5*extrwidth);
-  // go out again, now thin polys are gone
-  thickpolys = Clipping::getOffset(thickpolys, 0.55*extrwidth);
-  // (need overlap to really clip)
-
-  // use bigger (longer) polys for clip to avoid overlap of thin and thick extrusion lines
-  vector <Poly> bigthick = Clipping::getOffset(thickpolys, extrwidth);
-  // difference to original are thin polys
-  Clipping clipp;
-  clipp.addPolys(polys, subject);
-  clipp.addPolys(bigthick, clip);
-  thinpolys = clipp.subtract();
-  // remove overlap
-  thickpolys = Clipping::getOffset(thickpolys, -0.05*extrwidth);
+  Clipping::splitThin(polys, extrwidth, thickpolys, thinpolys);
 #else
   thickpolys = polys;
 #endif
@@ -604,6 +639,7 @@ void Layer::FindThinpolys(const vector<Poly> &polys, double extrwidth,
 
 void Layer::MakeShells(const Settings &settings)
 {
+  changed();
   double extrudedWidth        = settings.GetExtrudedMaterialWidth(thickness);
   double roundline_extrfactor =
     settings.RoundedLinewidthCorrection(extrudedWidth,thickness);
@@ -613,53 +649,51 @@ void Layer::MakeShells(const Settings &settings)
   uint   shellcount     = settings.get_integer("Slicing","ShellCount");
   double infilloverlap  = settings.get_double("Slicing","InfillOverlap");
 
-  // first shrink with global offset
-  vector<Poly> shrinked = Clipping::getOffset(polygons, -2.0/M_PI*extrudedWidth-shelloffset);
-
-  vector<Poly> thickPolygons;
-  FindThinpolys(shrinked, extrudedWidth, thickPolygons, thinPolygons);
-  shrinked = thickPolygons;
+  // first shrink with global offset, then from shell to shell,
+  // all in one pass (thin areas are separated on the way)
+  clearpolys(thinPolygons);
+  vector< vector<Poly> > shells =
+    Clipping::getShells(polygons, max(shellcount, (uint)1),
+			2.0/M_PI*extrudedWidth+shelloffset, extrudedWidth,
+			THINPOLYS ? extrudedWidth : 0., thinPolygons, cleandist);
 
   for (uint i = 0; i<thinPolygons.size(); i++)
     thinPolygons[i].cleanup(cleandist);
 
-  // // expand shrinked to get to the outer shell again
-  // shrinked = Clipping::getOffset(shrinked, 2*distance);
-  for (uint i = 0; i<shrinked.size(); i++)
-    shrinked[i].cleanup(cleandist);
+  for (uint s = 0; s<shells.size(); s++)
+    for (uint i = 0; i<shells[s].size(); i++)
+      shells[s][i].cleanup(cleandist);
 
-  //vector<Poly> shrinked = Clipping::getShrinkedCapped(polygons,distance);
+  const vector<Poly> * shrinked = &shells.back(); // innermost
   // outmost shells
   if (shellcount > 0) {
+    const double shellextrf = (skins>1) ? 1./skins*roundline_extrfactor
+                                        : roundline_extrfactor;
+    for (uint s = 0; s<shells.size(); s++)
+      for (uint i = 0; i<shells[s].size(); i++)
+	shells[s][i].setExtrusionFactor(shellextrf);
+    // hand over by swapping, shrinked follows the innermost shell
     if (skins>1) { // either skins
-      for (uint i = 0; i<shrinked.size(); i++)  {
-	shrinked[i].setExtrusionFactor(1./skins*roundline_extrfactor);
-      }
-      skinPolygons = shrinked;
+      clearpolys(skinPolygons);
+      skinPolygons.swap(shells[0]);
+      shrinked = &skinPolygons;
     } else {  // or normal shell
       clearpolys(shellPolygons);
-      for (uint i = 0; i<shrinked.size(); i++)  {
-	shrinked[i].setExtrusionFactor(roundline_extrfactor);
-      }
-      shellPolygons.push_back(shrinked);
+      shellPolygons.push_back(vector<Poly>());
+      shellPolygons.back().swap(shells[0]);
+      shrinked = &shellPolygons.back();
     }
     // inner shells
-    for (uint i = 1; i<shellcount; i++) // shrink from shell to shell
-      {
-	shrinked = Clipping::getOffset(shrinked,-extrudedWidth);
-	vector<Poly> thinpolys;
-	FindThinpolys(shrinked, extrudedWidth, thickPolygons, thinpolys);
-	shrinked = thickPolygons;
-	thinPolygons.insert(thinPolygons.end(), thinpolys.begin(),thinpolys.end());
-	for (uint j = 0; j<shrinked.size(); j++)
-	  shrinked[j].cleanup(cleandist);
-	//shrinked = Clipping::getShrinkedCapped(shrinked,extrudedWidth);
-	shellPolygons.push_back(shrinked);
-      }
+    for (uint s = 1; s<shells.size(); s++) {
+      shellPolygons.push_back(vector<Poly>());
+      shellPolygons.back().swap(shells[s]);
+    }
+    if (shells.size() > 1)
+      shrinked = &shellPolygons.back();
   }
   // the filling polygon
   if (settings.get_boolean("Slicing","DoInfill")) {
-    fillPolygons = Clipping::getOffset(shrinked,-(1.-infilloverlap)*extrudedWidth);
+    fillPolygons = Clipping::getOffset(*shrinked,-(1.-infilloverlap)*extrudedWidth);
     for (uint i = 0; i<fillPolygons.size(); i++)
       fillPolygons[i].cleanup(cleandist);
     //fillPolygons = Clipping::getShrinkedCapped(shrinked,extrudedWidth);
@@ -679,6 +713,7 @@ void Layer::MakeShells(const Settings &settings)
 
 void Layer::MakeSkirt(double distance, bool single)
 {
+  changed();
   clearpolys(skirtPolygons);
   vector<Poly> all;
   if (single) { // single skirt
@@ -700,6 +735,7 @@ void Layer::MakeSkirt(double distance, bool single)
 // calc convex hull and Min and Max of layer
 void Layer::calcConvexHull()
 {
+  changed();
   hullPolygon = convexHull2D(polygons); // see geometry.cpp
   hullPolygon.setZ(Z);
   setMinMax(hullPolygon);
@@ -707,6 +743,7 @@ void Layer::calcConvexHull()
 
 bool Layer::setMinMax(const vector<Poly> &polys)
 {
+  changed();
   Vector2d NewMin = Vector2d( INFTY, INFTY);
   Vector2d NewMax = Vector2d(-INFTY, -INFTY);
   for (uint i = 0; i< polys.size(); i++) {
@@ -723,6 +760,7 @@ bool Layer::setMinMax(const vector<Poly> &polys)
 }
 bool Layer::setMinMax(const Poly &poly)
 {
+  changed();
   vector<Vector2d> minmax = poly.getMinMax();
   if (minmax[0]==Min && minmax[1]==Max) return false;
   Min = minmax[0];
@@ -980,10 +1018,30 @@ void Layer::Draw(const Settings &settings)
 
   bool randomized = settings.get_boolean("Display","RandomizedLines");
   bool filledpolygons = settings.get_boolean("Display","DisplayFilledAreas");
-  // glEnable(GL_LINE_SMOOTH);
-  // glHint(GL_LINE_SMOOTH_HINT,  GL_NICEST);
-  draw_polys(polygons, GL_LINE_LOOP, 1, 3, RED, 1, randomized);
-  draw_polys(polygons, GL_POINTS,    1, 3, RED, 1, randomized);
+  bool displayinfill = settings.get_boolean("Display","DisplayinFill");
+  bool DebugInfill = settings.get_boolean("Display","DisplayDebuginFill");
+  bool showoverhang = settings.get_boolean("Display","ShowLayerOverhang");
+  vector<bool> style;
+  style.push_back(randomized);
+  style.push_back(filledpolygons);
+  style.push_back(displayinfill);
+  style.push_back(DebugInfill);
+  style.push_back(showoverhang);
+  // the previous layer may have been sliced again since
+  if (showoverhang && previous != NULL &&
+      previous->polygons_changes != display_previous_changes)
+    changed();
+  if (display_changed || style != display_style) {
+    display.clear();
+    record_display(randomized, filledpolygons, displayinfill, DebugInfill,
+		   showoverhang);
+    display.finish();
+    display_style = style;
+    display_changed = false;
+    if (previous != NULL)
+      display_previous_changes = previous->polygons_changes;
+  }
+  display.draw();
 
   if(settings.get_boolean("Display","DrawCPOutlineNumbers"))
     for(size_t p=0; p<polygons.size();p++)
@@ -994,154 +1052,161 @@ void Layer::Draw(const Settings &settings)
 	Render::draw_string(Vector3d(center.x(), center.y(), Z), oss.str());
       }
 
-  draw_poly(hullPolygon,    GL_LINE_LOOP, 3, 3, ORANGE,  0.5, randomized);
-  draw_polys(skirtPolygons, GL_LINE_LOOP, 3, 3, YELLOW,  1, randomized);
-  draw_polys(shellPolygons, GL_LINE_LOOP, 1, 3, YELLOW2, 1, randomized);
-  draw_polys(thinPolygons,  GL_LINE_LOOP, 2, 3, YELLOW,  1, randomized);
+  if(settings.get_boolean("Display","DrawCPVertexNumbers")) // poly vertex numbers
+    for(size_t p=0; p<polygons.size();p++)
+      polygons[p].drawVertexNumbers();
+      //polygons[p].drawVertexAngles();
 
-  glColor4f(0.5,0.9,1,1);
-  glLineWidth(1);
+  if(settings.get_boolean("Display","DrawCPLineNumbers"))  // poly line numbers
+    for(size_t p=0; p<polygons.size();p++)
+      polygons[p].drawLineNumbers();
+
+  if(settings.get_boolean("Display","DrawVertexNumbers")) { // infill vertex numbers
+    for(size_t p=0; p<supportPolygons.size();p++)
+      supportPolygons[p].drawVertexNumbers();
+    for(size_t p=0; p<fillPolygons.size();p++)
+      fillPolygons[p].drawVertexNumbers();
+    for(size_t p=0; p<fullFillPolygons.size();p++)
+      fullFillPolygons[p].drawVertexNumbers();
+    for(size_t p=0; p<decorPolygons.size();p++)
+      decorPolygons[p].drawVertexNumbers();
+    for(size_t p=0; p<shellPolygons.size();p++)
+      for(size_t q=0; q<shellPolygons[p].size();q++)
+	shellPolygons[p][q].drawVertexNumbers();
+  }
+
+#if 0
+  // test point-in-polygons
+  const vector<Poly> *polys = GetOuterShell();
+  glColor4f(RED[0],RED[1],RED[2], 0.6);
+  glPointSize(3);
+  glBegin(GL_POINTS);
+  for (double x = Min.x(); x<Max.x(); x+=thickness/1)
+    for (double y = Min.y(); y<Max.y(); y+=thickness/1) {
+      bool inpoly = false;
+      for (uint i=0; i<polys->size(); i++) {
+	if ((*polys)[i].vertexInside(Vector2d(x,y))){
+	  inpoly=true; break;
+	}
+      }
+      if (inpoly)
+	glVertex3d(x,y,Z);
+      // else
+      //   glColor4f(0.3,0.3,0.3, 0.6);
+    }
+  glEnd();
+#endif
+
+}
+
+// the polygons for Draw(), all but the numbers
+void Layer::record_display(bool randomized, bool filledpolygons,
+			   bool displayinfill, bool DebugInfill,
+			   bool showoverhang)
+{
+  // glEnable(GL_LINE_SMOOTH);
+  // glHint(GL_LINE_SMOOTH_HINT,  GL_NICEST);
+  draw_polys(display, polygons, GL_LINE_LOOP, 1, 3, RED, 1, randomized);
+  draw_polys(display, polygons, GL_POINTS,    1, 3, RED, 1, randomized);
+
+  draw_poly(display, hullPolygon,    GL_LINE_LOOP, 3, 3, ORANGE,  0.5, randomized);
+  draw_polys(display, skirtPolygons, GL_LINE_LOOP, 3, 3, YELLOW,  1, randomized);
+  draw_polys(display, shellPolygons, GL_LINE_LOOP, 1, 3, YELLOW2, 1, randomized);
+  draw_polys(display, thinPolygons,  GL_LINE_LOOP, 2, 3, YELLOW,  1, randomized);
+
+  const float skincolour[] = {0.5,0.9,1};
+  display.setColour(skincolour, 1);
+  display.setLineWidth(1);
   double zs = Z;
   for(size_t s=0;s<skins;s++) {
     for(size_t p=0; p < skinPolygons.size();p++) {
       //cerr << s << ": " << p << " _ " << zs << endl;
-      skinPolygons[p].draw(GL_LINE_LOOP, zs, randomized);
+      skinPolygons[p].draw(display, GL_LINE_LOOP, zs, randomized);
     }
     zs-=thickness/skins;
   }
-  draw_polys(fillPolygons,         GL_LINE_LOOP, 1, 3, WHITE, 0.6, randomized);
+  draw_polys(display, fillPolygons,         GL_LINE_LOOP, 1, 3, WHITE, 0.6, randomized);
   if (supportPolygons.size()>0) {
     if (filledpolygons)
-      draw_polys_surface(supportPolygons,  Min, Max, Z, thickness/2., BLUE2, 0.4);
-    draw_polys(supportPolygons,      GL_LINE_LOOP, 3, 3, BLUE2, 1,   randomized);
-    if(settings.get_boolean("Display","DrawVertexNumbers"))
-      for(size_t p=0; p<supportPolygons.size();p++)
-	supportPolygons[p].drawVertexNumbers();
+      draw_polys_surface(display, supportPolygons,  Min, Max, Z, thickness/2., BLUE2, 0.4);
+    draw_polys(display, supportPolygons,      GL_LINE_LOOP, 3, 3, BLUE2, 1,   randomized);
   } // else
-    // draw_polys(toSupportPolygons,    GL_LINE_LOOP, 1, 1, BLUE2, 1,   randomized);
-  draw_polys(bridgePolygons,       GL_LINE_LOOP, 3, 3, RED2,  0.7, randomized);
-  draw_polys(fullFillPolygons,     GL_LINE_LOOP, 1, 1, GREY,  0.6, randomized);
-  draw_polys(decorPolygons,        GL_LINE_LOOP, 1, 3, WHITE, 1,   randomized);
-  draw_polys(skinFullFillPolygons, GL_LINE_LOOP, 1, 3, GREY,  0.6, randomized);
+    // draw_polys(display, toSupportPolygons,    GL_LINE_LOOP, 1, 1, BLUE2, 1,   randomized);
+  draw_polys(display, bridgePolygons,       GL_LINE_LOOP, 3, 3, RED2,  0.7, randomized);
+  draw_polys(display, fullFillPolygons,     GL_LINE_LOOP, 1, 1, GREY,  0.6, randomized);
+  draw_polys(display, decorPolygons,        GL_LINE_LOOP, 1, 3, WHITE, 1,   randomized);
+  draw_polys(display, skinFullFillPolygons, GL_LINE_LOOP, 1, 3, GREY,  0.6, randomized);
   if (filledpolygons) {
-    draw_polys_surface(fullFillPolygons,  Min, Max, Z, thickness/2., GREEN, 0.5);
-    draw_polys_surface(decorPolygons,  Min, Max, Z, thickness/2., GREY, 0.2);
+    draw_polys_surface(display, fullFillPolygons,  Min, Max, Z, thickness/2., GREEN, 0.5);
+    draw_polys_surface(display, decorPolygons,  Min, Max, Z, thickness/2., GREY, 0.2);
   }
-  if(settings.get_boolean("Display","DisplayinFill"))
+  if(displayinfill)
     {
       if (filledpolygons)
-	draw_polys_surface(fillPolygons,  Min, Max, Z, thickness/2., GREEN2, 0.25);
-      bool DebugInfill = settings.get_boolean("Display","DisplayDebuginFill");
+	draw_polys_surface(display, fillPolygons,  Min, Max, Z, thickness/2., GREEN2, 0.25);
       if (normalInfill)
-	draw_polys(normalInfill->infillpolys, GL_LINE_LOOP, 1, 3,
+	draw_polys(display, normalInfill->infillpolys, GL_LINE_LOOP, 1, 3,
 		   (normalInfill->cached?BLUEGREEN:GREEN), 1, randomized);
       if(DebugInfill && normalInfill->cached)
-	draw_polys(normalInfill->getCachedPattern(Z), GL_LINE_LOOP, 1, 3,
+	draw_polys(display, normalInfill->getCachedPattern(Z), GL_LINE_LOOP, 1, 3,
 		   ORANGE, 0.5, randomized);
       if (thinInfill)
-	draw_polys(thinInfill->infillpolys, GL_LINE_LOOP, 1, 3,
+	draw_polys(display, thinInfill->infillpolys, GL_LINE_LOOP, 1, 3,
 		   GREEN, 1, randomized);
       if (fullInfill)
-	draw_polys(fullInfill->infillpolys, GL_LINE_LOOP, 1, 3,
+	draw_polys(display, fullInfill->infillpolys, GL_LINE_LOOP, 1, 3,
 		   (fullInfill->cached?BLUEGREEN:GREEN), 0.8, randomized);
       if (skirtInfill)
-	draw_polys(skirtInfill->infillpolys, GL_LINE_LOOP, 1, 3,
+	draw_polys(display, skirtInfill->infillpolys, GL_LINE_LOOP, 1, 3,
 		   YELLOW, 0.6, randomized);
       if(DebugInfill && fullInfill->cached)
-	draw_polys(fullInfill->getCachedPattern(Z), GL_LINE_LOOP, 1, 3,
+	draw_polys(display, fullInfill->getCachedPattern(Z), GL_LINE_LOOP, 1, 3,
 		   ORANGE, 0.5, randomized);
       if (decorInfill)
-	draw_polys(decorInfill->infillpolys, GL_LINE_LOOP, 1, 3,
+	draw_polys(display, decorInfill->infillpolys, GL_LINE_LOOP, 1, 3,
 		   (decorInfill->cached?BLUEGREEN:GREEN), 0.8, randomized);
       if(DebugInfill && decorInfill->cached)
-	draw_polys(decorInfill->getCachedPattern(Z), GL_LINE_LOOP, 1, 3,
+	draw_polys(display, decorInfill->getCachedPattern(Z), GL_LINE_LOOP, 1, 3,
 		   ORANGE, 0.5, randomized);
       uint bridgecount = bridgeInfills.size();
       if (bridgecount>0)
 	for (uint i = 0; i<bridgecount; i++)
-	  draw_polys(bridgeInfills[i]->infillpolys, GL_LINE_LOOP, 2, 3,
+	  draw_polys(display, bridgeInfills[i]->infillpolys, GL_LINE_LOOP, 2, 3,
 		     RED3,0.9, randomized);
       if (supportInfill)
-	draw_polys(supportInfill->infillpolys, GL_LINE_LOOP, 1, 3,
+	draw_polys(display, supportInfill->infillpolys, GL_LINE_LOOP, 1, 3,
 		   (supportInfill->cached?BLUEGREEN:GREEN), 0.8, randomized);
       if(DebugInfill && supportInfill->cached)
-	draw_polys(supportInfill->getCachedPattern(Z), GL_LINE_LOOP, 1, 3,
+	draw_polys(display, supportInfill->getCachedPattern(Z), GL_LINE_LOOP, 1, 3,
 		   ORANGE, 0.5, randomized);
       for(size_t s=0;s<skinFullInfills.size();s++)
-	draw_polys(skinFullInfills[s]->infillpolys, GL_LINE_LOOP, 1, 3,
+	draw_polys(display, skinFullInfills[s]->infillpolys, GL_LINE_LOOP, 1, 3,
 		   (skinFullInfills[s]->cached?BLUEGREEN:GREEN), 0.6, randomized);
     }
-  //draw_polys(GetInnerShell(), GL_LINE_LOOP, 2, 3, WHITE,  1);
-  glLineWidth(1);
-  if(settings.get_boolean("Display","DrawCPVertexNumbers")) // poly vertex numbers
-    for(size_t p=0; p<polygons.size();p++)
-      polygons[p].drawVertexNumbers();
-      //polygons[p].drawVertexAngles();
-
-  if(settings.get_boolean("Display","DrawCPLineNumbers"))  // poly line numbers
-    for(size_t p=0; p<polygons.size();p++)
-      polygons[p].drawLineNumbers();
+  //draw_polys(display, GetInnerShell(), GL_LINE_LOOP, 2, 3, WHITE,  1);
 
-  if(settings.get_boolean("Display","DrawVertexNumbers")) { // infill vertex numbers
-    for(size_t p=0; p<fillPolygons.size();p++)
-      fillPolygons[p].drawVertexNumbers();
-    for(size_t p=0; p<fullFillPolygons.size();p++)
-      fullFillPolygons[p].drawVertexNumbers();
-    for(size_t p=0; p<decorPolygons.size();p++)
-      decorPolygons[p].drawVertexNumbers();
-    for(size_t p=0; p<shellPolygons.size();p++)
-      for(size_t q=0; q<shellPolygons[p].size();q++)
-	shellPolygons[p][q].drawVertexNumbers();
-  }
-
-
-  if (settings.get_boolean("Display","ShowLayerOverhang")) {
-    draw_polys(bridgePillars,        GL_LINE_LOOP, 3, 3, YELLOW,0.7, randomized);
+  if (showoverhang) {
+    draw_polys(display, bridgePillars,        GL_LINE_LOOP, 3, 3, YELLOW,0.7, randomized);
     if (previous!=NULL) {
       vector<Poly> overhangs = getOverhangs();
-      draw_polys(overhangs, GL_LINE_LOOP, 1, 3, VIOLET, 0.8, randomized);
-      //draw_polys_surface(overhangs, Min, Max, Z, thickness/5, VIOLET , 0.5);
+      draw_polys(display, overhangs, GL_LINE_LOOP, 1, 3, VIOLET, 0.8, randomized);
+      //draw_polys_surface(display, overhangs, Min, Max, Z, thickness/5, VIOLET , 0.5);
 
       Cairo::RefPtr<Cairo::ImageSurface> surface;
       Cairo::RefPtr<Cairo::Context>      context;
       if (rasterpolys(overhangs, Min, Max, thickness/5, surface, context))
 	if(surface!=0) {
-	  glColor4f(RED[0],RED[1],RED[2], 0.5);
-	  glDrawCairoSurface(surface, Min, Max, Z);
-	  glColor4f(RED[0],RED[1],RED[2], 0.6);
-	  glPointSize(3);
- 	  glBegin(GL_POINTS);
- 	  for (double x = Min.x(); x<Max.x(); x+=thickness)
+	  display.setColour(RED, 0.5);
+	  display.texture(glCairoSurfaceTexture(surface), Min, Max, Z);
+	  display.setColour(RED, 0.6);
+	  display.setPointSize(3);
+	  for (double x = Min.x(); x<Max.x(); x+=thickness)
 	    for (double y = Min.y(); y<Max.y(); y+=thickness)
 	      if (getCairoSurfaceDatapoint(surface, Min, Max, Vector2d(x,y))!=0)
-	  	glVertex3d(x,y,Z);
-	  glEnd();
+		display.point(Vector3d(x,y,Z));
 	}
     }
   }
-
-#if 0
-  // test point-in-polygons
-  const vector<Poly> *polys = GetOuterShell();
-  glColor4f(RED[0],RED[1],RED[2], 0.6);
-  glPointSize(3);
-  glBegin(GL_POINTS);
-  for (double x = Min.x(); x<Max.x(); x+=thickness/1)
-    for (double y = Min.y(); y<Max.y(); y+=thickness/1) {
-      bool inpoly = false;
-      for (uint i=0; i<polys->size(); i++) {
-	if ((*polys)[i].vertexInside(Vector2d(x,y))){
-	  inpoly=true; break;
-	}
-      }
-      if (inpoly)
-	glVertex3d(x,y,Z);
-      // else
-      //   glColor4f(0.3,0.3,0.3, 0.6);
-    }
-  glEnd();
-#endif
-
 }
 
 void Layer::DrawRulers(const Vector2d &point)
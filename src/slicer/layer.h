@@ -28,6 +28,7 @@
 #include "poly.h"
 #include "gcode/gcodestate.h"
 #include "printlines.h"
+#include "displaycache.h"
 
 #include <cairomm/cairomm.h>
 
@@ -44,14 +45,13 @@ public:
   ~Layer();
 
   int LayerNo;
-  double thickness;
-  double Z;
+  double getThickness() const {return thickness;}
   double getZ() const {return Z;}
-  void setZ(double z){Z=z;}
-  void setSkins(uint skins_){skins = skins_;}
+  void setZ(double z){Z=z; changed();}
+  void setSkins(uint skins_){skins = skins_; changed();}
 
   Layer * getPrevious() const {return previous;};
-  void setPrevious(Layer * prevlayer){previous = prevlayer;};
+  void setPrevious(Layer * prevlayer){previous = prevlayer; changed();};
 
   Vector2d getMin() const {return Min;};
   Vector2d getMax() const {return Max;};
@@ -94,23 +94,23 @@ public:
   void calcConvexHull();
   void MakeSkirt(double distance, bool single=true);
 
-  vector<Poly> GetPolygons() const { return polygons; };
+  const vector<Poly> & GetPolygons() const { return polygons; };
   vector<ExPoly>  GetExPolygons() const;
   void SetPolygons(vector<Poly> &polys) ;
   /* void SetPolygons(const Matrix4d &T, const Shape &shape, double z); */
-  vector<Poly> GetFillPolygons() const { return fillPolygons; }
-  vector<Poly> GetFullFillPolygons() const { return fullFillPolygons; }
-  vector<ExPoly> GetBridgePolygons() const { return bridgePolygons; }
-  vector<Poly> GetSkinFullPolygons() const { return skinFullFillPolygons; }
-  vector<Poly> GetSupportPolygons() const { return supportPolygons; }
-  vector<Poly> GetToSupportPolygons() const { return toSupportPolygons; }
-  vector<Poly> GetDecorPolygons() const { return decorPolygons; }
-  vector< vector<Poly> >  GetShellPolygons() const {return shellPolygons; }
-  vector<Poly>  GetShellPolygonsCirc(int number) const;
-  vector<Poly>  GetSkirtPolygons() const {return skirtPolygons; };
+  const vector<Poly> & GetFillPolygons() const { return fillPolygons; }
+  const vector<Poly> & GetFullFillPolygons() const { return fullFillPolygons; }
+  const vector<ExPoly> & GetBridgePolygons() const { return bridgePolygons; }
+  const vector<Poly> & GetSkinFullPolygons() const { return skinFullFillPolygons; }
+  const vector<Poly> & GetSupportPolygons() const { return supportPolygons; }
+  const vector<Poly> & GetToSupportPolygons() const { return toSupportPolygons; }
+  const vector<Poly> & GetDecorPolygons() const { return decorPolygons; }
+  const vector< vector<Poly> > & GetShellPolygons() const {return shellPolygons; }
+  const vector<Poly> & GetShellPolygonsCirc(int number) const;
+  const vector<Poly> & GetSkirtPolygons() const {return skirtPolygons; };
   const vector<Poly> * GetInnerShell() const;
   const vector<Poly> * GetOuterShell() const;
-  Poly GetHullPolygon() const {return hullPolygon;};
+  const Poly & GetHullPolygon() const {return hullPolygon;};
 
   vector<Poly> getOverhangs() const;
 
@@ -128,6 +128,13 @@ public:
   void setSkirtPolygons(const vector<Poly> &poly);
   void setDecorPolygons(const vector<Poly> &polys);
 
+  // hand-off versions of the setters: take over the contents of polys
+  // without copying, polys is left empty
+  void takeNormalFillPolygons(vector<Poly> &polys);
+  void takeFullFillPolygons(vector<Poly> &polys);
+  void takeSupportPolygons(vector<Poly> &polys);
+  void takeSkirtPolygons(vector<Poly> &polys);
+
   /* void getOrderedPrintLines(const vector<Poly> polys,  */
   /* 			    Vector2d &startPoint, */
   /* 			    vector<printline> &lines, */
@@ -163,6 +170,9 @@ public:
 
  private:
 
+  double thickness;
+  double Z;
+
   Layer * previous;
 
   Vector2d Min, Max;  // Bounding box
@@ -177,6 +187,7 @@ public:
   Infill * thinInfill;             // one-line infill for thin features
 
   vector<Poly> polygons;		// original polygons directly from model
+  unsigned long polygons_changes;       // counts the changes of polygons
   vector< vector<Poly> > shellPolygons; // all shells except innermost
   vector<Poly> thinPolygons;            // areas thinner than 2 extrusion lines
   vector<Poly> fillPolygons;	        // innermost shell
@@ -193,6 +204,21 @@ public:
   vector<Poly> skirtPolygons;           // skirt polygon
   vector<Poly> decorPolygons;           // decoration polygons
 
+  // what Draw() shows but the numbers, recorded on the first draw after
+  // a change of the polygons or of the display settings
+  DisplayCache display;
+  bool display_changed;
+  // every method changing what Draw() shows calls this, with polygons set
+  // if the polygons from the model changed
+  void changed(bool polygons = false);
+  vector<bool> display_style;
+  // polygons_changes of the previous layer when recorded, the overhangs
+  // shown depend on its polygons
+  unsigned long display_previous_changes;
+  void record_display(bool randomized, bool filledpolygons,
+		      bool displayinfill, bool DebugInfill,
+		      bool showoverhang);
+
   // uses too much memory
   /* Cairo::RefPtr<Cairo::ImageSurface> raster_surface; */
   /* Cairo::RefPtr<Cairo::Context>      raster_context; */
@@ -24,11 +24,14 @@
 #include "shape.h"
 #include "clipping.h"
 #include "render.h"
+#include "displaycache.h"
 
 
 #include <poly2tri/poly2tri/poly2tri/poly2tri.h>
 
 
+unsigned long Poly::copycount = 0;
+
 Poly::Poly()
 {
   closed = true;
@@ -57,6 +60,10 @@ Poly::Poly(const Poly &p, double z_)
   //uint count = p.vertices.size();
   // vertices.resize(count);
   this->vertices = p.vertices;
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+  copycount++;
   holecalculated = p.holecalculated;
   if (holecalculated) {
     hole = p.hole;
@@ -65,6 +72,34 @@ Poly::Poly(const Poly &p, double z_)
     calcHole();
 }
 
+Poly::Poly(const Poly &p)
+  : z(p.z), extrusionfactor(p.extrusionfactor),
+    holecalculated(p.holecalculated), hole(p.hole), closed(p.closed),
+    vertices(p.vertices), center(p.center)
+{
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+  copycount++;
+}
+
+Poly & Poly::operator=(const Poly &p)
+{
+  if (this == &p) return *this;
+  z = p.z;
+  extrusionfactor = p.extrusionfactor;
+  holecalculated = p.holecalculated;
+  hole = p.hole;
+  closed = p.closed;
+  vertices = p.vertices;
+  center = p.center;
+#ifdef _OPENMP
+#pragma omp atomic
+#endif
+  copycount++;
+  return *this;
+}
+
 Poly::~Poly()
 {
 }
@@ -702,6 +737,25 @@ void Poly::draw(int gl_type, double z, bool randomized) const
   // }
 }
 
+void Poly::draw(DisplayCache &cache, int gl_type, double z,
+		bool randomized) const
+{
+  uint count = vertices.size();
+  if (!closed && gl_type == GL_LINE_LOOP)
+    count--;
+  for (uint i=0; i < count; i++){
+    Vector2d v = getVertexCircular(i);
+    if (randomized) v = random_displaced(v);
+    if (gl_type == GL_POINTS)
+      cache.point(Vector3d(v.x(),v.y(),z));
+    else {
+      Vector2d vn = getVertexCircular(i+1);
+      if (randomized) vn = random_displaced(vn);
+      cache.line(Vector3d(v.x(),v.y(),z), Vector3d(vn.x(),vn.y(),z));
+    }
+  }
+}
+
 void Poly::draw(int gl_type, bool randomized) const
 {
   draw(gl_type, getZ(), randomized);
@@ -949,6 +1003,58 @@ void draw_polys_surface(const vector< ExPoly > &expolys,
 }
 
 
+void draw_poly(DisplayCache &cache, const Poly &poly, int gl_type,
+	       int linewidth, int pointsize,
+	       const float *rgb, float a, bool randomized)
+{
+  cache.setColour(rgb, a);
+  cache.setLineWidth(linewidth);
+  cache.setPointSize(pointsize);
+  poly.draw(cache, gl_type, poly.getZ(), randomized);
+}
+
+void draw_polys(DisplayCache &cache, const vector <Poly> &polys, int gl_type,
+		int linewidth, int pointsize,
+		const float *rgb, float a, bool randomized)
+{
+  for(size_t p=0; p<polys.size();p++)
+    draw_poly(cache, polys[p], gl_type, linewidth, pointsize, rgb, a, randomized);
+}
+
+void draw_polys(DisplayCache &cache, const vector< vector <Poly> > &polys,
+		int gl_type, int linewidth, int pointsize,
+		const float *rgb, float a, bool randomized)
+{
+  for(size_t p=0; p<polys.size();p++)
+    draw_polys(cache, polys[p], gl_type, linewidth, pointsize, rgb, a, randomized);
+}
+
+void draw_polys(DisplayCache &cache, const vector <ExPoly> &expolys, int gl_type,
+		int linewidth, int pointsize,
+		const float *rgb, float a, bool randomized)
+{
+  for(size_t p=0; p < expolys.size();p++) {
+    draw_poly(cache, expolys[p].outer, gl_type, linewidth, pointsize, rgb, a, randomized);
+    for(size_t h=0; h < expolys[p].holes.size();h++)
+      draw_poly(cache, expolys[p].holes[h], gl_type, linewidth, pointsize, rgb, a, randomized);
+  }
+}
+
+void draw_polys_surface(DisplayCache &cache, const vector <Poly> &polys,
+			const Vector2d &Min, const Vector2d &Max,
+			double z,
+			double cleandist,
+			const float *rgb, float a)
+{
+  Cairo::RefPtr<Cairo::ImageSurface> surface;
+  Cairo::RefPtr<Cairo::Context> context;
+  if (!rasterpolys(polys, Min, Max, cleandist, surface, context)) return;
+  GLuint texture = glCairoSurfaceTexture(surface);
+  if (texture == 0) return;
+  cache.setColour(rgb, a);
+  cache.texture(texture, Min, Max, z);
+}
+
 
 void clearpolys(vector<Poly> &polys){
   for (uint i=0; i<polys.size();i++)
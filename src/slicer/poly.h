@@ -22,6 +22,8 @@
 #include "stdafx.h"
 #include "geometry.h"
 
+class DisplayCache;
+
 class Poly
 {
   double z;
@@ -36,6 +38,8 @@ public:
         Poly();
 	Poly(double z, double extrusionfactor=1.);
         Poly(const Poly &p, double z);
+        Poly(const Poly &p);
+        Poly & operator=(const Poly &p);
 	/* Poly(double z, */
 	/*      const ClipperLib::Polygon cpoly, bool reverse=false); */
         ~Poly();
@@ -113,6 +117,9 @@ public:
 
 	void draw(int gl_type, bool randomized=true) const;
 	void draw(int gl_type, double z, bool randomized=true) const; // draw at given z
+	// record into cache instead, GL_LINE_LOOP as GL_LINES
+	void draw(DisplayCache &cache, int gl_type, double z,
+		  bool randomized=true) const;
 	void drawVertexNumbers() const;
 	void drawVertexAngles() const;
 	void drawLineNumbers() const;
@@ -149,6 +156,14 @@ public:
 
 	static void move(vector<Poly> &polys, const Vector2d &trans);
 
+	// number of deep copies and assignments made since the last reset,
+	// see repsnapper --slice-benchmark
+	static unsigned long getCopyCount() {return copycount;};
+	static void resetCopyCount() {copycount = 0;};
+
+ private:
+	static unsigned long copycount;
+
 };
 
 
@@ -205,6 +220,25 @@ void draw_polys_surface(const vector <ExPoly> &expolys,
 			double cleandist,
 			const float *rgb, float a);
 
+// the same, recorded into a cache
+void draw_poly (DisplayCache &cache, const Poly &poly, int gl_type,
+		int linewidth, int pointsize,
+		const float *rgb, float a, bool randomized = false);
+void draw_polys(DisplayCache &cache, const vector <Poly> &polys, int gl_type,
+		int linewidth, int pointsize,
+		const float *rgb, float a, bool randomized = false);
+void draw_polys(DisplayCache &cache, const vector< vector <Poly> > &polys,
+		int gl_type, int linewidth, int pointsize,
+		const float *rgb, float a, bool randomized = false);
+void draw_polys(DisplayCache &cache, const vector <ExPoly> &expolys, int gl_type,
+		int linewidth, int pointsize,
+		const float *rgb, float a, bool randomized = false);
+void draw_polys_surface(DisplayCache &cache, const vector <Poly> &polys,
+			const Vector2d &Min, const Vector2d &Max,
+			double z,
+			double cleandist,
+			const float *rgb, float a);
+
 void clearpolys(vector<Poly> &polys);
 void clearpolys(vector<ExPoly> &polys);
 void clearpolys(vector< vector<Poly> > &polys);
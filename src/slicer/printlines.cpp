@@ -105,12 +105,16 @@ double PLine<M>::calcangle() const
 
 
 
+template class PLine<2>;
+template class PLine<3>;
+
+
 ///////////// PLine3: single 3D printline //////////////////////
 
 PLine3::PLine3(PLineArea area_,  const uint extruder_no_,
 	       const Vector3d &from_, const Vector3d &to_,
 	       double speed_, double extrusion_)
-: extrusion(extrusion_)
+  : extrusion(extrusion_), command(NULL)
 {
   area = area_;
   from = from_;
@@ -127,6 +131,8 @@ PLine3::PLine3(const PLine3 &rhs)
 {
   area = rhs.area;
   command = rhs.command;
+  if (command)
+    g_atomic_int_inc(&command->refs);
   from = rhs.from;
   to = rhs.to;
   speed = rhs.speed;
@@ -140,6 +146,7 @@ PLine3::PLine3(const PLine3 &rhs)
 }
 
 PLine3::PLine3(const PLine2 &pline, double z, double extrusion_per_mm)
+  : command(NULL)
 {
   lifted             = pline.lifted;
   area               = pline.area;
@@ -158,9 +165,43 @@ PLine3::PLine3(const PLine2 &pline, double z, double extrusion_per_mm)
 PLine3::PLine3(const Command &command_)
 {
   area = COMMAND;
-  command = command_;
-  extruder_no = command.extruder_no;
+  command = new SharedCommand(command_);
+  extruder_no = command_.extruder_no;
   arc = 0;
+  speed = lifted = angle = absolute_extrusion = extrusion = 0;
+}
+
+PLine3::~PLine3()
+{
+  unrefCommand();
+}
+
+void PLine3::unrefCommand()
+{
+  if (command && g_atomic_int_dec_and_test(&command->refs))
+    delete command;
+  command = NULL;
+}
+
+PLine3 & PLine3::operator=(const PLine3 &rhs)
+{
+  if (this == &rhs) return *this;
+  if (rhs.command)
+    g_atomic_int_inc(&rhs.command->refs);
+  unrefCommand();
+  command = rhs.command;
+  area = rhs.area;
+  from = rhs.from;
+  to = rhs.to;
+  speed = rhs.speed;
+  arc = rhs.arc;
+  arccenter = rhs.arccenter;
+  angle = rhs.angle;
+  extruder_no = rhs.extruder_no;
+  extrusion = rhs.extrusion;
+  absolute_extrusion = rhs.absolute_extrusion;
+  lifted = rhs.lifted;
+  return *this;
 }
 
 
@@ -193,7 +234,7 @@ int PLine3::getCommands(Vector3d &lastpos, vector<Command> &commands,
 			bool useTCommand) const
 {
   if (area == COMMAND) { // it is an explicit command line
-    commands.push_back(command);
+    commands.push_back(command->command);
     return 1;
   }
 
@@ -401,7 +442,7 @@ double PLine3::addMaxAbsoluteExtrusionAmount(double max_absspeed)
 string PLine3::info() const
 {
   if (area == COMMAND) {
-    return "command-line " + command.info();
+    return "command-line " + command->command.info();
   }
   ostringstream ostr;
   ostr << "line "<< AreaNames[area]
@@ -538,7 +579,7 @@ Printlines::Printlines(const Layer * layer, const Settings * settings, double z_
   if (layer!=NULL) {
     Cairo::RefPtr<Cairo::Context>      context;
     vector<Poly> overhangs = layer->getOverhangs();
-    rasterpolys(overhangs, layer->getMin(), layer->getMax(), layer->thickness/5,
+    rasterpolys(overhangs, layer->getMin(), layer->getMax(), layer->getThickness()/5,
 		overhangs_surface, context);
   }
 }
@@ -35,25 +35,24 @@ const string AreaNames[] = { _(""), _("Shell"), _("Skin"), _("Infill"),
 
 
 // generic single printline (2d or 3d)
+// (members ordered by size for tight packing, there are millions of these)
 template <size_t M>
 class PLine
 {
 public:
-  PLineArea area;
   vmml::vector<M, double> from, to;
+  Vector2d arccenter; // always 2d, the arc is a 2d rotation
 
   double speed;
-
-  uint extruder_no;
   double lifted;
-
-  short arc; // -1: ccw arc, 1: cw arc, 0: not an arc
   double angle; // angle of line (in 2d lines), or arc angle
-  Vector2d arccenter; // always 2d, the arc is a 2d rotation
-
 
   double absolute_extrusion; // additional absolute extrusion /mm (retract/repush f.e.)
 
+  PLineArea area;
+  uint extruder_no;
+  short arc; // -1: ccw arc, 1: cw arc, 0: not an arc
+
   bool has_absolute_extrusion() const {return (abs(absolute_extrusion)>0.00001);}
 
   // virtual vector< PLine > division(double length) const;
@@ -61,9 +60,9 @@ public:
   vmml::vector<M, double> dir() const { return to - from; }
   vmml::vector<M, double> splitpoint(double at_length) const;
 
-  virtual double time() const;
-  virtual double lengthSq() const;
-  virtual double length() const;
+  double time() const;
+  double lengthSq() const;
+  double length() const;
 
   bool is_command() const {return (area == COMMAND);}
 
@@ -88,9 +87,8 @@ class PLine3 : public PLine<3>
   PLine3(const PLine3 &rhs);
   PLine3(const PLine2 &pline, double z, double extrusion_per_mm_);
   PLine3(const Command &command);
-  ~PLine3(){}
-
-  Command command;
+  ~PLine3();
+  PLine3 & operator=(const PLine3 &rhs);
 
   double extrusion; // total extrusion in mm of filament
 
@@ -119,6 +117,18 @@ class PLine3 : public PLine<3>
   bool is_move() const {return (abs(extrusion) < 0.00001);}
 
   string info() const;
+
+ private:
+  // explicit command (only for area == COMMAND lines, which are rare,
+  // so it is kept out of line).  It does not change, so the copies of a
+  // line share it.
+  struct SharedCommand {
+    SharedCommand(const Command &command_) : command(command_), refs(1) {};
+    Command command;
+    gint refs; // g_atomic_int_*(), copies are made in several threads
+  };
+  SharedCommand * command;
+  void unrefCommand();
 };
 
 
@@ -274,6 +284,13 @@ class Printlines
   static uint makeAntioozeRetract(vector< PLine3 > &lines,
 				  const Settings &settings,
 				  ViewProgress * progress = NULL);
+  static uint makeAntioozeRetract(vector< PLine3 > &lines,
+				  double AOmindistance, double AOamount,
+				  double AOspeed, double zlift,
+				  ViewProgress * progress = NULL);
+  static uint antioozeRange(const AORange &range, double AOamount,
+			    double AOspeed, double zlift,
+			    vector< PLine3 > &segment);
   static uint insertAntioozeHaltBefore(uint index, double amount, double speed,
 				       vector< PLine3 > &lines);
 
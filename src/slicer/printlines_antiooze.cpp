@@ -20,6 +20,10 @@
 #include "printlines.h"
 #include "ui/progress.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #define AODEBUG 0
 
 
@@ -158,11 +162,11 @@ bool Printlines::find_nextmoves(double minlength, uint startindex,
 uint Printlines::insertAntioozeHaltBefore(uint index, double amount, double AOspeed,
 					  vector< PLine3 > &lines)
 {
-  Vector3d where;
-  if (index > lines.size()) return 0;
-  if (index == lines.size()) where = lines.back().to;
-  else where = lines[index].from;
-  PLine3 halt (lines[index].area, lines.front().extruder_no,
+  if (index > lines.size() || lines.empty()) return 0;
+  // at the end, halt after the last line
+  const PLine3 &neighbour = (index == lines.size()) ? lines.back() : lines[index];
+  const Vector3d where = (index == lines.size()) ? neighbour.to : neighbour.from;
+  PLine3 halt (neighbour.area, neighbour.extruder_no,
 	       where, where, AOspeed, 0);
   halt.addAbsoluteExtrusionAmount(amount, AOspeed);
   lines.insert(lines.begin()+index, halt); // (inserts before)
@@ -282,27 +286,90 @@ int Printlines::distribute_AntioozeAmount(double AOamount, double AOspeed,
 
 
 
+// apply retract and repush to a single range of lines, given as its own
+// segment starting at range.tractstart (indices of range are local)
+uint Printlines::antioozeRange(const AORange &range_, double AOamount,
+			       double AOspeed, double zlift,
+			       vector< PLine3 > &segment)
+{
+  AORange range = range_;
+  uint added = 0;
+
+  if (range.moveend > segment.size()-2) range.moveend = segment.size()-2;
+
+  // lift move-only range
+  if (zlift > 0)
+    for (uint i = range.movestart; i <= range.moveend; i++) {
+      segment[i].lifted = zlift;
+    }
+
+  // do repush first to keep indices before right
+  double havedist = 0;
+  uint newl = distribute_AntioozeAmount(AOamount, AOspeed,
+					range.moveend+1, range.pushend,
+					segment, havedist);
+  added += newl;
+  range.pushend += newl;
+
+#if AODEBUG
+  double extrusionsum = 0;
+  double linesext = 0;
+  for (uint i = range.moveend+1; i<=range.pushend; i++)
+    linesext+=segment[i].absolute_extrusion;
+  if (abs(linesext-AOamount)>0.01) cerr  << "wrong lines dist push " << linesext << endl;
+  extrusionsum += havedist;
+  if (abs(havedist-AOamount)>0.01) cerr << " wrong distrib push " << havedist << endl;
+#endif
+
+  // find lines to distribute retract
+  havedist = 0;
+  if (range.movestart == range.tractstart) {
+    // nothing before the move: retract on halt just before it
+    newl = insertAntioozeHaltBefore(range.movestart, -AOamount, AOspeed, segment);
+    if (newl == 1) havedist -= AOamount;
+  } else {
+    newl = distribute_AntioozeAmount(-AOamount, AOspeed,
+				     range.movestart-1, range.tractstart,
+				     segment, havedist);
+  }
+  added += newl;
+#if AODEBUG
+  extrusionsum += havedist;
+  if (abs(havedist+AOamount)>0.01) cerr << " wrong distrib tract " << havedist << endl;
+  if (abs(extrusionsum) > 0.01) cerr << "wrong AO extr.: " << extrusionsum << endl;
+#endif
+  return added;
+}
+
+
+// Single streaming pass: the ranges are found first, then every range is
+// processed in its own small segment (in parallel), and the result is
+// assembled by appending to a new buffer. No insertion into the middle
+// of the (possibly huge) lines vector.
 uint Printlines::makeAntioozeRetract(vector<PLine3> &lines,
 				     const Settings &settings,
 				     ViewProgress * progress)
 {
   if (!settings.get_boolean("Extruder","EnableAntiooze")) return 0;
 
+  return makeAntioozeRetract(lines,
+			     settings.get_double("Extruder","AntioozeDistance"),
+			     settings.get_double("Extruder","AntioozeAmount"),
+			     settings.get_double("Extruder","AntioozeSpeed") * 60,
+			     settings.get_double("Extruder","AntioozeZlift"),
+			     progress);
+}
 
-  double
-    AOmindistance = settings.get_double("Extruder","AntioozeDistance"),
-    AOamount      = settings.get_double("Extruder","AntioozeAmount"),
-    AOspeed       = settings.get_double("Extruder","AntioozeSpeed") * 60;
-    //AOonhaltratio = settings.Slicing.AntioozeHaltRatio;
+uint Printlines::makeAntioozeRetract(vector<PLine3> &lines,
+				     double AOmindistance, double AOamount,
+				     double AOspeed, double zlift,
+				     ViewProgress * progress)
+{
   if (lines.size() < 2 || AOmindistance <=0 || AOamount == 0) return 0;
-  // const double onhalt_amount = AOamount * AOonhaltratio;
-  // const double onmove_amount = AOamount - onhalt_amount;
 
-  uint linescount = lines.size();
+  const uint linescount = lines.size();
 
-  uint total_added = 0;
 #if AODEBUG
-  double total_extrusionsum = 0;
   double total_ext = total_Extrusion(lines);
   double total_rel = total_rel_Extrusion(lines);
 #endif
@@ -321,101 +388,71 @@ uint Printlines::makeAntioozeRetract(vector<PLine3> &lines,
 
     if (progress){
       if (count%20 == 0)
-	if (!progress->update(range.movestart)) break;
+	if (!progress->update(range.movestart)) return 0;
     }
     count++;
     ranges.push_back(range);
     lastend = range.pushend+1;
   }
 
-  // copy all lines successively to avoid mid-insertion
-  vector<PLine3> newlines;
-  // at most count*2 lines will be added
-  newlines.reserve(linescount + count*2);
-
-  if (progress) if (!progress->restart (_("Antiooze Retract"), ranges.size())) return 0;
-  int progress_steps = max(1,(int)(ranges.size()/100));
-
-  lastend = 0;
-  for (uint r = 0; r < ranges.size(); r++) {
-    //for (int r = ranges.size()-1; r >= 0; r--) {
-    if (progress && r%progress_steps == 0){
-      if (!progress->update(r)) break;
-    }
-
-    ranges[r].add(total_added); // shift by previous insertion
-
-    uint added = 0;
-
-    // get next slice of lines
-    uint endcopy = min(ranges[r].pushend+1, linescount);
-    newlines.insert(newlines.end(),
-		    lines.begin()+lastend, lines.begin()+endcopy);
-    lastend = endcopy;
-
-    if (ranges[r].moveend > newlines.size()-2) ranges[r].moveend = newlines.size()-2;
-
-    // lift move-only range
-    const double zlift = settings.get_double("Extruder","AntioozeZlift");
-    if (zlift > 0)
-      for (uint i = ranges[r].movestart; i <= ranges[r].moveend; i++) {
-	newlines[i].lifted = zlift;
-      }
-
-    // do repush first to keep indices before right
-    double havedist = 0;
-    uint newl = distribute_AntioozeAmount(AOamount, AOspeed,
-					  ranges[r].moveend+1, ranges[r].pushend,
-					  newlines, havedist);
-    added += newl;
-    ranges[r].pushend += newl;
-    //test_range(movestart,moveend,tractstart,pushend, newlines);
-
-#if AODEBUG
-    double extrusionsum = 0;
-    double linesext = 0;
-    for (uint i = ranges[r].moveend+1; i<=ranges[r].pushend; i++)
-      linesext+=newlines[i].absolute_extrusion;
-    if (abs(linesext-AOamount)>0.01) cerr  << "wrong lines dist push " << linesext << endl;
-    extrusionsum += havedist;
-    if (abs(havedist-AOamount)>0.01) cerr << " wrong distrib push " << havedist << endl;
+  const int numranges = ranges.size();
+  if (progress) if (!progress->restart (_("Antiooze Retract"), numranges)) return 0;
+  const int progress_steps = max(1, numranges/100);
+
+  // ranges do not overlap, so they can be processed independently
+  vector< vector<PLine3> > segments(numranges);
+  vector<uint> added(numranges, 0);
+  bool cont = true;
+#ifdef _OPENMP
+  omp_lock_t progress_lock;
+  omp_init_lock(&progress_lock);
+#pragma omp parallel for schedule(dynamic)
 #endif
-
-    // find lines to distribute retract
-    if (ranges[r].movestart < 1) ranges[r].movestart = 1;
-#if AODEBUG
-    double linesextbefore = 0;
-    for (uint i = ranges[r].tractstart; i < ranges[r].movestart; i++)
-      linesextbefore += newlines[i].absolute_extrusion;
+  for (int r = 0; r < numranges; r++) {
+    if (!cont) continue;
+    if (progress && r%progress_steps == 0) {
+#ifdef _OPENMP
+      omp_set_lock(&progress_lock);
 #endif
-    havedist = 0;
-    newl = distribute_AntioozeAmount(-AOamount, AOspeed,
-				     ranges[r].movestart-1, ranges[r].tractstart,
-				     newlines, havedist);
-    added += newl;
-    ranges[r].movestart += newl;
-    ranges[r].moveend += newl;
-    ranges[r].pushend += newl;
-    total_added += added;
-#if AODEBUG
-    linesext = -linesextbefore;
-    for (uint i = ranges[r].tractstart; i < ranges[r].movestart; i++)
-      linesext += newlines[i].absolute_extrusion;
-    if (abs(linesext+AOamount)>0.01)
-      cerr  << "wrong lines dist tract " << distCase  << " : "<<linesextbefore << " : "<<linesext << " (" << havedist << ") != "  << -AOamount
-	    << " - " << ranges[r].tractstart << "->" <<  ranges[r].movestart
-	    << " new: "<< newl << " -- before: "<<linesextbefore<< endl;
-    // else
-    //   cerr << "dist tract ok: " << distCase << " : " << linesext  << " new: " << newl <<endl;
-    extrusionsum += havedist;
-    if (abs(havedist+AOamount)>0.01) cerr << " wrong distrib tract " << havedist << endl;
-    if (abs(extrusionsum) > 0.01) cerr << "wrong AO extr.: " << extrusionsum << endl;
-    total_extrusionsum += extrusionsum;
+      cont = progress->update(r);
+#ifdef _OPENMP
+      omp_unset_lock(&progress_lock);
 #endif
+    }
+    const uint segstart = ranges[r].tractstart;
+    const uint segend   = min(ranges[r].pushend+1, linescount);
+    segments[r].reserve(segend - segstart + 2); // at most 2 lines are added
+    segments[r].insert(segments[r].end(),
+		       lines.begin()+segstart, lines.begin()+segend);
+    AORange local = ranges[r];
+    local.tractstart -= segstart;
+    local.movestart  -= segstart;
+    local.moveend    -= segstart;
+    local.pushend    -= segstart;
+    added[r] = antioozeRange(local, AOamount, AOspeed, zlift, segments[r]);
   }
-#if AODEBUG
-  if (abs(total_extrusionsum) > 0.01) cerr << "wrong total AO extr.: " << total_extrusionsum << endl;
+#ifdef _OPENMP
+  omp_destroy_lock(&progress_lock);
+#endif
+  if (!cont) return 0;
+
+  // assemble
+  uint total_added = 0;
+  for (int r = 0; r < numranges; r++)
+    total_added += added[r];
+  vector<PLine3> newlines;
+  newlines.reserve(linescount + total_added);
+  lastend = 0;
+  for (int r = 0; r < numranges; r++) {
+    newlines.insert(newlines.end(),
+		    lines.begin()+lastend, lines.begin()+ranges[r].tractstart);
+    newlines.insert(newlines.end(), segments[r].begin(), segments[r].end());
+    vector<PLine3>().swap(segments[r]); // free early
+    lastend = min(ranges[r].pushend+1, linescount);
+  }
+  newlines.insert(newlines.end(), lines.begin()+lastend, lines.end());
 
+#if AODEBUG
   double totalabs = total_abs_Extrusion(newlines);
   if (abs(totalabs)>0.01)
     cerr << "abs-extrusion difference after antiooze " << totalabs << endl;
@@ -426,8 +463,6 @@ uint Printlines::makeAntioozeRetract(vector<PLine3> &lines,
   if (abs(total_ext2)>0.01)
     cerr << "total extrusion difference after antiooze " << total_ext2 << endl;
 #endif
-  //cerr << lines.size() << " - " << newlines.size() <<  "- " <<total_added << endl;
-  lines = newlines;
+  lines.swap(newlines);
   return total_added;
 }
-
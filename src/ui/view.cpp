@@ -28,6 +28,7 @@
 #include "objtree.h"
 #include "flatshape.h"
 #include "render.h"
+#include "renderstats.h"
 #include "settings.h"
 #include "prefs_dlg.h"
 #include "progress.h"
@@ -498,32 +499,48 @@ void View::custombutton_pressed(string name, Gtk::ToolButton *button)
 }
 
 
-void View::log_msg(Gtk::TextView *tview, string s)
+void View::log_msg(Gtk::TextView *tview, const string &s)
 {
   //Glib::Mutex::Lock lock(mutex);
   if (!tview || s.length() == 0) return;
   if (!m_model || !m_model->settings.get_boolean("Printer","Logging"))
     return;
 
+  int max_lines = 5000;
+  try {
+    max_lines = m_model->settings.get_integer("Printer","MaxLogLines");
+  } catch (const Glib::KeyFileError &err) {
+  }
+
   Glib::RefPtr<Gtk::TextBuffer> c_buffer = tview->get_buffer();
-  Gtk::TextBuffer::iterator tend = c_buffer->end();
-  c_buffer->insert (tend, s);
-  tend = c_buffer->end();
-  tview->scroll_to(tend);
+  c_buffer->insert (c_buffer->end(), s);
+
+  // drop the oldest lines, so that long prints don't fill the memory
+  int excess = c_buffer->get_line_count() - max_lines;
+  if (max_lines > 0 && excess > 0)
+    c_buffer->erase(c_buffer->begin(), c_buffer->get_iter_at_line(excess));
+
+  // scrolling to a mark waits for the new lines to be laid out
+  Glib::RefPtr<Gtk::TextBuffer::Mark> end_mark = c_buffer->get_mark("log_end");
+  if (end_mark)
+    c_buffer->move_mark(end_mark, c_buffer->end());
+  else
+    end_mark = c_buffer->create_mark("log_end", c_buffer->end(), false);
+  tview->scroll_to(end_mark);
   //tview->queue_draw();
   // while(Gtk::Main::events_pending())
   //     Gtk::Main::iteration();
 }
 
-void View::err_log(string s)
+void View::err_log(const string &s)
 {
   log_msg(err_view,s);
 }
-void View::comm_log(string s)
+void View::comm_log(const string &s)
 {
   log_msg(log_view,s);
 }
-void View::echo_log(string s)
+void View::echo_log(const string &s)
 {
   log_msg(echo_view,s);
 }
@@ -1320,6 +1337,12 @@ View::~View()
   m_renderer = NULL;
 }
 
+bool View::render_benchmark(uint frames, int width, int height, ostream &out)
+{
+  hide();
+  return m_renderer && m_renderer->benchmark(frames, width, height, out);
+}
+
 /* Recursively sets all widgets in the window to visible */
 void View::showAllWidgets() {
   Gtk::Window *pWindow = NULL;
@@ -1426,6 +1449,23 @@ void View::setModel(Model *model)
   m_gcodetextview->set_buffer (m_model->GetGCodeBuffer());
   m_gcodetextview->get_buffer()->signal_mark_set().
     connect( sigc::mem_fun(this, &View::on_gcodebuffer_cursor_set) );
+  m_gcode_scrolling = false;
+  Gtk::ScrolledWindow *gcodewin = NULL;
+  m_builder->get_widget ("gcode_result_win", gcodewin);
+  if (gcodewin) {
+    gcodewin->get_vadjustment()->signal_value_changed().
+      connect( sigc::mem_fun(this, &View::on_gcode_scrolled) );
+    gcodewin->get_vadjustment()->signal_changed().
+      connect( sigc::mem_fun(this, &View::on_gcode_resized) );
+  }
+  m_gcodescrollbar = NULL;
+  m_builder->get_widget ("gcode_result_scrollbar", m_gcodescrollbar);
+  if (m_gcodescrollbar) {
+    m_gcodescrollbar->signal_value_changed().
+      connect( sigc::mem_fun(this, &View::on_gcode_lines_scrolled) );
+    m_gcodetextview->signal_scroll_event().
+      connect( sigc::mem_fun(this, &View::on_gcode_scroll_event), false );
+  }
 
 
   // Main view progress bar
@@ -1516,6 +1556,115 @@ void View::setModel(Model *model)
   showAllWidgets();
 }
 
+// The GCode buffer only holds a window of the lines, see GCode::buffer.
+// The text view scrolls inside the window, the scrollbar beside it spans
+// all lines, one step per line.  Scrolling the text view close to one of
+// the ends of the window moves the window on, with the line on top
+// staying there.
+void View::on_gcode_scrolled()
+{
+  if (!m_model || m_gcode_scrolling) return;
+  GCode &gcode = m_model->gcode;
+  const unsigned long first = gcode.getBufferFirstLine(),
+    lines = gcode.getBufferLineCount(),
+    margin = GCode::buffer_window / 8;
+  unsigned long top_line, bottom_line;
+  get_gcode_visible(top_line, bottom_line);
+
+  m_gcode_scrolling = true;
+  if ((first > 0 && top_line < first + margin) ||
+      (first + lines < gcode.getLineCount() &&
+       bottom_line + margin > first + lines))
+    show_gcode_line(top_line);
+  if (m_gcodescrollbar) {
+    set_gcode_lines_range(top_line, bottom_line);
+    m_gcodescrollbar->set_value(top_line);
+  }
+  m_gcode_scrolling = false;
+}
+
+// The text changed or the view was resized.  The window is not moved
+// here, the text view may not have scrolled to the line shown yet.
+void View::on_gcode_resized()
+{
+  if (!m_model || m_gcode_scrolling || !m_gcodescrollbar) return;
+  unsigned long top_line, bottom_line;
+  get_gcode_visible(top_line, bottom_line);
+  m_gcode_scrolling = true;
+  set_gcode_lines_range(top_line, bottom_line);
+  m_gcode_scrolling = false;
+}
+
+// the lines (from 0) on top and at the bottom of the text view
+void View::get_gcode_visible(unsigned long &top_line,
+			     unsigned long &bottom_line)
+{
+  const unsigned long first = m_model->gcode.getBufferFirstLine();
+  top_line = bottom_line = first;
+  if (m_model->gcode.getBufferLineCount() == 0) return;
+  Gdk::Rectangle rect;
+  m_gcodetextview->get_visible_rect(rect);
+  Gtk::TextIter top, bottom;
+  int y;
+  m_gcodetextview->get_line_at_y(top, rect.get_y(), y);
+  m_gcodetextview->get_line_at_y(bottom, rect.get_y() + rect.get_height(), y);
+  top_line = first + top.get_line();
+  bottom_line = first + bottom.get_line();
+}
+
+// the scrollbar over all lines, with a page of the lines visible
+void View::set_gcode_lines_range(unsigned long top_line,
+				 unsigned long bottom_line)
+{
+  const double page = bottom_line - top_line + 1;
+  m_gcodescrollbar->get_adjustment()->set_page_size(page);
+  m_gcodescrollbar->set_increments(1, page);
+  m_gcodescrollbar->set_range(0, MAX(m_model->gcode.getLineCount(), 1));
+}
+
+void View::on_gcode_lines_scrolled()
+{
+  if (!m_model || m_gcode_scrolling) return;
+  m_gcode_scrolling = true;
+  show_gcode_line((unsigned long)m_gcodescrollbar->get_value());
+  m_gcode_scrolling = false;
+}
+
+// The wheel moves the scrollbar, as the text view only scrolls inside the
+// window
+bool View::on_gcode_scroll_event(GdkEventScroll *event)
+{
+  const double step = 3;
+  if (event->direction == GDK_SCROLL_UP)
+    m_gcodescrollbar->set_value(m_gcodescrollbar->get_value() - step);
+  else if (event->direction == GDK_SCROLL_DOWN)
+    m_gcodescrollbar->set_value(m_gcodescrollbar->get_value() + step);
+  else
+    return false;
+  return true;
+}
+
+// Scrolls the text view to line (from 0) on top, moving the window of
+// lines there if it gets close to one of its ends
+void View::show_gcode_line(unsigned long line)
+{
+  GCode &gcode = m_model->gcode;
+  const unsigned long first = gcode.getBufferFirstLine(),
+    lines = gcode.getBufferLineCount(),
+    margin = GCode::buffer_window / 8;
+  if ((first > 0 && line < first + margin) ||
+      (first + lines < gcode.getLineCount() &&
+       line + 2 * margin > first + lines)) {
+    const unsigned long half = GCode::buffer_window / 2;
+    gcode.showLines(line > half ? line - half : 0);
+  }
+  Glib::RefPtr<Gtk::TextBuffer> buffer = gcode.buffer;
+  Glib::RefPtr<Gtk::TextMark> mark = buffer->create_mark
+    (buffer->get_iter_at_line(line - gcode.getBufferFirstLine()));
+  m_gcodetextview->scroll_to(mark, 0, 0, 0);
+  buffer->delete_mark(mark);
+}
+
 void View::on_gcodebuffer_cursor_set(const Gtk::TextIter &iter,
 				     const Glib::RefPtr <Gtk::TextMark> &refMark)
 {
@@ -1941,6 +2090,7 @@ void View::Draw (vector<Gtk::TreeModel::Path> &selected, bool objects_only)
 	// Draw the grid, pushed back so it can be seen
 	// when viewed from below.
         if (!objects_only) {
+	  RenderStats::Pass pass("Grid");
 	  glEnable (GL_POLYGON_OFFSET_FILL);
 	  glPolygonOffset (1.0f, 1.0f);
     	  DrawGrid();
@@ -1951,6 +2101,7 @@ void View::Draw (vector<Gtk::TreeModel::Path> &selected, bool objects_only)
 
 	// Draw GCode, which already incorporates any print offset
         if (!objects_only) {
+	  RenderStats::Pass pass("GCode");
 	  if (m_gcodetextview->has_focus()) {
 	    double z = m_model->gcode.currentCursorWhere.z();
 	    m_model->GlDrawGCode(z);
@@ -1962,7 +2113,11 @@ void View::Draw (vector<Gtk::TreeModel::Path> &selected, bool objects_only)
 	}
 
 	// Draw all objects
-	int layerdrawn = m_model->draw(selected);
+	int layerdrawn;
+	{
+	  RenderStats::Pass pass("Shapes");
+	  layerdrawn = m_model->draw(selected);
+	}
 	if (layerdrawn > -1) {
 	  Gtk::Label *layerlabel;
 	  m_builder->get_widget("layerno_label", layerlabel);
@@ -92,10 +92,19 @@ class View : public Gtk::Window
 
   void on_gcodebuffer_cursor_set (const Gtk::TextIter &iter,
 				  const Glib::RefPtr <Gtk::TextMark> &refMark);
+  void on_gcode_scrolled ();
+  void on_gcode_resized ();
+  void on_gcode_lines_scrolled ();
+  bool on_gcode_scroll_event (GdkEventScroll *event);
+  void get_gcode_visible (unsigned long &top_line, unsigned long &bottom_line);
+  void set_gcode_lines_range (unsigned long top_line, unsigned long bottom_line);
+  void show_gcode_line (unsigned long line);
   Gtk::TextView * m_gcodetextview;
+  Gtk::VScrollbar * m_gcodescrollbar; // spans all lines of the GCode
+  bool m_gcode_scrolling;
 
   Gtk::TextView *log_view, *err_view, *echo_view;
-  void log_msg(Gtk::TextView *view, string s);
+  void log_msg(Gtk::TextView *view, const string &s);
 
   Gtk::ToolButton *m_print_button;
   Gtk::ToggleToolButton *m_pause_button;
@@ -174,6 +183,8 @@ class View : public Gtk::Window
   void setNonPrintingMode(bool noprinting=true, string filename="");
   void PrintToFile();
   string printtofile_name;
+  // see Render::benchmark()
+  bool render_benchmark(uint frames, int width, int height, ostream &out);
 
   Model *get_model() { return m_model; }
   ViewProgress *get_view_progress() { return m_progress; }
@@ -217,9 +228,9 @@ class View : public Gtk::Window
   void show_preferences();
   Glib::RefPtr<Gtk::Builder> getBuilder() const { return m_builder; };
 
-  void err_log(string s);
-  void comm_log(string s);
-  void echo_log(string s);
+  void err_log(const string &s);
+  void comm_log(const string &s);
+  void echo_log(const string &s);
 
   sigc::connection logprint_timeout;
   void set_logging(bool);
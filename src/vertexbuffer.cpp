@@ -0,0 +1,187 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "stdafx.h"
+#include "vertexbuffer.h"
+#include "renderstats.h"
+
+#include <gtkglmm.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER 0x8892
+#endif
+#ifndef GL_STATIC_DRAW
+#define GL_STATIC_DRAW 0x88E4
+#endif
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+// OpenGL 1.5, which old headers and opengl32.dll don't declare
+typedef void (APIENTRY *GenBuffersProc)(GLsizei n, GLuint *buffers);
+typedef void (APIENTRY *DeleteBuffersProc)(GLsizei n, const GLuint *buffers);
+typedef void (APIENTRY *BindBufferProc)(GLenum target, GLuint buffer);
+typedef void (APIENTRY *BufferDataProc)(GLenum target, ptrdiff_t size,
+					const GLvoid *data, GLenum usage);
+
+static GenBuffersProc    gen_buffers    = NULL;
+static DeleteBuffersProc delete_buffers = NULL;
+static BindBufferProc    bind_buffer    = NULL;
+static BufferDataProc    buffer_data    = NULL;
+
+// looks the functions up on first use, with a context
+static bool have_buffer_objects()
+{
+  static int have = -1;
+  if (have >= 0) return have;
+
+  const char *version = (const char *) glGetString(GL_VERSION);
+  if (!version) return false; // no context yet, ask again later
+
+  have = 0;
+  int major = 0, minor = 0;
+  if (sscanf(version, "%d.%d", &major, &minor) == 2 &&
+      (major > 1 || minor >= 5)) {
+    gen_buffers    = (GenBuffersProc)    gdk_gl_get_proc_address("glGenBuffers");
+    delete_buffers = (DeleteBuffersProc) gdk_gl_get_proc_address("glDeleteBuffers");
+    bind_buffer    = (BindBufferProc)    gdk_gl_get_proc_address("glBindBuffer");
+    buffer_data    = (BufferDataProc)    gdk_gl_get_proc_address("glBufferData");
+    have = gen_buffers && delete_buffers && bind_buffer && buffer_data;
+  }
+  return have;
+}
+
+
+std::vector<GLuint> VertexBuffer::released_buffers;
+
+VertexBuffer::VertexBuffer()
+  : format(COLOURED), count(0), buffer(0)
+{
+}
+
+VertexBuffer::VertexBuffer(const VertexBuffer &)
+  : format(COLOURED), count(0), buffer(0)
+{
+}
+
+VertexBuffer::~VertexBuffer()
+{
+  clear();
+}
+
+VertexBuffer &VertexBuffer::operator=(const VertexBuffer &rhs)
+{
+  if (this != &rhs)
+    clear();
+  return *this;
+}
+
+// without the GL context, see freeReleased()
+void VertexBuffer::clear()
+{
+  if (buffer)
+    released_buffers.push_back(buffer);
+  buffer = 0;
+  std::vector<char>().swap(data);
+  count = 0;
+}
+
+void VertexBuffer::freeReleased()
+{
+  if (released_buffers.empty()) return;
+  delete_buffers(released_buffers.size(), &released_buffers[0]);
+  released_buffers.clear();
+}
+
+void VertexBuffer::set(const std::vector<ColouredVertex> &vertices)
+{
+  upload(vertices.empty() ? NULL : &vertices[0], vertices.size(),
+	 sizeof(ColouredVertex), COLOURED);
+}
+
+void VertexBuffer::set(const std::vector<NormalVertex> &vertices)
+{
+  upload(vertices.empty() ? NULL : &vertices[0], vertices.size(),
+	 sizeof(NormalVertex), NORMALS);
+}
+
+void VertexBuffer::upload(const void *vertices, size_t num, size_t vertex_size,
+			  Format fmt)
+{
+  clear();
+  format = fmt;
+  count = num;
+  if (num == 0) return;
+
+  if (have_buffer_objects()) {
+    gen_buffers(1, &buffer);
+    bind_buffer(GL_ARRAY_BUFFER, buffer);
+    buffer_data(GL_ARRAY_BUFFER, num * vertex_size, vertices, GL_STATIC_DRAW);
+    bind_buffer(GL_ARRAY_BUFFER, 0);
+    if (glGetError() == GL_NO_ERROR)
+      return;
+    // probably out of graphics memory, keep them here instead
+    delete_buffers(1, &buffer);
+    buffer = 0;
+  }
+
+  const char *v = (const char *) vertices;
+  data.assign(v, v + num * vertex_size);
+}
+
+void VertexBuffer::draw(GLenum mode, size_t first, size_t num) const
+{
+  if (first >= count) return;
+  if (num == 0 || first + num > count)
+    num = count - first;
+
+  // offsets into the buffer object, or pointers to our copy
+  const char *base = buffer ? (const char *) 0 : &data[0];
+
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+  if (buffer)
+    bind_buffer(GL_ARRAY_BUFFER, buffer);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  if (format == COLOURED) {
+    // the colour array leaves the current colour undefined
+    glPushAttrib(GL_CURRENT_BIT);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(ColouredVertex),
+		    base + offsetof(ColouredVertex, pos));
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(ColouredVertex),
+		   base + offsetof(ColouredVertex, colour));
+  } else {
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glVertexPointer(3, GL_FLOAT, sizeof(NormalVertex),
+		    base + offsetof(NormalVertex, pos));
+    glNormalPointer(GL_FLOAT, sizeof(NormalVertex),
+		    base + offsetof(NormalVertex, normal));
+  }
+
+  glDrawArrays(mode, first, num);
+  RenderStats::countDraw(num);
+
+  if (format == COLOURED)
+    glPopAttrib();
+  if (buffer)
+    bind_buffer(GL_ARRAY_BUFFER, 0);
+  glPopClientAttrib();
+}
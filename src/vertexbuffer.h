@@ -0,0 +1,79 @@
+/*
+    This file is a part of the RepSnapper project.
+    Copyright (C) 2011-12 martin.dieringer@gmx.de
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#ifndef VERTEXBUFFER_H
+#define VERTEXBUFFER_H
+
+#include <vector>
+#include "platform.h"
+
+struct ColouredVertex
+{
+  GLfloat pos[3];
+  GLubyte colour[4];
+};
+
+struct NormalVertex
+{
+  GLfloat pos[3];
+  GLfloat normal[3];
+};
+
+// Vertices handed to OpenGL once and then drawn by ranges with one call
+// each.  They live in a vertex buffer object if the implementation has
+// them (OpenGL 1.5), else in a client side vertex array (OpenGL 1.1, like
+// old software renderers).  Everything but clear(), empty() and size()
+// needs the GL context to be current; the buffer objects of cleared and
+// deleted VertexBuffers are freed by freeReleased() on the next frame.  A
+// copy starts out empty, the buffer object can only have one owner.
+class VertexBuffer
+{
+ public:
+  VertexBuffer();
+  VertexBuffer(const VertexBuffer &);
+  ~VertexBuffer();
+  VertexBuffer &operator=(const VertexBuffer &);
+
+  void set(const std::vector<ColouredVertex> &vertices);
+  void set(const std::vector<NormalVertex> &vertices);
+  void clear();
+
+  bool empty() const { return count == 0; };
+  size_t size() const { return count; };
+
+  // draws count vertices from first on, all to the end if count is 0.
+  // mode as for glBegin().
+  void draw(GLenum mode, size_t first = 0, size_t count = 0) const;
+
+  // frees the buffer objects released by clear(), with the GL context current
+  static void freeReleased();
+
+ private:
+  enum Format { COLOURED, NORMALS };
+
+  Format format;
+  size_t count;
+  GLuint buffer;            // the vertex buffer object, 0 if none
+  std::vector<char> data;   // the vertices if there is no buffer object
+
+  void upload(const void *vertices, size_t num, size_t vertex_size, Format fmt);
+
+  static std::vector<GLuint> released_buffers;
+};
+
+#endif // VERTEXBUFFER_H